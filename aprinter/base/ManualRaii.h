@@ -30,49 +30,55 @@
 
 namespace APrinter {
 
+// Storage for an object which is constructed and destructed explicitly.
+// It is itself trivial, so it can be a member of a union even when the
+// object type is not.
 template <typename ObjectType>
 class ManualRaii
 {
-    union ObjectUnion {
-        ObjectUnion () {}
-        ~ObjectUnion () {}
-        
-        ObjectType object;
-    };
-    
 private:
-    ObjectUnion m_union;
+    alignas(ObjectType) char m_storage[sizeof(ObjectType)];
+    
+    inline ObjectType * ptr ()
+    {
+        return reinterpret_cast<ObjectType *>(m_storage);
+    }
+    
+    inline ObjectType const * ptr () const
+    {
+        return reinterpret_cast<ObjectType const *>(m_storage);
+    }
     
 public:
     template <typename... Args>
     inline void construct (Args && ... args)
     {
-        new(&m_union.object) ObjectType(std::forward<Args>(args)...);
+        new(m_storage) ObjectType(std::forward<Args>(args)...);
     }
     
     inline void destruct ()
     {
-        m_union.object.~ObjectType();
+        ptr()->~ObjectType();
     }
     
     inline ObjectType & operator* ()
     {
-        return m_union.object;
+        return *ptr();
     }
     
     inline ObjectType const & operator* () const
     {
-        return m_union.object;
+        return *ptr();
     }
     
     inline ObjectType * operator-> ()
     {
-        return &m_union.object;
+        return ptr();
     }
     
     inline ObjectType const * operator-> () const
     {
-        return &m_union.object;
+        return ptr();
     }
 };
 
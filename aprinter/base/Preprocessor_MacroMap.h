@@ -24,9 +24,9 @@
 
 // This is made to be included from Preprocessor.h, don't include directly.
 
-#define APRINTER_AS_NUM_MACRO_ARGS(...) APRINTER_AS_NUM_MACRO_ARGS_HELPER1(__VA_ARGS__, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define APRINTER_AS_NUM_MACRO_ARGS(...) APRINTER_AS_NUM_MACRO_ARGS_HELPER1(__VA_ARGS__, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
 #define APRINTER_AS_NUM_MACRO_ARGS_HELPER1(...) APRINTER_AS_NUM_MACRO_ARGS_HELPER2(__VA_ARGS__)
-#define APRINTER_AS_NUM_MACRO_ARGS_HELPER2(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, N, ...) N
+#define APRINTER_AS_NUM_MACRO_ARGS_HELPER2(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, N, ...) N
 
 #define APRINTER_NUM_TUPLE_ARGS(tuple) APRINTER_AS_NUM_MACRO_ARGS tuple
 
@@ -52,6 +52,10 @@
 #define APRINTER_AS_GET_20(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, ...) p20
 #define APRINTER_AS_GET_21(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, ...) p21
 #define APRINTER_AS_GET_22(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, ...) p22
+#define APRINTER_AS_GET_23(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, p23, ...) p23
+#define APRINTER_AS_GET_24(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, p23, p24, ...) p24
+#define APRINTER_AS_GET_25(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, p23, p24, p25, ...) p25
+#define APRINTER_AS_GET_26(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20, p21, p22, p23, p24, p25, p26, ...) p26
 
 #define  APRINTER_AS_MAP_1(f, del, arg, pars)                                                  f(arg,  APRINTER_AS_GET_1 pars)
 #define  APRINTER_AS_MAP_2(f, del, arg, pars)  APRINTER_AS_MAP_1(f, del, arg, pars) del(dummy) f(arg,  APRINTER_AS_GET_2 pars)
@@ -75,6 +79,10 @@
 #define APRINTER_AS_MAP_20(f, del, arg, pars) APRINTER_AS_MAP_19(f, del, arg, pars) del(dummy) f(arg, APRINTER_AS_GET_20 pars)
 #define APRINTER_AS_MAP_21(f, del, arg, pars) APRINTER_AS_MAP_20(f, del, arg, pars) del(dummy) f(arg, APRINTER_AS_GET_21 pars)
 #define APRINTER_AS_MAP_22(f, del, arg, pars) APRINTER_AS_MAP_21(f, del, arg, pars) del(dummy) f(arg, APRINTER_AS_GET_22 pars)
+#define APRINTER_AS_MAP_23(f, del, arg, pars) APRINTER_AS_MAP_22(f, del, arg, pars) del(dummy) f(arg, APRINTER_AS_GET_23 pars)
+#define APRINTER_AS_MAP_24(f, del, arg, pars) APRINTER_AS_MAP_23(f, del, arg, pars) del(dummy) f(arg, APRINTER_AS_GET_24 pars)
+#define APRINTER_AS_MAP_25(f, del, arg, pars) APRINTER_AS_MAP_24(f, del, arg, pars) del(dummy) f(arg, APRINTER_AS_GET_25 pars)
+#define APRINTER_AS_MAP_26(f, del, arg, pars) APRINTER_AS_MAP_25(f, del, arg, pars) del(dummy) f(arg, APRINTER_AS_GET_26 pars)
 
 #define APRINTER_AS_MAP(f, del, arg, pars) APRINTER_JOIN(APRINTER_AS_MAP_, APRINTER_NUM_TUPLE_ARGS(pars))(f, del, arg, pars)
 
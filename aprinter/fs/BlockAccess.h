@@ -57,7 +57,7 @@ private:
     struct SdCommandHandler;
     APRINTER_MAKE_INSTANCE(TheSd, (Params::SdService::template SdCard<Context, Object, SdInitHandler, SdCommandHandler>))
     
-    enum {STATE_INACTIVE, STATE_ACTIVATING, STATE_READY, STATE_BUSY};
+    enum {STATE_INACTIVE, STATE_ACTIVATING, STATE_READY};
     
 public:
     using BlockIndexType = typename TheSd::BlockIndexType;
@@ -65,7 +65,13 @@ public:
     using DataWordType = typename TheSd::DataWordType;
     static size_t const MaxIoBlocks = TheSd::MaxIoBlocks;
     static int const MaxIoDescriptors = TheSd::MaxIoDescriptors;
-    static int const MaxBufferLocks = 1;
+    static int const MaxConcurrentCommands = TheSd::MaxConcurrentCommands;
+    static int const MaxBufferLocks = MaxConcurrentCommands;
+    
+private:
+    static_assert(MaxConcurrentCommands > 0, "");
+    
+public:
     
     static void init (Context c)
     {
@@ -109,7 +115,7 @@ public:
     {
         auto *o = Object::self(c);
         TheDebugObject::access(c);
-        AMBRO_ASSERT(o->state == STATE_READY || o->state == STATE_BUSY)
+        AMBRO_ASSERT(o->state == STATE_READY)
         
         BlockIndexType capacity = TheSd::getCapacityBlocks(c);
         AMBRO_ASSERT(capacity > 0)
@@ -120,7 +126,7 @@ public:
     {
         auto *o = Object::self(c);
         TheDebugObject::access(c);
-        AMBRO_ASSERT(o->state == STATE_READY || o->state == STATE_BUSY)
+        AMBRO_ASSERT(o->state == STATE_READY)
         
         return TheSd::isWritable(c);
     }
@@ -153,7 +159,7 @@ public:
         {
             auto *o = Object::self(c);
             TheDebugObject::access(c);
-            AMBRO_ASSERT(o->state == STATE_READY || o->state == STATE_BUSY)
+            AMBRO_ASSERT(o->state == STATE_READY)
             AMBRO_ASSERT(m_state == USER_STATE_IDLE)
             
             m_state = is_write ? USER_STATE_WRITING : USER_STATE_READING;
@@ -218,28 +224,31 @@ private:
         } else {
             o->state = STATE_READY;
             o->queue.init();
+            o->in_flight.init();
+            o->num_in_flight = 0;
         }
         return ActivateHandler::call(c, error_code);
     }
     struct SdInitHandler : public AMBRO_WFUNC_TD(&BlockAccess::sd_init_handler) {};
     
+    // The SD card completes commands in the order they were started.
     static void sd_command_handler (Context c, bool error)
     {
         auto *o = Object::self(c);
         TheDebugObject::access(c);
-        AMBRO_ASSERT(o->state == STATE_BUSY)
-        AMBRO_ASSERT(!o->queue.isEmpty())
+        AMBRO_ASSERT(o->state == STATE_READY)
+        AMBRO_ASSERT(o->num_in_flight > 0)
         
-        User *user = o->queue.first();
+        User *user = o->in_flight.first();
         AMBRO_ASSERT(user->m_state == User::USER_STATE_READING || user->m_state == User::USER_STATE_WRITING)
         
         if (user->m_state == User::USER_STATE_WRITING) {
             user->maybe_call_locker(c, false);
         }
         
-        o->queue.removeFirst();
+        o->in_flight.removeFirst();
+        o->num_in_flight--;
         user->m_state = User::USER_STATE_IDLE;
-        o->state = STATE_READY;
         
         continue_queue(c);
         
@@ -250,12 +259,10 @@ private:
     static void add_request (Context c, User *user)
     {
         auto *o = Object::self(c);
-        AMBRO_ASSERT(o->state == STATE_READY || o->state == STATE_BUSY)
+        AMBRO_ASSERT(o->state == STATE_READY)
         
         o->queue.append(user);
-        if (o->state == STATE_READY) {
-            continue_queue(c);
-        }
+        continue_queue(c);
     }
     
     static void continue_queue (Context c)
@@ -263,18 +270,41 @@ private:
         auto *o = Object::self(c);
         AMBRO_ASSERT(o->state == STATE_READY)
         
-        User *user = o->queue.first();
-        if (user) {
+        // Start queued requests in order, as long as the SD card accepts more
+        // commands and the request does not conflict with one in progress.
+        User *user;
+        while (o->num_in_flight < MaxConcurrentCommands && (user = o->queue.first()) && !conflicts_in_flight(c, user)) {
             AMBRO_ASSERT(user->m_state == User::USER_STATE_READING || user->m_state == User::USER_STATE_WRITING)
             bool is_write = (user->m_state == User::USER_STATE_WRITING);
+            
+            o->queue.removeFirst();
+            o->in_flight.append(user);
+            o->num_in_flight++;
+            
             if (is_write) {
                 user->maybe_call_locker(c, true);
             }
             TheSd::startReadOrWrite(c, is_write, user->m_block_idx, user->m_num_blocks, user->m_data_vector);
-            o->state = STATE_BUSY;
         }
     }
     
+    // Concurrent commands may be executed in any order, so a request must
+    // wait if it overlaps with a request in progress and either is a write.
+    static bool conflicts_in_flight (Context c, User *user)
+    {
+        auto *o = Object::self(c);
+        
+        for (User *other = o->in_flight.first(); other; other = o->in_flight.next(other)) {
+            if ((user->m_state == User::USER_STATE_WRITING || other->m_state == User::USER_STATE_WRITING) &&
+                user->m_block_idx < other->m_block_idx + other->m_num_blocks &&
+                other->m_block_idx < user->m_block_idx + user->m_num_blocks
+            ) {
+                return true;
+            }
+        }
+        return false;
+    }
+    
 public:
     struct Object : public ObjBase<BlockAccess, ParentObject, MakeTypeList<
         TheDebugObject,
@@ -282,6 +312,8 @@ public:
     >> {
         uint8_t state;
         DoubleEndedList<User, &User::m_list_node> queue;
+        DoubleEndedList<User, &User::m_list_node> in_flight;
+        int num_in_flight;
     };
 };
 
@@ -31,6 +31,8 @@
 #include <inttypes.h>
 
 #include <aprinter/meta/ChooseInt.h>
+#include <aprinter/meta/BitsInInt.h>
+#include <aprinter/meta/PowerOfTwo.h>
 #include <aprinter/meta/StructIf.h>
 #include <aprinter/meta/FunctionIf.h>
 #include <aprinter/meta/BasicMetaUtils.h>
@@ -41,7 +43,10 @@
 #include <aprinter/base/DebugObject.h>
 #include <aprinter/base/TransferVector.h>
 #include <aprinter/base/LoopUtils.h>
+#include <aprinter/base/ManualRaii.h>
 #include <aprinter/structure/DoubleEndedList.h>
+#include <aprinter/structure/LinkedList.h>
+#include <aprinter/structure/LinkModel.h>
 
 namespace APrinter {
 
@@ -68,13 +73,23 @@ public:
     static int const MaxIoBlocks     = Arg::MaxIoBlocks;
     static bool const Writable       = Arg::Writable;
     
+    // Write-behind: when enabled, unreferenced dirty entries are written out
+    // in the background, once WriteBehindDirtyCount entries are dirty or
+    // WriteBehindDelay seconds after an entry has been dirtied (zero disables
+    // the respective trigger). Writes are started while no other I/O is
+    // queued, one for each run of adjacent dirty blocks, so that the runs go
+    // out as multi-block writes.
+    static int const WriteBehindDirtyCount = Arg::WriteBehindDirtyCount;
+    static bool const WriteBehind = Writable && (WriteBehindDirtyCount > 0 || Arg::WriteBehindDelay::value() > 0.0);
+    
 private:
     static_assert(NumCacheEntries > 0, "");
-    static_assert(NumCacheEntries <= 64, "");
     static_assert(NumIoUnits > 0 && NumIoUnits <= NumCacheEntries, "");
     static_assert(MaxIoBlocks > 0 && MaxIoBlocks <= NumCacheEntries, "");
     static_assert(MaxIoBlocks <= TheBlockAccess::MaxIoBlocks, "");
     static_assert(MaxIoBlocks <= TheBlockAccess::MaxIoDescriptors, "");
+    static_assert(WriteBehindDirtyCount >= 0 && WriteBehindDirtyCount <= NumCacheEntries, "");
+    static_assert(Arg::WriteBehindDelay::value() >= 0.0, "");
     
     class CacheEntry;
     class IoDispatcher;
@@ -89,6 +104,10 @@ private:
     
     using DirtTimeType = uint32_t;
     
+    using TimeType = typename Context::Clock::TimeType;
+    static TimeType const WriteBehindDelayTicks = Arg::WriteBehindDelay::value() * Context::Clock::time_freq;
+    static int const WriteBehindMaxRuns = (NumCacheEntries < 8) ? NumCacheEntries : 8;
+    
     using CacheEntryIndexType = ChooseIntForMax<NumCacheEntries, true>;
     using IoUnitIndexType = ChooseIntForMax<NumIoUnits, true>;
     using IoBlockIndexType = ChooseIntForMax<MaxIoBlocks, true>;
@@ -99,6 +118,26 @@ private:
     using NumRefsType = uint8_t;
     static NumRefsType const MaxNumRefs = (NumRefsType)-1;
     
+    // Open-addressed table mapping block indices to the assigned cache entries,
+    // with at least twice as many slots as there are entries.
+    static int const BlockTableBits = BitsInInt<2 * NumCacheEntries - 1>::Value;
+    static size_t const BlockTableSize = PowerOfTwo<size_t, BlockTableBits>::Value;
+    
+    // Every entry which may be given a new block is in one of these lists.
+    // After the list of free entries, the lists are in order of eviction
+    // preference (see eviction_lesser_than). The lists of clean entries are
+    // in LRU order and the lists of dirty entries are sorted by dirt time.
+    // Entries read due to hints which have not been used yet are kept apart
+    // from other clean entries, so that they are not evicted before them.
+    static uint8_t const EvictListFree        = 0;
+    static uint8_t const EvictListClean       = 1;
+    static uint8_t const EvictListCleanHinted = 2;
+    static uint8_t const EvictListDirty       = 3;
+    static uint8_t const EvictListCleanWeak   = 4;
+    static uint8_t const EvictListDirtyWeak   = 5;
+    static int const NumEvictLists            = 6;
+    static uint8_t const EvictListNone      = NumEvictLists;
+    
 public:
     using BlockIndexType = typename TheBlockAccess::BlockIndexType;
     static size_t const BlockSize = TheBlockAccess::BlockSize;
@@ -111,6 +150,14 @@ public:
         o->io_queue_event.init(c, APRINTER_CB_STATFUNC_T(&BlockCache::io_queue_event_handler));
         writable_init(c);
         
+        for (auto i : LoopRange<size_t>(BlockTableSize)) {
+            o->block_table[i] = -1;
+        }
+        
+        for (auto &list : o->evict_lists) {
+            list.init();
+        }
+        
         for (CacheEntry &entry : o->cache_entries) {
             entry.init(c);
         }
@@ -147,55 +194,41 @@ public:
         AMBRO_ASSERT(protect_block <= start_block)
         AMBRO_ASSERT(start_block <= end_block)
         
-        // Create two lists, of:
-        // 1) Block indices in the given range which are already in the cache.
-        // 2) Indices of cache entries which we may use to assign the blocks.
-        
-        BlockIndexType cached_blocks[NumCacheEntries];
-        CacheEntryIndexType num_cached_blocks = 0;
-        
-        CacheEntryIndexType free_entries[NumCacheEntries];
-        CacheEntryIndexType num_free_entries = 0;
-        
-        for (auto i : LoopRange<CacheEntryIndexType>(NumCacheEntries)) {
-            CacheEntry *e = &o->cache_entries[i];
-            if (e->isAssigned(c)) {
-                BlockIndexType block = e->getBlock(c);
-                if (block >= protect_block && block < end_block) {
-                    if (block >= start_block) {
-                        cached_blocks[num_cached_blocks++] = block;
-                    }
-                    // This entry is assigned with a block in the while protected range,
-                    // so prevent it from being reassigned now to another hinted block.
-                    continue;
-                }
-            }
-            if (!e->isBeingReleased(c) && !e->isReferencedIncludingWeak(c) && (!e->isAssigned(c) || e->canReassign(c))) {
-                free_entries[num_free_entries++] = i;
-            }
-        }
+        // Assign blocks which are not yet in the cache to free entries, or to
+        // clean unreferenced entries in LRU order. Entries assigned to blocks in
+        // the whole protected range must not be reassigned to another hinted block,
+        // and neither are entries of earlier hints which have not been used yet.
         
-        // Assign blocks based on information in these lists.
+        CacheEntry *reuse_cursor = o->evict_lists[EvictListClean].first();
         
         BlockIndexType block = start_block;
-        while (block < end_block && num_free_entries > 0) {
+        while (block < end_block) {
             // Skip this block if it is already in the cache.
-            bool already = false;
-            for (auto i : LoopRange<CacheEntryIndexType>(num_cached_blocks)) {
-                if (cached_blocks[i] == block) {
-                    already = true;
+            if (find_block_entry(c, block)) {
+                block++;
+                continue;
+            }
+            
+            CacheEntry *free_entry = o->evict_lists[EvictListFree].first();
+            if (!free_entry) {
+                // The assigned entries will be moved to the end of the list,
+                // and will then be skipped since they are reading.
+                while (reuse_cursor) {
+                    CacheEntry *e = reuse_cursor;
+                    reuse_cursor = o->evict_lists[EvictListClean].next(*e);
+                    BlockIndexType e_block = e->getBlock(c);
+                    if (e->canReassign(c) && !(e_block >= protect_block && e_block < end_block)) {
+                        free_entry = e;
+                        break;
+                    }
+                }
+                if (!free_entry) {
                     break;
                 }
             }
             
-            if (!already) {
-                // Pop a free entry from the list.
-                CacheEntryIndexType free_entry_index = free_entries[--num_free_entries];
-                CacheEntry *free_entry = &o->cache_entries[free_entry_index];
-                
-                // Assign this block to this entry.
-                free_entry->assignBlockAndAttachUser(c, block, write_stride, write_count, false, nullptr);
-            }
+            // Assign this block to this entry.
+            free_entry->assignBlockAndAttachUser(c, block, write_stride, write_count, false, nullptr, true);
             
             block++;
         }
@@ -596,11 +629,13 @@ private:
         
         o->allocations_event.init(c, APRINTER_CB_STATFUNC_T(&BlockCache::allocations_event_handler<>));
         o->current_dirt_time = 0;
+        o->releasing_entry = -1;
         o->waiting_flush_requests.init();
         o->pending_allocations.init();
         for (auto i : LoopRange<BufferIndexType>(NumBuffers)) {
             o->buffer_usage[i] = false;
         }
+        write_behind_init(c);
     }
     
     APRINTER_FUNCTION_IF_OR_EMPTY_EXT(Writable, static, void, writable_deinit_assert (Context c))
@@ -613,9 +648,178 @@ private:
     APRINTER_FUNCTION_IF_OR_EMPTY_EXT(Writable, static, void, writable_deinit (Context c))
     {
         auto *o = Object::self(c);
+        write_behind_deinit(c);
         o->allocations_event.deinit(c);
     }
     
+    APRINTER_FUNCTION_IF_OR_EMPTY_EXT(WriteBehind, static, void, write_behind_init (Context c))
+    {
+        auto *o = Object::self(c);
+        
+        o->write_behind_event.init(c, APRINTER_CB_STATFUNC_T(&BlockCache::write_behind_event_handler<>));
+        o->write_behind_timer.construct();
+        o->write_behind_timer->init(c, APRINTER_CB_STATFUNC_T(&BlockCache::write_behind_timer_handler<>));
+        o->num_dirty = 0;
+        o->write_behind_pending = false;
+    }
+    
+    APRINTER_FUNCTION_IF_OR_EMPTY_EXT(WriteBehind, static, void, write_behind_deinit (Context c))
+    {
+        auto *o = Object::self(c);
+        
+        o->write_behind_timer->deinit(c);
+        o->write_behind_timer.destruct();
+        o->write_behind_event.deinit(c);
+    }
+    
+    // Called when an entry is dirtied, with became_dirty=true if it was clean.
+    APRINTER_FUNCTION_IF_OR_EMPTY_EXT(WriteBehind, static, void, write_behind_entry_dirtied (Context c, bool became_dirty))
+    {
+        auto *o = Object::self(c);
+        
+        if (became_dirty) {
+            o->num_dirty++;
+            if (WriteBehindDirtyCount > 0 && o->num_dirty >= WriteBehindDirtyCount) {
+                request_write_behind(c);
+            }
+        }
+        if (WriteBehindDelayTicks > 0 && !o->write_behind_timer->isSet(c)) {
+            o->write_behind_timer->appendAt(c, Context::Clock::getTime(c) + WriteBehindDelayTicks);
+        }
+    }
+    
+    APRINTER_FUNCTION_IF_OR_EMPTY_EXT(WriteBehind, static, void, write_behind_entry_cleaned (Context c))
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(o->num_dirty > 0)
+        
+        o->num_dirty--;
+    }
+    
+    APRINTER_FUNCTION_IF_EXT(WriteBehind, static, void, request_write_behind (Context c))
+    {
+        auto *o = Object::self(c);
+        
+        o->write_behind_pending = true;
+        if (!o->write_behind_event.isSet(c)) {
+            o->write_behind_event.prependNowNotAlready(c);
+        }
+    }
+    
+    // Called by the IoDispatcher when it has dispatched all queued I/O.
+    APRINTER_FUNCTION_IF_OR_EMPTY_EXT(WriteBehind, static, void, write_behind_io_queue_empty (Context c))
+    {
+        auto *o = Object::self(c);
+        
+        if (o->write_behind_pending && !o->write_behind_event.isSet(c)) {
+            o->write_behind_event.prependNowNotAlready(c);
+        }
+    }
+    
+    APRINTER_FUNCTION_IF_EXT(WriteBehind, static, void, write_behind_timer_handler (Context c))
+    {
+        TheDebugObject::access(c);
+        
+        request_write_behind(c);
+    }
+    
+    APRINTER_FUNCTION_IF_EXT(WriteBehind, static, void, write_behind_event_handler (Context c))
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        AMBRO_ASSERT(o->write_behind_pending)
+        
+        // Do not get in the way of other I/O, we will be called again
+        // by write_behind_io_queue_empty.
+        if (!o->io_queue.isEmpty()) {
+            return;
+        }
+        o->write_behind_pending = false;
+        
+        // Walk the unreferenced dirty entries and collect the first entry of
+        // each run of adjacent blocks, keeping them sorted by block. If there
+        // are more runs than fit into run_starts, the highest are dropped and
+        // we come back for them once the I/O queue is empty again.
+        CacheEntry *run_starts[WriteBehindMaxRuns];
+        int num_run_starts = 0;
+        CacheEntryIndexType num_listed = 0;
+        bool have_skipped = false;
+        
+        static uint8_t const dirty_lists[] = {EvictListDirty, EvictListDirtyWeak};
+        for (uint8_t list_index : dirty_lists) {
+            auto &list = o->evict_lists[list_index];
+            for (CacheEntry *ce = list.first(); ce; ce = list.next(*ce)) {
+                num_listed++;
+                if (!ce->canStartWrite(c)) {
+                    continue;
+                }
+                BlockIndexType block = ce->getBlock(c);
+                CacheEntry *prev_e = (block > 0) ? find_block_entry(c, block - 1) : nullptr;
+                if (!ce->hasLastWriteFailed(c) && prev_e && is_write_behind_run_member(c, prev_e)) {
+                    continue;
+                }
+                int pos = num_run_starts;
+                while (pos > 0 && run_starts[pos - 1]->getBlock(c) > block) {
+                    pos--;
+                }
+                if (num_run_starts == WriteBehindMaxRuns) {
+                    have_skipped = true;
+                    if (pos == WriteBehindMaxRuns) {
+                        continue;
+                    }
+                    num_run_starts--;
+                }
+                for (int i = num_run_starts; i > pos; i--) {
+                    run_starts[i] = run_starts[i - 1];
+                }
+                run_starts[pos] = ce;
+                num_run_starts++;
+            }
+        }
+        
+        // Start the writes in order of block index, one for every MaxIoBlocks
+        // entries of each run. The IoUnit will extend each write into the
+        // following entries (see IoUnit::extend_io). Starting a write only
+        // queues the entry, so the following entries are still idle here.
+        for (int i = 0; i < num_run_starts; i++) {
+            CacheEntry *ce = run_starts[i];
+            BlockIndexType block = ce->getBlock(c);
+            bool extend = is_write_behind_run_member(c, ce);
+            ce->startWriteBehind(c);
+            if (!extend) {
+                continue;
+            }
+            for (BlockIndexType offset = 1;; offset++) {
+                CacheEntry *next_e = find_block_entry(c, block + offset);
+                if (!next_e || !is_write_behind_run_member(c, next_e)) {
+                    break;
+                }
+                if (offset % MaxIoBlocks == 0) {
+                    next_e->startWriteBehind(c);
+                }
+            }
+        }
+        
+        if (have_skipped) {
+            request_write_behind(c);
+        }
+        
+        bool have_referenced = (num_listed < o->num_dirty);
+        
+        // Referenced entries are likely to be modified again, they will
+        // be considered when the delay expires next time.
+        if (WriteBehindDelayTicks > 0 && have_referenced && !o->write_behind_timer->isSet(c)) {
+            o->write_behind_timer->appendAt(c, Context::Clock::getTime(c) + WriteBehindDelayTicks);
+        }
+    }
+    
+    // Whether the entry can be written by write_behind_event_handler as part
+    // of a multi-block write, together with the entry for the preceding block.
+    APRINTER_FUNCTION_IF_EXT(WriteBehind, static, bool, is_write_behind_run_member (Context c, CacheEntry *ce))
+    {
+        return ce->canStartWrite(c) && !ce->isReferenced(c) && !ce->isBeingReleased(c) && !ce->hasLastWriteFailed(c);
+    }
+    
     APRINTER_FUNCTION_IF_EXT(Writable, static, bool, is_flush_completed (Context c, bool for_new_request, bool *out_error))
     {
         auto *o = Object::self(c);
@@ -680,50 +884,38 @@ private:
     {
         auto *o = Object::self(c);
         
-        CacheEntryIndexType free_entry = -1;
-        CacheEntryIndexType evictable_entry = -1;
-        CacheEntryIndexType releasing_entry = -1;
+        CacheEntry *ce = find_block_entry(c, block);
+        if (ce) {
+            return ce->isBeingReleased(c) ? -1 : ce->get_entry_index(c);
+        }
         
-        for (auto entry_index : LoopRange<CacheEntryIndexType>(NumCacheEntries)) {
-            CacheEntry *ce = &o->cache_entries[entry_index];
+        CacheEntry *free_entry = o->evict_lists[EvictListFree].first();
+        if (free_entry) {
+            return free_entry->get_entry_index(c);
+        }
             
-            if (ce->isAssigned(c) && ce->getBlock(c) == block) {
-                return ce->isBeingReleased(c) ? -1 : entry_index;
-            }
-            
-            if (!ce->isBeingReleased(c)) {
-                if (!ce->isAssigned(c)) {
-                    free_entry = entry_index;
-                }
-                else if (!Writable ? ce->canReassign(c) : (ce->isAssigned(c) && !ce->isReferenced(c))) {
-                    if (evictable_entry == -1 || eviction_lesser_than(c, ce, &o->cache_entries[evictable_entry])) {
-                        evictable_entry = entry_index;
-                    }
-                }
-            } else {
-                releasing_entry = entry_index;
+        CacheEntry *ee = nullptr;
+        for (auto list_index : LoopRange<uint8_t>(EvictListFree + 1, NumEvictLists)) {
+            if ((ee = o->evict_lists[list_index].first())) {
+                break;
             }
         }
         
-        if (free_entry != -1) {
-            return free_entry;
-        }
+        CacheEntryIndexType releasing_entry = get_releasing_entry(c);
         
-        if (evictable_entry != -1) {
-            CacheEntry *ee = &o->cache_entries[evictable_entry];
-            
+        if (ee) {
             if (!Writable) {
                 AMBRO_ASSERT(ee->canReassign(c))
-                return evictable_entry;
+                return ee->get_entry_index(c);
             }
             
             if (ee->canReassign(c) && (releasing_entry == -1 || !eviction_lesser_than(c, &o->cache_entries[releasing_entry], ee))) {
-                return evictable_entry;
+                return ee->get_entry_index(c);
             }
             
             if (releasing_entry == -1) {
                 ee->startRelease(c);
-                releasing_entry = evictable_entry;
+                releasing_entry = ee->get_entry_index(c);
             }
         }
         
@@ -734,6 +926,74 @@ private:
         return -2;
     }
     
+    APRINTER_FUNCTION_IF_ELSE_EXT(Writable, static, CacheEntryIndexType, get_releasing_entry (Context c), {
+        auto *o = Object::self(c);
+        return o->releasing_entry;
+    }, {
+        return -1;
+    })
+    
+    static size_t block_table_hash (BlockIndexType block)
+    {
+        uint32_t x = (uint32_t)block ^ (uint32_t)((uint64_t)block >> 32);
+        return (uint32_t)(x * UINT32_C(2654435761)) >> (32 - BlockTableBits);
+    }
+    
+    static CacheEntry * find_block_entry (Context c, BlockIndexType block)
+    {
+        auto *o = Object::self(c);
+        
+        size_t pos = block_table_hash(block);
+        CacheEntryIndexType entry_index;
+        while ((entry_index = o->block_table[pos]) != -1) {
+            CacheEntry *ce = &o->cache_entries[entry_index];
+            if (ce->getBlock(c) == block) {
+                return ce;
+            }
+            pos = (pos + 1) & (BlockTableSize - 1);
+        }
+        return nullptr;
+    }
+    
+    static void block_table_insert (Context c, CacheEntry *ce)
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(!find_block_entry(c, ce->getBlock(c)))
+        
+        size_t pos = block_table_hash(ce->getBlock(c));
+        while (o->block_table[pos] != -1) {
+            pos = (pos + 1) & (BlockTableSize - 1);
+        }
+        o->block_table[pos] = ce->get_entry_index(c);
+    }
+    
+    static void block_table_remove (Context c, CacheEntry *ce)
+    {
+        auto *o = Object::self(c);
+        
+        size_t pos = block_table_hash(ce->getBlock(c));
+        while (o->block_table[pos] != ce->get_entry_index(c)) {
+            AMBRO_ASSERT(o->block_table[pos] != -1)
+            pos = (pos + 1) & (BlockTableSize - 1);
+        }
+        
+        // Shift back any following entries which would otherwise become unreachable.
+        size_t next_pos = pos;
+        while (true) {
+            next_pos = (next_pos + 1) & (BlockTableSize - 1);
+            CacheEntryIndexType entry_index = o->block_table[next_pos];
+            if (entry_index == -1) {
+                break;
+            }
+            size_t home_pos = block_table_hash(o->cache_entries[entry_index].getBlock(c));
+            if (((next_pos - home_pos) & (BlockTableSize - 1)) >= ((next_pos - pos) & (BlockTableSize - 1))) {
+                o->block_table[pos] = entry_index;
+                pos = next_pos;
+            }
+        }
+        o->block_table[pos] = -1;
+    }
+    
     /**
      * Determines if eviction of e1 is preferred to eviction of e2.
      * 
@@ -788,9 +1048,10 @@ private:
         auto *o = Object::self(c);
         TheDebugObject::access(c);
         
-        for (CacheEntry &ce : o->cache_entries) {
-            if (ce.isBeingReleased(c) && !ce.isAssigned(c)) {
-                ce.completeRelease(c);
+        if (o->releasing_entry != -1) {
+            CacheEntry *ce = &o->cache_entries[o->releasing_entry];
+            if (!ce->isAssigned(c)) {
+                ce->completeRelease(c);
             }
         }
         
@@ -845,8 +1106,11 @@ private:
             m_cache_users_list.init();
             m_num_hard_refs = 0;
             m_state = State::INVALID;
+            m_hinted = false;
+            m_evict_list = EvictListNone;
             IoQueue::markRemoved(this);
             writable_entry_init(c);
+            update_evict_list(c);
         }
         
         void deinit (Context c)
@@ -964,7 +1228,7 @@ private:
             return m_num_hard_refs < MaxNumRefs;
         }
         
-        void assignBlockAndAttachUser (Context c, BlockIndexType block, BlockIndexType write_stride, uint8_t write_count, bool no_need_to_read, CacheRef *user)
+        void assignBlockAndAttachUser (Context c, BlockIndexType block, BlockIndexType write_stride, uint8_t write_count, bool no_need_to_read, CacheRef *user, bool hinted=false)
         {
             AMBRO_ASSERT(write_count >= 1)
             AMBRO_ASSERT(!isBeingReleased(c))
@@ -979,6 +1243,9 @@ private:
                 
                 break_weak_refs(c);
                 
+                if (isAssigned(c)) {
+                    block_table_remove(c, this);
+                }
                 m_block = block;
                 writable_assign(c, write_stride, write_count);
                 
@@ -991,12 +1258,17 @@ private:
                     m_state = State::READING;
                     IoDispatcher::dispatch(c, this);
                 }
+                
+                block_table_insert(c, this);
             }
             
             if (user) {
                 m_cache_users_list.prepend(user);
                 m_num_hard_refs++;
             }
+            m_hinted = hinted;
+            
+            update_evict_list(c);
         }
         
         enum class DetachMode {HARD_TO_WEAK, DETACH_HARD, DETACH_WEAK};
@@ -1011,6 +1283,8 @@ private:
             if (mode != DetachMode::DETACH_WEAK) {
                 m_num_hard_refs--;
             }
+            
+            update_evict_list(c);
         }
         
         void hardenWeakUser (Context c, CacheRef *user)
@@ -1020,6 +1294,7 @@ private:
             AMBRO_ASSERT(!isBeingReleased(c))
             
             m_num_hard_refs++;
+            update_evict_list(c);
         }
         
         APRINTER_FUNCTION_IF(Writable, void, markDirty (Context c))
@@ -1029,10 +1304,12 @@ private:
             AMBRO_ASSERT(isReferenced(c))
             AMBRO_ASSERT(!isBeingReleased(c))
             
+            bool became_dirty = (this->m_dirt_state == DirtState::CLEAN);
             if (this->m_dirt_state != DirtState::DIRTY) {
                 this->m_dirt_state = DirtState::DIRTY;
                 this->m_dirt_time = o->current_dirt_time++;
             }
+            write_behind_entry_dirtied(c, became_dirty);
             
             if (!o->waiting_flush_requests.isEmpty() && m_state == State::IDLE) {
                 scheduleWriting(c);
@@ -1047,8 +1324,18 @@ private:
             this->m_write_event.prependNow(c);
         }
         
+        APRINTER_FUNCTION_IF(WriteBehind, void, startWriteBehind (Context c))
+        {
+            AMBRO_ASSERT(canStartWrite(c))
+            AMBRO_ASSERT(!isReferenced(c))
+            
+            write_event_handler(c);
+        }
+        
         APRINTER_FUNCTION_IF_OR_EMPTY(Writable, void, startRelease (Context c))
         {
+            auto *o = Object::self(c);
+            AMBRO_ASSERT(o->releasing_entry == -1)
             AMBRO_ASSERT(isAssigned(c))
             AMBRO_ASSERT(!canReassign(c))
             AMBRO_ASSERT(!isReferenced(c))
@@ -1057,6 +1344,9 @@ private:
             break_weak_refs(c);
             
             this->m_releasing = true;
+            o->releasing_entry = get_entry_index(c);
+            update_evict_list(c);
+            
             if (m_state == State::IDLE) {
                 scheduleWriting(c);
             }
@@ -1064,17 +1354,87 @@ private:
         
         APRINTER_FUNCTION_IF(Writable, void, completeRelease (Context c))
         {
+            auto *o = Object::self(c);
             AMBRO_ASSERT(this->m_releasing)
+            AMBRO_ASSERT(o->releasing_entry == get_entry_index(c))
+            
             this->m_releasing = false;
+            o->releasing_entry = -1;
+            update_evict_list(c);
         }
         
-    private:
         CacheEntryIndexType get_entry_index (Context c)
         {
             auto *o = Object::self(c);
             return (this - o->cache_entries);
         }
         
+    private:
+        APRINTER_FUNCTION_IF_ELSE(Writable, bool, is_dirty_for_eviction (Context c), {
+            return isDirty(c);
+        }, {
+            return false;
+        })
+        
+        uint8_t get_evict_list (Context c)
+        {
+            if (isBeingReleased(c)) {
+                return EvictListNone;
+            }
+            if (!isAssigned(c)) {
+                return EvictListFree;
+            }
+            if (isReferenced(c) || (!Writable && m_state != State::IDLE)) {
+                return EvictListNone;
+            }
+            bool weak = isReferencedIncludingWeak(c);
+            bool dirty = is_dirty_for_eviction(c);
+            if (!weak && !dirty && m_hinted) {
+                return EvictListCleanHinted;
+            }
+            return weak ? (dirty ? EvictListDirtyWeak : EvictListCleanWeak) : (dirty ? EvictListDirty : EvictListClean);
+        }
+        
+        // Moves the entry to the right list after a change of its state.
+        // Dirty entries are inserted by dirt time, searching from the end
+        // since they usually become unreferenced soon after being dirtied.
+        void update_evict_list (Context c)
+        {
+            auto *o = Object::self(c);
+            
+            uint8_t new_list = get_evict_list(c);
+            if (new_list == m_evict_list) {
+                return;
+            }
+            
+            if (m_evict_list != EvictListNone) {
+                o->evict_lists[m_evict_list].remove(*this);
+            }
+            m_evict_list = new_list;
+            if (new_list == EvictListNone) {
+                return;
+            }
+            
+            auto &list = o->evict_lists[new_list];
+            if (Writable && (new_list == EvictListDirty || new_list == EvictListDirtyWeak) && !list.isEmpty()) {
+                CacheEntry *after = list.lastNotEmpty();
+                while (eviction_lesser_than(c, this, after)) {
+                    if (after == list.first()) {
+                        return list.prepend(*this);
+                    }
+                    after = list.prevNotFirst(*after);
+                }
+                return list.insertAfter(*this, *after);
+            }
+            list.append(*this);
+        }
+        
+        void set_unassigned (Context c)
+        {
+            block_table_remove(c, this);
+            m_state = State::INVALID;
+        }
+        
         APRINTER_FUNCTION_IF_OR_EMPTY(Writable, void, writable_entry_init (Context c))
         {
             auto *o = Object::self(c);
@@ -1162,10 +1522,15 @@ private:
             if (m_state == State::READING) {
                 APRINTER_BLOCKCACHE_MSG("c RD %" PRIu32 " e%d", (uint32_t)m_block, (int)error);
                 if (isBeingReleased(c)) {
-                    m_state = State::INVALID;
+                    set_unassigned(c);
                     return schedule_allocations_check(c);
                 }
-                m_state = error ? State::INVALID : State::IDLE;
+                if (error) {
+                    set_unassigned(c);
+                } else {
+                    m_state = State::IDLE;
+                }
+                update_evict_list(c);
                 raise_read_completed(c, error);
                 AMBRO_ASSERT(!error || !isReferencedIncludingWeak(c))
             }
@@ -1238,6 +1603,10 @@ private:
             this->m_last_write_failed = error;
             this->m_flush_write_failed = error;
             this->m_dirt_state = (!error && this->m_dirt_state == DirtState::WRITING) ? DirtState::CLEAN : DirtState::DIRTY;
+            if (this->m_dirt_state == DirtState::CLEAN) {
+                write_behind_entry_cleaned(c);
+            }
+            update_evict_list(c);
             
             if (!error && this->m_dirt_state == DirtState::DIRTY && (!o->waiting_flush_requests.isEmpty() || this->m_releasing)) {
                 return write_event_handler(c);
@@ -1249,7 +1618,7 @@ private:
                     report_allocation_event(c, true);
                 } else {
                     AMBRO_ASSERT(this->m_dirt_state == DirtState::CLEAN)
-                    m_state = State::INVALID;
+                    set_unassigned(c);
                     schedule_allocations_check(c);
                 }
             }
@@ -1264,12 +1633,16 @@ private:
         
         DoubleEndedList<CacheRef, &CacheRef::m_list_node, false> m_cache_users_list;
         DoubleEndedListNode<CacheEntry> m_queue_node;
+        LinkedListNode<PointerLinkModel<CacheEntry>> m_evict_node;
         BlockIndexType m_block;
         NumRefsType m_num_hard_refs;
         State m_state;
+        uint8_t m_evict_list;
+        bool m_hinted;
         
     public:
         using IoQueue = DoubleEndedList<CacheEntry, &CacheEntry::m_queue_node>;
+        using EvictList = LinkedList<APRINTER_MEMBER_ACCESSOR_TN(&CacheEntry::m_evict_node), PointerLinkModel<CacheEntry>, true>;
     };
     
     class IoDispatcher {
@@ -1304,6 +1677,10 @@ private:
                 
                 unit->acceptJob(c, e);
             }
+            
+            if (o->io_queue.isEmpty()) {
+                write_behind_io_queue_empty(c);
+            }
         }
         
     private:
@@ -1390,60 +1767,19 @@ private:
             auto *o = Object::self(c);
             
             // Make sure that after a failed multi-block write, the next write attempt for all
-            // involved entries will be a single-block write (see also extension check below).
+            // involved entries will be a single-block write (see also can_extend_into).
             // The rationale is that a multi-block write may have failed due to a specific block.
             if (first_e->hasLastWriteFailed(c)) {
                 return;
             }
             
-            // Clear entry indices for the remainder of the block sequence (needed for next step).
-            for (auto i : LoopRange<IoBlockIndexType>(1, MaxIoBlocks)) {
-                m_entry_indices[i] = -1;
-            }
-            
-            // Find candidate blocks to add to the sequence.
-            for (CacheEntry &this_e : o->cache_entries) {
-                // Ignore unassigned entries (they do not have a block index).
-                if (!this_e.isAssigned(c)) {
-                    continue;
-                }
-                
-                // Check if the entry has a place in the sequence.
-                BlockIndexType block_index = this_e.get_io_block_index();
-                if (!(block_index > start_block && block_index - start_block < MaxIoBlocks)) {
-                    continue;
-                }
-                
-                // See above...
-                if (this_e.hasLastWriteFailed(c)) {
-                    continue;
-                }
-                
-                if (this_e.isIoActive(c)) {
-                    // Active I/O - we can take the entry if the I/O direction matches and it is still in the queue.
-                    if (!((!Writable || first_e->m_state == this_e.m_state) && !CacheEntry::IoQueue::isRemoved(&this_e))) {
-                        continue;
-                    }
-                } else {
-                    // Inactive I/O - we can take the entry if we are writing and the entry is ready for writing.
-                    if (!(Writable && first_e->m_state == CacheEntry::State::WRITING && this_e.canStartWrite(c))) {
-                        continue;
-                    }
-                }
-                
-                // The entry is a candidate, add it to the list.
-                // Unless some other entry is already in this place - but the only way this can
-                // happen if the user caused a conflict with the write strides.
-                IoBlockIndexType io_index = block_index - start_block;
-                if (m_entry_indices[io_index] == -1) {
-                    m_entry_indices[io_index] = (&this_e - o->cache_entries);
-                }
-            }
-            
-            // Extend the chain into the candidate entries as much as possible,
+            // Extend the chain into the entries for the following blocks as much as possible,
             // keeping it contiguous. Update these entries to reflect start of I/O.
-            while (m_num_blocks < MaxIoBlocks && m_entry_indices[m_num_blocks] != -1) {
-                CacheEntry *this_e = &o->cache_entries[m_entry_indices[m_num_blocks]];
+            while (m_num_blocks < MaxIoBlocks) {
+                CacheEntry *this_e = find_extend_entry(c, first_e, start_block + m_num_blocks);
+                if (!this_e) {
+                    break;
+                }
                 
                 if (this_e->isIoActive(c)) {
                     // It was queued, so remove it from the I/O queue.
@@ -1455,10 +1791,51 @@ private:
                     this_e->write_starting(c);
                 }
                 
+                m_entry_indices[m_num_blocks] = this_e->get_entry_index(c);
                 m_num_blocks++;
             }
         }
         
+        static CacheEntry * find_extend_entry (Context c, CacheEntry *first_e, BlockIndexType block_index)
+        {
+            // The entry doing I/O on this block is found by its own block, or, when the
+            // first entry is writing a further copy, likely by the block of the same copy.
+            BlockIndexType copy_offset = first_e->get_io_block_index() - first_e->m_block;
+            
+            CacheEntry *this_e = find_block_entry(c, block_index);
+            if (this_e && can_extend_into(c, first_e, this_e, block_index)) {
+                return this_e;
+            }
+            if (copy_offset != 0) {
+                this_e = find_block_entry(c, block_index - copy_offset);
+                if (this_e && can_extend_into(c, first_e, this_e, block_index)) {
+                    return this_e;
+                }
+            }
+            return nullptr;
+        }
+        
+        static bool can_extend_into (Context c, CacheEntry *first_e, CacheEntry *this_e, BlockIndexType block_index)
+        {
+            // Check if the entry has this place in the sequence.
+            if (this_e->get_io_block_index() != block_index) {
+                return false;
+            }
+            
+            // See extend_io.
+            if (this_e->hasLastWriteFailed(c)) {
+                return false;
+            }
+            
+            if (this_e->isIoActive(c)) {
+                // Active I/O - we can take the entry if the I/O direction matches and it is still in the queue.
+                return (!Writable || first_e->m_state == this_e->m_state) && !CacheEntry::IoQueue::isRemoved(this_e);
+            } else {
+                // Inactive I/O - we can take the entry if we are writing and the entry is ready for writing.
+                return Writable && first_e->m_state == CacheEntry::State::WRITING && this_e->canStartWrite(c);
+            }
+        }
+        
         APRINTER_FUNCTION_IF(Writable, void, block_user_locker (Context c, bool lock_else_unlock))
         {
             auto *o = Object::self(c);
@@ -1504,19 +1881,30 @@ private:
     APRINTER_STRUCT_IF_TEMPLATE(CacheWritableMembers) {
         typename Context::EventLoop::QueuedEvent allocations_event;
         DirtTimeType current_dirt_time;
+        CacheEntryIndexType releasing_entry;
         DoubleEndedList<FlushRequest<>, &FlushRequest<>::m_waiting_flush_requests_node, false> waiting_flush_requests;
         DoubleEndedList<CacheRef, &CacheRef::m_list_node> pending_allocations;
         bool buffer_usage[NumBuffers];
     };
     
+    APRINTER_STRUCT_IF_TEMPLATE(CacheWriteBehindMembers) {
+        typename Context::EventLoop::QueuedEvent write_behind_event;
+        // Constructed in init, the Object may be placed in a Union.
+        ManualRaii<typename Context::EventLoop::TimedEvent> write_behind_timer;
+        CacheEntryIndexType num_dirty;
+        bool write_behind_pending;
+    };
+    
 public:
     struct Object : public ObjBase<BlockCache, ParentObject, MakeTypeList<
         TheDebugObject
-    >>, public CacheWritableMembers<Writable> {
+    >>, public CacheWritableMembers<Writable>, public CacheWriteBehindMembers<WriteBehind> {
         CacheEntry cache_entries[NumCacheEntries];
         IoUnit io_units[NumIoUnits];
         typename CacheEntry::IoQueue io_queue;
         typename Context::EventLoop::QueuedEvent io_queue_event;
+        CacheEntryIndexType block_table[BlockTableSize];
+        typename CacheEntry::EvictList evict_lists[NumEvictLists];
         DataWordType buffers[NumBuffers][BlockSizeInWords];
     };
 };
@@ -1528,7 +1916,9 @@ APRINTER_ALIAS_STRUCT_EXT(BlockCacheArg, (
     APRINTER_AS_VALUE(int, NumCacheEntries),
     APRINTER_AS_VALUE(int, NumIoUnits),
     APRINTER_AS_VALUE(int, MaxIoBlocks),
-    APRINTER_AS_VALUE(bool, Writable)
+    APRINTER_AS_VALUE(bool, Writable),
+    APRINTER_AS_VALUE(int, WriteBehindDirtyCount),
+    APRINTER_AS_TYPE(WriteBehindDelay)
 ), (
     APRINTER_DEF_INSTANCE(BlockCacheArg, BlockCache)
 ))
@@ -26,6 +26,7 @@
 #define APRINTER_BUFFERED_FILE_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 
 #include <aprinter/meta/MinMax.h>
@@ -40,14 +41,17 @@ class BufferedFile {
 private:
     using TheFs = typename TheFsAccess::TheFileSystem;
     using TheOpener = typename TheFs::Opener;
+    using TheDirModifier = typename TheFs::template DirModifier<>;
     using TheFile = typename TheFs::template File<true>;
     
     enum class State {
         IDLE,
-        OPEN_ACCESS, OPEN_BASEDIR, OPEN_OPEN, OPEN_OPENWR,
+        OPEN_ACCESS, OPEN_BASEDIR, OPEN_OPEN, OPEN_CREATE, OPEN_OPENWR,
         READY,
         WRITE_EVENT, WRITE_WRITE, WRITE_TRUNCATE, WRITE_FLUSH,
-        READ_EVENT, READ_READ
+        READ_EVENT, READ_READ,
+        READ_BLOCK_EVENT, READ_BLOCK,
+        SEEK_SEEK, SEEK_READ
     };
     
 public:
@@ -63,6 +67,7 @@ public:
         m_access_client.init(c, APRINTER_CB_OBJFUNC_T(&BufferedFile::access_client_handler, this));
         m_state = State::IDLE;
         m_have_opener = false;
+        m_have_modifier = false;
         m_have_file = false;
         m_have_flush = false;
     }
@@ -129,6 +134,71 @@ public:
         m_event.prependNowNotAlready(c);
     }
     
+    // Reads the next block of the file without copying. The completion
+    // handler reports the number of bytes available at getReadBlockData,
+    // zero meaning end of file. The data remains valid until the next read
+    // is started or the file is reset.
+    void startReadBlock (Context c)
+    {
+        AMBRO_ASSERT(m_state == State::READY)
+        AMBRO_ASSERT(!m_write_mode)
+        
+        m_state = State::READ_BLOCK_EVENT;
+        m_event.prependNowNotAlready(c);
+    }
+    
+    char const * getReadBlockData (Context c)
+    {
+        AMBRO_ASSERT(m_state == State::READY)
+        AMBRO_ASSERT(!m_write_mode)
+        AMBRO_ASSERT(m_read_buffer_pos < m_read_buffer_length)
+        
+        return m_fs_file.getReadPointer(c);
+    }
+    
+    // Moves the read position to an arbitrary offset, which must not be
+    // beyond the end of the file. The file system can only seek to block
+    // boundaries, so the containing block is read and the part before the
+    // offset skipped. This is meant to be followed by startReadData.
+    void startSeek (Context c, uint32_t offset)
+    {
+        AMBRO_ASSERT(m_state == State::READY)
+        AMBRO_ASSERT(!m_write_mode)
+        AMBRO_ASSERT(offset <= m_fs_file.getSize(c))
+        
+        if (m_read_buffer_pos < m_read_buffer_length) {
+            m_read_buffer_pos = m_read_buffer_length;
+            m_fs_file.finishRead(c);
+        }
+        
+        m_read_pos = offset % TheFs::BlockSize;
+        m_state = State::SEEK_SEEK;
+        m_fs_file.startSeek(c, offset - m_read_pos);
+    }
+    
+    uint32_t getFileSize (Context c)
+    {
+        AMBRO_ASSERT(m_have_file)
+        
+        return m_fs_file.getSize(c);
+    }
+    
+    // Modification time from the directory entry (see FsEntry::getModTime).
+    uint32_t getModTime (Context c)
+    {
+        AMBRO_ASSERT(m_have_file)
+        
+        return m_mod_time;
+    }
+    
+    // First cluster from the directory entry (see FsEntry::getFirstCluster).
+    uint32_t getFirstCluster (Context c)
+    {
+        AMBRO_ASSERT(m_have_file)
+        
+        return m_first_cluster;
+    }
+    
     bool isReady (Context c)
     {
         return (m_state == State::READY);
@@ -149,6 +219,10 @@ private:
             m_fs_opener.deinit(c);
             m_have_opener = false;
         }
+        if (m_have_modifier) {
+            m_fs_modifier.deinit(c);
+            m_have_modifier = false;
+        }
         m_access_client.reset(c);
         m_event.unset(c);
         m_state = State::IDLE;
@@ -175,6 +249,7 @@ private:
             m_fs_opener.init(c, dir_entry, TheFs::EntryType::DIR_TYPE, m_basedir, APRINTER_CB_OBJFUNC_T(&BufferedFile::fs_opener_handler, this));
         } else {
             m_state = State::OPEN_OPEN;
+            m_open_dir_entry = dir_entry;
             m_fs_opener.init(c, dir_entry, TheFs::EntryType::FILE_TYPE, m_filename, APRINTER_CB_OBJFUNC_T(&BufferedFile::fs_opener_handler, this));
         }
         m_have_opener = true;
@@ -186,6 +261,19 @@ private:
         AMBRO_ASSERT(m_have_opener)
         AMBRO_ASSERT(!m_have_file)
         
+        // When writing, a file which does not exist is created.
+        if (status == TheOpener::OpenerStatus::NOT_FOUND && m_state == State::OPEN_OPEN && m_write_mode) {
+            m_fs_opener.deinit(c);
+            m_have_opener = false;
+            
+            m_fs_modifier.init(c, APRINTER_CB_OBJFUNC_T(&BufferedFile::fs_modifier_handler, this));
+            m_have_modifier = true;
+            
+            m_state = State::OPEN_CREATE;
+            m_fs_modifier.startCreate(c, m_open_dir_entry, m_filename, TheFs::EntryType::FILE_TYPE);
+            return;
+        }
+        
         if (status != TheOpener::OpenerStatus::SUCCESS) {
             Error user_error = (status == TheOpener::OpenerStatus::NOT_FOUND) ? Error::NOT_FOUND : Error::OTHER_ERROR;
             return reset_and_complete(c, user_error);
@@ -195,14 +283,39 @@ private:
         
         if (m_state == State::OPEN_BASEDIR) {
             m_state = State::OPEN_OPEN;
+            m_open_dir_entry = entry;
             m_fs_opener.init(c, entry, TheFs::EntryType::FILE_TYPE, m_filename, APRINTER_CB_OBJFUNC_T(&BufferedFile::fs_opener_handler, this));
             return;
         }
         
         m_have_opener = false;
         
+        open_file(c, entry);
+    }
+    
+    void fs_modifier_handler (Context c, typename TheDirModifier::ModifierStatus status, typename TheFs::FsEntry entry)
+    {
+        AMBRO_ASSERT(m_state == State::OPEN_CREATE)
+        AMBRO_ASSERT(m_have_modifier)
+        AMBRO_ASSERT(!m_have_file)
+        
+        if (status != TheDirModifier::ModifierStatus::SUCCESS) {
+            Error user_error = (status == TheDirModifier::ModifierStatus::NOT_FOUND) ? Error::NOT_FOUND : Error::OTHER_ERROR;
+            return reset_and_complete(c, user_error);
+        }
+        
+        m_fs_modifier.deinit(c);
+        m_have_modifier = false;
+        
+        open_file(c, entry);
+    }
+    
+    void open_file (Context c, typename TheFs::FsEntry entry)
+    {
         m_fs_file.init(c, entry, APRINTER_CB_OBJFUNC_T(&BufferedFile::fs_file_handler, this), TheFile::IoMode::FS_BUFFER);
         m_have_file = true;
+        m_mod_time = entry.getModTime();
+        m_first_cluster = entry.getFirstCluster();
         
         if (m_write_mode) {
             m_state = State::OPEN_OPENWR;
@@ -217,7 +330,8 @@ private:
     
     void fs_file_handler (Context c, bool io_error, size_t read_length)
     {
-        AMBRO_ASSERT(m_state == State::OPEN_OPENWR || m_state == State::WRITE_WRITE || m_state == State::READ_READ || m_state == State::WRITE_TRUNCATE)
+        AMBRO_ASSERT(m_state == State::OPEN_OPENWR || m_state == State::WRITE_WRITE || m_state == State::READ_READ || m_state == State::READ_BLOCK ||
+                     m_state == State::SEEK_SEEK || m_state == State::SEEK_READ || m_state == State::WRITE_TRUNCATE)
         AMBRO_ASSERT(m_have_file)
         
         if (io_error) {
@@ -243,6 +357,39 @@ private:
             m_read_buffer_length = read_length;
             m_event.prependNowNotAlready(c);
         }
+        else if (m_state == State::READ_BLOCK) {
+            AMBRO_ASSERT(read_length <= TheFs::BlockSize)
+            
+            m_state = State::READY;
+            m_read_buffer_pos = 0;
+            m_read_buffer_length = read_length;
+            return m_completion_handler(c, Error::NO_ERROR, read_length);
+        }
+        else if (m_state == State::SEEK_SEEK) {
+            m_read_buffer_pos = TheFs::BlockSize;
+            m_read_buffer_length = TheFs::BlockSize;
+            
+            if (m_read_pos > 0) {
+                m_state = State::SEEK_READ;
+                m_fs_file.startRead(c);
+                return;
+            }
+            
+            m_state = State::READY;
+            return m_completion_handler(c, Error::NO_ERROR, 0);
+        }
+        else if (m_state == State::SEEK_READ) {
+            AMBRO_ASSERT(read_length <= TheFs::BlockSize)
+            
+            m_read_buffer_pos = MinValue(m_read_pos, read_length);
+            m_read_buffer_length = read_length;
+            if (m_read_buffer_pos == m_read_buffer_length) {
+                m_fs_file.finishRead(c);
+            }
+            
+            m_state = State::READY;
+            return m_completion_handler(c, Error::NO_ERROR, 0);
+        }
         else { // m_state == State::WRITE_TRUNCATE
             AMBRO_ASSERT(!m_have_flush)
             
@@ -269,6 +416,8 @@ private:
     {
         if (m_state == State::WRITE_EVENT) {
             handle_event_write(c);
+        } else if (m_state == State::READ_BLOCK_EVENT) {
+            handle_event_read_block(c);
         } else {
             AMBRO_ASSERT(m_state == State::READ_EVENT)
             handle_event_read(c);
@@ -334,17 +483,38 @@ private:
         return m_completion_handler(c, Error::NO_ERROR, m_read_pos);
     }
     
+    void handle_event_read_block (Context c)
+    {
+        if (m_read_buffer_pos < m_read_buffer_length) {
+            m_read_buffer_pos = m_read_buffer_length;
+            m_fs_file.finishRead(c);
+        }
+        
+        if (m_read_buffer_length < TheFs::BlockSize) {
+            m_state = State::READY;
+            return m_completion_handler(c, Error::NO_ERROR, 0);
+        }
+        
+        m_state = State::READ_BLOCK;
+        m_fs_file.startRead(c);
+    }
+    
 private:
     CompletionHandler m_completion_handler;
     typename Context::EventLoop::QueuedEvent m_event;
     typename TheFsAccess::Client m_access_client;
     union {
         TheOpener m_fs_opener;
+        TheDirModifier m_fs_modifier;
         TheFile m_fs_file;
         typename TheFs::template FlushRequest<> m_fs_flush;
     };
+    typename TheFs::FsEntry m_open_dir_entry;
+    uint32_t m_mod_time;
+    uint32_t m_first_cluster;
     State m_state;
     bool m_have_opener : 1;
+    bool m_have_modifier : 1;
     bool m_have_file : 1;
     bool m_have_flush : 1;
     bool m_write_mode : 1;
@@ -43,8 +43,11 @@
 #include <aprinter/base/TransferVector.h>
 #include <aprinter/base/LoopUtils.h>
 #include <aprinter/misc/Utf8Encoder.h>
+#include <aprinter/misc/Utf8Decoder.h>
 #include <aprinter/misc/StringTools.h>
 #include <aprinter/structure/DoubleEndedList.h>
+#include <aprinter/structure/ExtentIndex.h>
+#include <aprinter/structure/IndexBitmap.h>
 #include <aprinter/fs/BlockCache.h>
 #include <aprinter/fs/BlockRange.h>
 
@@ -64,13 +67,16 @@ public:
     static bool const FsWritable = Params::Writable;
     static bool const EnableReadHinting = Params::EnableReadHinting;
     static int const MaxFileNameSize = Params::MaxFileNameSize;
+    static int const SeekIndexEntries = Params::SeekIndexEntries;
+    static bool const UseFreeBitmap = FsWritable && Params::FreeBitmapClusters > 0;
     
 private:
     static_assert(Params::NumCacheEntries >= 1, "");
     static_assert(Params::MaxFileNameSize >= 12, "");
+    static_assert(SeekIndexEntries == 0 || SeekIndexEntries >= 2, "");
     
     using TheDebugObject = DebugObject<Context, Object>;
-    APRINTER_MAKE_INSTANCE(TheBlockCache, (BlockCacheArg<Context, Object, TheBlockAccess, Params::NumCacheEntries, Params::NumIoUnits, Params::MaxIoBlocks, FsWritable>))
+    APRINTER_MAKE_INSTANCE(TheBlockCache, (BlockCacheArg<Context, Object, TheBlockAccess, Params::NumCacheEntries, Params::NumIoUnits, Params::MaxIoBlocks, FsWritable, Params::WriteBehindDirtyCount, typename Params::WriteBehindDelay>))
     
     using BlockAccessUser = typename TheBlockAccess::User;
     using BlockIndexType = typename TheBlockAccess::BlockIndexType;
@@ -100,6 +106,12 @@ private:
     static ClusterIndexType const EmptyFileMarker = UINT32_C(0x00000000);
     static ClusterIndexType const NormalClusterIndexEnd = UINT32_C(0x0FFFFFF8);
     
+    static size_t const DirEntryCreateTimeOffset = 0xE;
+    static size_t const DirEntryAccessDateOffset = 0x12;
+    static size_t const DirEntryModTimeOffset = 0x16;
+    
+    // DOS date/time 1980-01-01 00:00:00, the earliest valid one.
+    static uint32_t const DosTimeEpoch = UINT32_C(0x00210000);
     static size_t const DirEntrySizeOffset = 0x1C;
     
     static size_t const FsInfoSig1Offset = 0x0;
@@ -109,12 +121,14 @@ private:
     static size_t const FsInfoSig3Offset = 0x1FC;
     
     enum class FsState : uint8_t {INIT, READY, FAILED};
-    enum class WriteMountState : uint8_t {NOT_MOUNTED, MOUNT_META, MOUNT_FSINFO, MOUNT_FLUSH, MOUNTED, UMOUNT_FLUSH1, UMOUNT_META, UMOUNT_FLUSH2};
+    enum class WriteMountState : uint8_t {NOT_MOUNTED, MOUNT_META, MOUNT_FSINFO, MOUNT_SCAN, MOUNT_FLUSH, MOUNTED, UMOUNT_FLUSH1, UMOUNT_META, UMOUNT_FLUSH2};
     enum class AllocationState : uint8_t {IDLE, CHECK_EVENT, REQUESTING_BLOCK};
     
     template <bool Writable> class ClusterChain;
     template <bool Writable> class DirEntryRef;
     class DirectoryIterator;
+    struct DirEntryPos;
+    class DirCursor;
     template <bool Writable> class WriteReference;
     
     APRINTER_STRUCT_IF_TEMPLATE(FsEntryExtra) {
@@ -134,9 +148,22 @@ public:
         inline EntryType getType () const { return type; }
         inline uint32_t getFileSize () const { return file_size; }
         
+        // Last modification time as stored in the directory entry,
+        // DOS date in the high 16 bits and DOS time in the low 16 bits.
+        // There is no clock, so the file system keeps a logical one: it is
+        // raised to every time seen in a directory, and each creation or
+        // modification of a file takes a time past it. The time of a file
+        // thus changes when it is modified, and a file which replaces a
+        // removed one gets a later time than the removed one had.
+        inline uint32_t getModTime () const { return mod_time; }
+        
+        // First cluster of the file, zero for an empty file.
+        inline uint32_t getFirstCluster () const { return cluster_index; }
+        
     private:
         EntryType type;
         uint32_t file_size;
+        uint32_t mod_time;
         ClusterIndexType cluster_index;
     };
     
@@ -185,6 +212,7 @@ public:
         FsEntry entry;
         entry.type = EntryType::DIR_TYPE;
         entry.file_size = 0;
+        entry.mod_time = 0;
         entry.cluster_index = o->root_cluster;
         set_fs_entry_extra(&entry, 0, 0);
         return entry;
@@ -258,7 +286,8 @@ public:
         
         using OpenerHandler = Callback<void(Context c, OpenerStatus status, FsEntry entry)>;
         
-        void init (Context c, FsEntry dir_entry, EntryType entry_type, char const *path, OpenerHandler handler)
+        // If path_len is given, only that many characters of path are considered.
+        void init (Context c, FsEntry dir_entry, EntryType entry_type, char const *path, OpenerHandler handler, size_t path_len=(size_t)-1)
         {
             auto *o = Object::self(c);
             TheDebugObject::access(c);
@@ -270,6 +299,7 @@ public:
             m_handler = handler;
             
             m_path_comp = path;
+            m_path_rem = path_len;
             find_name_component_length();
             
             if (m_path_comp_len == 0) {
@@ -300,13 +330,14 @@ public:
         bool find_name_component_length ()
         {
             bool skipped_slashes = false;
-            while (*m_path_comp == '/') {
+            while (m_path_rem > 0 && *m_path_comp == '/') {
                 m_path_comp++;
+                m_path_rem--;
                 skipped_slashes = true;
             }
             
             m_path_comp_len = 0;
-            while (m_path_comp[m_path_comp_len] != '\0' && m_path_comp[m_path_comp_len] != '/') {
+            while (m_path_comp_len < m_path_rem && m_path_comp[m_path_comp_len] != '\0' && m_path_comp[m_path_comp_len] != '/') {
                 m_path_comp_len++;
             }
             
@@ -339,69 +370,1069 @@ public:
                 OpenerStatus status = is_error ? OpenerStatus::ERROR : OpenerStatus::NOT_FOUND;
                 return m_handler(c, status, FsEntry{});
             }
-            
-            if (!compare_filename_equal(name, m_path_comp, m_path_comp_len)) {
-                m_dir_iter.requestEntry(c);
+            
+            if (!compare_filename_equal(name, m_path_comp, m_path_comp_len)) {
+                m_dir_iter.requestEntry(c);
+                return;
+            }
+            
+            m_dir_iter.deinit(c);
+            
+            m_path_comp += m_path_comp_len;
+            m_path_rem -= m_path_comp_len;
+            bool skipped_slashes = find_name_component_length();
+            
+            if (m_path_comp_len > 0) {
+                if (entry.type != EntryType::DIR_TYPE) {
+                    m_state = State::COMPLETED;
+                    return m_handler(c, OpenerStatus::NOT_FOUND, FsEntry{});
+                }
+                m_dir_iter.init(c, entry.cluster_index, APRINTER_CB_OBJFUNC_T(&Opener::dir_iter_handler, this));
+                m_dir_iter.requestEntry(c);
+                return;
+            }
+            
+            m_state = State::COMPLETED;
+            if (entry.type == m_entry_type && !skipped_slashes) {
+                return m_handler(c, OpenerStatus::SUCCESS, entry);
+            } else {
+                return m_handler(c, OpenerStatus::NOT_FOUND, FsEntry{});
+            }
+        }
+        
+        EntryType m_entry_type;
+        State m_state;
+        char const *m_path_comp;
+        size_t m_path_comp_len;
+        size_t m_path_rem;
+        OpenerHandler m_handler;
+        union {
+            struct {
+                typename Context::EventLoop::QueuedEvent m_no_names_event;
+                FsEntry m_no_names_entry;
+            };
+            DirectoryIterator m_dir_iter;
+        };
+    };
+    
+    template <typename Dummy=void>
+    class DirModifier {
+        static_assert(FsWritable, "");
+        
+        enum class Op : uint8_t {CREATE, REMOVE, RENAME};
+        enum class State : uint8_t {
+            IDLE, START_EVENT, OPEN_SRC_DIR, OPEN_DST_DIR,
+            SCAN_SRC, CHECK_EMPTY, CHECK_ANCESTRY, SCAN_DST, MAKE_DIR,
+            WRITE_DST, ZERO_NEXT, FIX_DOTDOT, DELETE_SRC, FREE_CHAIN
+        };
+        enum class Aux : uint8_t {NONE, CURSOR, CHAIN};
+        
+        static size_t const MaxLfnChars = MinValue(255, MaxFileNameSize);
+        static int const MaxAncestryDepth = 64;
+        
+    public:
+        enum class ModifierStatus : uint8_t {SUCCESS, NOT_FOUND, EXISTS, NOT_EMPTY, BAD_NAME, BAD_MOVE, BUSY, ERROR};
+        
+        using ModifierHandler = Callback<void(Context c, ModifierStatus status, FsEntry entry)>;
+        
+        void init (Context c, ModifierHandler handler)
+        {
+            m_event.init(c, APRINTER_CB_OBJFUNC_T(&DirModifier::event_handler, this));
+            m_write_ref.init(c);
+            m_handler = handler;
+            m_state = State::IDLE;
+            m_have_opener = false;
+            m_have_cursor = false;
+            m_aux = Aux::NONE;
+        }
+        
+        void deinit (Context c)
+        {
+            reset_internal(c);
+            m_write_ref.deinit(c);
+            m_event.deinit(c);
+        }
+        
+        // Creates an empty file or directory. All but the last component of the
+        // path (which is relative to dir_entry) must exist. The path must remain
+        // valid until completion. On success, the handler receives the new entry.
+        void startCreate (Context c, FsEntry dir_entry, char const *path, EntryType entry_type)
+        {
+            start_op(c, Op::CREATE, dir_entry, nullptr, dir_entry, path);
+            m_entry_type = entry_type;
+        }
+        
+        // Removes a file or an empty directory. Fails with BUSY if the file is open.
+        void startRemove (Context c, FsEntry dir_entry, char const *path)
+        {
+            start_op(c, Op::REMOVE, dir_entry, path, dir_entry, nullptr);
+        }
+        
+        // Renames a file or directory, possibly moving it into another directory.
+        // Each path is relative to its own directory entry. On success, the handler
+        // receives the entry at its new location. Fails with BUSY if the file is open.
+        void startRename (Context c, FsEntry src_dir_entry, char const *src_path, FsEntry dst_dir_entry, char const *dst_path)
+        {
+            start_op(c, Op::RENAME, src_dir_entry, src_path, dst_dir_entry, dst_path);
+        }
+        
+    private:
+        void start_op (Context c, Op op, FsEntry src_dir_entry, char const *src_path, FsEntry dst_dir_entry, char const *dst_path)
+        {
+            auto *o = Object::self(c);
+            TheDebugObject::access(c);
+            AMBRO_ASSERT(o->state == FsState::READY)
+            AMBRO_ASSERT(m_state == State::IDLE)
+            AMBRO_ASSERT(src_dir_entry.type == EntryType::DIR_TYPE)
+            AMBRO_ASSERT(dst_dir_entry.type == EntryType::DIR_TYPE)
+            
+            m_op = op;
+            m_src_dir_entry = src_dir_entry;
+            m_dst_dir_entry = dst_dir_entry;
+            m_src_path = src_path;
+            m_dst_path = dst_path;
+            m_state = State::START_EVENT;
+            m_event.prependNowNotAlready(c);
+        }
+        
+        void reset_internal (Context c)
+        {
+            if (m_aux == Aux::CURSOR) {
+                m_aux_cursor.deinit(c);
+            }
+            else if (m_aux == Aux::CHAIN) {
+                m_free_chain.deinit(c);
+            }
+            if (m_have_cursor) {
+                m_cursor.deinit(c);
+            }
+            if (m_have_opener) {
+                m_opener.deinit(c);
+            }
+            m_write_ref.release(c);
+            m_event.unset(c);
+            m_state = State::IDLE;
+            m_have_opener = false;
+            m_have_cursor = false;
+            m_aux = Aux::NONE;
+        }
+        
+        void complete (Context c, ModifierStatus status, FsEntry entry=FsEntry{})
+        {
+            reset_internal(c);
+            return m_handler(c, status, entry);
+        }
+        
+        void event_handler (Context c)
+        {
+            TheDebugObject::access(c);
+            AMBRO_ASSERT(m_state == State::START_EVENT)
+            
+            if (!m_write_ref.take(c)) {
+                return complete(c, ModifierStatus::ERROR);
+            }
+            
+            open_parent_dir(c, (m_op == Op::CREATE) ? State::OPEN_DST_DIR : State::OPEN_SRC_DIR);
+        }
+        
+        void open_parent_dir (Context c, State state)
+        {
+            bool for_dst = (state == State::OPEN_DST_DIR);
+            char const *path = for_dst ? m_dst_path : m_src_path;
+            char const *slash = strrchr(path, '/');
+            size_t dir_len = slash ? (size_t)(slash - path) : 0;
+            
+            m_state = state;
+            m_opener.init(c, for_dst ? m_dst_dir_entry : m_src_dir_entry, EntryType::DIR_TYPE, path, APRINTER_CB_OBJFUNC_T(&DirModifier::opener_handler, this), dir_len);
+            m_have_opener = true;
+        }
+        
+        void opener_handler (Context c, typename Opener::OpenerStatus status, FsEntry entry)
+        {
+            TheDebugObject::access(c);
+            AMBRO_ASSERT(m_state == State::OPEN_SRC_DIR || m_state == State::OPEN_DST_DIR)
+            AMBRO_ASSERT(m_have_opener)
+            
+            if (status != Opener::OpenerStatus::SUCCESS) {
+                return complete(c, (status == Opener::OpenerStatus::NOT_FOUND) ? ModifierStatus::NOT_FOUND : ModifierStatus::ERROR);
+            }
+            
+            m_opener.deinit(c);
+            m_have_opener = false;
+            
+            if (m_state == State::OPEN_SRC_DIR) {
+                m_src_dir_cluster = entry.cluster_index;
+                if (m_op == Op::RENAME) {
+                    return open_parent_dir(c, State::OPEN_DST_DIR);
+                }
+                return start_scan(c, State::SCAN_SRC);
+            }
+            
+            m_dst_dir_cluster = entry.cluster_index;
+            start_scan(c, (m_op == Op::CREATE) ? State::SCAN_DST : State::SCAN_SRC);
+        }
+        
+        void start_scan (Context c, State state)
+        {
+            bool for_dst = (state == State::SCAN_DST);
+            
+            if (!parse_name(for_dst ? m_dst_path : m_src_path)) {
+                return complete(c, ModifierStatus::BAD_NAME);
+            }
+            
+            m_entries_needed = 1;
+            if (for_dst) {
+                make_short_name();
+                if (m_need_lfn) {
+                    m_entries_needed += (m_lfn_len + 12) / 13;
+                }
+            }
+            
+            m_state = state;
+            m_scan_index = 0;
+            m_end_index = UINT32_MAX;
+            m_run_len = 0;
+            m_slot_found = false;
+            m_lfn_seq = -1;
+            m_alias_used = 0;
+            m_hash_alias_used = 0;
+            init_cursor(c, for_dst ? m_dst_dir_cluster : m_src_dir_cluster);
+            m_cursor.requestNext(c, false);
+        }
+        
+        void init_cursor (Context c, ClusterIndexType first_cluster)
+        {
+            if (m_have_cursor) {
+                m_cursor.deinit(c);
+            }
+            m_cursor.init(c, first_cluster, APRINTER_CB_OBJFUNC_T(&DirModifier::cursor_handler, this));
+            m_have_cursor = true;
+        }
+        
+        void init_aux_cursor (Context c, ClusterIndexType first_cluster)
+        {
+            deinit_aux(c);
+            m_aux_cursor.init(c, first_cluster, APRINTER_CB_OBJFUNC_T(&DirModifier::aux_cursor_handler, this));
+            m_aux = Aux::CURSOR;
+        }
+        
+        void deinit_aux (Context c)
+        {
+            if (m_aux == Aux::CURSOR) {
+                m_aux_cursor.deinit(c);
+            }
+            m_aux = Aux::NONE;
+        }
+        
+        void cursor_handler (Context c, bool error)
+        {
+            TheDebugObject::access(c);
+            AMBRO_ASSERT(m_have_cursor)
+            
+            if (error) {
+                return complete(c, ModifierStatus::ERROR);
+            }
+            
+            switch (m_state) {
+                case State::SCAN_SRC:
+                case State::SCAN_DST:   return scan_entry(c);
+                case State::WRITE_DST:  return write_entry(c);
+                case State::ZERO_NEXT:  return zero_next_entry(c);
+                case State::DELETE_SRC: return delete_entry(c);
+                default: AMBRO_ASSERT(false);
+            }
+        }
+        
+        void scan_entry (Context c)
+        {
+            bool for_dst = (m_state == State::SCAN_DST);
+            
+            if (m_cursor.isEnd(c)) {
+                return scan_finished(c);
+            }
+            
+            DirEntryPos pos = m_cursor.getPos(c);
+            uint32_t index = m_scan_index++;
+            char const *entry_ptr = m_cursor.getEntry<false>(c);
+            
+            uint8_t first_byte = ReadBinaryInt<uint8_t, BinaryLittleEndian>(entry_ptr + 0x0);
+            uint8_t attrs =      ReadBinaryInt<uint8_t, BinaryLittleEndian>(entry_ptr + 0xB);
+            uint8_t type_byte =  ReadBinaryInt<uint8_t, BinaryLittleEndian>(entry_ptr + 0xC);
+            
+            // End marker, all following entries are free.
+            if (first_byte == 0) {
+                m_end_index = index;
+                note_free_entry(pos, index);
+                return scan_finished(c);
+            }
+            
+            if (first_byte == 0xE5) {
+                m_lfn_seq = -1;
+                note_free_entry(pos, index);
+                return m_cursor.requestNext(c, false);
+            }
+            
+            m_run_len = 0;
+            
+            if (attrs == 0xF && type_byte == 0) {
+                collect_lfn_entry(entry_ptr, pos);
+                return m_cursor.requestNext(c, false);
+            }
+            
+            bool has_lfn = (m_lfn_seq == 0 && vfat_checksum(entry_ptr) == m_lfn_csum);
+            m_lfn_seq = -1;
+            
+            // Ignore volume label and dot entries.
+            if ((attrs & 0x8) || first_byte == (uint8_t)'.') {
+                return m_cursor.requestNext(c, false);
+            }
+            
+            observe_mod_time(c, ReadBinaryInt<uint32_t, BinaryLittleEndian>(entry_ptr + DirEntryModTimeOffset));
+            
+            char short_name[13];
+            format_short_name(entry_ptr, short_name);
+            bool matched = (has_lfn && m_lfn_match) || compare_filename_equal(short_name, m_name, m_name_len);
+            
+            if (for_dst) {
+                if (matched || (!m_need_lfn && !memcmp(entry_ptr, m_short_name, 11))) {
+                    return complete(c, ModifierStatus::EXISTS);
+                }
+                if (m_need_lfn) {
+                    if (m_use_plain_short && !memcmp(entry_ptr, m_short_name, 11)) {
+                        m_plain_short_used = true;
+                    }
+                    note_alias(entry_ptr);
+                }
+                return m_cursor.requestNext(c, false);
+            }
+            
+            if (!matched) {
+                return m_cursor.requestNext(c, false);
+            }
+            
+            // The directory entry of an open file is written when the file is closed.
+            if (!(attrs & 0x10) && is_file_open(c, get_cluster_data_block_index(c, pos.cluster, pos.block_in_cluster), pos.entry)) {
+                return complete(c, ModifierStatus::BUSY);
+            }
+            
+            memcpy(m_src_entry, entry_ptr, 32);
+            m_src_pos = has_lfn ? m_lfn_pos : pos;
+            m_src_count = has_lfn ? (m_lfn_count + 1) : 1;
+            src_found(c);
+        }
+        
+        void note_free_entry (DirEntryPos pos, uint32_t index)
+        {
+            if (m_run_len == 0) {
+                m_run_pos = pos;
+                m_run_index = index;
+            }
+            if (m_run_len < m_entries_needed) {
+                m_run_len++;
+            }
+            if (!m_slot_found && m_run_len == m_entries_needed) {
+                m_slot_found = true;
+                m_slot_pos = m_run_pos;
+                m_slot_index = m_run_index;
+            }
+        }
+        
+        void collect_lfn_entry (char const *entry_ptr, DirEntryPos pos)
+        {
+            uint8_t first_byte = ReadBinaryInt<uint8_t, BinaryLittleEndian>(entry_ptr + 0x0);
+            uint8_t checksum_byte = ReadBinaryInt<uint8_t, BinaryLittleEndian>(entry_ptr + 0xD);
+            int8_t entry_seq = first_byte & 0x1F;
+            
+            if ((first_byte & 0x60) == 0x40) {
+                m_lfn_seq = entry_seq;
+                m_lfn_csum = checksum_byte;
+                m_lfn_count = entry_seq;
+                m_lfn_pos = pos;
+                m_lfn_match = (entry_seq == (m_lfn_len + 12) / 13);
+            }
+            
+            if (entry_seq == 0 || m_lfn_seq <= 0 || entry_seq != m_lfn_seq || checksum_byte != m_lfn_csum) {
+                m_lfn_seq = -1;
+                return;
+            }
+            
+            if (m_lfn_match) {
+                size_t base = (size_t)(entry_seq - 1) * 13;
+                for (auto i : LoopRange<int>(13)) {
+                    uint16_t ch = ReadBinaryInt<uint16_t, BinaryLittleEndian>(entry_ptr + lfn_char_offset(i));
+                    size_t pos = base + i;
+                    if (pos < m_lfn_len) {
+                        if (!lfn_char_equal(ch, m_lfn[pos])) {
+                            m_lfn_match = false;
+                        }
+                    }
+                    else if (pos == m_lfn_len && ch != 0) {
+                        m_lfn_match = false;
+                    }
+                }
+            }
+            
+            m_lfn_seq--;
+        }
+        
+        void scan_finished (Context c)
+        {
+            if (m_state == State::SCAN_SRC) {
+                return complete(c, ModifierStatus::NOT_FOUND);
+            }
+            
+            if (m_need_lfn && !(m_use_plain_short && !m_plain_short_used) && !choose_alias()) {
+                return complete(c, ModifierStatus::ERROR);
+            }
+            
+            if (m_op == Op::CREATE && m_entry_type == EntryType::DIR_TYPE) {
+                m_state = State::MAKE_DIR;
+                m_aux_step = 0;
+                init_aux_cursor(c, 0);
+                m_aux_cursor.requestNext(c, true);
+                return;
+            }
+            
+            m_new_cluster = 0;
+            start_write(c);
+        }
+        
+        void src_found (Context c)
+        {
+            bool is_dir = (m_src_entry[0xB] & 0x10);
+            ClusterIndexType cluster = mask_cluster_entry(read_dir_entry_first_cluster(c, m_src_entry));
+            
+            if (m_op == Op::REMOVE) {
+                if (is_dir && is_cluster_idx_normal(cluster)) {
+                    m_state = State::CHECK_EMPTY;
+                    init_aux_cursor(c, cluster);
+                    m_aux_cursor.requestNext(c, false);
+                    return;
+                }
+                return start_delete(c);
+            }
+            
+            // A directory must not be moved into itself or its subdirectory.
+            if (is_dir && m_dst_dir_cluster != m_src_dir_cluster) {
+                m_state = State::CHECK_ANCESTRY;
+                m_ancestor_cluster = m_dst_dir_cluster;
+                m_ancestry_depth = 0;
+                return check_ancestry(c);
+            }
+            
+            start_scan(c, State::SCAN_DST);
+        }
+        
+        void check_ancestry (Context c)
+        {
+            auto *o = Object::self(c);
+            
+            if (m_ancestor_cluster == mask_cluster_entry(read_dir_entry_first_cluster(c, m_src_entry))) {
+                return complete(c, ModifierStatus::BAD_MOVE);
+            }
+            if (m_ancestor_cluster == o->root_cluster) {
+                deinit_aux(c);
+                return start_scan(c, State::SCAN_DST);
+            }
+            if (m_ancestry_depth++ == MaxAncestryDepth) {
+                return complete(c, ModifierStatus::ERROR);
+            }
+            
+            m_aux_step = 0;
+            init_aux_cursor(c, m_ancestor_cluster);
+            m_aux_cursor.requestNext(c, false);
+        }
+        
+        void aux_cursor_handler (Context c, bool error)
+        {
+            auto *o = Object::self(c);
+            TheDebugObject::access(c);
+            AMBRO_ASSERT(m_aux == Aux::CURSOR)
+            
+            if (error) {
+                return complete(c, ModifierStatus::ERROR);
+            }
+            
+            switch (m_state) {
+                case State::CHECK_EMPTY: {
+                    char const *entry_ptr = m_aux_cursor.isEnd(c) ? nullptr : m_aux_cursor.getEntry<false>(c);
+                    if (!entry_ptr || entry_ptr[0] == 0) {
+                        deinit_aux(c);
+                        return start_delete(c);
+                    }
+                    uint8_t first_byte = entry_ptr[0];
+                    uint8_t attrs = entry_ptr[0xB];
+                    if (first_byte != 0xE5 && first_byte != (uint8_t)'.' && attrs != 0xF) {
+                        return complete(c, ModifierStatus::NOT_EMPTY);
+                    }
+                    m_aux_cursor.requestNext(c, false);
+                } break;
+                
+                case State::CHECK_ANCESTRY:
+                case State::FIX_DOTDOT: {
+                    if (m_aux_cursor.isEnd(c)) {
+                        return complete(c, ModifierStatus::ERROR);
+                    }
+                    if (m_aux_step == 0) {
+                        m_aux_step = 1;
+                        return m_aux_cursor.requestNext(c, false);
+                    }
+                    if (!is_dotdot_entry(m_aux_cursor.getEntry<false>(c))) {
+                        return complete(c, ModifierStatus::ERROR);
+                    }
+                    if (m_state == State::CHECK_ANCESTRY) {
+                        ClusterIndexType parent = mask_cluster_entry(read_dir_entry_first_cluster(c, m_aux_cursor.getEntry<false>(c)));
+                        m_ancestor_cluster = (parent == 0) ? o->root_cluster : parent;
+                        return check_ancestry(c);
+                    }
+                    char *entry_ptr = m_aux_cursor.getEntry<true>(c);
+                    write_dir_entry_first_cluster(c, update_cluster_entry(read_dir_entry_first_cluster(c, entry_ptr), dotdot_cluster(c)), entry_ptr);
+                    m_aux_cursor.markDirty(c);
+                    deinit_aux(c);
+                    start_delete(c);
+                } break;
+                
+                case State::MAKE_DIR: {
+                    if (m_aux_cursor.isEnd(c)) {
+                        return complete(c, ModifierStatus::ERROR);
+                    }
+                    char *entry_ptr = m_aux_cursor.getEntry<true>(c);
+                    memset(entry_ptr, 0, 32);
+                    memset(entry_ptr, ' ', 11);
+                    entry_ptr[0] = '.';
+                    entry_ptr[0xB] = 0x10;
+                    write_dir_entry_times(entry_ptr, o->mod_clock);
+                    if (m_aux_step == 0) {
+                        write_dir_entry_first_cluster(c, m_aux_cursor.getFirstCluster(c), entry_ptr);
+                        m_aux_cursor.markDirty(c);
+                        m_aux_step = 1;
+                        return m_aux_cursor.requestNext(c, false);
+                    }
+                    entry_ptr[1] = '.';
+                    write_dir_entry_first_cluster(c, dotdot_cluster(c), entry_ptr);
+                    m_aux_cursor.markDirty(c);
+                    m_new_cluster = m_aux_cursor.getFirstCluster(c);
+                    deinit_aux(c);
+                    start_write(c);
+                } break;
+                
+                default: AMBRO_ASSERT(false);
+            }
+        }
+        
+        void start_write (Context c)
+        {
+            m_state = State::WRITE_DST;
+            m_write_index = 0;
+            m_short_csum = vfat_checksum(m_short_name);
+            
+            if (m_slot_found) {
+                m_write_start_index = m_slot_index;
+                m_cursor.requestPos(c, m_slot_pos);
+            }
+            else if (m_run_len > 0) {
+                // Use the free entries at the end, extending the directory as needed.
+                m_write_start_index = m_run_index;
+                m_cursor.requestPos(c, m_run_pos);
+            }
+            else {
+                // The directory is full, the cursor is at its end.
+                m_write_start_index = UINT32_MAX;
+                m_cursor.requestNext(c, true);
+            }
+        }
+        
+        void write_entry (Context c)
+        {
+            if (m_cursor.isEnd(c)) {
+                return complete(c, ModifierStatus::ERROR);
+            }
+            
+            char *entry_ptr = m_cursor.getEntry<true>(c);
+            uint8_t num_lfn_entries = m_entries_needed - 1;
+            
+            if (m_write_index < num_lfn_entries) {
+                write_lfn_entry(entry_ptr, num_lfn_entries - m_write_index, m_write_index == 0);
+            } else {
+                write_short_entry(c, entry_ptr);
+            }
+            m_cursor.markDirty(c);
+            
+            if (++m_write_index < m_entries_needed) {
+                return m_cursor.requestNext(c, true);
+            }
+            
+            // If we have written over the end marker, mark the end after our entries.
+            if (m_write_start_index != UINT32_MAX && m_write_start_index + m_entries_needed > m_end_index) {
+                m_state = State::ZERO_NEXT;
+                return m_cursor.requestNext(c, false);
+            }
+            
+            dst_written(c);
+        }
+        
+        void zero_next_entry (Context c)
+        {
+            if (!m_cursor.isEnd(c)) {
+                m_cursor.getEntry<true>(c)[0] = 0;
+                m_cursor.markDirty(c);
+            }
+            dst_written(c);
+        }
+        
+        void write_lfn_entry (char *entry_ptr, uint8_t seq, bool is_last)
+        {
+            memset(entry_ptr, 0, 32);
+            entry_ptr[0x0] = seq | (is_last ? 0x40 : 0);
+            entry_ptr[0xB] = 0xF;
+            entry_ptr[0xD] = m_short_csum;
+            
+            size_t base = (size_t)(seq - 1) * 13;
+            for (auto i : LoopRange<int>(13)) {
+                size_t pos = base + i;
+                uint16_t ch = (pos < m_lfn_len) ? m_lfn[pos] : (pos == m_lfn_len) ? 0 : 0xFFFF;
+                WriteBinaryInt<uint16_t, BinaryLittleEndian>(ch, entry_ptr + lfn_char_offset(i));
+            }
+        }
+        
+        void write_short_entry (Context c, char *entry_ptr)
+        {
+            if (m_op == Op::RENAME) {
+                memcpy(entry_ptr, m_src_entry, 32);
+            } else {
+                memset(entry_ptr, 0, 32);
+                entry_ptr[0xB] = (m_entry_type == EntryType::DIR_TYPE) ? 0x10 : 0x20;
+                write_dir_entry_first_cluster(c, m_new_cluster, entry_ptr);
+                write_dir_entry_times(entry_ptr, take_mod_time(c, 0));
+            }
+            memcpy(entry_ptr, m_short_name, 11);
+            entry_ptr[0xC] = (entry_ptr[0xC] & ~0x18) | m_case_bits;
+            
+            DirEntryPos pos = m_cursor.getPos(c);
+            m_result.type = (entry_ptr[0xB] & 0x10) ? EntryType::DIR_TYPE : EntryType::FILE_TYPE;
+            m_result.file_size = ReadBinaryInt<uint32_t, BinaryLittleEndian>(entry_ptr + DirEntrySizeOffset);
+            m_result.mod_time = ReadBinaryInt<uint32_t, BinaryLittleEndian>(entry_ptr + DirEntryModTimeOffset);
+            m_result.cluster_index = mask_cluster_entry(read_dir_entry_first_cluster(c, entry_ptr));
+            set_fs_entry_extra(&m_result, get_cluster_data_block_index(c, pos.cluster, pos.block_in_cluster), pos.entry);
+        }
+        
+        void dst_written (Context c)
+        {
+            if (m_op == Op::CREATE) {
+                return complete(c, ModifierStatus::SUCCESS, m_result);
+            }
+            
+            ClusterIndexType cluster = m_result.cluster_index;
+            if (m_result.type == EntryType::DIR_TYPE && m_dst_dir_cluster != m_src_dir_cluster && is_cluster_idx_normal(cluster)) {
+                m_state = State::FIX_DOTDOT;
+                m_aux_step = 0;
+                init_aux_cursor(c, cluster);
+                m_aux_cursor.requestNext(c, false);
+                return;
+            }
+            
+            start_delete(c);
+        }
+        
+        void start_delete (Context c)
+        {
+            m_state = State::DELETE_SRC;
+            m_delete_remain = m_src_count;
+            init_cursor(c, m_src_dir_cluster);
+            m_cursor.requestPos(c, m_src_pos);
+        }
+        
+        void delete_entry (Context c)
+        {
+            if (m_cursor.isEnd(c)) {
+                return complete(c, ModifierStatus::ERROR);
+            }
+            
+            m_cursor.getEntry<true>(c)[0] = 0xE5;
+            m_cursor.markDirty(c);
+            
+            if (--m_delete_remain > 0) {
+                return m_cursor.requestNext(c, false);
+            }
+            
+            if (m_op == Op::RENAME) {
+                return complete(c, ModifierStatus::SUCCESS, m_result);
+            }
+            
+            // The entries are gone, now release the clusters.
+            ClusterIndexType cluster = mask_cluster_entry(read_dir_entry_first_cluster(c, m_src_entry));
+            if (!is_cluster_idx_normal(cluster)) {
+                return complete(c, ModifierStatus::SUCCESS);
+            }
+            
+            m_state = State::FREE_CHAIN;
+            deinit_aux(c);
+            m_free_chain.init(c, cluster, APRINTER_CB_OBJFUNC_T(&DirModifier::free_chain_handler, this));
+            m_aux = Aux::CHAIN;
+            m_free_chain.startTruncate(c);
+        }
+        
+        void free_chain_handler (Context c, bool error, bool first_cluster_changed)
+        {
+            TheDebugObject::access(c);
+            AMBRO_ASSERT(m_state == State::FREE_CHAIN)
+            
+            complete(c, error ? ModifierStatus::ERROR : ModifierStatus::SUCCESS);
+        }
+        
+        ClusterIndexType dotdot_cluster (Context c)
+        {
+            auto *o = Object::self(c);
+            return (m_dst_dir_cluster == o->root_cluster) ? 0 : m_dst_dir_cluster;
+        }
+        
+        bool parse_name (char const *path)
+        {
+            char const *slash = strrchr(path, '/');
+            m_name = slash ? (slash + 1) : path;
+            m_name_len = strlen(m_name);
+            
+            if (m_name_len == 0 || m_name_len > MaxFileNameSize) {
+                return false;
+            }
+            if (m_name[m_name_len - 1] == ' ' || m_name[m_name_len - 1] == '.') {
+                return false;
+            }
+            
+            size_t pos = 0;
+            m_lfn_len = 0;
+            while (pos < m_name_len) {
+                uint32_t ch;
+                int ch_len = Utf8DecodeChar(m_name + pos, m_name_len - pos, &ch);
+                if (ch_len == 0 || ch > UINT32_C(0xFFFF) || ch < 0x20 || (ch < 0x80 && strchr("\"*/:<>?\\|", (char)ch)) || m_lfn_len == MaxLfnChars) {
+                    return false;
+                }
+                m_lfn[m_lfn_len++] = ch;
+                pos += ch_len;
+            }
+            
+            return true;
+        }
+        
+        void make_short_name ()
+        {
+            bool mixed_case;
+            m_need_lfn = !make_exact_short_name(&mixed_case);
+            if (!m_need_lfn) {
+                return;
+            }
+            
+            // A name which only differs from its 8.3 form by case gets that
+            // as the short name, unless it is already taken.
+            m_use_plain_short = mixed_case;
+            m_plain_short_used = false;
+            m_case_bits = 0;
+            
+            // The extension starts after the last dot, unless that is the first character.
+            size_t ext_start = m_lfn_len;
+            for (size_t i = m_lfn_len; i > 1; i--) {
+                if (m_lfn[i - 1] == '.') {
+                    ext_start = i - 1;
+                    break;
+                }
+            }
+            
+            m_basis_len = 0;
+            for (auto i : LoopRange<size_t>(ext_start)) {
+                if (m_lfn[i] != ' ' && m_lfn[i] != '.' && m_basis_len < 8) {
+                    m_basis[m_basis_len++] = make_short_char(m_lfn[i]);
+                }
+            }
+            if (m_basis_len == 0) {
+                m_basis[m_basis_len++] = '_';
+            }
+            
+            memset(m_basis_ext, ' ', 3);
+            size_t ext_len = 0;
+            for (size_t i = ext_start + 1; i < m_lfn_len; i++) {
+                if (m_lfn[i] != ' ' && ext_len < 3) {
+                    m_basis_ext[ext_len++] = make_short_char(m_lfn[i]);
+                }
+            }
+            
+            m_name_hash = 0;
+            for (auto i : LoopRange<size_t>(m_lfn_len)) {
+                m_name_hash = (uint16_t)((m_name_hash << 5) | (m_name_hash >> 11)) + m_lfn[i];
+            }
+        }
+        
+        // Checks if the name is a valid 8.3 name, possibly with an all-lowercase
+        // name or extension, and needs no long name entries. If the name is not
+        // valid only because of mixed case, mixed_case is set and the short name
+        // is still produced.
+        bool make_exact_short_name (bool *mixed_case)
+        {
+            *mixed_case = false;
+            
+            char short_name[11];
+            memset(short_name, ' ', 11);
+            
+            size_t part_len = 0;
+            bool in_ext = false;
+            bool has_upper[2] = {false, false};
+            bool has_lower[2] = {false, false};
+            
+            for (auto i : LoopRange<size_t>(m_lfn_len)) {
+                uint16_t ch = m_lfn[i];
+                if (ch == '.') {
+                    if (in_ext || part_len == 0) {
+                        return false;
+                    }
+                    in_ext = true;
+                    part_len = 0;
+                    continue;
+                }
+                if (part_len == (in_ext ? 3 : 8) || ch >= 0x80 || !is_short_char(ch)) {
+                    return false;
+                }
+                if (ch >= 'a' && ch <= 'z') {
+                    has_lower[in_ext] = true;
+                    ch -= 32;
+                }
+                else if (ch >= 'A' && ch <= 'Z') {
+                    has_upper[in_ext] = true;
+                }
+                short_name[(in_ext ? 8 : 0) + part_len++] = ch;
+            }
+            
+            memcpy(m_short_name, short_name, 11);
+            
+            if ((has_upper[0] && has_lower[0]) || (has_upper[1] && has_lower[1])) {
+                *mixed_case = true;
+                return false;
+            }
+            
+            m_case_bits = (has_lower[0] ? 0x08 : 0) | (has_lower[1] ? 0x10 : 0);
+            return true;
+        }
+        
+        // Generates a short name for a long name. There are 31 names using
+        // the basis with a numeric tail, and then 9 more where part of
+        // the basis is replaced with a hash of the long name.
+        void make_alias (bool hashed, int num, char *out)
+        {
+            memset(out, ' ', 8);
+            memcpy(out + 8, m_basis_ext, 3);
+            
+            int num_digits = (num >= 10) ? 2 : 1;
+            size_t pos;
+            if (!hashed) {
+                pos = MinValue((size_t)m_basis_len, (size_t)(7 - num_digits));
+                memcpy(out, m_basis, pos);
+            } else {
+                pos = MinValue((size_t)m_basis_len, (size_t)2);
+                memcpy(out, m_basis, pos);
+                for (int shift = 12; shift >= 0; shift -= 4) {
+                    out[pos++] = "0123456789ABCDEF"[(m_name_hash >> shift) & 0xF];
+                }
+            }
+            out[pos++] = '~';
+            if (num_digits == 2) {
+                out[pos++] = '0' + (num / 10);
+            }
+            out[pos++] = '0' + (num % 10);
+        }
+        
+        void note_alias (char const *entry_ptr)
+        {
+            char const *tilde = (char const *)memchr(entry_ptr, '~', 8);
+            if (!tilde) {
                 return;
             }
             
-            m_dir_iter.deinit(c);
-            
-            m_path_comp += m_path_comp_len;
-            bool skipped_slashes = find_name_component_length();
-            
-            if (m_path_comp_len > 0) {
-                if (entry.type != EntryType::DIR_TYPE) {
-                    m_state = State::COMPLETED;
-                    return m_handler(c, OpenerStatus::NOT_FOUND, FsEntry{});
-                }
-                m_dir_iter.init(c, entry.cluster_index, APRINTER_CB_OBJFUNC_T(&Opener::dir_iter_handler, this));
-                m_dir_iter.requestEntry(c);
+            int num = 0;
+            for (char const *ptr = tilde + 1; ptr < entry_ptr + 8 && *ptr >= '0' && *ptr <= '9' && num < 100; ptr++) {
+                num = 10 * num + (*ptr - '0');
+            }
+            if (num < 1 || num > 31) {
                 return;
             }
             
-            m_state = State::COMPLETED;
-            if (entry.type == m_entry_type && !skipped_slashes) {
-                return m_handler(c, OpenerStatus::SUCCESS, entry);
-            } else {
-                return m_handler(c, OpenerStatus::NOT_FOUND, FsEntry{});
+            char alias[11];
+            make_alias(false, num, alias);
+            if (!memcmp(alias, entry_ptr, 11)) {
+                m_alias_used |= UINT32_C(1) << num;
+            }
+            if (num <= 9) {
+                make_alias(true, num, alias);
+                if (!memcmp(alias, entry_ptr, 11)) {
+                    m_hash_alias_used |= (uint16_t)(1 << num);
+                }
+            }
+        }
+        
+        bool choose_alias ()
+        {
+            for (int num = 1; num <= 31; num++) {
+                if (!(m_alias_used & (UINT32_C(1) << num))) {
+                    make_alias(false, num, m_short_name);
+                    return true;
+                }
             }
+            for (int num = 1; num <= 9; num++) {
+                if (!(m_hash_alias_used & (1 << num))) {
+                    make_alias(true, num, m_short_name);
+                    return true;
+                }
+            }
+            return false;
         }
         
-        static bool compare_filename_equal (char const *str1, char const *str2, size_t str2_len)
+        static bool is_short_char (uint16_t ch)
         {
-            return Params::CaseInsens ? AsciiCaseInsensStringEqualToMem(str1, str2, str2_len) : (strlen(str1) == str2_len && !memcmp(str1, str2, str2_len));
+            return (ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z') || (ch >= '0' && ch <= '9') || (ch != 0 && strchr("$%'-_@~`!(){}^#&", (char)ch));
         }
         
-        EntryType m_entry_type;
+        static char make_short_char (uint16_t ch)
+        {
+            if (ch >= 0x80 || !is_short_char(ch)) {
+                return '_';
+            }
+            return (ch >= 'a' && ch <= 'z') ? (ch - 32) : ch;
+        }
+        
+        static bool lfn_char_equal (uint16_t ch1, uint16_t ch2)
+        {
+            if (Params::CaseInsens && ch1 < 0x80 && ch2 < 0x80) {
+                return AsciiToLower(ch1) == AsciiToLower(ch2);
+            }
+            return ch1 == ch2;
+        }
+        
+        static size_t lfn_char_offset (int i)
+        {
+            return (i < 5) ? (0x1 + 2 * i) : (i < 11) ? (0xE + 2 * (i - 5)) : (0x1C + 2 * (i - 11));
+        }
+        
+        static bool is_dotdot_entry (char const *entry_ptr)
+        {
+            return !memcmp(entry_ptr, "..         ", 11) && (entry_ptr[0xB] & 0x10);
+        }
+        
+        typename Context::EventLoop::QueuedEvent m_event;
+        WriteReference<true> m_write_ref;
+        ModifierHandler m_handler;
+        Op m_op;
         State m_state;
-        char const *m_path_comp;
-        size_t m_path_comp_len;
-        OpenerHandler m_handler;
+        Aux m_aux;
+        bool m_have_opener;
+        bool m_have_cursor;
+        EntryType m_entry_type;
+        FsEntry m_src_dir_entry;
+        FsEntry m_dst_dir_entry;
+        char const *m_src_path;
+        char const *m_dst_path;
+        ClusterIndexType m_src_dir_cluster;
+        ClusterIndexType m_dst_dir_cluster;
         union {
+            Opener m_opener;
             struct {
-                typename Context::EventLoop::QueuedEvent m_no_names_event;
-                FsEntry m_no_names_entry;
+                DirCursor m_cursor;
+                union {
+                    DirCursor m_aux_cursor;
+                    ClusterChain<true> m_free_chain;
+                };
             };
-            DirectoryIterator m_dir_iter;
         };
+        
+        // The name being looked up or created.
+        char const *m_name;
+        size_t m_name_len;
+        uint8_t m_lfn_len;
+        uint8_t m_entries_needed;
+        bool m_need_lfn;
+        bool m_use_plain_short;
+        bool m_plain_short_used;
+        uint8_t m_case_bits;
+        char m_short_name[11];
+        char m_basis[8];
+        uint8_t m_basis_len;
+        char m_basis_ext[3];
+        uint16_t m_name_hash;
+        uint16_t m_lfn[MaxLfnChars];
+        
+        // Directory scan state.
+        uint32_t m_scan_index;
+        uint32_t m_end_index;
+        uint32_t m_run_index;
+        uint32_t m_slot_index;
+        DirEntryPos m_run_pos;
+        DirEntryPos m_slot_pos;
+        DirEntryPos m_lfn_pos;
+        uint8_t m_run_len;
+        bool m_slot_found;
+        int8_t m_lfn_seq;
+        uint8_t m_lfn_csum;
+        uint8_t m_lfn_count;
+        bool m_lfn_match;
+        uint32_t m_alias_used;
+        uint16_t m_hash_alias_used;
+        
+        // The source entry, and other state of later steps.
+        char m_src_entry[32];
+        DirEntryPos m_src_pos;
+        uint8_t m_src_count;
+        uint8_t m_delete_remain;
+        uint8_t m_write_index;
+        uint8_t m_short_csum;
+        uint8_t m_aux_step;
+        uint8_t m_ancestry_depth;
+        uint32_t m_write_start_index;
+        ClusterIndexType m_ancestor_cluster;
+        ClusterIndexType m_new_cluster;
+        FsEntry m_result;
+    };
+    
+    // Location of the directory entry of an open file, kept in a list so that
+    // files which are open are not removed or renamed from under them.
+    struct OpenFileNode {
+        DoubleEndedListNode<OpenFileNode> list_node;
+        BlockIndexType dir_entry_block_index;
+        DirEntriesPerBlockType dir_entry_block_offset;
+    };
+    
+    APRINTER_STRUCT_IF_TEMPLATE(FileOpenMembers) {
+        OpenFileNode m_open_node;
     };
     
     APRINTER_STRUCT_IF_TEMPLATE(FileWritableMembers) {
         DirEntryRef<true> m_dir_entry;
         size_t m_write_bytes_in_block;
-        BlockIndexType m_dir_entry_block_index;
-        DirEntriesPerBlockType m_dir_entry_block_offset;
         bool m_no_need_to_read_for_write;
+        bool m_modified;
         WriteReference<true> m_write_ref;
     };
     
+    // Bounds of the read-ahead window of files, in blocks. It starts out large
+    // enough for the largest multi-block reads, and never takes all of the cache.
+    static int const ReadAheadMaxBlocks = MaxValue(1, Params::NumCacheEntries - 1);
+    static int const ReadAheadMinBlocks = MinValue(Params::MaxIoBlocks, ReadAheadMaxBlocks);
+    using ReadAheadBlocksType = ChooseIntForMax<ReadAheadMaxBlocks, false>;
+    
     APRINTER_STRUCT_IF_TEMPLATE(FileHintingMembers) {
-        BlockIndexType m_hint_block_pos;
+        ClusterChain<false> m_ahead_chain;
+        ClusterIndexType m_ahead_chain_pos;
+        uint32_t m_ahead_block_pos;
+        uint32_t m_ahead_start_pos;
+        uint32_t m_ahead_target_pos;
+        BlockIndexType m_ahead_run_block;
+        uint32_t m_ahead_run_length;
+        ReadAheadBlocksType m_ahead_window;
+        bool m_ahead_synced;
+        bool m_ahead_busy;
+    };
+    
+    APRINTER_STRUCT_IF_TEMPLATE(FileSeekIndexMembers) {
+        ExtentIndex<ClusterIndexType, SeekIndexEntries> m_seek_index;
     };
     
     template <bool Writable>
-    class File : public FileWritableMembers<Writable>, public FileHintingMembers<EnableReadHinting> {
+    class File : public FileOpenMembers<FsWritable>, public FileWritableMembers<Writable>, public FileHintingMembers<EnableReadHinting>, public FileSeekIndexMembers<(SeekIndexEntries > 0)> {
         static_assert(!Writable || FsWritable, "");
         
         enum class State : uint8_t {
@@ -409,7 +1440,8 @@ public:
             READ_EVENT, READ_NEXT_CLUSTER, READ_BLOCK, READ_READY,
             OPENWR_EVENT, OPENWR_DIR_ENTRY,
             WRITE_EVENT, WRITE_NEXT_CLUSTER, WRITE_BLOCK, WRITE_READY,
-            TRUNC_EVENT, TRUNC_CHAIN
+            TRUNC_EVENT, TRUNC_CHAIN,
+            SEEK_EVENT, SEEK_NEXT_CLUSTER
         };
         
     public:
@@ -440,8 +1472,12 @@ public:
             m_io_mode = io_mode;
             m_file_pos = 0;
             m_block_in_cluster = o->blocks_per_cluster;
+            m_chain_pos = 0;
             
-            writable_init(c, file_entry);
+            open_init(c, file_entry);
+            writable_init(c);
+            hinting_init(c, file_entry);
+            seek_index_init(c);
         }
         
         // NOTE: Not allowed when reader is busy, except when deiniting the whole FatFs and underlying storage!
@@ -449,7 +1485,9 @@ public:
         {
             TheDebugObject::access(c);
             
+            hinting_deinit(c);
             writable_deinit(c);
+            open_deinit(c);
             
             if (m_io_mode == IoMode::USER_BUFFER) {
                 m_user_buffer_mode.block_user.deinit(c);
@@ -470,6 +1508,45 @@ public:
             m_chain.rewind(c);
             m_file_pos = 0;
             m_block_in_cluster = o->blocks_per_cluster;
+            m_chain_pos = 0;
+            reset_read_ahead(c);
+        }
+        
+        /**
+         * Moves to the given position, which must be a multiple of the block
+         * size and not beyond the end of the file. Completion is reported to
+         * the file handler, with length zero.
+         * 
+         * The cluster chain is walked from the current position or from the
+         * nearest cluster known to the seek index, whichever is closer. The
+         * seek index is filled in whenever the chain is walked (when reading,
+         * writing or seeking), so seeks within the part of the file that has
+         * been seen need no FAT lookups unless the file is more fragmented
+         * than the index can hold.
+         */
+        void startSeek (Context c, uint32_t offset)
+        {
+            TheDebugObject::access(c);
+            AMBRO_ASSERT(m_state == State::IDLE)
+            AMBRO_ASSERT(offset % BlockSize == 0)
+            
+            m_seek_offset = offset;
+            m_state = State::SEEK_EVENT;
+            m_event.prependNowNotAlready(c);
+        }
+        
+        uint32_t getPosition (Context c)
+        {
+            TheDebugObject::access(c);
+            
+            return m_file_pos;
+        }
+        
+        uint32_t getSize (Context c)
+        {
+            TheDebugObject::access(c);
+            
+            return m_file_size;
         }
         
         void startReadUserBuf (Context c, DataWordType *buf)
@@ -578,13 +1655,25 @@ public:
         }
         
     private:
-        APRINTER_FUNCTION_IF_OR_EMPTY(Writable, void, writable_init (Context c, FsEntry file_entry))
+        APRINTER_FUNCTION_IF_OR_EMPTY(FsWritable, void, open_init (Context c, FsEntry file_entry))
+        {
+            auto *o = Object::self(c);
+            this->m_open_node.dir_entry_block_index = file_entry.dir_entry_block_index;
+            this->m_open_node.dir_entry_block_offset = file_entry.dir_entry_block_offset;
+            o->open_files_list.prepend(&this->m_open_node);
+        }
+        
+        APRINTER_FUNCTION_IF_OR_EMPTY(FsWritable, void, open_deinit (Context c))
+        {
+            auto *o = Object::self(c);
+            o->open_files_list.remove(&this->m_open_node);
+        }
+        
+        APRINTER_FUNCTION_IF_OR_EMPTY(Writable, void, writable_init (Context c))
         {
             this->m_dir_entry.init(c, APRINTER_CB_OBJFUNC_T(&File::dir_entry_handler<>, this));
             this->m_write_ref.init(c);
-            
-            this->m_dir_entry_block_index = file_entry.dir_entry_block_index;
-            this->m_dir_entry_block_offset = file_entry.dir_entry_block_offset;
+            this->m_modified = false;
         }
         
         APRINTER_FUNCTION_IF_OR_EMPTY(Writable, void, writable_deinit (Context c))
@@ -599,7 +1688,8 @@ public:
                 return complete_open_writable_request(c, true);
             }
             m_state = State::OPENWR_DIR_ENTRY;
-            this->m_dir_entry.requestEntryRef(c, this->m_dir_entry_block_index, this->m_dir_entry_block_offset);
+            this->m_modified = false;
+            this->m_dir_entry.requestEntryRef(c, this->m_open_node.dir_entry_block_index, this->m_open_node.dir_entry_block_offset);
         }
         
         void handle_event_read (Context c)
@@ -622,26 +1712,142 @@ public:
                 m_user_buffer_mode.block_user.startReadOrWrite(c, false, abs_block_idx, 1, TransferVector<DataWordType>{&m_user_buffer_mode.transfer_desc, 1});
             } else {
                 m_fs_buffer_mode.block_ref.requestBlock(c, abs_block_idx, 0, 1, CacheBlockRef::FLAG_NO_IMMEDIATE_COMPLETION);
-                do_read_hinting(c, abs_block_idx);
+                do_read_hinting(c);
             }
         }
         
-        APRINTER_FUNCTION_IF_OR_EMPTY(EnableReadHinting, void, do_read_hinting (Context c, BlockIndexType abs_block_idx))
+        APRINTER_FUNCTION_IF_OR_EMPTY(EnableReadHinting, void, hinting_init (Context c, FsEntry file_entry))
+        {
+            this->m_ahead_chain.init(c, file_entry.cluster_index, APRINTER_CB_OBJFUNC_T(&File::ahead_chain_handler<>, this));
+            this->m_ahead_window = ReadAheadMinBlocks;
+            this->m_ahead_synced = false;
+            this->m_ahead_busy = false;
+        }
+        
+        APRINTER_FUNCTION_IF_OR_EMPTY(EnableReadHinting, void, hinting_deinit (Context c))
+        {
+            this->m_ahead_chain.deinit(c);
+        }
+        
+        APRINTER_FUNCTION_IF_OR_EMPTY(EnableReadHinting, void, reset_read_ahead (Context c))
+        {
+            // The read-ahead starts over at the cluster of the next block read.
+            this->m_ahead_synced = false;
+        }
+        
+        /**
+         * Read-ahead is done by a second cluster chain which follows the file
+         * ahead of the reader, hinting the blocks of its clusters to the cache.
+         * Blocks hinted together which are contiguous on the disk are read with
+         * multi-block reads, also across clusters.
+         * 
+         * Whenever no more than half of the window is left ahead of the reader,
+         * read-ahead is issued up to a full window ahead. The window is doubled
+         * when the reader catches up with the read-ahead, which means that blocks
+         * are consumed faster than they are read ahead, and is reduced to what
+         * the cache could hold when the cache runs out of entries to spare.
+         */
+        APRINTER_FUNCTION_IF_OR_EMPTY(EnableReadHinting, void, do_read_hinting (Context c))
         {
             auto *o = Object::self(c);
             
-            if (m_block_in_cluster == 0 || abs_block_idx >= this->m_hint_block_pos) {
-                BlockIndexType cluster_start_block = abs_block_idx - m_block_in_cluster;
-                BlockIndexType cluster_end_block = cluster_start_block + o->blocks_per_cluster;
-                if (m_block_in_cluster == 0) {
-                    this->m_hint_block_pos = cluster_start_block + 1;
+            uint32_t block_pos = (uint32_t)(m_chain_pos - 1) * o->blocks_per_cluster + m_block_in_cluster;
+            
+            if (this->m_ahead_synced && block_pos >= this->m_ahead_block_pos) {
+                this->m_ahead_window = MinValue(ReadAheadMaxBlocks, 2 * this->m_ahead_window);
+            }
+            
+            if (!this->m_ahead_synced || block_pos > this->m_ahead_block_pos) {
+                // Abandon any cluster lookup still in progress for an old position.
+                if (this->m_ahead_busy) {
+                    this->m_ahead_chain.deinit(c);
+                    this->m_ahead_chain.init(c, m_chain.getFirstCluster(c), APRINTER_CB_OBJFUNC_T(&File::ahead_chain_handler<>, this));
+                    this->m_ahead_busy = false;
+                }
+                this->m_ahead_chain.jumpTo(c, m_chain.getCurrentCluster(c));
+                this->m_ahead_chain_pos = m_chain_pos;
+                this->m_ahead_block_pos = block_pos + 1;
+                this->m_ahead_run_length = 0;
+                this->m_ahead_synced = true;
+            }
+            
+            if (this->m_ahead_block_pos - (block_pos + 1) <= this->m_ahead_window / 2) {
+                uint32_t file_blocks = m_file_size / BlockSize + (m_file_size % BlockSize != 0);
+                this->m_ahead_start_pos = block_pos + 1;
+                this->m_ahead_target_pos = MinValue(file_blocks, (uint32_t)(block_pos + 1 + this->m_ahead_window));
+                if (!this->m_ahead_busy) {
+                    continue_read_ahead(c);
+                }
+            }
+        }
+        
+        APRINTER_FUNCTION_IF_OR_EMPTY(EnableReadHinting, void, continue_read_ahead (Context c))
+        {
+            auto *o = Object::self(c);
+            AMBRO_ASSERT(this->m_ahead_synced)
+            AMBRO_ASSERT(!this->m_ahead_busy)
+            
+            // Blocks are collected into a run of contiguous blocks which is hinted
+            // once it cannot be extended or is large enough for a full I/O.
+            while (true) {
+                uint32_t next_pos = this->m_ahead_block_pos + this->m_ahead_run_length;
+                if (next_pos >= this->m_ahead_target_pos || this->m_ahead_run_length >= ReadAheadMinBlocks) {
+                    if (!hint_read_ahead_run(c) || next_pos >= this->m_ahead_target_pos) {
+                        return;
+                    }
+                }
+                
+                uint32_t cluster_end_pos = (uint32_t)this->m_ahead_chain_pos * o->blocks_per_cluster;
+                if (next_pos == cluster_end_pos) {
+                    if (this->m_ahead_chain.endReached(c)) {
+                        hint_read_ahead_run(c);
+                        return;
+                    }
+                    this->m_ahead_busy = true;
+                    this->m_ahead_chain.requestNext(c);
+                    return;
+                }
+                
+                ClusterIndexType cluster = this->m_ahead_chain.getCurrentCluster(c);
+                if (!is_cluster_idx_valid_for_data(c, cluster)) {
+                    hint_read_ahead_run(c);
+                    return;
+                }
+                
+                BlockIndexType block = get_cluster_data_abs_block_index(c, cluster, next_pos - (cluster_end_pos - o->blocks_per_cluster));
+                if (this->m_ahead_run_length > 0 && block != this->m_ahead_run_block + this->m_ahead_run_length) {
+                    if (!hint_read_ahead_run(c)) {
+                        return;
+                    }
                 }
-                if (m_block_in_cluster == 0 || abs_block_idx >= this->m_hint_block_pos) {
-                    this->m_hint_block_pos = TheBlockCache::hintBlocks(c, this->m_hint_block_pos, this->m_hint_block_pos, cluster_end_block, 0, 1);
+                if (this->m_ahead_run_length == 0) {
+                    this->m_ahead_run_block = block;
                 }
+                this->m_ahead_run_length += MinValue(this->m_ahead_target_pos, cluster_end_pos) - next_pos;
             }
         }
         
+        APRINTER_FUNCTION_IF_ELSE(EnableReadHinting, bool, hint_read_ahead_run (Context c), {
+            BlockIndexType end_block = this->m_ahead_run_block + this->m_ahead_run_length;
+            BlockIndexType hinted_end = TheBlockCache::hintBlocks(c, this->m_ahead_run_block, this->m_ahead_run_block, end_block, 0, 1);
+            uint32_t num_hinted = hinted_end - this->m_ahead_run_block;
+            this->m_ahead_block_pos += num_hinted;
+            this->m_ahead_run_block = hinted_end;
+            this->m_ahead_run_length -= num_hinted;
+            
+            if (this->m_ahead_run_length > 0) {
+                // The cache has no more entries to spare, so reduce the window to
+                // what it could hold. The rest of the run is hinted with the next
+                // trigger.
+                uint32_t ahead_blocks = this->m_ahead_block_pos - this->m_ahead_start_pos;
+                this->m_ahead_window = MaxValue((uint32_t)ReadAheadMinBlocks, MinValue((uint32_t)this->m_ahead_window, ahead_blocks));
+                return false;
+            }
+            return true;
+        }, {
+            return false;
+        })
+        
         APRINTER_FUNCTION_IF_OR_EMPTY(Writable, void, handle_event_write (Context c))
         {
             auto *o = Object::self(c);
@@ -676,7 +1882,9 @@ public:
             if (m_file_size > m_file_pos) {
                 m_file_size = m_file_pos;
                 this->m_dir_entry.setFileSize(c, m_file_size);
+                mark_modified(c);
             }
+            reset_read_ahead(c);
             m_state = State::TRUNC_CHAIN;
             m_chain.startTruncate(c);
         }
@@ -691,6 +1899,87 @@ public:
             }
         }
         
+        void handle_event_seek (Context c)
+        {
+            auto *o = Object::self(c);
+            
+            if (m_seek_offset > m_file_size) {
+                return complete_request(c, true);
+            }
+            
+            // Position the chain at the cluster before the target position if that
+            // is at the start of a cluster, like after reading the previous block.
+            uint32_t cluster_size = (uint32_t)o->blocks_per_cluster * BlockSize;
+            ClusterIndexType target_chain_pos = m_seek_offset / cluster_size + (m_seek_offset % cluster_size != 0);
+            
+            // Continue from the current position if possible, unless the seek index
+            // knows a cluster closer to the target.
+            bool current_usable = (m_chain_pos <= target_chain_pos && !m_chain.endReached(c));
+            
+            ClusterIndexType known_pos;
+            ClusterIndexType known_cluster;
+            if (target_chain_pos > 0 && seek_index_lookup(c, target_chain_pos - 1, &known_pos, &known_cluster) &&
+                (!current_usable || known_pos + 1 > m_chain_pos))
+            {
+                m_chain.jumpTo(c, known_cluster);
+                m_chain_pos = known_pos + 1;
+            }
+            else if (!current_usable) {
+                m_chain.rewind(c);
+                m_chain_pos = 0;
+            }
+            
+            continue_seek(c);
+        }
+        
+        void continue_seek (Context c)
+        {
+            auto *o = Object::self(c);
+            uint32_t cluster_size = (uint32_t)o->blocks_per_cluster * BlockSize;
+            ClusterIndexType target_chain_pos = m_seek_offset / cluster_size + (m_seek_offset % cluster_size != 0);
+            
+            if (m_chain_pos < target_chain_pos) {
+                m_state = State::SEEK_NEXT_CLUSTER;
+                m_chain.requestNext(c);
+                return;
+            }
+            
+            m_file_pos = m_seek_offset;
+            uint32_t offset_in_cluster = m_seek_offset % cluster_size;
+            m_block_in_cluster = (offset_in_cluster == 0) ? o->blocks_per_cluster : (offset_in_cluster / BlockSize);
+            reset_read_ahead(c);
+            return complete_request(c, false);
+        }
+        
+        void handle_chain_seek_next (Context c, bool error)
+        {
+            if (error || m_chain.endReached(c)) {
+                return complete_request(c, true);
+            }
+            continue_seek(c);
+        }
+        
+        APRINTER_FUNCTION_IF_OR_EMPTY(SeekIndexEntries > 0, void, seek_index_init (Context c))
+        {
+            this->m_seek_index.init();
+        }
+        
+        APRINTER_FUNCTION_IF_OR_EMPTY(SeekIndexEntries > 0, void, seek_index_add (Context c, ClusterIndexType pos, ClusterIndexType cluster))
+        {
+            this->m_seek_index.add(pos, cluster);
+        }
+        
+        APRINTER_FUNCTION_IF_OR_EMPTY(SeekIndexEntries > 0, void, seek_index_truncate (Context c, ClusterIndexType length))
+        {
+            this->m_seek_index.truncate(length);
+        }
+        
+        APRINTER_FUNCTION_IF_ELSE(SeekIndexEntries > 0, bool, seek_index_lookup (Context c, ClusterIndexType pos, ClusterIndexType *out_pos, ClusterIndexType *out_cluster), {
+            return this->m_seek_index.lookup(pos, out_pos, out_cluster);
+        }, {
+            return false;
+        })
+        
         void handle_chain_read_next (Context c, bool error)
         {
             auto *o = Object::self(c);
@@ -760,6 +2049,11 @@ public:
         
         APRINTER_FUNCTION_IF(Writable, void, clean_up_writability (Context c))
         {
+            // Advance the time again on close, so that anything read while
+            // the file was being written is not mistaken for the final contents.
+            if (this->m_write_ref.isTaken(c) && this->m_modified) {
+                this->m_dir_entry.advanceModTime(c);
+            }
             this->m_write_ref.release(c);
             this->m_dir_entry.reset(c);
         }
@@ -782,6 +2076,9 @@ public:
             else if (Writable && m_state == State::TRUNC_EVENT) {
                 handle_event_trunc(c);
             }
+            else if (m_state == State::SEEK_EVENT) {
+                handle_event_seek(c);
+            }
             else {
                 AMBRO_ASSERT(false);
             }
@@ -794,6 +2091,16 @@ public:
             
             extra_first_cluster_update(c, first_cluster_changed);
             
+            // Keep track of the position of the chain, and feed the seek index.
+            if (m_state != State::TRUNC_CHAIN) {
+                if (!error && !m_chain.endReached(c)) {
+                    seek_index_add(c, m_chain_pos, m_chain.getCurrentCluster(c));
+                    m_chain_pos++;
+                }
+            } else {
+                seek_index_truncate(c, m_chain_pos);
+            }
+            
             if (m_state == State::READ_NEXT_CLUSTER) {
                 handle_chain_read_next(c, error);
             }
@@ -803,11 +2110,33 @@ public:
             else if (Writable && m_state == State::TRUNC_CHAIN) {
                 return complete_request(c, error);
             }
+            else if (m_state == State::SEEK_NEXT_CLUSTER) {
+                handle_chain_seek_next(c, error);
+            }
             else {
                 AMBRO_ASSERT(false);
             }
         }
         
+        APRINTER_FUNCTION_IF(EnableReadHinting, void, ahead_chain_handler (Context c, bool error, bool first_cluster_changed))
+        {
+            TheDebugObject::access(c);
+            AMBRO_ASSERT(this->m_ahead_busy)
+            
+            this->m_ahead_busy = false;
+            
+            if (error) {
+                this->m_ahead_synced = false;
+                return;
+            }
+            if (!this->m_ahead_chain.endReached(c)) {
+                this->m_ahead_chain_pos++;
+            }
+            if (this->m_ahead_synced) {
+                continue_read_ahead(c);
+            }
+        }
+        
         void block_user_block_ref_handler (Context c, bool error)
         {
             auto *o = Object::self(c);
@@ -860,14 +2189,25 @@ public:
                 m_file_size = m_file_pos;
                 this->m_dir_entry.setFileSize(c, m_file_size);
             }
+            mark_modified(c);
             m_block_in_cluster++;
         }
         
+        APRINTER_FUNCTION_IF(Writable, void, mark_modified (Context c))
+        {
+            if (!this->m_modified) {
+                this->m_modified = true;
+                this->m_dir_entry.advanceModTime(c);
+            }
+        }
+        
         typename Context::EventLoop::QueuedEvent m_event;
         ClusterChain<Writable> m_chain;
         FileHandler m_handler;
         uint32_t m_file_size;
         uint32_t m_file_pos;
+        uint32_t m_seek_offset;
+        ClusterIndexType m_chain_pos;
         State m_state;
         IoMode m_io_mode;
         ClusterBlockIndexType m_block_in_cluster;
@@ -895,11 +2235,13 @@ private:
         o->write_block_ref.init(c, APRINTER_CB_STATFUNC_T(&FatFs::write_block_ref_handler<>));
         o->fs_info_block_ref.init(c, APRINTER_CB_STATFUNC_T(&FatFs::fs_info_block_ref_handler<>));
         o->flush_request.init(c, APRINTER_CB_STATFUNC_T(&FatFs::flush_request_handler<>));
+        free_bitmap_init(c);
     }
     
     APRINTER_FUNCTION_IF_OR_EMPTY_EXT(FsWritable, static, void, fs_writable_deinit (Context c))
     {
         auto *o = Object::self(c);
+        free_bitmap_deinit(c);
         o->flush_request.deinit(c);
         o->fs_info_block_ref.deinit(c);
         o->write_block_ref.deinit(c);
@@ -914,6 +2256,8 @@ private:
         o->fs_info_block = fs_info_block;
         o->allocating_chains_list.init();
         o->num_write_references = 0;
+        o->open_files_list.init();
+        o->mod_clock = DosTimeEpoch;
     }
     
     APRINTER_FUNCTION_IF_OR_EMPTY_EXT(FsWritable, static, void, write_block_ref_handler (Context c, bool error))
@@ -1047,6 +2391,7 @@ private:
         auto *o = Object::self(c);
         o->write_block_ref.reset(c);
         o->flush_request.reset(c);
+        free_bitmap_scan_finished(c);
         if (error) {
             o->fs_info_block_ref.reset(c);
             o->write_mount_state = WriteMountState::NOT_MOUNTED;
@@ -1066,6 +2411,7 @@ private:
         } else {
             o->fs_info_block_ref.reset(c);
             o->write_mount_state = WriteMountState::NOT_MOUNTED;
+            free_bitmap_deactivate(c);
         }
         return WriteMountHandler::call(c, error);
     }
@@ -1145,9 +2491,141 @@ private:
         if (alloc_cluster >= 2 && alloc_cluster < 2 + o->num_valid_clusters) {
             o->alloc_position = alloc_cluster - 2;
         }
-        update_fs_dirty_bit(c, &o->write_block_ref, true);
-        o->write_mount_state = WriteMountState::MOUNT_FLUSH;
-        o->flush_request.requestFlush(c);
+        if (free_bitmap_can_cover(c)) {
+            return start_free_bitmap_scan(c);
+        }
+        complete_write_mount_fsinfo(c);
+    }
+    
+    APRINTER_FUNCTION_IF_EXT(FsWritable, static, void, complete_write_mount_fsinfo (Context c))
+    {
+        auto *o = Object::self(c);
+        
+        update_fs_dirty_bit(c, &o->write_block_ref, true);
+        o->write_mount_state = WriteMountState::MOUNT_FLUSH;
+        o->flush_request.requestFlush(c);
+    }
+    
+    APRINTER_FUNCTION_IF_OR_EMPTY_EXT(UseFreeBitmap, static, void, free_bitmap_init (Context c))
+    {
+        auto *o = Object::self(c);
+        o->free_bitmap_scan_ref.init(c, APRINTER_CB_STATFUNC_T(&FatFs::free_bitmap_scan_ref_handler<>));
+        o->free_bitmap_active = false;
+    }
+    
+    APRINTER_FUNCTION_IF_OR_EMPTY_EXT(UseFreeBitmap, static, void, free_bitmap_deinit (Context c))
+    {
+        auto *o = Object::self(c);
+        o->free_bitmap_scan_ref.deinit(c);
+    }
+    
+    APRINTER_FUNCTION_IF_OR_EMPTY_EXT(UseFreeBitmap, static, void, free_bitmap_scan_finished (Context c))
+    {
+        auto *o = Object::self(c);
+        o->free_bitmap_scan_ref.reset(c);
+    }
+    
+    APRINTER_FUNCTION_IF_OR_EMPTY_EXT(UseFreeBitmap, static, void, free_bitmap_deactivate (Context c))
+    {
+        auto *o = Object::self(c);
+        o->free_bitmap_active = false;
+    }
+    
+    APRINTER_FUNCTION_IF_ELSE_EXT(UseFreeBitmap, static, bool, free_bitmap_can_cover (Context c), {
+        auto *o = Object::self(c);
+        return o->num_valid_clusters <= decltype(o->free_bitmap)::Size;
+    }, {
+        return false;
+    })
+    
+    APRINTER_FUNCTION_IF_ELSE_EXT(UseFreeBitmap, static, bool, is_free_bitmap_active (Context c), {
+        auto *o = Object::self(c);
+        return o->free_bitmap_active;
+    }, {
+        return false;
+    })
+    
+    APRINTER_FUNCTION_IF_OR_EMPTY_EXT(UseFreeBitmap, static, void, start_free_bitmap_scan (Context c))
+    {
+        auto *o = Object::self(c);
+        
+        // The free clusters are found by going through the whole FAT once, with
+        // read-ahead. Allocation then needs no searching in the FAT, and the free
+        // cluster count in the FS Information Sector can be set to the exact value.
+        o->free_bitmap.clearAll();
+        o->free_bitmap_active = false;
+        o->free_bitmap_count = 0;
+        o->free_bitmap_scan_cluster = 2;
+        o->free_bitmap_hint_block = 0;
+        o->write_mount_state = WriteMountState::MOUNT_SCAN;
+        continue_free_bitmap_scan(c);
+    }
+    
+    APRINTER_FUNCTION_IF_OR_EMPTY_EXT(UseFreeBitmap, static, void, continue_free_bitmap_scan (Context c))
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(o->write_mount_state == WriteMountState::MOUNT_SCAN)
+        
+        ClusterIndexType end_cluster = 2 + o->num_valid_clusters;
+        
+        while (o->free_bitmap_scan_cluster < end_cluster) {
+            ClusterIndexType cluster = o->free_bitmap_scan_cluster;
+            if (!request_fat_cache_block(c, &o->free_bitmap_scan_ref, cluster, false)) {
+                BlockIndexType block = get_abs_block_index_for_fat_entry(c, cluster);
+                BlockIndexType end_block = get_abs_block_index_for_fat_entry(c, end_cluster - 1) + 1;
+                BlockIndexType hint_block = MaxValue(o->free_bitmap_hint_block, (BlockIndexType)(block + 1));
+                if (hint_block < end_block) {
+                    BlockIndexType num_blocks_per_fat = o->num_fat_entries / FatEntriesPerBlock;
+                    o->free_bitmap_hint_block = TheBlockCache::hintBlocks(c, block, hint_block, end_block, num_blocks_per_fat, o->num_fats);
+                }
+                return;
+            }
+            
+            ClusterIndexType block_end_cluster = MinValue(end_cluster, (ClusterIndexType)((cluster / FatEntriesPerBlock + 1) * FatEntriesPerBlock));
+            for (; cluster < block_end_cluster; cluster++) {
+                if (read_fat_entry_in_cache_block(c, &o->free_bitmap_scan_ref, cluster) == FreeClusterMarker) {
+                    o->free_bitmap.set(cluster - 2, true);
+                    o->free_bitmap_count++;
+                }
+            }
+            o->free_bitmap_scan_cluster = cluster;
+        }
+        
+        o->free_bitmap_scan_ref.reset(c);
+        o->free_bitmap_active = true;
+        
+        char *buffer = o->fs_info_block_ref.getData(c, WrapBool<true>());
+        WriteBinaryInt<uint32_t, BinaryLittleEndian>(o->free_bitmap_count, buffer + FsInfoFreeClustersOffset);
+        o->fs_info_block_ref.markDirty(c);
+        
+        complete_write_mount_fsinfo(c);
+    }
+    
+    APRINTER_FUNCTION_IF_OR_EMPTY_EXT(UseFreeBitmap, static, void, free_bitmap_scan_ref_handler (Context c, bool error))
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        AMBRO_ASSERT(o->state == FsState::READY)
+        AMBRO_ASSERT(o->write_mount_state == WriteMountState::MOUNT_SCAN)
+        
+        if (error) {
+            return complete_write_mount_request(c, true);
+        }
+        continue_free_bitmap_scan(c);
+    }
+    
+    APRINTER_FUNCTION_IF_OR_EMPTY_EXT(UseFreeBitmap, static, void, free_bitmap_update (Context c, ClusterIndexType cluster_index, bool is_free))
+    {
+        auto *o = Object::self(c);
+        
+        if (o->free_bitmap_active && o->free_bitmap.get(cluster_index - 2) != is_free) {
+            o->free_bitmap.set(cluster_index - 2, is_free);
+            if (is_free) {
+                o->free_bitmap_count++;
+            } else {
+                o->free_bitmap_count--;
+            }
+        }
     }
     
     APRINTER_FUNCTION_IF_EXT(FsWritable, static, void, write_unmount_metablock_ref_handler (Context c, bool error))
@@ -1248,6 +2726,7 @@ private:
             return false;
         }
         update_fat_entry_in_cache_block(c, block_ref, cluster_index, FreeClusterMarker);
+        free_bitmap_update(c, cluster_index, true);
         update_fs_info_free_clusters(c, true);
         return true;
     }
@@ -1287,6 +2766,126 @@ private:
         WriteBinaryInt<uint16_t, BinaryLittleEndian>(value >> 16, entry_ptr + 0x14);
     }
     
+    // Returns the DOS date/time two seconds after the given one. Days are
+    // wrapped at 28 and invalid fields are fixed, so that the result is
+    // always a valid date.
+    static uint32_t next_dos_time (uint32_t value)
+    {
+        uint8_t secs2 = (value >>  0) & 0x1F;
+        uint8_t mins  = (value >>  5) & 0x3F;
+        uint8_t hours = (value >> 11) & 0x1F;
+        uint8_t day   = (value >> 16) & 0x1F;
+        uint8_t month = (value >> 21) & 0xF;
+        uint8_t year  = (value >> 25) & 0x7F;
+        
+        if (day == 0 || month == 0 || month > 12) {
+            day = MaxValue((uint8_t)1, MinValue(day, (uint8_t)28));
+            month = MaxValue((uint8_t)1, MinValue(month, (uint8_t)12));
+        }
+        
+        if (++secs2 > 29) {
+            secs2 = 0;
+            if (++mins > 59) {
+                mins = 0;
+                if (++hours > 23) {
+                    hours = 0;
+                    if (++day > 28) {
+                        day = 1;
+                        if (++month > 12) {
+                            month = 1;
+                            year = (year + 1) & 0x7F;
+                        }
+                    }
+                }
+            }
+        }
+        
+        return ((uint32_t)secs2 << 0) | ((uint32_t)mins << 5) | ((uint32_t)hours << 11) |
+               ((uint32_t)day << 16) | ((uint32_t)month << 21) | ((uint32_t)year << 25);
+    }
+    
+    static void write_dir_entry_times (char *entry_ptr, uint32_t time)
+    {
+        WriteBinaryInt<uint32_t, BinaryLittleEndian>(time, entry_ptr + DirEntryCreateTimeOffset);
+        WriteBinaryInt<uint16_t, BinaryLittleEndian>(time >> 16, entry_ptr + DirEntryAccessDateOffset);
+        WriteBinaryInt<uint32_t, BinaryLittleEndian>(time, entry_ptr + DirEntryModTimeOffset);
+    }
+    
+    APRINTER_FUNCTION_IF_OR_EMPTY_EXT(FsWritable, static, void, observe_mod_time (Context c, uint32_t mod_time))
+    {
+        auto *o = Object::self(c);
+        if (mod_time > o->mod_clock) {
+            o->mod_clock = mod_time;
+        }
+    }
+    
+    // Advances the logical clock past both the given time and any time seen
+    // so far, and returns the new time (see FsEntry::getModTime).
+    APRINTER_FUNCTION_IF_EXT(FsWritable, static, uint32_t, take_mod_time (Context c, uint32_t mod_time))
+    {
+        auto *o = Object::self(c);
+        o->mod_clock = next_dos_time(MaxValue(mod_time, o->mod_clock));
+        return o->mod_clock;
+    }
+    
+    static bool compare_filename_equal (char const *str1, char const *str2, size_t str2_len)
+    {
+        return Params::CaseInsens ? AsciiCaseInsensStringEqualToMem(str1, str2, str2_len) : (strlen(str1) == str2_len && !memcmp(str1, str2, str2_len));
+    }
+    
+    static uint8_t vfat_checksum (char const *data)
+    {
+        uint8_t csum = 0;
+        for (auto i : LoopRange<int>(11)) {
+            csum = (uint8_t)((uint8_t)((csum & 1) << 7) + (csum >> 1)) + (uint8_t)data[i];
+        }
+        return csum;
+    }
+    
+    static size_t fixup_83_name (char *data, size_t length, bool lowercase)
+    {
+        while (length > 0 && data[length - 1] == ' ') {
+            length--;
+        }
+        if (lowercase) {
+            for (auto i : LoopRange<size_t>(length)) {
+                if (data[i] >= 'A' && data[i] <= 'Z') {
+                    data[i] += 32;
+                }
+            }
+        }
+        return length;
+    }
+    
+    // Formats the 8.3 name of a directory entry as a null-terminated string.
+    // The output buffer must have space for 13 characters.
+    static size_t format_short_name (char const *entry_ptr, char *out)
+    {
+        uint8_t type_byte = ReadBinaryInt<uint8_t, BinaryLittleEndian>(entry_ptr + 0xC);
+        
+        char name_temp[8];
+        memcpy(name_temp, entry_ptr + 0, 8);
+        if (name_temp[0] == 0x5) {
+            name_temp[0] = 0xE5;
+        }
+        size_t name_len = fixup_83_name(name_temp, 8, bool(type_byte & 0x8));
+        
+        char ext_temp[3];
+        memcpy(ext_temp, entry_ptr + 8, 3);
+        size_t ext_len = fixup_83_name(ext_temp, 3, bool(type_byte & 0x10));
+        
+        size_t filename_len = 0;
+        memcpy(out + filename_len, name_temp, name_len);
+        filename_len += name_len;
+        if (ext_len > 0) {
+            out[filename_len++] = '.';
+            memcpy(out + filename_len, ext_temp, ext_len);
+            filename_len += ext_len;
+        }
+        out[filename_len] = '\0';
+        return filename_len;
+    }
+    
     static bool get_fs_dirty_bit (Context c, CacheBlockRef *block_ref)
     {
         char const *status_bits_ptr = block_ref->getData(c, WrapBool<false>()) + EbpbStatusBitsOffset;
@@ -1322,6 +2921,11 @@ private:
         auto *o = Object::self(c);
         
         char *buffer = o->fs_info_block_ref.getData(c, WrapBool<true>());
+        if (is_free_bitmap_active(c)) {
+            WriteBinaryInt<uint32_t, BinaryLittleEndian>(get_free_bitmap_count(c), buffer + FsInfoFreeClustersOffset);
+            o->fs_info_block_ref.markDirty(c);
+            return;
+        }
         uint32_t free_clusters = ReadBinaryInt<uint32_t, BinaryLittleEndian>(buffer + FsInfoFreeClustersOffset);
         if (free_clusters <= o->num_valid_clusters) {
             if (inc_else_dec) {
@@ -1396,6 +3000,10 @@ private:
         AMBRO_ASSERT(o->alloc_state == AllocationState::CHECK_EVENT)
         AMBRO_ASSERT(o->write_mount_state == WriteMountState::MOUNTED)
         
+        if (is_free_bitmap_active(c)) {
+            return allocate_using_free_bitmap(c);
+        }
+        
         while (true) {
             ClusterIndexType current_cluster = 2 + o->alloc_position;
             
@@ -1423,6 +3031,66 @@ private:
         }
     }
     
+    APRINTER_FUNCTION_IF_ELSE_EXT(UseFreeBitmap, static, ClusterIndexType, get_free_bitmap_count (Context c), {
+        auto *o = Object::self(c);
+        return o->free_bitmap_count;
+    }, {
+        return 0;
+    })
+    
+    APRINTER_FUNCTION_IF_OR_EMPTY_EXT(UseFreeBitmap, static, void, allocate_using_free_bitmap (Context c))
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(o->free_bitmap_active)
+        AMBRO_ASSERT(!o->allocating_chains_list.isEmpty())
+        
+        // Prefer the cluster following the last cluster of the chain being
+        // extended, so that files which are written sequentially come out
+        // contiguous even when several are being written at the same time.
+        ClusterIndexType prev_cluster = o->allocating_chains_list.first()->m_prev_cluster;
+        
+        while (true) {
+            ClusterIndexType cluster_pos;
+            if (is_cluster_idx_valid_for_data(c, prev_cluster) && prev_cluster - 2 + 1 < o->num_valid_clusters &&
+                o->free_bitmap.get(prev_cluster - 2 + 1))
+            {
+                cluster_pos = prev_cluster - 2 + 1;
+            } else {
+                cluster_pos = o->free_bitmap.findSet(o->alloc_position, o->num_valid_clusters);
+                if (cluster_pos == o->num_valid_clusters) {
+                    cluster_pos = o->free_bitmap.findSet(0, o->alloc_position);
+                    if (cluster_pos == o->alloc_position) {
+                        return complete_allocation(c, true);
+                    }
+                }
+            }
+            ClusterIndexType current_cluster = 2 + cluster_pos;
+            
+            if (!request_fat_cache_block(c, &o->write_block_ref, current_cluster, false)) {
+                o->alloc_state = AllocationState::REQUESTING_BLOCK;
+                return;
+            }
+            
+            ClusterIndexType fat_value = read_fat_entry_in_cache_block(c, &o->write_block_ref, current_cluster);
+            if (fat_value != FreeClusterMarker) {
+                // The cluster was allocated behind our back, correct the bitmap.
+                free_bitmap_update(c, current_cluster, false);
+                continue;
+            }
+            
+            o->alloc_position = cluster_pos + 1;
+            if (o->alloc_position == o->num_valid_clusters) {
+                o->alloc_position = 0;
+            }
+            
+            update_fat_entry_in_cache_block(c, &o->write_block_ref, current_cluster, EndOfChainMarker);
+            free_bitmap_update(c, current_cluster, false);
+            update_fs_info_free_clusters(c, false);
+            update_fs_info_allocated_cluster(c);
+            return complete_allocation(c, false, current_cluster);
+        }
+    }
+    
     APRINTER_FUNCTION_IF_EXT(FsWritable, static, void, alloc_block_ref_handler (Context c, bool error))
     {
         auto *o = Object::self(c);
@@ -1435,6 +3103,17 @@ private:
         o->alloc_event.prependNowNotAlready(c);
     }
     
+    APRINTER_FUNCTION_IF_EXT(FsWritable, static, bool, is_file_open (Context c, BlockIndexType dir_entry_block_index, DirEntriesPerBlockType dir_entry_block_offset))
+    {
+        auto *o = Object::self(c);
+        for (OpenFileNode *node = o->open_files_list.first(); node; node = o->open_files_list.next(node)) {
+            if (node->dir_entry_block_index == dir_entry_block_index && node->dir_entry_block_offset == dir_entry_block_offset) {
+                return true;
+            }
+        }
+        return false;
+    }
+    
     APRINTER_FUNCTION_IF_OR_EMPTY_EXT(FsWritable, static, void, set_fs_entry_extra (FsEntry *entry, BlockIndexType dir_entry_block_index, DirEntriesPerBlockType dir_entry_block_offset))
     {
         entry->dir_entry_block_index = dir_entry_block_index;
@@ -1450,6 +3129,7 @@ private:
     template <bool Writable>
     class ClusterChain : public ClusterChainExtraMembers<Writable> {
         static_assert(!Writable || FsWritable, "");
+        friend FatFs;
         
         enum class State : uint8_t {
             IDLE,
@@ -1490,6 +3170,17 @@ private:
             rewind_internal(c);
         }
         
+        // Continues the iteration at the given cluster of this chain, as if it
+        // had been reached by requestNext.
+        void jumpTo (Context c, ClusterIndexType cluster)
+        {
+            AMBRO_ASSERT(m_state == State::IDLE)
+            AMBRO_ASSERT(is_cluster_idx_normal(cluster))
+            
+            m_iter_state = IterState::CLUSTER;
+            m_current_cluster = cluster;
+        }
+        
         void requestNext (Context c)
         {
             AMBRO_ASSERT(m_state == State::IDLE)
@@ -1790,6 +3481,16 @@ private:
             m_block_ref.markDirty(c);
         }
         
+        void advanceModTime (Context c)
+        {
+            AMBRO_ASSERT(m_state == State::READY)
+            
+            char *buffer = get_entry_ptr<true>(c);
+            uint32_t mod_time = ReadBinaryInt<uint32_t, BinaryLittleEndian>(buffer + DirEntryModTimeOffset);
+            WriteBinaryInt<uint32_t, BinaryLittleEndian>(take_mod_time(c, mod_time), buffer + DirEntryModTimeOffset);
+            m_block_ref.markDirty(c);
+        }
+        
     private:
         void block_ref_handler (Context c, bool error)
         {
@@ -1895,6 +3596,7 @@ private:
             uint8_t type_byte =     ReadBinaryInt<uint8_t, BinaryLittleEndian>(entry_ptr + 0xC);
             uint8_t checksum_byte = ReadBinaryInt<uint8_t, BinaryLittleEndian>(entry_ptr + 0xD);
             uint32_t file_size =    ReadBinaryInt<uint32_t, BinaryLittleEndian>(entry_ptr + DirEntrySizeOffset);
+            uint32_t mod_time =     ReadBinaryInt<uint32_t, BinaryLittleEndian>(entry_ptr + DirEntryModTimeOffset);
             
             if (first_byte == 0) {
                 return complete_request(c, false);
@@ -1973,33 +3675,16 @@ private:
                 filename = m_filename + m_filename_pos;
                 m_filename[Params::MaxFileNameSize] = 0;
             } else {
-                char name_temp[8];
-                memcpy(name_temp, entry_ptr + 0, 8);
-                if (name_temp[0] == 0x5) {
-                    name_temp[0] = 0xE5;
-                }
-                size_t name_len = fixup_83_name(name_temp, 8, bool(type_byte & 0x8));
-                
-                char ext_temp[3];
-                memcpy(ext_temp, entry_ptr + 8, 3);
-                size_t ext_len = fixup_83_name(ext_temp, 3, bool(type_byte & 0x10));
-                
-                size_t filename_len = 0;
-                memcpy(m_filename + filename_len, name_temp, name_len);
-                filename_len += name_len;
-                if (ext_len > 0) {
-                    m_filename[filename_len++] = '.';
-                    memcpy(m_filename + filename_len, ext_temp, ext_len);
-                    filename_len += ext_len;
-                }
-                m_filename[filename_len] = '\0';
+                format_short_name(entry_ptr, m_filename);
                 filename = m_filename;
             }
             
             FsEntry entry;
             entry.type = is_dir ? EntryType::DIR_TYPE : EntryType::FILE_TYPE;
             entry.file_size = file_size;
+            entry.mod_time = mod_time;
             entry.cluster_index = first_cluster;
+            observe_mod_time(c, mod_time);
             set_fs_entry_extra(&entry,
                 get_cluster_data_block_index(c, m_chain.getCurrentCluster(c), m_block_in_cluster - 1),
                 m_block_entry_pos - 1);
@@ -2030,41 +3715,250 @@ private:
             schedule_event(c);
         }
         
-        static uint8_t vfat_checksum (char const *data)
+        typename Context::EventLoop::QueuedEvent m_event;
+        ClusterChain<false> m_chain;
+        CacheBlockRef m_dir_block_ref;
+        DirectoryIteratorHandler m_handler;
+        ClusterBlockIndexType m_block_in_cluster;
+        DirEntriesPerBlockType m_block_entry_pos;
+        State m_state;
+        int8_t m_vfat_seq;
+        uint8_t m_vfat_csum;
+        FileNameLenType m_filename_pos;
+        char m_filename[Params::MaxFileNameSize + 1];
+    };
+    
+    struct DirEntryPos {
+        ClusterIndexType cluster;
+        ClusterBlockIndexType block_in_cluster;
+        DirEntriesPerBlockType entry;
+    };
+    
+    class DirCursor {
+        static_assert(FsWritable, "");
+        
+        enum class State : uint8_t {IDLE, NEXT_EVENT, POS_EVENT, REQUESTING_CLUSTER, ALLOCATING_CLUSTER, ZEROING_BLOCK, REQUESTING_BLOCK};
+        
+    public:
+        using DirCursorHandler = Callback<void(Context c, bool error)>;
+        
+        void init (Context c, ClusterIndexType first_cluster, DirCursorHandler handler)
+        {
+            auto *o = Object::self(c);
+            
+            m_event.init(c, APRINTER_CB_OBJFUNC_T(&DirCursor::event_handler, this));
+            m_chain.init(c, first_cluster, APRINTER_CB_OBJFUNC_T(&DirCursor::chain_handler, this));
+            m_block_ref.init(c, APRINTER_CB_OBJFUNC_T(&DirCursor::block_ref_handler, this));
+            
+            m_handler = handler;
+            m_state = State::IDLE;
+            m_block_in_cluster = o->blocks_per_cluster - 1;
+            m_entry = DirEntriesPerBlock - 1;
+            m_at_end = false;
+        }
+        
+        void deinit (Context c)
+        {
+            m_block_ref.deinit(c);
+            m_chain.deinit(c);
+            m_event.deinit(c);
+        }
+        
+        // Moves to the next entry. When the end of the directory is reached,
+        // a new zeroed cluster is appended if extend is true, otherwise
+        // isEnd will return true.
+        void requestNext (Context c, bool extend)
+        {
+            AMBRO_ASSERT(m_state == State::IDLE)
+            
+            m_extend = extend;
+            m_state = State::NEXT_EVENT;
+            m_event.prependNowNotAlready(c);
+        }
+        
+        // Moves to an entry whose position was obtained by getPos.
+        void requestPos (Context c, DirEntryPos pos)
+        {
+            AMBRO_ASSERT(m_state == State::IDLE)
+            
+            m_chain.jumpTo(c, pos.cluster);
+            m_block_in_cluster = pos.block_in_cluster;
+            m_entry = pos.entry;
+            m_at_end = false;
+            m_state = State::POS_EVENT;
+            m_event.prependNowNotAlready(c);
+        }
+        
+        bool isEnd (Context c)
+        {
+            AMBRO_ASSERT(m_state == State::IDLE)
+            
+            return m_at_end;
+        }
+        
+        DirEntryPos getPos (Context c)
+        {
+            AMBRO_ASSERT(m_state == State::IDLE)
+            AMBRO_ASSERT(!m_at_end)
+            
+            return DirEntryPos{m_chain.getCurrentCluster(c), m_block_in_cluster, m_entry};
+        }
+        
+        template <bool ForWriting>
+        If<ForWriting, char, char const> * getEntry (Context c)
+        {
+            AMBRO_ASSERT(m_state == State::IDLE)
+            AMBRO_ASSERT(!m_at_end)
+            
+            return m_block_ref.getData(c, WrapBool<ForWriting>()) + ((size_t)m_entry * 32);
+        }
+        
+        void markDirty (Context c)
+        {
+            AMBRO_ASSERT(m_state == State::IDLE)
+            AMBRO_ASSERT(!m_at_end)
+            
+            m_block_ref.markDirty(c);
+        }
+        
+        ClusterIndexType getFirstCluster (Context c)
+        {
+            AMBRO_ASSERT(m_state == State::IDLE)
+            
+            return m_chain.getFirstCluster(c);
+        }
+        
+    private:
+        void complete_request (Context c, bool error)
+        {
+            m_state = State::IDLE;
+            return m_handler(c, error);
+        }
+        
+        void event_handler (Context c)
         {
-            uint8_t csum = 0;
-            for (auto i : LoopRange<int>(11)) {
-                csum = (uint8_t)((uint8_t)((csum & 1) << 7) + (csum >> 1)) + (uint8_t)data[i];
+            auto *o = Object::self(c);
+            TheDebugObject::access(c);
+            
+            if (m_state == State::POS_EVENT) {
+                return request_block(c);
+            }
+            
+            AMBRO_ASSERT(m_state == State::NEXT_EVENT)
+            
+            if (m_at_end) {
+                if (!m_extend) {
+                    return complete_request(c, false);
+                }
+                m_at_end = false;
+                m_state = State::ALLOCATING_CLUSTER;
+                m_chain.requestNew(c);
+                return;
+            }
+            
+            if ((size_t)m_entry + 1 < DirEntriesPerBlock) {
+                m_entry++;
+                return complete_request(c, false);
+            }
+            m_entry = 0;
+            
+            if (m_block_in_cluster + 1 < o->blocks_per_cluster) {
+                m_block_in_cluster++;
+                return request_block(c);
             }
-            return csum;
+            m_block_in_cluster = 0;
+            
+            m_block_ref.reset(c);
+            m_state = State::REQUESTING_CLUSTER;
+            m_chain.requestNext(c);
         }
         
-        static size_t fixup_83_name (char *data, size_t length, bool lowercase)
+        void chain_handler (Context c, bool error, bool first_cluster_changed)
         {
-            while (length > 0 && data[length - 1] == ' ') {
-                length--;
+            TheDebugObject::access(c);
+            AMBRO_ASSERT(m_state == State::REQUESTING_CLUSTER || m_state == State::ALLOCATING_CLUSTER)
+            
+            if (error) {
+                return complete_request(c, true);
             }
-            if (lowercase) {
-                for (auto i : LoopRange<size_t>(length)) {
-                    if (data[i] >= 'A' && data[i] <= 'Z') {
-                        data[i] += 32;
+            
+            if (m_state == State::REQUESTING_CLUSTER) {
+                if (m_chain.endReached(c)) {
+                    m_at_end = true;
+                    if (!m_extend) {
+                        return complete_request(c, false);
                     }
+                    m_at_end = false;
+                    m_state = State::ALLOCATING_CLUSTER;
+                    m_chain.requestNew(c);
+                    return;
+                }
+                return request_block(c);
+            }
+            
+            if (!is_cluster_idx_valid_for_data(c, m_chain.getCurrentCluster(c))) {
+                return complete_request(c, true);
+            }
+            
+            // A new cluster of a directory must not contain stale entries.
+            m_zero_block = 0;
+            zero_blocks(c);
+        }
+        
+        void zero_blocks (Context c)
+        {
+            auto *o = Object::self(c);
+            
+            while (m_zero_block < o->blocks_per_cluster) {
+                BlockIndexType abs_block_idx = get_cluster_data_abs_block_index(c, m_chain.getCurrentCluster(c), m_zero_block);
+                if (!m_block_ref.requestBlock(c, abs_block_idx, 0, 1, CacheBlockRef::FLAG_NO_NEED_TO_READ)) {
+                    m_state = State::ZEROING_BLOCK;
+                    return;
                 }
+                memset(m_block_ref.getData(c, WrapBool<true>()), 0, BlockSize);
+                m_block_ref.markDirty(c);
+                m_zero_block++;
+            }
+            
+            request_block(c);
+        }
+        
+        void request_block (Context c)
+        {
+            if (!is_cluster_idx_valid_for_data(c, m_chain.getCurrentCluster(c))) {
+                return complete_request(c, true);
+            }
+            
+            BlockIndexType abs_block_idx = get_cluster_data_abs_block_index(c, m_chain.getCurrentCluster(c), m_block_in_cluster);
+            if (!m_block_ref.requestBlock(c, abs_block_idx, 0, 1, 0)) {
+                m_state = State::REQUESTING_BLOCK;
+                return;
+            }
+            
+            return complete_request(c, false);
+        }
+        
+        void block_ref_handler (Context c, bool error)
+        {
+            TheDebugObject::access(c);
+            AMBRO_ASSERT(m_state == State::REQUESTING_BLOCK || m_state == State::ZEROING_BLOCK)
+            
+            if (error || m_state == State::REQUESTING_BLOCK) {
+                return complete_request(c, error);
             }
-            return length;
+            zero_blocks(c);
         }
         
         typename Context::EventLoop::QueuedEvent m_event;
-        ClusterChain<false> m_chain;
-        CacheBlockRef m_dir_block_ref;
-        DirectoryIteratorHandler m_handler;
+        ClusterChain<true> m_chain;
+        CacheBlockRef m_block_ref;
+        DirCursorHandler m_handler;
         ClusterBlockIndexType m_block_in_cluster;
-        DirEntriesPerBlockType m_block_entry_pos;
+        ClusterBlockIndexType m_zero_block;
+        DirEntriesPerBlockType m_entry;
         State m_state;
-        int8_t m_vfat_seq;
-        uint8_t m_vfat_csum;
-        FileNameLenType m_filename_pos;
-        char m_filename[Params::MaxFileNameSize + 1];
+        bool m_extend;
+        bool m_at_end;
     };
     
     template <bool Writable>
@@ -2126,13 +4020,24 @@ private:
         ClusterIndexType alloc_position;
         ClusterIndexType alloc_start;
         size_t num_write_references;
+        DoubleEndedList<OpenFileNode, &OpenFileNode::list_node, false> open_files_list;
+        uint32_t mod_clock;
+    };
+    
+    APRINTER_STRUCT_IF_TEMPLATE(FsFreeBitmapMembers) {
+        IndexBitmap<ClusterIndexType, Params::FreeBitmapClusters> free_bitmap;
+        CacheBlockRef free_bitmap_scan_ref;
+        ClusterIndexType free_bitmap_count;
+        ClusterIndexType free_bitmap_scan_cluster;
+        BlockIndexType free_bitmap_hint_block;
+        bool free_bitmap_active;
     };
     
 public:
     struct Object : public ObjBase<FatFs, ParentObject, MakeTypeList<
         TheDebugObject,
         TheBlockCache
-    >>, public FsWritableMembers<FsWritable> {
+    >>, public FsWritableMembers<FsWritable>, public FsFreeBitmapMembers<UseFreeBitmap> {
         BlockRange<BlockIndexType> block_range;
         FsState state;
         union {
@@ -2156,7 +4061,11 @@ APRINTER_ALIAS_STRUCT_EXT(FatFsService, (
     APRINTER_AS_VALUE(int, MaxIoBlocks),
     APRINTER_AS_VALUE(bool, CaseInsens),
     APRINTER_AS_VALUE(bool, Writable),
-    APRINTER_AS_VALUE(bool, EnableReadHinting)
+    APRINTER_AS_VALUE(bool, EnableReadHinting),
+    APRINTER_AS_VALUE(int, SeekIndexEntries),
+    APRINTER_AS_VALUE(uint32_t, FreeBitmapClusters),
+    APRINTER_AS_VALUE(int, WriteBehindDirtyCount),
+    APRINTER_AS_TYPE(WriteBehindDelay)
 ), (
     APRINTER_ALIAS_STRUCT_EXT(Fs, (
         APRINTER_AS_TYPE(Context),
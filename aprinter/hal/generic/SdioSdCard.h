@@ -108,6 +108,7 @@ public:
     using DataWordType = uint32_t;
     static size_t const MaxIoBlocks = TheSdio::MaxIoBlocks;
     static int const MaxIoDescriptors = TheSdio::MaxIoDescriptors;
+    static int const MaxConcurrentCommands = 1;
     
     static void init (Context c)
     {
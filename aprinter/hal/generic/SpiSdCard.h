@@ -78,6 +78,7 @@ public:
     using DataWordType = uint8_t;
     static size_t const MaxIoBlocks = 1;
     static int const MaxIoDescriptors = 1;
+    static int const MaxConcurrentCommands = 1;
     
     static void init (Context c)
     {
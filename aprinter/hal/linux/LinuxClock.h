@@ -31,6 +31,8 @@
 #include <unistd.h>
 #include <sys/timerfd.h>
 
+#include <atomic>
+
 #include <aprinter/platform/linux/linux_support.h>
 #include <aprinter/base/Object.h>
 #include <aprinter/meta/ServiceUtils.h>
@@ -48,6 +50,27 @@ namespace APrinter {
 template <typename>
 class LinuxClockInterruptTimer;
 
+/**
+ * Clock and interrupt timers for the Linux port.
+ * 
+ * Timer handlers are called from a dedicated (RT) thread, with the
+ * interrupt_mutex held so that they are atomic with respect to code
+ * using InterruptLock. Active timers are kept in a binary heap by
+ * expiration time. The thread arms a timerfd for the earliest expiration
+ * and only re-arms it when that changes; expirations closer than
+ * ShortWaitNsec are busy-waited for instead, which avoids any system
+ * calls when stepping at high rates. Starting a timer only arms the
+ * timerfd if the timer expires before the currently armed time.
+ * 
+ * With --rt-spin (which requires --rt-affinity, the core should be
+ * isolated), the thread never sleeps but polls the earliest expiration
+ * without taking the lock, and dispatches handlers as soon as they are
+ * due. No system calls are made at all in this mode.
+ * 
+ * Times are compared modulo 2^32, so all active timers must be set
+ * within half the clock range of each other.
+ */
+
 template <typename Arg>
 class LinuxClock {
     APRINTER_USE_TYPE1(Arg, Context)
@@ -63,6 +86,8 @@ class LinuxClock {
     static int const NanosShift = 63 - SubSecondBits;
     static uint64_t const NanosMul = PowerOfTwo<uint64_t, SubSecondBits+NanosShift>::Value / NsecInSec;
     static uint32_t const SubSecondMask = PowerOfTwoMinusOne<uint32_t, SubSecondBits>::Value;
+    static long const ShortWaitNsec = 20000;
+    static int8_t const NotInHeap = -1;
     
     template <typename> friend class LinuxClockInterruptTimer;
     
@@ -79,6 +104,8 @@ private:
     using TheClockUtils = ClockUtilsForClock<LinuxClock>;
     using TheDebugObject = DebugObject<Context, Object>;
     
+    static TimeType const ShortWaitTicks = ShortWaitNsec * (time_freq / NsecInSec);
+    
 public:
     static void init (Context c)
     {
@@ -87,7 +114,14 @@ public:
         for (auto i : LoopRangeAuto(MaxTimers)) {
             o->m_timer_active[i] = false;
             o->m_timer_handler[i] = nullptr;
+            o->m_heap_pos[i] = NotInHeap;
         }
+        o->m_heap_size = 0;
+        o->m_next_valid = false;
+        o->m_next_time = 0;
+        o->m_armed = false;
+        o->m_spin = cmdline_options.rt_spin;
+        o->m_dispatching = false;
         
         o->m_timer_fd = ::timerfd_create(CLOCK_MONOTONIC, 0);
         AMBRO_ASSERT_FORCE(o->m_timer_fd >= 0)
@@ -119,6 +153,19 @@ public:
         return timespecToTime(getTimespec(c));
     }
     
+    // When called from a timer handler, returns the time the timer was
+    // set for. This is used to trace how late the handlers run.
+    static bool getDispatchTime (AtomicContext<Context> c, TimeType *out_time)
+    {
+        auto *o = Object::self(c);
+        
+        if (!o->m_dispatching) {
+            return false;
+        }
+        *out_time = o->m_dispatch_time;
+        return true;
+    }
+    
 public:
     static void assert_timespec (struct timespec ts)
     {
@@ -169,76 +216,239 @@ private:
         auto *o = Object::self(c);
         
         while (true) {
-            // Wait for the timerfd to expire.
-            uint64_t expire_count = 0;
-            ssize_t read_res = ::read(o->m_timer_fd, &expire_count, sizeof(expire_count));
-            AMBRO_ASSERT_FORCE(read_res == sizeof(expire_count))
-            AMBRO_ASSERT_FORCE(expire_count > 0)
+            // Wait until the earliest timer may have expired.
+            bool woken = wait_for_timer(c);
             
             // Get the current time.
             struct timespec now_ts = getTimespec(c);
             TimeType now = timespecToTime(now_ts);
             
             AMBRO_LOCK_T(InterruptTempLock(), c, lock_c) {
-                // Call handlers for all expired timers.
-                for (auto i : LoopRangeAuto(MaxTimers)) {
-                    if (o->m_timer_active[i] && TheClockUtils::timeGreaterOrEqual(now, o->m_timer_time[i])) {
-                        o->m_timer_handler[i](lock_c);
-                    }
+                if (woken) {
+                    o->m_armed = false;
                 }
                 
-                // Arm (or disarm) the timerfd according to the latest timer states.
-                configure_timerfd(lock_c, now_ts, now);
+                // Call handlers for all expired timers.
+                dispatch_expired(lock_c, now);
+                
+                // Arm the timerfd for the next expiration if needed.
+                if (!o->m_spin) {
+                    rearm_timerfd(lock_c, now_ts, now);
+                }
             }
         }
     }
     
-    static void configure_timerfd (AtomicContext<Context> c, struct timespec now_ts, TimeType now)
+    // Returns whether the timerfd expired, as opposed to the thread
+    // busy-waiting for the earliest timer.
+    static bool wait_for_timer (Context c)
     {
         auto *o = Object::self(c);
         
-        bool have_first_time = false;
-        TimeType first_time;
+        while (true) {
+            bool next_valid = o->m_next_valid.load(std::memory_order_acquire);
+            TimeType next_time = o->m_next_time.load(std::memory_order_relaxed);
         
-        for (auto i : LoopRangeAuto(MaxTimers)) {
-            if (o->m_timer_active[i]) {
-                TimeType tmr_time = o->m_timer_time[i];
-                if (!TheClockUtils::timeGreaterOrEqual(tmr_time, now)) {
-                    have_first_time = true;
-                    first_time = now;
-                    break;
+            if (next_valid) {
+                TimeType now = timespecToTime(getTimespec(c));
+                if (TheClockUtils::timeGreaterOrEqual(now, next_time)) {
+                    return false;
                 }
-                if (!have_first_time || !TheClockUtils::timeGreaterOrEqual(tmr_time, first_time)) {
-                    have_first_time = true;
-                    first_time = tmr_time;
+                if (o->m_spin || TheClockUtils::timeDifference(next_time, now) <= ShortWaitTicks) {
+                    LinuxCpuRelax();
+                    continue;
                 }
             }
+            else if (o->m_spin) {
+                LinuxCpuRelax();
+                continue;
+            }
+            
+            // Wait for the timerfd to expire.
+            uint64_t expire_count = 0;
+            ssize_t read_res = ::read(o->m_timer_fd, &expire_count, sizeof(expire_count));
+            AMBRO_ASSERT_FORCE(read_res == sizeof(expire_count))
+            AMBRO_ASSERT_FORCE(expire_count > 0)
+            return true;
         }
+    }
+    
+    static void dispatch_expired (AtomicContext<Context> c, TimeType now)
+    {
+        auto *o = Object::self(c);
         
-        struct itimerspec itspec = {};
-        if (have_first_time) {
-            TimeType time_from_now = TheClockUtils::timeDifference(first_time, now);
-            itspec.it_value = addTimeToTimespec(now_ts, time_from_now);
+        // Take all expired timers out of the heap before calling any handlers,
+        // so that each is called once per pass even if its handler sets a time
+        // which has already passed, and the lock is released in between.
+        int8_t expired[MaxTimers];
+        int num_expired = 0;
+        while (o->m_heap_size > 0 && TheClockUtils::timeGreaterOrEqual(now, o->m_timer_time[o->m_heap[0]])) {
+            int8_t i = o->m_heap[0];
+            heap_remove(c, i);
+            expired[num_expired++] = i;
         }
         
-        int res = ::timerfd_settime(o->m_timer_fd, TFD_TIMER_ABSTIME, &itspec, nullptr);
-        AMBRO_ASSERT_FORCE(res == 0)
+        for (auto k : LoopRangeAuto(num_expired)) {
+            int8_t i = expired[k];
+            
+            // Skip timers unset (or unset and started again) by earlier handlers.
+            if (!o->m_timer_active[i] || o->m_heap_pos[i] != NotInHeap) {
+                continue;
+            }
+            
+            o->m_dispatching = true;
+            o->m_dispatch_time = o->m_timer_time[i];
+            o->m_timer_handler[i](c);
+            
+            if (o->m_timer_active[i]) {
+                heap_insert(c, i);
+            }
+        }
+        o->m_dispatching = false;
+        
+        update_next(c);
+    }
+    
+    static void rearm_timerfd (AtomicContext<Context> c, struct timespec now_ts, TimeType now)
+    {
+        auto *o = Object::self(c);
+        
+        // Nothing to do if no timer is active (a stale expiration only
+        // causes a spurious wakeup), or if the next timer is close enough
+        // that it will be busy-waited for.
+        if (o->m_heap_size == 0) {
+            return;
+        }
+        TimeType next_time = o->m_timer_time[o->m_heap[0]];
+        if (!TheClockUtils::timeGreaterOrEqual(next_time, now) || TheClockUtils::timeDifference(next_time, now) <= ShortWaitTicks) {
+            return;
+        }
+        if (o->m_armed && o->m_armed_time == next_time) {
+            return;
+        }
+        
+        arm_timerfd(c, now_ts, now, next_time);
     }
     
-    static void poke_timer_thread (AtomicContext<Context> c, struct timespec now_ts)
+    static void arm_timerfd (AtomicContext<Context> c, struct timespec now_ts, TimeType now, TimeType time)
     {
         auto *o = Object::self(c);
         
-        // This is used when a timer is started, to make the timer thread wake
-        // up immediately and arm the timerfd taking the changed timer into account.
-        // It has to be done within the lock, else the adjustment may be overridden
-        // with one that does not account for the timer change.
+        TimeType time_from_now = TheClockUtils::timeGreaterOrEqual(time, now) ? TheClockUtils::timeDifference(time, now) : 0;
         
         struct itimerspec itspec = {};
-        itspec.it_value = now_ts;
+        itspec.it_value = addTimeToTimespec(now_ts, time_from_now);
         
         int res = ::timerfd_settime(o->m_timer_fd, TFD_TIMER_ABSTIME, &itspec, nullptr);
         AMBRO_ASSERT_FORCE(res == 0)
+        
+        o->m_armed = true;
+        o->m_armed_time = time;
+    }
+    
+    static void timer_started (AtomicContext<Context> c, int8_t i)
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(o->m_heap_pos[i] == NotInHeap)
+        
+        heap_insert(c, i);
+        update_next(c);
+        
+        // This is used when a timer is started from outside of the timer thread.
+        // Arm the timerfd if the timer expires before the timer thread would wake
+        // up. It has to be done within the lock, else the adjustment may be
+        // overridden with one that does not account for the timer change.
+        TimeType time = o->m_timer_time[i];
+        if (!o->m_spin && !o->m_dispatching && (!o->m_armed || !TheClockUtils::timeGreaterOrEqual(time, o->m_armed_time))) {
+            struct timespec now_ts = getTimespec(c);
+            arm_timerfd(c, now_ts, timespecToTime(now_ts), time);
+        }
+    }
+    
+    static void timer_stopped (AtomicContext<Context> c, int8_t i)
+    {
+        auto *o = Object::self(c);
+        
+        if (o->m_heap_pos[i] != NotInHeap) {
+            heap_remove(c, i);
+            update_next(c);
+        }
+    }
+        
+    static void update_next (AtomicContext<Context> c)
+    {
+        auto *o = Object::self(c);
+        
+        if (o->m_heap_size > 0) {
+            o->m_next_time.store(o->m_timer_time[o->m_heap[0]], std::memory_order_relaxed);
+        }
+        o->m_next_valid.store(o->m_heap_size > 0, std::memory_order_release);
+    }
+    
+    static bool heap_less (Object *o, int8_t i, int8_t j)
+    {
+        return !TheClockUtils::timeGreaterOrEqual(o->m_timer_time[i], o->m_timer_time[j]);
+    }
+    
+    static void heap_place (Object *o, int8_t pos, int8_t i)
+    {
+        o->m_heap[pos] = i;
+        o->m_heap_pos[i] = pos;
+    }
+    
+    static void heap_sift (Object *o, int8_t pos)
+    {
+        int8_t i = o->m_heap[pos];
+        
+        while (pos > 0) {
+            int8_t parent = (pos - 1) / 2;
+            if (!heap_less(o, i, o->m_heap[parent])) {
+                break;
+            }
+            heap_place(o, pos, o->m_heap[parent]);
+            pos = parent;
+        }
+        
+        while (true) {
+            int8_t child = 2 * pos + 1;
+            if (child >= o->m_heap_size) {
+                break;
+            }
+            if (child + 1 < o->m_heap_size && heap_less(o, o->m_heap[child + 1], o->m_heap[child])) {
+                child++;
+            }
+            if (!heap_less(o, o->m_heap[child], i)) {
+                break;
+            }
+            heap_place(o, pos, o->m_heap[child]);
+            pos = child;
+        }
+        
+        heap_place(o, pos, i);
+    }
+    
+    static void heap_insert (AtomicContext<Context> c, int8_t i)
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(o->m_heap_size < MaxTimers)
+        
+        int8_t pos = o->m_heap_size++;
+        heap_place(o, pos, i);
+        heap_sift(o, pos);
+    }
+    
+    static void heap_remove (AtomicContext<Context> c, int8_t i)
+    {
+        auto *o = Object::self(c);
+        int8_t pos = o->m_heap_pos[i];
+        AMBRO_ASSERT(pos >= 0 && pos < o->m_heap_size)
+        
+        o->m_heap_pos[i] = NotInHeap;
+        int8_t last = o->m_heap[--o->m_heap_size];
+        if (pos < o->m_heap_size) {
+            heap_place(o, pos, last);
+            heap_sift(o, pos);
+        }
     }
     
 public:
@@ -248,6 +458,16 @@ public:
         bool m_timer_active[MaxTimers];
         TimeType m_timer_time[MaxTimers];
         InternalTimerHandlerType m_timer_handler[MaxTimers];
+        int8_t m_heap[MaxTimers];
+        int8_t m_heap_pos[MaxTimers];
+        int8_t m_heap_size;
+        std::atomic_bool m_next_valid;
+        std::atomic<TimeType> m_next_time;
+        bool m_armed;
+        TimeType m_armed_time;
+        bool m_spin;
+        bool m_dispatching;
+        TimeType m_dispatch_time;
     };
 };
 
@@ -307,6 +527,7 @@ public:
         
         AMBRO_LOCK_T(InterruptTempLock(), c, lock_c) {
             co->m_timer_active[Index] = false;
+            Clock::timer_stopped(lock_c, Index);
         }
         
         co->m_timer_handler[Index] = nullptr;
@@ -319,13 +540,10 @@ public:
         TheDebugObject::access(c);
         AMBRO_ASSERT(!co->m_timer_active[Index])
         
-        co->m_timer_time[Index] = time;
-        
-        struct timespec now_ts = Clock::getTimespec(c);
-        
         AMBRO_LOCK_T(InterruptTempLock(), c, lock_c) {
+            co->m_timer_time[Index] = time;
             co->m_timer_active[Index] = true;
-            Clock::poke_timer_thread(lock_c, now_ts);
+            Clock::timer_started(lock_c, Index);
         }
     }
     
@@ -345,6 +563,7 @@ public:
         
         AMBRO_LOCK_T(InterruptTempLock(), c, lock_c) {
             co->m_timer_active[Index] = false;
+            Clock::timer_stopped(lock_c, Index);
         }
     }
     
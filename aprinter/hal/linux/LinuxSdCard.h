@@ -22,38 +22,52 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+
 #ifndef APRINTER_LINUX_SDCARD_H
 #define APRINTER_LINUX_SDCARD_H
 
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 #include <limits.h>
 #include <pthread.h>
-#include <semaphore.h>
+#include <poll.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
 
 #include <atomic>
 #include <limits>
 
 #include <aprinter/meta/ServiceUtils.h>
+#include <aprinter/meta/MinMax.h>
 #include <aprinter/base/Object.h>
 #include <aprinter/base/DebugObject.h>
 #include <aprinter/base/Assert.h>
+#include <aprinter/base/Callback.h>
 #include <aprinter/base/Preprocessor.h>
 #include <aprinter/base/TransferVector.h>
-#include <aprinter/base/OneOf.h>
 #include <aprinter/base/LoopUtils.h>
 #include <aprinter/platform/linux/linux_support.h>
 
 namespace APrinter {
 
+// Up to MaxConcurrentCommands reads and writes may be in progress at the
+// same time. They are submitted to an io_uring, or if that is not available
+// (old kernel or forbidden by seccomp), to a pool of I/O threads doing
+// preadv/pwritev. Either way, completion is signaled through an eventfd
+// monitored by the event loop. Commands are reported as completed in the
+// order they were started.
+// 
 // NOTE: The existing SD-card API does not support asynchonous execution
 // of deactivate (it assumed that any cleanup can be done immediately),
-// but we have to wait for any operations in the I/O thread to complete.
+// but we have to wait for any operations in progress to complete.
 // Since the Linux port is for testing only, waiting synchronously in
 // deactivate and deinit is fine.
 
@@ -68,9 +82,10 @@ private:
     using TheDebugObject = DebugObject<Context, Object>;
     
     using CompletedFastEvent = typename Context::EventLoop::template FastEventSpec<LinuxSdCard>;
+    APRINTER_USE_TYPE1(Context::EventLoop, FdEvFlags)
     
     enum class InitState : uint8_t {Inactive, Initing, Running};
-    enum class IoState : uint8_t {Inactive, Reading, Writing};
+    enum class SlotState : uint8_t {Free, Submitted, Completed};
     
     enum class ErrorCode : uint8_t {
         Success = 0,
@@ -90,12 +105,24 @@ public:
     using DataWordType = uint32_t;
     static size_t const MaxIoBlocks = Params::MaxIoBlocks;
     static int const MaxIoDescriptors = Params::MaxIoDescriptors;
+    static int const MaxConcurrentCommands = Params::MaxConcurrentCommands;
     
 private:
     static_assert(BlockSize > 0, "");
     static_assert(BlockSize % sizeof(DataWordType) == 0, "");
     static_assert(MaxIoBlocks > 0, "");
     static_assert(MaxIoDescriptors > 0, "");
+    static_assert(MaxConcurrentCommands > 0 && MaxConcurrentCommands <= 64, "");
+    
+    struct Slot {
+        std::atomic<SlotState> state;
+        bool is_write;
+        BlockIndexType block;
+        size_t num_blocks;
+        int num_iov;
+        ssize_t result;
+        struct iovec iov[MaxIoDescriptors];
+    };
     
 public:
     static void init (Context c)
@@ -103,20 +130,24 @@ public:
         auto *o = Object::self(c);
         
         o->init_state = InitState::Inactive;
-        o->io_state = IoState::Inactive;
-        o->stop_thread = false;
-        o->cmd_in_progress = false;
         o->file_fd = -1;
+        o->first_slot = 0;
+        o->num_slots = 0;
+        for (auto i : LoopRangeAuto(MaxConcurrentCommands)) {
+            o->slots[i].state = SlotState::Free;
+        }
         
         Context::EventLoop::template initFastEvent<CompletedFastEvent>(c, LinuxSdCard::completed_event_handler);
         
-        AMBRO_ASSERT_FORCE_MSG(::sem_init(&o->start_cmd_sem, 0, 0) == 0, "sem_init failed")
+        o->event_fd = ::eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+        AMBRO_ASSERT_FORCE_MSG(o->event_fd >= 0, "eventfd failed")
         
-        AMBRO_ASSERT_FORCE_MSG(::sem_init(&o->end_cmd_sem, 0, 1) == 0, "sem_init failed")
+        o->event_fd_event.init(c, APRINTER_CB_STATFUNC_T(&LinuxSdCard::event_fd_handler));
+        o->event_fd_event.start(c, o->event_fd, FdEvFlags::EV_READ);
         
-        {
-            LinuxBlockSignals block_signals;
-            AMBRO_ASSERT_FORCE_MSG(::pthread_create(&o->io_thread, nullptr, LinuxSdCard::io_thread_func, nullptr) == 0, "pthread_create failed")
+        o->use_uring = uring_init(c);
+        if (!o->use_uring) {
+            pool_init(c);
         }
         
         TheDebugObject::init(c);
@@ -127,21 +158,20 @@ public:
         auto *o = Object::self(c);
         TheDebugObject::deinit(c);
         
-        if (o->cmd_in_progress) {
-            wait_for_cmd(c);
-        }
+        wait_for_commands(c);
         
         if (o->file_fd >= 0) {
             ::close(o->file_fd);
         }
         
-        o->stop_thread = true;
-        AMBRO_ASSERT_FORCE_MSG(::sem_post(&o->start_cmd_sem) == 0, "sem_post failed")
-        AMBRO_ASSERT_FORCE_MSG(::pthread_join(o->io_thread, nullptr) == 0, "pthread_join failed")
-        
-        AMBRO_ASSERT_FORCE_MSG(::sem_destroy(&o->end_cmd_sem) == 0, "sem_destroy failed")
+        if (o->use_uring) {
+            uring_deinit(c);
+        } else {
+            pool_deinit(c);
+        }
         
-        AMBRO_ASSERT_FORCE_MSG(::sem_destroy(&o->start_cmd_sem) == 0, "sem_destroy failed")
+        o->event_fd_event.deinit(c);
+        ::close(o->event_fd);
         
         Context::EventLoop::template resetFastEvent<CompletedFastEvent>(c);
     }
@@ -152,13 +182,14 @@ public:
         TheDebugObject::access(c);
         AMBRO_ASSERT(o->init_state == InitState::Inactive)
         // implies
-        AMBRO_ASSERT(o->io_state == IoState::Inactive)
-        AMBRO_ASSERT(!o->cmd_in_progress)
+        AMBRO_ASSERT(o->num_slots == 0)
         AMBRO_ASSERT(o->file_fd == -1)
         
+        // Opening the file does not block for long, so it is done right here
+        // and only the completion is reported asynchronously.
         o->init_state = InitState::Initing;
-        o->cmd_in_progress = true;
-        AMBRO_ASSERT_FORCE_MSG(::sem_post(&o->start_cmd_sem) == 0, "sem_post failed")
+        o->init_error = open_file(c);
+        Context::EventLoop::template triggerFastEvent<CompletedFastEvent>(c);
     }
     
     static void deactivate (Context c)
@@ -167,17 +198,21 @@ public:
         TheDebugObject::access(c);
         AMBRO_ASSERT(o->init_state != InitState::Inactive)
         
-        if (o->cmd_in_progress) {
-            wait_for_cmd(c);
+        wait_for_commands(c);
+        
+        for (auto i : LoopRangeAuto(MaxConcurrentCommands)) {
+            o->slots[i].state = SlotState::Free;
         }
+        o->first_slot = 0;
+        o->num_slots = 0;
         
         if (o->file_fd >= 0) {
             ::close(o->file_fd);
             o->file_fd = -1;
         }
         
+        Context::EventLoop::template resetFastEvent<CompletedFastEvent>(c);
         o->init_state = InitState::Inactive;
-        o->io_state = IoState::Inactive;
     }
     
     static BlockIndexType getCapacityBlocks (Context c)
@@ -203,7 +238,7 @@ public:
         auto *o = Object::self(c);
         TheDebugObject::access(c);
         AMBRO_ASSERT(o->init_state == InitState::Running)
-        AMBRO_ASSERT(o->io_state == IoState::Inactive)
+        AMBRO_ASSERT(o->num_slots < MaxConcurrentCommands)
         AMBRO_ASSERT(block <= o->capacity_blocks)
         AMBRO_ASSERT(num_blocks > 0)
         AMBRO_ASSERT(num_blocks <= o->capacity_blocks - block)
@@ -211,62 +246,45 @@ public:
         AMBRO_ASSERT(data_vector.num_descriptors <= MaxIoDescriptors)
         AMBRO_ASSERT(CheckTransferVector(data_vector, num_blocks * (BlockSize/sizeof(DataWordType))))
         // implies
-        AMBRO_ASSERT(!o->cmd_in_progress)
         AMBRO_ASSERT(o->file_fd >= 0)
         
-        o->io_state = is_write ? IoState::Writing : IoState::Reading;
-        o->io_block = block;
-        o->io_num_blocks = num_blocks;
-        o->io_vector = data_vector;
-        o->cmd_in_progress = true;
-        AMBRO_ASSERT_FORCE_MSG(::sem_post(&o->start_cmd_sem) == 0, "sem_post failed")
+        int slot_idx = slot_index(o->num_slots);
+        Slot *slot = &o->slots[slot_idx];
+        AMBRO_ASSERT(slot->state == SlotState::Free)
+        
+        slot->is_write = is_write;
+        slot->block = block;
+        slot->num_blocks = num_blocks;
+        slot->num_iov = data_vector.num_descriptors;
+        for (auto i : LoopRangeAuto(data_vector.num_descriptors)) {
+            slot->iov[i].iov_base = data_vector.descriptors[i].buffer_ptr;
+            slot->iov[i].iov_len = data_vector.descriptors[i].num_words * sizeof(DataWordType);
+        }
+        slot->state = SlotState::Submitted;
+        o->num_slots++;
+        
+        if (o->use_uring) {
+            uring_submit(c, slot_idx);
+        } else {
+            pool_submit(c, slot_idx);
+        }
     }
     
     using EventLoopFastEvents = MakeTypeList<CompletedFastEvent>;
     
 private:
-    static void * io_thread_func (void *)
+    static int slot_index (int pos)
     {
-        Context c;
-        auto *o = Object::self(c);
-        
-        while (true) {
-            AMBRO_ASSERT_FORCE_MSG(::sem_wait(&o->start_cmd_sem) == 0, "sem_wait failed")
-            
-            if (o->stop_thread) {
-                break;
-            }
-            
-            AMBRO_ASSERT(o->cmd_in_progress)
-            
-            ErrorCode err = ErrorCode::Impossible;
-            
-            if (o->init_state == InitState::Initing) {
-                err = process_init(c);
-            }
-            else if (o->io_state == OneOf(IoState::Reading, IoState::Writing)) {
-                err = process_read_or_write(c, o->io_state == IoState::Writing);
-            }
-            else {
-                AMBRO_ASSERT(false)
-            }
-            
-            o->error_code = err;
-            
-            Context::EventLoop::template triggerFastEvent<CompletedFastEvent>(c);
-            
-            AMBRO_ASSERT_FORCE_MSG(::sem_post(&o->end_cmd_sem) == 0, "sem_post failed")
-        }
-        
-        return nullptr;
+        auto *o = Object::self(Context());
+        return (o->first_slot + pos) % MaxConcurrentCommands;
     }
     
-    static ErrorCode process_init (Context c)
+    static ErrorCode open_file (Context c)
     {
         auto *o = Object::self(c);
         int res;
         
-        int fd = ::open(FilePath(), O_RDWR);
+        int fd = ::open(FilePath(), O_RDWR|O_CLOEXEC);
         if (fd < 0) {
             return ErrorCode::OpenFailed;
         }
@@ -292,52 +310,43 @@ private:
         return ErrorCode::Success;
     }
     
-    static ErrorCode process_read_or_write (Context c, bool is_write)
+    static ErrorCode check_result (Slot const *slot)
     {
-        auto *o = Object::self(c);
-        AMBRO_ASSERT(o->init_state == InitState::Running)
-        
-        auto num_descriptors = o->io_vector.num_descriptors;
-        AMBRO_ASSERT(num_descriptors <= MaxIoDescriptors)
-        
-        for (auto i : LoopRangeAuto(num_descriptors)) {
-            o->iov[i].iov_base = o->io_vector.descriptors[i].buffer_ptr;
-            o->iov[i].iov_len = o->io_vector.descriptors[i].num_words * sizeof(DataWordType);
-        }
-        
-        off_t offset = o->io_block * (off_t)BlockSize;
-        
-        ssize_t res;
-        if (is_write) {
-            res = ::pwritev(o->file_fd, o->iov, num_descriptors, offset);
-        } else {
-            res = ::preadv(o->file_fd, o->iov, num_descriptors, offset);
-        }
-        
-        if (res < 0) {
+        if (slot->result < 0) {
             return ErrorCode::IoFailed;
         }
-        
-        if ((size_t)res != o->io_num_blocks * BlockSize) {
+        if ((size_t)slot->result != slot->num_blocks * BlockSize) {
             return ErrorCode::BadIoResLen;
         }
-        
         return ErrorCode::Success;
     }
     
-    static void completed_event_handler (Context c)
+    static void event_fd_handler (Context c, int events)
     {
         auto *o = Object::self(c);
-        AMBRO_ASSERT(o->cmd_in_progress)
+        TheDebugObject::access(c);
+        
+        uint64_t count;
+        while (::read(o->event_fd, &count, sizeof(count)) > 0);
         
-        AMBRO_ASSERT_FORCE_MSG(::sem_trywait(&o->end_cmd_sem) == 0, "sem_trywait failed")
+        if (o->use_uring) {
+            uring_reap(c);
+        }
         
-        o->cmd_in_progress = false;
+        if (o->num_slots > 0 && o->slots[o->first_slot].state.load(std::memory_order_acquire) == SlotState::Completed) {
+            Context::EventLoop::template triggerFastEvent<CompletedFastEvent>(c);
+        }
+    }
+    
+    static void completed_event_handler (Context c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
         
         if (o->init_state == InitState::Initing) {
-            AMBRO_ASSERT(o->io_state == IoState::Inactive)
+            AMBRO_ASSERT(o->num_slots == 0)
             
-            if (o->error_code == ErrorCode::Success) {
+            if (o->init_error == ErrorCode::Success) {
                 AMBRO_ASSERT(o->file_fd >= 0)
                 o->init_state = InitState::Running;
             } else {
@@ -345,59 +354,312 @@ private:
                 o->init_state = InitState::Inactive;
             }
             
-            return InitHandler::call(c, (uint8_t)o->error_code);
+            return InitHandler::call(c, (uint8_t)o->init_error);
         }
-        else if (o->io_state == OneOf(IoState::Reading, IoState::Writing)) {
-            AMBRO_ASSERT(o->init_state == InitState::Running)
             
-            o->io_state = IoState::Inactive;
+        AMBRO_ASSERT(o->init_state == InitState::Running)
             
-            bool error = o->error_code != ErrorCode::Success;
-            return CommandHandler::call(c, error);
+        if (o->num_slots == 0 || o->slots[o->first_slot].state.load(std::memory_order_acquire) != SlotState::Completed) {
+            return;
         }
-        else {
-            AMBRO_ASSERT(false)
+        
+        Slot *slot = &o->slots[o->first_slot];
+        bool error = check_result(slot) != ErrorCode::Success;
+        slot->state = SlotState::Free;
+        o->first_slot = slot_index(1);
+        o->num_slots--;
+        
+        // Report any further completed commands from another event, since
+        // the handler may start new commands or deactivate.
+        if (o->num_slots > 0 && o->slots[o->first_slot].state.load(std::memory_order_acquire) == SlotState::Completed) {
+            Context::EventLoop::template triggerFastEvent<CompletedFastEvent>(c);
         }
+        
+        return CommandHandler::call(c, error);
     }
     
-    static void wait_for_cmd (Context c)
+    static bool have_submitted (Context c)
     {
         auto *o = Object::self(c);
-        AMBRO_ASSERT(o->cmd_in_progress)
         
-        AMBRO_ASSERT_FORCE_MSG(::sem_wait(&o->end_cmd_sem) == 0, "sem_wait failed")
-        AMBRO_ASSERT_FORCE_MSG(::sem_wait(&o->end_cmd_sem) == 0, "sem_wait failed")
-        AMBRO_ASSERT_FORCE_MSG(::sem_post(&o->end_cmd_sem) == 0, "sem_post failed")
+        for (auto i : LoopRangeAuto(o->num_slots)) {
+            if (o->slots[slot_index(i)].state.load(std::memory_order_acquire) == SlotState::Submitted) {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    static void wait_for_commands (Context c)
+    {
+        auto *o = Object::self(c);
         
-        Context::EventLoop::template resetFastEvent<CompletedFastEvent>(c);
-        o->cmd_in_progress = false;
+        while (have_submitted(c)) {
+            struct pollfd pfd = {};
+            pfd.fd = o->event_fd;
+            pfd.events = POLLIN;
+            ::poll(&pfd, 1, -1);
+            
+            uint64_t count;
+            while (::read(o->event_fd, &count, sizeof(count)) > 0);
+            
+            if (o->use_uring) {
+                uring_reap(c);
+            }
+        }
+    }
+    
+    // io_uring backend
+    
+    static bool uring_init (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        struct io_uring_params params;
+        ::memset(&params, 0, sizeof(params));
+        
+        int ring_fd = ::syscall(__NR_io_uring_setup, MaxConcurrentCommands, &params);
+        if (ring_fd < 0) {
+            return false;
+        }
+        
+        size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP);
+        if (single_mmap) {
+            sq_size = MaxValue(sq_size, cq_size);
+            cq_size = sq_size;
+        }
+        
+        void *sq_ptr = ::mmap(nullptr, sq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+        AMBRO_ASSERT_FORCE_MSG(sq_ptr != MAP_FAILED, "mmap failed")
+        
+        void *cq_ptr = sq_ptr;
+        if (!single_mmap) {
+            cq_ptr = ::mmap(nullptr, cq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+            AMBRO_ASSERT_FORCE_MSG(cq_ptr != MAP_FAILED, "mmap failed")
+        }
+        
+        size_t sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+        void *sqes_ptr = ::mmap(nullptr, sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+        AMBRO_ASSERT_FORCE_MSG(sqes_ptr != MAP_FAILED, "mmap failed")
+        
+        int res = ::syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_EVENTFD, &o->event_fd, 1);
+        AMBRO_ASSERT_FORCE_MSG(res == 0, "io_uring_register failed")
+        
+        char *sq = (char *)sq_ptr;
+        char *cq = (char *)cq_ptr;
+        o->uring.fd = ring_fd;
+        o->uring.sq_ptr = sq_ptr;
+        o->uring.sq_size = sq_size;
+        o->uring.cq_ptr = cq_ptr;
+        o->uring.cq_size = cq_size;
+        o->uring.sqes_size = sqes_size;
+        o->uring.sq_tail = (unsigned *)(sq + params.sq_off.tail);
+        o->uring.sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+        o->uring.sq_array = (unsigned *)(sq + params.sq_off.array);
+        o->uring.sqes = (struct io_uring_sqe *)sqes_ptr;
+        o->uring.cq_head = (unsigned *)(cq + params.cq_off.head);
+        o->uring.cq_tail = (unsigned *)(cq + params.cq_off.tail);
+        o->uring.cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+        o->uring.cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+        
+        return true;
+    }
+    
+    static void uring_deinit (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        ::munmap(o->uring.sqes, o->uring.sqes_size);
+        if (o->uring.cq_ptr != o->uring.sq_ptr) {
+            ::munmap(o->uring.cq_ptr, o->uring.cq_size);
+        }
+        ::munmap(o->uring.sq_ptr, o->uring.sq_size);
+        ::close(o->uring.fd);
+    }
+    
+    static void uring_submit (Context c, int slot_idx)
+    {
+        auto *o = Object::self(c);
+        Slot *slot = &o->slots[slot_idx];
+        
+        // There are at most MaxConcurrentCommands entries in flight and
+        // the rings are at least that large, so they cannot overflow.
+        unsigned tail = *o->uring.sq_tail;
+        unsigned index = tail & o->uring.sq_mask;
+        
+        struct io_uring_sqe *sqe = &o->uring.sqes[index];
+        ::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = slot->is_write ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe->fd = o->file_fd;
+        sqe->addr = (uintptr_t)slot->iov;
+        sqe->len = slot->num_iov;
+        sqe->off = slot->block * (off_t)BlockSize;
+        sqe->user_data = slot_idx;
+        
+        o->uring.sq_array[index] = index;
+        __atomic_store_n(o->uring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+        
+        int res = ::syscall(__NR_io_uring_enter, o->uring.fd, 1, 0, 0, nullptr, 0);
+        AMBRO_ASSERT_FORCE_MSG(res == 1, "io_uring_enter failed")
+    }
+    
+    static void uring_reap (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        unsigned head = *o->uring.cq_head;
+        unsigned tail = __atomic_load_n(o->uring.cq_tail, __ATOMIC_ACQUIRE);
+        
+        while (head != tail) {
+            struct io_uring_cqe *cqe = &o->uring.cqes[head & o->uring.cq_mask];
+            AMBRO_ASSERT(cqe->user_data < MaxConcurrentCommands)
+            Slot *slot = &o->slots[cqe->user_data];
+            AMBRO_ASSERT(slot->state == SlotState::Submitted)
+            slot->result = cqe->res;
+            slot->state.store(SlotState::Completed, std::memory_order_release);
+            head++;
+        }
+        
+        __atomic_store_n(o->uring.cq_head, head, __ATOMIC_RELEASE);
+    }
+    
+    // Thread pool backend
+    
+    static void pool_init (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        o->pool.stop = false;
+        o->pool.queue_start = 0;
+        o->pool.queue_length = 0;
+        
+        AMBRO_ASSERT_FORCE_MSG(::pthread_mutex_init(&o->pool.mutex, nullptr) == 0, "pthread_mutex_init failed")
+        AMBRO_ASSERT_FORCE_MSG(::pthread_cond_init(&o->pool.cond, nullptr) == 0, "pthread_cond_init failed")
+        
+        LinuxBlockSignals block_signals;
+        for (auto i : LoopRangeAuto(MaxConcurrentCommands)) {
+            AMBRO_ASSERT_FORCE_MSG(::pthread_create(&o->pool.threads[i], nullptr, LinuxSdCard::pool_thread_func, nullptr) == 0, "pthread_create failed")
+        }
+    }
+    
+    static void pool_deinit (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        ::pthread_mutex_lock(&o->pool.mutex);
+        o->pool.stop = true;
+        ::pthread_cond_broadcast(&o->pool.cond);
+        ::pthread_mutex_unlock(&o->pool.mutex);
+        
+        for (auto i : LoopRangeAuto(MaxConcurrentCommands)) {
+            AMBRO_ASSERT_FORCE_MSG(::pthread_join(o->pool.threads[i], nullptr) == 0, "pthread_join failed")
+        }
+        
+        ::pthread_cond_destroy(&o->pool.cond);
+        ::pthread_mutex_destroy(&o->pool.mutex);
+    }
+    
+    static void pool_submit (Context c, int slot_idx)
+    {
+        auto *o = Object::self(c);
+        
+        ::pthread_mutex_lock(&o->pool.mutex);
+        AMBRO_ASSERT(o->pool.queue_length < MaxConcurrentCommands)
+        o->pool.queue[(o->pool.queue_start + o->pool.queue_length) % MaxConcurrentCommands] = slot_idx;
+        o->pool.queue_length++;
+        ::pthread_cond_signal(&o->pool.cond);
+        ::pthread_mutex_unlock(&o->pool.mutex);
+    }
+    
+    static void * pool_thread_func (void *)
+    {
+        Context c;
+        auto *o = Object::self(c);
+        
+        while (true) {
+            ::pthread_mutex_lock(&o->pool.mutex);
+            while (!o->pool.stop && o->pool.queue_length == 0) {
+                ::pthread_cond_wait(&o->pool.cond, &o->pool.mutex);
+            }
+            if (o->pool.stop) {
+                ::pthread_mutex_unlock(&o->pool.mutex);
+                break;
+            }
+            int slot_idx = o->pool.queue[o->pool.queue_start];
+            o->pool.queue_start = (o->pool.queue_start + 1) % MaxConcurrentCommands;
+            o->pool.queue_length--;
+            int file_fd = o->file_fd;
+            ::pthread_mutex_unlock(&o->pool.mutex);
+            
+            Slot *slot = &o->slots[slot_idx];
+            off_t offset = slot->block * (off_t)BlockSize;
+            if (slot->is_write) {
+                slot->result = ::pwritev(file_fd, slot->iov, slot->num_iov, offset);
+            } else {
+                slot->result = ::preadv(file_fd, slot->iov, slot->num_iov, offset);
+            }
+            slot->state.store(SlotState::Completed, std::memory_order_release);
+            
+            uint64_t one = 1;
+            AMBRO_ASSERT_FORCE(::write(o->event_fd, &one, sizeof(one)) == sizeof(one))
+        }
+        
+        return nullptr;
     }
     
+    struct UringState {
+        int fd;
+        void *sq_ptr;
+        size_t sq_size;
+        void *cq_ptr;
+        size_t cq_size;
+        size_t sqes_size;
+        unsigned *sq_tail;
+        unsigned sq_mask;
+        unsigned *sq_array;
+        struct io_uring_sqe *sqes;
+        unsigned *cq_head;
+        unsigned *cq_tail;
+        unsigned cq_mask;
+        struct io_uring_cqe *cqes;
+    };
+    
+    struct PoolState {
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+        bool stop;
+        int queue_start;
+        int queue_length;
+        int queue[MaxConcurrentCommands];
+        pthread_t threads[MaxConcurrentCommands];
+    };
+    
 public:
     struct Object : public ObjBase<LinuxSdCard, ParentObject, MakeTypeList<
         TheDebugObject
     >> {
-        sem_t start_cmd_sem;
-        sem_t end_cmd_sem;
-        pthread_t io_thread;
         InitState init_state;
-        IoState io_state;
-        std::atomic_bool stop_thread;
-        bool cmd_in_progress;
-        ErrorCode error_code;
+        ErrorCode init_error;
+        bool use_uring;
         int file_fd;
+        int event_fd;
+        typename Context::EventLoop::FdEvent event_fd_event;
         BlockIndexType capacity_blocks;
-        BlockIndexType io_block;
-        size_t io_num_blocks;
-        TransferVector<DataWordType> io_vector;
-        struct iovec iov[MaxIoDescriptors];
+        int first_slot;
+        int num_slots;
+        Slot slots[MaxConcurrentCommands];
+        UringState uring;
+        PoolState pool;
     };
 };
 
 APRINTER_ALIAS_STRUCT_EXT(LinuxSdCardService, (
     APRINTER_AS_VALUE(size_t, BlockSize),
     APRINTER_AS_VALUE(size_t, MaxIoBlocks),
-    APRINTER_AS_VALUE(int, MaxIoDescriptors)
+    APRINTER_AS_VALUE(int, MaxIoDescriptors),
+    APRINTER_AS_VALUE(int, MaxConcurrentCommands)
 ), (
     APRINTER_ALIAS_STRUCT_EXT(SdCard, (
         APRINTER_AS_TYPE(Context),
@@ -0,0 +1,342 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef APRINTER_LINUX_TRACE_PINS_H
+#define APRINTER_LINUX_TRACE_PINS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <atomic>
+
+#include <aprinter/meta/ServiceUtils.h>
+#include <aprinter/meta/PowerOfTwo.h>
+#include <aprinter/base/Object.h>
+#include <aprinter/base/DebugObject.h>
+#include <aprinter/base/Assert.h>
+#include <aprinter/base/Preprocessor.h>
+#include <aprinter/base/LoopUtils.h>
+#include <aprinter/base/BinaryTools.h>
+#include <aprinter/system/InterruptLock.h>
+#include <aprinter/platform/linux/linux_support.h>
+#include <aprinter/hal/generic/StubPins.h>
+
+namespace APrinter {
+
+/**
+ * Pins implementation for the Linux port which records the changes of
+ * stepper step and direction pins to a file, for analysis of the timing
+ * of step generation (see tools/step_trace_analyze.py).
+ * 
+ * Traced pins are LinuxTraceStepPin<Channel> and LinuxTraceDirPin<Channel>,
+ * where a channel normally corresponds to one stepper. Any other pin
+ * (e.g. StubPin) is ignored like with StubPins. Tracing is enabled by
+ * passing --step-trace=FILE on the command line.
+ * 
+ * Each pin change is stored into a per-channel single-producer ring buffer
+ * together with the actual time and, if the change is done from a timer
+ * handler, the time the timer was set for. A separate thread drains the
+ * rings into the file. If a ring is full the event is dropped and counted,
+ * and the count is written to the file as an overflow record.
+ * 
+ * The file starts with a 16-byte header: "APST", uint16 version (1),
+ * uint16 number of channels, uint32 clock ticks per second, uint32 zero.
+ * It is followed by 12-byte records: uint32 set time, uint32 actual time,
+ * uint8 channel, uint8 type (0=step, 1=dir, 2=overflow), uint8 level,
+ * uint8 flags (bit 0: set time is valid). For overflow records, the actual
+ * time field is the number of dropped events. All values are little-endian.
+ */
+template <int Channel>
+struct LinuxTraceStepPin {};
+
+template <int Channel>
+struct LinuxTraceDirPin {};
+
+template <typename Arg>
+class LinuxTracePins {
+    APRINTER_USE_TYPES1(Arg, (Context, ParentObject, Params))
+    APRINTER_USE_VALS(Params, (NumChannels, RingSizeBits))
+    
+    static_assert(NumChannels > 0 && NumChannels <= 256, "");
+    static_assert(RingSizeBits >= 4 && RingSizeBits <= 24, "");
+    
+public:
+    struct Object;
+    
+private:
+    using TheDebugObject = DebugObject<Context, Object>;
+    using Clock = typename Context::Clock;
+    using TimeType = typename Clock::TimeType;
+    
+    static uint32_t const RingSize = PowerOfTwo<uint32_t, RingSizeBits>::Value;
+    static size_t const HeaderSize = 16;
+    static size_t const RecordSize = 12;
+    static uint16_t const FormatVersion = 1;
+    static long const DrainIntervalNsec = 1000000;
+    
+    enum EventType : uint8_t {EventStep = 0, EventDir = 1, EventOverflow = 2};
+    
+    struct Event {
+        TimeType set_time;
+        TimeType actual_time;
+        uint8_t type;
+        uint8_t level;
+        bool set_time_valid;
+    };
+    
+    struct Ring {
+        std::atomic<uint32_t> head;
+        std::atomic<uint32_t> tail;
+        std::atomic<uint32_t> dropped;
+        Event events[RingSize];
+    };
+    
+    template <typename Pin>
+    struct PinInfo {
+        static bool const Traced = false;
+        static int const TheChannel = 0;
+        static uint8_t const Type = EventStep;
+    };
+    
+    template <int PinChannel>
+    struct PinInfo<LinuxTraceStepPin<PinChannel>> {
+        static bool const Traced = true;
+        static int const TheChannel = PinChannel;
+        static uint8_t const Type = EventStep;
+    };
+    
+    template <int PinChannel>
+    struct PinInfo<LinuxTraceDirPin<PinChannel>> {
+        static bool const Traced = true;
+        static int const TheChannel = PinChannel;
+        static uint8_t const Type = EventDir;
+    };
+    
+public:
+    static void init (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        o->file = nullptr;
+        o->stop_thread = false;
+        for (auto i : LoopRangeAuto(NumChannels)) {
+            o->rings[i].head = 0;
+            o->rings[i].tail = 0;
+            o->rings[i].dropped = 0;
+        }
+        
+        if (cmdline_options.step_trace_file) {
+            o->file = ::fopen(cmdline_options.step_trace_file, "wb");
+            AMBRO_ASSERT_FORCE_MSG(o->file, "Failed to open step trace file")
+            
+            char header[HeaderSize] = {'A', 'P', 'S', 'T'};
+            WriteBinaryInt<uint16_t, BinaryLittleEndian>(FormatVersion, header + 4);
+            WriteBinaryInt<uint16_t, BinaryLittleEndian>(NumChannels, header + 6);
+            WriteBinaryInt<uint32_t, BinaryLittleEndian>(Clock::time_freq, header + 8);
+            WriteBinaryInt<uint32_t, BinaryLittleEndian>(0, header + 12);
+            AMBRO_ASSERT_FORCE(::fwrite(header, HeaderSize, 1, o->file) == 1)
+            
+            // The writer thread does not need RT scheduling, it only has
+            // to keep up with the rings on average.
+            o->writer_thread.start(APRINTER_CB_STATFUNC_T(&LinuxTracePins::writer_thread), -1, -1, 0);
+        }
+        
+        TheDebugObject::init(c);
+    }
+    
+    static void deinit (Context c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::deinit(c);
+        
+        if (o->file) {
+            o->stop_thread = true;
+            o->writer_thread.join();
+            ::fclose(o->file);
+        }
+    }
+    
+    template <typename Pin, typename Mode=StubPinInputMode, typename ThisContext>
+    static void setInput (ThisContext c)
+    {
+        TheDebugObject::access(c);
+    }
+    
+    template <typename Pin, typename Mode=StubPinOutputMode, typename ThisContext>
+    static void setOutput (ThisContext c)
+    {
+        TheDebugObject::access(c);
+    }
+    
+    template <typename Pin, typename ThisContext>
+    static bool get (ThisContext c)
+    {
+        TheDebugObject::access(c);
+        return false;
+    }
+    
+    template <typename Pin, typename ThisContext>
+    static void set (ThisContext c, bool x)
+    {
+        TheDebugObject::access(c);
+        
+        if (PinInfo<Pin>::Traced) {
+            record<PinInfo<Pin>>(c, x);
+        }
+    }
+    
+    template <typename Pin>
+    static void emergencySet (bool x)
+    {
+    }
+    
+private:
+    static bool get_set_time (Context c, TimeType *out_time)
+    {
+        return false;
+    }
+    
+    static bool get_set_time (AtomicContext<Context> c, TimeType *out_time)
+    {
+        return Clock::getDispatchTime(c, out_time);
+    }
+    
+    // There is a single producer per ring since the step and direction
+    // pins of a stepper are only changed from its timer handler, and
+    // from the main thread before the timer is started.
+    template <typename Info, typename ThisContext>
+    static void record (ThisContext c, bool level)
+    {
+        static_assert(Info::TheChannel >= 0 && Info::TheChannel < NumChannels, "");
+        auto *o = Object::self(c);
+        
+        if (!o->file) {
+            return;
+        }
+        
+        Ring *ring = &o->rings[Info::TheChannel];
+        uint32_t head = ring->head.load(std::memory_order_relaxed);
+        uint32_t tail = ring->tail.load(std::memory_order_acquire);
+        if (AMBRO_UNLIKELY(head - tail >= RingSize)) {
+            ring->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        
+        Event *ev = &ring->events[head % RingSize];
+        ev->actual_time = Clock::timespecToTime(Clock::getTimespec(c));
+        ev->set_time_valid = get_set_time(c, &ev->set_time);
+        if (!ev->set_time_valid) {
+            ev->set_time = ev->actual_time;
+        }
+        ev->type = Info::Type;
+        ev->level = level;
+        
+        ring->head.store(head + 1, std::memory_order_release);
+    }
+    
+    static void writer_thread ()
+    {
+        Context c;
+        auto *o = Object::self(c);
+        
+        while (true) {
+            bool stopping = o->stop_thread;
+            
+            for (auto channel : LoopRangeAuto(NumChannels)) {
+                drain_ring(c, channel);
+            }
+            AMBRO_ASSERT_FORCE(::fflush(o->file) == 0)
+            
+            if (stopping) {
+                break;
+            }
+            
+            struct timespec interval = {0, DrainIntervalNsec};
+            ::nanosleep(&interval, nullptr);
+        }
+    }
+    
+    static void drain_ring (Context c, int channel)
+    {
+        auto *o = Object::self(c);
+        Ring *ring = &o->rings[channel];
+        
+        uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+        uint32_t head = ring->head.load(std::memory_order_acquire);
+        
+        while (tail != head) {
+            Event const *ev = &ring->events[tail % RingSize];
+            write_record(c, ev->set_time, ev->actual_time, channel, ev->type, ev->level, ev->set_time_valid);
+            tail++;
+        }
+        
+        ring->tail.store(tail, std::memory_order_release);
+        
+        uint32_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped > 0) {
+            write_record(c, 0, dropped, channel, EventOverflow, 0, false);
+        }
+    }
+    
+    static void write_record (Context c, uint32_t set_time, uint32_t actual_time, int channel, uint8_t type, uint8_t level, bool set_time_valid)
+    {
+        auto *o = Object::self(c);
+        
+        char rec[RecordSize];
+        WriteBinaryInt<uint32_t, BinaryLittleEndian>(set_time, rec + 0);
+        WriteBinaryInt<uint32_t, BinaryLittleEndian>(actual_time, rec + 4);
+        WriteBinaryInt<uint8_t, BinaryLittleEndian>(channel, rec + 8);
+        WriteBinaryInt<uint8_t, BinaryLittleEndian>(type, rec + 9);
+        WriteBinaryInt<uint8_t, BinaryLittleEndian>(level, rec + 10);
+        WriteBinaryInt<uint8_t, BinaryLittleEndian>(set_time_valid, rec + 11);
+        AMBRO_ASSERT_FORCE(::fwrite(rec, RecordSize, 1, o->file) == 1)
+    }
+    
+public:
+    struct Object : public ObjBase<LinuxTracePins, ParentObject, MakeTypeList<TheDebugObject>> {
+        FILE *file;
+        LinuxRtThread writer_thread;
+        std::atomic_bool stop_thread;
+        Ring rings[NumChannels];
+    };
+};
+
+APRINTER_ALIAS_STRUCT_EXT(LinuxTracePinsService, (
+    APRINTER_AS_VALUE(int, NumChannels),
+    APRINTER_AS_VALUE(int, RingSizeBits)
+), (
+    APRINTER_ALIAS_STRUCT_EXT(Pins, (
+        APRINTER_AS_TYPE(Context),
+        APRINTER_AS_TYPE(ParentObject)
+    ), (
+        using Params = LinuxTracePinsService;
+        APRINTER_DEF_INSTANCE(Pins, LinuxTracePins)
+    ))
+))
+
+}
+
+#endif
@@ -131,6 +131,96 @@ T StrToFloat (char const *nptr, char **endptr)
 #endif
 }
 
+/**
+ * Parses a plain decimal number, as found in g-code: an optional sign,
+ * digits, and an optional fraction. This is much faster than strtod,
+ * and the result is the same, since the value is computed as an exact
+ * integer divided by an exact power of ten, with a single rounding.
+ * Anything else (an exponent, hex, inf/nan, too many significant digits)
+ * is passed on to StrToFloat.
+ */
+template <typename T>
+T FastStrToFloat (char const *nptr, char **endptr)
+{
+    static_assert(IsFpType<T>::Value, "");
+    
+    // Largest mantissa and power of ten which are exactly representable.
+    uint32_t const max_mantissa = (sizeof(T) == 4) ? (UINT32_C(1) << 24) : UINT32_MAX;
+    int const max_scale = (sizeof(T) == 4) ? 10 : 22;
+    
+    char const *ptr = nptr;
+    
+    bool negative = false;
+    if (*ptr == '-' || *ptr == '+') {
+        negative = (*ptr == '-');
+        ptr++;
+    }
+    
+    uint32_t mantissa = 0;
+    int scale = 0;
+    int pending_zeros = 0;
+    bool have_digits = false;
+    bool in_fraction = false;
+    
+    while (true) {
+        char ch = *ptr;
+        if (ch >= '0' && ch <= '9') {
+            uint8_t digit = ch - '0';
+            have_digits = true;
+            ptr++;
+            // Trailing zeros of the fraction do not affect the value,
+            // so only apply them when a nonzero digit follows.
+            if (in_fraction && digit == 0) {
+                pending_zeros++;
+                continue;
+            }
+            for (int i = 0; i <= pending_zeros; i++) {
+                uint8_t d = (i == pending_zeros) ? digit : 0;
+                if (mantissa > (max_mantissa - d) / 10) {
+                    goto fallback;
+                }
+                mantissa = 10 * mantissa + d;
+            }
+            if (in_fraction) {
+                scale += pending_zeros + 1;
+                pending_zeros = 0;
+                if (scale > max_scale) {
+                    goto fallback;
+                }
+            }
+        }
+        else if (ch == '.' && !in_fraction) {
+            in_fraction = true;
+            ptr++;
+        }
+        else {
+            break;
+        }
+    }
+    
+    if (!have_digits || *ptr == 'e' || *ptr == 'E' || *ptr == 'x' || *ptr == 'X') {
+        goto fallback;
+    }
+    
+    {
+        T value = mantissa;
+        if (scale > 0) {
+            T divisor = 10.0f;
+            for (int i = 1; i < scale; i++) {
+                divisor *= 10.0f;
+            }
+            value /= divisor;
+        }
+        if (endptr) {
+            *endptr = (char *)ptr;
+        }
+        return negative ? -value : value;
+    }
+    
+fallback:
+    return StrToFloat<T>(nptr, endptr);
+}
+
 double FloatLdexp (double x, int exp)
 {
     return ldexp(x, exp);
@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2013 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AMBROLIB_PRINT_FLOAT_H
+#define AMBROLIB_PRINT_FLOAT_H
+
+#include <stdint.h>
+
+#include <aprinter/math/FloatTools.h>
+#include <aprinter/math/PrintInt.h>
+
+namespace APrinter {
+
+/**
+ * Maximum number of characters written by PrintFloatGeneral,
+ * e.g. "-1.23457e-308".
+ */
+static int const PrintFloatGeneralMaxLength = 13;
+
+template <typename T>
+static T PrintFloatScalePow10 (T x, int k)
+{
+    // Powers of ten up to 10^10 (float) or 10^22 (double) are exact, so
+    // for numbers of usual magnitude this rounds just once.
+    while (k != 0) {
+        int n = (k > 0) ? k : -k;
+        if (n > 16) {
+            n = 16;
+        }
+        T p = 10.0;
+        for (int i = 1; i < n; i++) {
+            p *= 10.0;
+        }
+        if (k > 0) {
+            x *= p;
+            k -= n;
+        } else {
+            x /= p;
+            k += n;
+        }
+    }
+    return x;
+}
+
+/**
+ * Formats a number like printf "%g": six significant digits, without
+ * trailing zeros, using the exponent form for exponents below -4 or
+ * above 5. Returns the number of characters written (no terminator).
+ * 
+ * The digits are obtained by scaling the number with a power of ten
+ * and rounding to an integer. For numbers of usual magnitude the
+ * scaling is exact or rounds once, giving the same result as printf.
+ */
+template <typename T>
+static int PrintFloatGeneral (T value, char *s)
+{
+    static_assert(IsFpType<T>::Value, "");
+    
+    // Work in double precision. A float does not have enough precision
+    // to round a scaled value with six integer digits reliably. Where
+    // double is the same as float (AVR), this is the best we can do.
+    double x = value;
+    int len = 0;
+    
+    if (AMBRO_UNLIKELY(FloatIsNan(x))) {
+        s[len++] = 'n';
+        s[len++] = 'a';
+        s[len++] = 'n';
+        return len;
+    }
+    
+    if (FloatSignBit(x)) {
+        s[len++] = '-';
+        x = -x;
+    }
+    
+    if (AMBRO_UNLIKELY(x == INFINITY)) {
+        s[len++] = 'i';
+        s[len++] = 'n';
+        s[len++] = 'f';
+        return len;
+    }
+    
+    if (x == 0.0) {
+        s[len++] = '0';
+        return len;
+    }
+    
+    // Estimate the decimal exponent, such that 10^exp <= x < 10^(exp+1).
+    int exp = 0;
+    if (x >= 1.0) {
+        while (PrintFloatScalePow10(x, -(exp + 1)) >= 1.0) {
+            exp++;
+        }
+    } else {
+        while (PrintFloatScalePow10(x, -exp) < 1.0) {
+            exp--;
+        }
+    }
+    
+    // Get the six significant digits, correcting the exponent if the
+    // rounded value falls outside of the expected range.
+    uint32_t digits;
+    while (true) {
+        // Round half to even, like printf does with exact ties.
+        double scaled = PrintFloatScalePow10(x, 5 - exp);
+        digits = (uint32_t)scaled;
+        double frac = scaled - digits;
+        if (frac > 0.5 || (frac == 0.5 && (digits & 1))) {
+            digits++;
+        }
+        if (digits >= UINT32_C(1000000)) {
+            exp++;
+        } else if (digits < UINT32_C(100000)) {
+            exp--;
+        } else {
+            break;
+        }
+    }
+    
+    char digit_chars[6];
+    PrintNonnegativeIntDecimal<uint32_t>(digits, digit_chars);
+    
+    bool exp_form = (exp < -4 || exp > 5);
+    int int_digits = (exp_form || exp < 0) ? 1 : (exp + 1);
+    
+    int num_digits = 6;
+    while (num_digits > int_digits && digit_chars[num_digits - 1] == '0') {
+        num_digits--;
+    }
+    
+    if (!exp_form && exp < 0) {
+        s[len++] = '0';
+        s[len++] = '.';
+        for (int i = 0; i < -exp - 1; i++) {
+            s[len++] = '0';
+        }
+        for (int i = 0; i < num_digits; i++) {
+            s[len++] = digit_chars[i];
+        }
+        return len;
+    }
+    
+    for (int i = 0; i < num_digits; i++) {
+        if (i == int_digits) {
+            s[len++] = '.';
+        }
+        s[len++] = digit_chars[i];
+    }
+    
+    if (exp_form) {
+        s[len++] = 'e';
+        s[len++] = (exp < 0) ? '-' : '+';
+        int abs_exp = (exp < 0) ? -exp : exp;
+        if (abs_exp < 10) {
+            s[len++] = '0';
+        }
+        len += PrintNonnegativeIntDecimal<int>(abs_exp, s + len);
+    }
+    
+    return len;
+}
+
+}
+
+#endif
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef APRINTER_CRC32_H
+#define APRINTER_CRC32_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <aprinter/base/Hints.h>
+#include <aprinter/meta/ConstexprCrc32.h>
+
+namespace APrinter {
+
+// Runtime CRC-32 (as used by zlib and Ethernet), sharing the lookup table
+// with ConstexprCrc32. The result of Crc32Final for some data is the same
+// as ConstexprHash<ConstexprCrc32> would compute.
+
+static uint32_t const Crc32Initial = UINT32_C(0xFFFFFFFF);
+
+AMBRO_ALWAYS_INLINE
+static uint32_t Crc32UpdateByte (uint32_t crc, uint8_t data)
+{
+    return ConstexprCrc32__Table[(crc ^ data) & UINT32_C(0xFF)] ^ (crc >> 8);
+}
+
+static uint32_t Crc32Update (uint32_t crc, char const *data, size_t length)
+{
+    // Unrolled by four, which lets the compiler keep the CRC in a register
+    // and overlap the table lookups with the loads.
+    while (length >= 4) {
+        crc = Crc32UpdateByte(crc, (uint8_t)data[0]);
+        crc = Crc32UpdateByte(crc, (uint8_t)data[1]);
+        crc = Crc32UpdateByte(crc, (uint8_t)data[2]);
+        crc = Crc32UpdateByte(crc, (uint8_t)data[3]);
+        data += 4;
+        length -= 4;
+    }
+    while (length > 0) {
+        crc = Crc32UpdateByte(crc, (uint8_t)*data);
+        data++;
+        length--;
+    }
+    return crc;
+}
+
+static uint32_t Crc32Final (uint32_t crc)
+{
+    return crc ^ UINT32_C(0xFFFFFFFF);
+}
+
+}
+
+#endif
@@ -69,6 +69,16 @@ static bool StringDecodeHexDigit (char c, int *out)
     return true;
 }
 
+// Writes exactly eight lowercase hex digits, without a null terminator.
+static void StringEncodeHexUint32 (uint32_t x, char *out)
+{
+    for (int i = 7; i >= 0; i--) {
+        int digit = x & 0xF;
+        out[i] = (digit < 10) ? ('0' + digit) : ('a' + (digit - 10));
+        x >>= 4;
+    }
+}
+
 }
 
 #endif
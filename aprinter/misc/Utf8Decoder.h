@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef APRINTER_UTF8DECODER_H
+#define APRINTER_UTF8DECODER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace APrinter {
+
+/**
+* Decodes one Unicode character from a sequence of bytes in UTF-8.
+* 
+* Overlong encodings, surrogates and characters above U+10FFFF are
+* rejected.
+* 
+* @param in pointer to the encoded bytes
+* @param in_len number of bytes available at in
+* @param out_ch will receive the decoded character on success
+* @return number of bytes consumed, 1-4, or 0 if the input does not start
+*         with a valid encoded character
+*/
+static int Utf8DecodeChar (char const *in, size_t in_len, uint32_t *out_ch);
+
+static int Utf8DecodeChar (char const *in, size_t in_len, uint32_t *out_ch)
+{
+    uint8_t const *uin = (uint8_t const *)in;
+    
+    if (in_len == 0) {
+        return 0;
+    }
+    
+    uint8_t first = uin[0];
+    
+    if (first < 0x80) {
+        *out_ch = first;
+        return 1;
+    }
+    
+    int len;
+    uint32_t ch;
+    uint32_t min_ch;
+    if ((first & 0xE0) == 0xC0) {
+        len = 2;
+        ch = first & 0x1F;
+        min_ch = UINT32_C(0x80);
+    }
+    else if ((first & 0xF0) == 0xE0) {
+        len = 3;
+        ch = first & 0x0F;
+        min_ch = UINT32_C(0x800);
+    }
+    else if ((first & 0xF8) == 0xF0) {
+        len = 4;
+        ch = first & 0x07;
+        min_ch = UINT32_C(0x10000);
+    }
+    else {
+        return 0;
+    }
+    
+    if (in_len < (size_t)len) {
+        return 0;
+    }
+    
+    for (int i = 1; i < len; i++) {
+        if ((uin[i] & 0xC0) != 0x80) {
+            return 0;
+        }
+        ch = (ch << 6) | (uin[i] & 0x3F);
+    }
+    
+    if (ch < min_ch || ch > UINT32_C(0x10FFFF) || (ch >= UINT32_C(0xD800) && ch <= UINT32_C(0xDFFF))) {
+        return 0;
+    }
+    
+    *out_ch = ch;
+    return len;
+}
+
+}
+
+#endif
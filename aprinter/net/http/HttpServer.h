@@ -137,6 +137,11 @@ private:
     static size_t const TxLastChunkSize = 5;
     static_assert(GuaranteedTxBufferSize >= TxLastChunkSize, "");
     
+    // Conditional request headers (If-None-Match, If-Range) are remembered up to
+    // this length. Longer values are treated as not matching, which is always
+    // safe since then the full resource is sent.
+    static size_t const MaxCondHeaderLength = 32;
+    
     static TimeType const QueueTimeoutTicks      = Params::Net::QueueTimeout::value()      * Context::Clock::time_freq;
     static TimeType const InactivityTimeoutTicks = Params::Net::InactivityTimeout::value() * Context::Clock::time_freq;
     
@@ -196,6 +201,16 @@ private:
                 return client.accept_connection(c, *o->listener);
             }
         }
+        
+        // All clients are in use. If one of them is a persistent connection merely
+        // waiting for another request, close it so that the new connection (which
+        // remains queued) can be accepted once that client has disconnected.
+        for (Client &client : o->clients) {
+            if (client.is_idle_persistent(c)) {
+                HTTP_SERVER_DEBUG("HttpClientIdleClose");
+                return client.close_gracefully(c, nullptr);
+            }
+        }
     }
     
     class Client :
@@ -268,6 +283,7 @@ private:
             
             // Go prepare_for_request() very soon through this state for simplicity.
             // Really there will be no waiting.
+            m_served_request = false;
             m_state = State::WAIT_SEND_BUF_FOR_REQUEST;
             m_send_event.prependNow(c);
         }
@@ -326,6 +342,10 @@ private:
             m_bad_transfer_encoding = false;
             m_expect_100_continue = false;
             m_expectation_failed = false;
+            m_have_range = false;
+            m_accept_gzip = false;
+            m_if_none_match.reset();
+            m_if_range.reset();
             m_rem_allowed_length = Params::MaxRequestHeadLength;
             
             // And set some values related to higher-level processing of the request.
@@ -345,6 +365,16 @@ private:
             m_recv_event.prependNow(c);
         }
         
+        // Whether this is a persistent connection which has completed a request and
+        // has received nothing of the next one yet. Note that pipelined requests are
+        // already in the receive buffer, in which case this is false.
+        bool is_idle_persistent (Context c)
+        {
+            return m_state == State::RECV_REQUEST_LINE && m_served_request &&
+                   m_line_length == 0 && m_recv_ring_buf.getReadRange(*this).tot_len == 0 &&
+                   !TcpConnection::wasEndReceived();
+        }
+        
         bool have_request (Context c)
         {
             return m_state == OneOf(State::HEAD_RECEIVED, State::USER_GONE);
@@ -359,9 +389,12 @@ private:
                 // The request is processed.
                 // If closing is desired, we want to wait until everything is sent,
                 // otherwise just until we have enough space in the send buffer for the next request.
+                // The response does not need to be acknowledged for that, so pipelined
+                // requests are processed while earlier responses are still being sent.
                 AMBRO_ASSERT(!m_user)
                 AMBRO_ASSERT(!m_send_timeout_event.isSet(c))
                 AMBRO_ASSERT(!m_recv_timeout_event.isSet(c))
+                m_served_request = true;
                 m_state = m_close_connection ? State::DISCONNECT_AFTER_SENDING : State::WAIT_SEND_BUF_FOR_REQUEST;
                 m_recv_state = RecvState::INVALID;
                 m_send_state = SendState::INVALID;
@@ -814,6 +847,23 @@ private:
                     }
                 });
             }
+            else if (HttpStringRemoveHeader(&header, "range")) {
+                // Multiple Range headers are not valid, ignore them all.
+                m_have_range = !m_have_range && HttpParseByteRange(header, &m_range);
+            }
+            else if (HttpStringRemoveHeader(&header, "accept-encoding")) {
+                HttpStringIterTokens(header, [this](AIpStack::MemRef token) {
+                    if (HttpIsAcceptedCoding(token, "gzip")) {
+                        m_accept_gzip = true;
+                    }
+                });
+            }
+            else if (HttpStringRemoveHeader(&header, "if-none-match")) {
+                m_if_none_match.set(header);
+            }
+            else if (HttpStringRemoveHeader(&header, "if-range")) {
+                m_if_range.set(header);
+            }
         }
         
         void request_head_received (Context c)
@@ -1079,15 +1129,20 @@ private:
             send_string_lit(c, "\r\nServer: Aprinter\r\nContent-Type: ");
             send_string(c, content_type);
             send_string_lit(c, "\r\n");
-            if (send_status_as_body) {
+            
+            // Responses such as 304 Not Modified must not have a body.
+            if (send_status_as_body && status_forbids_body(resp_status)) {
+                send_status_as_body = false;
+            }
+            else if (send_status_as_body) {
                 send_string_lit(c, "Content-Length: ");
                 char length_buf[12];
                 sprintf(length_buf, "%d", (int)(strlen(resp_status) + 1));
                 send_string(c, length_buf);
+                send_string_lit(c, "\r\n");
             } else {
-                send_string_lit(c, "Transfer-Encoding: chunked");
+                send_string_lit(c, "Transfer-Encoding: chunked\r\n");
             }
-            send_string_lit(c, "\r\n");
             if (extra_headers) {
                 send_string(c, extra_headers);
             }
@@ -1100,6 +1155,11 @@ private:
             }
         }
         
+        static bool status_forbids_body (char const *status)
+        {
+            return status[0] == '1' || !strncmp(status, "204", 3) || !strncmp(status, "304", 3);
+        }
+        
         void send_string (Context c, char const *str)
         {
             size_t len = strlen(str);
@@ -1123,7 +1183,7 @@ private:
             if (m_send_state == OneOf(SendState::HEAD_NOT_SENT, SendState::SEND_HEAD)) {
                 // The response head has not been sent.
                 // Send the response now, with the status as the body.
-                send_response(c, m_resp_status, true, nullptr, nullptr, m_close_connection);
+                send_response(c, m_resp_status, true, nullptr, m_resp_extra_headers, m_close_connection);
                 
                 // Poke/cose connection, transition to SendState::COMPLETED.
                 sending_completed(c);
@@ -1206,6 +1266,44 @@ private:
             return m_have_request_body;
         }
         
+        // Returns the byte range requested with a Range header, if any.
+        // Ranges which could not be parsed are not reported.
+        bool getRequestRange (Context c, HttpByteRange *range)
+        {
+            AMBRO_ASSERT(m_state == State::HEAD_RECEIVED)
+            
+            if (m_have_range) {
+                *range = m_range;
+            }
+            return m_have_range;
+        }
+        
+        // Returns whether the client indicated support for gzip content-coding.
+        bool acceptsGzip (Context c)
+        {
+            AMBRO_ASSERT(m_state == State::HEAD_RECEIVED)
+            
+            return m_accept_gzip;
+        }
+        
+        // Checks a conditional GET. Returns true if an If-None-Match header
+        // matches the given entity tag, that is if 304 should be sent.
+        bool checkIfNoneMatch (Context c, AIpStack::MemRef etag)
+        {
+            AMBRO_ASSERT(m_state == State::HEAD_RECEIVED)
+            
+            return m_if_none_match.matches(etag, true);
+        }
+        
+        // Returns whether a Range header should be honored, which is the case
+        // unless an If-Range header is present and does not match the entity tag.
+        bool checkIfRange (Context c, AIpStack::MemRef etag)
+        {
+            AMBRO_ASSERT(m_state == State::HEAD_RECEIVED)
+            
+            return !m_if_range.present || m_if_range.matches(etag, false);
+        }
+        
         void setCallback (Context c, RequestUserCallback *callback)
         {
             AMBRO_ASSERT(m_state == State::HEAD_RECEIVED)
@@ -1475,6 +1573,36 @@ private:
             }
         }
         
+    private:
+        struct CondHeader {
+            void reset ()
+            {
+                present = false;
+                length = 0;
+            }
+            
+            void set (char const *value)
+            {
+                // A repeated header or one that is too long will not match.
+                size_t value_len = strlen(value);
+                length = (present || value_len > MaxCondHeaderLength) ? (MaxCondHeaderLength + 1) : value_len;
+                present = true;
+                if (length <= MaxCondHeaderLength) {
+                    memcpy(data, value, length);
+                }
+            }
+            
+            bool matches (AIpStack::MemRef etag, bool weak) const
+            {
+                return present && length <= MaxCondHeaderLength &&
+                       HttpEtagMatches(AIpStack::MemRef(data, length), etag, weak);
+            }
+            
+            bool present;
+            uint8_t length;
+            char data[MaxCondHeaderLength];
+        };
+        
     private:
         typename Context::EventLoop::QueuedEvent m_send_event;
         typename Context::EventLoop::QueuedEvent m_recv_event;
@@ -1483,6 +1611,9 @@ private:
         SendRingBuffer m_send_ring_buf;
         RecvRingBuffer m_recv_ring_buf;
         HttpPathParser<Params::MaxQueryParams> m_path_parser;
+        HttpByteRange m_range;
+        CondHeader m_if_none_match;
+        CondHeader m_if_range;
         RequestUserCallback *m_user;
         UserClientState m_user_client_state;
         size_t m_line_length;
@@ -1508,6 +1639,9 @@ private:
         bool m_req_body_recevied : 1;
         bool m_user_accepting_request_body : 1;
         bool m_assuming_timeout : 1;
+        bool m_have_range : 1;
+        bool m_accept_gzip : 1;
+        bool m_served_request : 1;
         char m_tx_buf[TxBufferSize];
         char m_rx_buf[RxBufferSize];
         char m_request_line[Params::MaxRequestLineLength];
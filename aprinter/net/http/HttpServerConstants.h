@@ -29,12 +29,15 @@ namespace APrinter {
 
 struct HttpStatusCodes {
     static constexpr char const * Okay() { return "200 OK"; }
+    static constexpr char const * PartialContent() { return "206 Partial Content"; }
+    static constexpr char const * NotModified() { return "304 Not Modified"; }
     static constexpr char const * BadRequest() { return "400 Bad Request"; }
     static constexpr char const * NotFound() { return "404 Not Found"; }
     static constexpr char const * MethodNotAllowed() { return "405 Method Not Allowed"; }
     static constexpr char const * RequestTimeout() { return "408 Request Timeout"; }
     static constexpr char const * UriTooLong() { return "414 URI Too Long"; }
     static constexpr char const * ExpectationFailed() { return "417 Expectation Failed"; }
+    static constexpr char const * RangeNotSatisfiable() { return "416 Range Not Satisfiable"; }
     static constexpr char const * RequestHeaderFieldsTooLarge() { return "431 Request Header Fields Too Large"; }
     static constexpr char const * InternalServerError() { return "500 Internal Server Error"; }
     static constexpr char const * HttpVersionNotSupported() { return "505 HTTP Version Not Supported"; }
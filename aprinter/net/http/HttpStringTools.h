@@ -128,6 +128,26 @@ void HttpStringIterTokens (AIpStack::MemRef data, TokenCallback token_cb)
     }
 }
 
+static bool HttpStringParseDecimal (AIpStack::MemRef data, uint64_t *out)
+{
+    if (data.len == 0 || data.len > 19) {
+        return false;
+    }
+    
+    uint64_t res = 0;
+    while (data.len > 0) {
+        char ch = *data.ptr++;
+        data.len--;
+        if (!(ch >= '0' && ch <= '9')) {
+            return false;
+        }
+        res = (res * 10) + (ch - '0');
+    }
+    *out = res;
+    
+    return true;
+}
+
 static bool HttpStringParseHexadecimal (AIpStack::MemRef data, uint64_t *out)
 {
     while (data.len > 0 && *data.ptr == '0') {
@@ -161,6 +181,154 @@ static bool HttpStringParseHexadecimal (AIpStack::MemRef data, uint64_t *out)
     return true;
 }
 
+/**
+ * Checks whether a token from an Accept-Encoding header accepts the given
+ * content-coding, that is names it and does not have a zero q-value.
+ */
+static bool HttpIsAcceptedCoding (AIpStack::MemRef token, char const *low_coding)
+{
+    size_t coding_len = strlen(low_coding);
+    if (token.len < coding_len || !HttpMemEqualsCaseIns(token.subTo(coding_len), low_coding)) {
+        return false;
+    }
+    
+    AIpStack::MemRef params = token.subFrom(coding_len);
+    if (params.len == 0) {
+        return true;
+    }
+    if (params.ptr[0] != ';') {
+        return false;
+    }
+    params = params.subFrom(1);
+    
+    if (params.len < 2 || AsciiToLower(params.ptr[0]) != 'q' || params.ptr[1] != '=') {
+        return true;
+    }
+    params = params.subFrom(2);
+    
+    // Only a q-value of zero (0, 0.0, 0.00, 0.000) refuses the coding.
+    if (params.len == 0 || params.ptr[0] != '0') {
+        return true;
+    }
+    for (size_t i = 1; i < params.len; i++) {
+        if (params.ptr[i] != (i == 1 ? '.' : '0')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * A single byte range from a Range request header, before it is
+ * resolved against the length of the resource.
+ */
+struct HttpByteRange {
+    uint64_t first; // suffix length if is_suffix
+    uint64_t last;
+    bool is_suffix;
+    bool have_last;
+    
+    // Determines the part of a resource of the given length which is
+    // selected. Returns false if the range is not satisfiable.
+    bool resolve (uint64_t length, uint64_t *out_offset, uint64_t *out_count) const
+    {
+        if (is_suffix) {
+            if (first == 0 || length == 0) {
+                return false;
+            }
+            uint64_t count = (first < length) ? first : length;
+            *out_offset = length - count;
+            *out_count = count;
+            return true;
+        }
+        
+        if (first >= length) {
+            return false;
+        }
+        uint64_t end = (have_last && last < length - 1) ? last : (length - 1);
+        *out_offset = first;
+        *out_count = end - first + 1;
+        return true;
+    }
+};
+
+/**
+ * Parses the value of a Range header. Only a single range in bytes
+ * is supported; for anything else false is returned and the header
+ * should be ignored (the whole resource is sent).
+ */
+static bool HttpParseByteRange (char const *value, HttpByteRange *out)
+{
+    AIpStack::MemRef data(value, strlen(value));
+    while (data.len > 0 && data.ptr[data.len - 1] == ' ') {
+        data.len--;
+    }
+    
+    if (data.len < 6 || !HttpMemEqualsCaseIns(data.subTo(6), "bytes=")) {
+        return false;
+    }
+    data = data.subFrom(6);
+    
+    size_t dash_pos = 0;
+    while (dash_pos < data.len && data.ptr[dash_pos] != '-') {
+        dash_pos++;
+    }
+    if (dash_pos == data.len) {
+        return false;
+    }
+    
+    AIpStack::MemRef first_str = data.subTo(dash_pos);
+    AIpStack::MemRef last_str = data.subFrom(dash_pos + 1);
+    
+    if (first_str.len == 0) {
+        out->is_suffix = true;
+        out->have_last = false;
+        out->last = 0;
+        return HttpStringParseDecimal(last_str, &out->first);
+    }
+    
+    out->is_suffix = false;
+    if (!HttpStringParseDecimal(first_str, &out->first)) {
+        return false;
+    }
+    
+    out->have_last = (last_str.len > 0);
+    out->last = 0;
+    if (out->have_last && (!HttpStringParseDecimal(last_str, &out->last) || out->last < out->first)) {
+        return false;
+    }
+    
+    return true;
+}
+
+/**
+ * Checks whether an entity tag matches an If-None-Match or If-Range header
+ * value, which may be a list of tags or "*". With weak comparison, "W/"
+ * prefixes are disregarded.
+ */
+static bool HttpEtagMatches (AIpStack::MemRef header, AIpStack::MemRef etag, bool weak)
+{
+    if (weak && etag.len >= 2 && etag.ptr[0] == 'W' && etag.ptr[1] == '/') {
+        etag = etag.subFrom(2);
+    }
+    
+    bool matched = false;
+    HttpStringIterTokens(header, [&](AIpStack::MemRef token) {
+        if (weak && token.len == 1 && token.ptr[0] == '*') {
+            matched = true;
+            return;
+        }
+        if (weak && token.len >= 2 && token.ptr[0] == 'W' && token.ptr[1] == '/') {
+            token = token.subFrom(2);
+        }
+        if (token.len == etag.len && !memcmp(token.ptr, etag.ptr, etag.len)) {
+            matched = true;
+        }
+    });
+    
+    return matched;
+}
+
 }
 
 #endif
@@ -110,22 +110,26 @@ static bool parse_options (int argc, char *argv[])
     cmdline_options.rt_class = -1;
     cmdline_options.rt_priority = -1;
     cmdline_options.rt_affinity = 0;
+    cmdline_options.rt_spin = false;
     cmdline_options.main_affinity = 0;
     cmdline_options.tap_dev = nullptr;
+    cmdline_options.step_trace_file = nullptr;
     
     static struct option const long_options[] = {
         {"lock-mem",      no_argument,       nullptr, 'l'},
         {"rt-class",      required_argument, nullptr, 'c'},
         {"rt-priority",   required_argument, nullptr, 'p'},
         {"rt-affinity",   required_argument, nullptr, 'a'},
+        {"rt-spin",       no_argument,       nullptr, 'w'},
         {"main-affinity", required_argument, nullptr, 'f'},
         {"tap-dev",       required_argument, nullptr, 't'},
+        {"step-trace",    required_argument, nullptr, 's'},
         {}
     };
     
     while (true) {
         int option_index = 0;
-        int opt = getopt_long(argc, argv, "lc:p:a:f:t:", long_options, &option_index);
+        int opt = getopt_long(argc, argv, "lc:p:a:wf:t:s:", long_options, &option_index);
         if (opt == -1) {
             break;
         }
@@ -169,6 +173,10 @@ static bool parse_options (int argc, char *argv[])
                 cmdline_options.rt_affinity = val;
             } break;
             
+            case 'w': {
+                cmdline_options.rt_spin = true;
+            } break;
+            
             case 'f': {
                 int val = atoi(optarg);
                 if (val == 0) {
@@ -182,6 +190,10 @@ static bool parse_options (int argc, char *argv[])
                 cmdline_options.tap_dev = optarg;
             } break;
             
+            case 's': {
+                cmdline_options.step_trace_file = optarg;
+            } break;
+            
             default: {
                 return false;
             } break;
@@ -193,6 +205,11 @@ static bool parse_options (int argc, char *argv[])
         return false;
     }
     
+    if (cmdline_options.rt_spin && cmdline_options.rt_affinity == 0) {
+        fprintf(stderr, "Error: RT spin requires RT affinity\n");
+        return false;
+    }
+    
     return true;
 }
 
@@ -48,8 +48,10 @@ struct LinuxCmdlineOptions {
     int rt_class;
     int rt_priority;
     int rt_affinity;
+    bool rt_spin;
     int main_affinity;
     char const *tap_dev;
+    char const *step_trace_file;
 };
 
 extern LinuxCmdlineOptions cmdline_options;
@@ -74,6 +76,18 @@ inline static void sei (void)
     }
 }
 
+// Used in busy-wait loops, to tell the CPU we are spinning.
+inline static void LinuxCpuRelax (void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    asm volatile ("pause" ::: "memory");
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile ("yield" ::: "memory");
+#else
+    asm volatile ("" ::: "memory");
+#endif
+}
+
 class LinuxRtThread {
 public:
     using FuncType = APrinter::Callback<void()>;
@@ -91,6 +91,8 @@ APRINTER_ALIAS_STRUCT(PrinterMainParams, (
     APRINTER_AS_VALUE(int, LookaheadCommitCount),
     APRINTER_AS_TYPE(ForceTimeout),
     APRINTER_AS_TYPE(FpType),
+    APRINTER_AS_TYPE(LinearPlannerService),
+    APRINTER_AS_TYPE(InputShaperParams),
     APRINTER_AS_TYPE(WatchdogService),
     APRINTER_AS_VALUE(bool, WatchdogDebugMode),
     APRINTER_AS_TYPE(ConfigManagerService),
@@ -108,11 +110,13 @@ APRINTER_ALIAS_STRUCT(PrinterMainAxisParams, (
     APRINTER_AS_TYPE(DefaultMax),
     APRINTER_AS_TYPE(DefaultMaxSpeed),
     APRINTER_AS_TYPE(DefaultMaxAccel),
+    APRINTER_AS_TYPE(DefaultMaxJerk),
     APRINTER_AS_TYPE(DefaultDistanceFactor),
     APRINTER_AS_TYPE(DefaultCorneringDistance),
     APRINTER_AS_TYPE(Homing),
     APRINTER_AS_VALUE(bool, IsCartesian),
     APRINTER_AS_VALUE(bool, IsExtruder),
+    APRINTER_AS_TYPE(PressureAdvance),
     APRINTER_AS_VALUE(int, StepBits),
     APRINTER_AS_TYPE(TheAxisDriverService),
     APRINTER_AS_TYPE(SlaveSteppersList)
@@ -134,6 +138,16 @@ APRINTER_ALIAS_STRUCT_EXT(PrinterMainHomingParams, (
     static bool const Enabled = true;
 ))
 
+struct PrinterMainNoPressureAdvanceParams {
+    static bool const Enabled = false;
+};
+
+APRINTER_ALIAS_STRUCT_EXT(PrinterMainPressureAdvanceParams, (
+    APRINTER_AS_TYPE(AdvanceTime)
+), (
+    static bool const Enabled = true;
+))
+
 struct PrinterMainNoTransformParams {
     static const bool Enabled = false;
 };
@@ -322,6 +336,7 @@ public:
         virtual void reply_append_pbuffer_impl (Context c, AMBRO_PGM_P pstr, size_t length) = 0;
 #endif
         virtual size_t get_send_buf_avail_impl (Context c) = 0;
+        virtual void reply_append_ok_impl (Context c) {}
     };
     
     class SendBufEventCallback {
@@ -351,6 +366,7 @@ public:
             m_error = false;
             m_refuse_on_error = false;
             m_auto_ok_and_poke = true;
+            m_custom_ok = false;
             m_send_buf_event_handler = nullptr;
             m_captured_command_handler = nullptr;
             mo->command_stream_list.prepend(this);
@@ -379,6 +395,12 @@ public:
             m_auto_ok_and_poke = auto_ok_and_poke;
         }
         
+        // When set, reply_append_ok_impl() of the callback writes the "ok" line.
+        void setCustomOk (Context c, bool custom_ok)
+        {
+            m_custom_ok = custom_ok;
+        }
+        
         void setPokeOverhead (Context c, uint8_t overhead_bytes)
         {
             m_poke_overhead = overhead_bytes;
@@ -536,7 +558,11 @@ public:
             
             if (m_auto_ok_and_poke) {
                 if (!no_ok) {
-                    this->reply_append_pstr(c, AMBRO_PSTR("ok\n"));
+                    if (m_custom_ok) {
+                        m_callback->reply_append_ok_impl(c);
+                    } else {
+                        this->reply_append_pstr(c, AMBRO_PSTR("ok\n"));
+                    }
                 }
             }
             m_callback->reply_poke_impl(c, true);
@@ -827,6 +853,7 @@ public:
         bool m_error : 1;
         bool m_refuse_on_error : 1;
         bool m_auto_ok_and_poke : 1;
+        bool m_custom_ok : 1;
         uint8_t m_poke_overhead;
         CommandStreamCallback *m_callback;
         SendBufEventCallback *m_buf_callback;
@@ -1064,6 +1091,7 @@ private:
         using DistConversion = decltype(Config::e(AxisSpec::DefaultStepsPerUnit::i()));
         using SpeedConversion = decltype(Config::e(AxisSpec::DefaultStepsPerUnit::i()) / TimeConversion());
         using AccelConversion = decltype(Config::e(AxisSpec::DefaultStepsPerUnit::i()) / (TimeConversion() * TimeConversion()));
+        using JerkConversion = decltype(Config::e(AxisSpec::DefaultStepsPerUnit::i()) / (TimeConversion() * TimeConversion() * TimeConversion()));
         
         using AbsStepFixedTypeMin = APRINTER_FP_CONST_EXPR(AbsStepFixedType::minValue().fpValueConstexpr());
         using AbsStepFixedTypeMax = APRINTER_FP_CONST_EXPR(AbsStepFixedType::maxValue().fpValueConstexpr());
@@ -1073,10 +1101,17 @@ private:
         
         using PlannerMaxSpeedRec = decltype(ExprRec(Config::e(AxisSpec::DefaultMaxSpeed::i()) * SpeedConversion()));
         using PlannerMaxAccelRec = decltype(ExprRec(Config::e(AxisSpec::DefaultMaxAccel::i()) * AccelConversion()));
+        using PlannerMaxJerkRec = decltype(ExprRec(Config::e(AxisSpec::DefaultMaxJerk::i()) * JerkConversion()));
         
         template <typename ThePrinterMain=PrinterMain>
         static constexpr typename ThePrinterMain::PhysVirtAxisMaskType AxisMask () { return (PhysVirtAxisMaskType)1 << AxisIndex; }
         
+        AMBRO_STRUCT_IF(PressureAdvanceHelper, AxisSpec::PressureAdvance::Enabled) {
+            using PlannerParams = MotionPlannerPressureAdvance<decltype(Config::e(AxisSpec::PressureAdvance::AdvanceTime::i()))>;
+        } AMBRO_STRUCT_ELSE(PressureAdvanceHelper) {
+            using PlannerParams = MotionPlannerNoPressureAdvance;
+        };
+        
         struct PlannerPrestepCallback;
         struct PlannerAxisSpec : public MotionPlannerAxisSpec<
             TheAxisDriver,
@@ -1085,6 +1120,8 @@ private:
             decltype(Config::e(AxisSpec::DefaultCorneringDistance::i())),
             PlannerMaxSpeedRec,
             PlannerMaxAccelRec,
+            PlannerMaxJerkRec,
+            typename PressureAdvanceHelper::PlannerParams,
             PlannerPrestepCallback
         > {};
         
@@ -1094,7 +1131,7 @@ private:
             using HomerGeneral = typename HomingSpec::HomerService::template HomerGeneral<
                 Context, PrinterMain, AxisSpec::StepBits, Params::StepperSegmentBufferSize,
                 Params::LookaheadBufferSize, MaxStepsPerCycle, decltype(Config::e(AxisSpec::DefaultMaxAccel::i())),
-                DistConversion, TimeConversion, decltype(Config::e(HomingSpec::HomeDir::i()))
+                decltype(Config::e(AxisSpec::DefaultMaxJerk::i())), DistConversion, TimeConversion, decltype(Config::e(HomingSpec::HomeDir::i()))
             >;
             
             APRINTER_MAKE_INSTANCE(HomerGlobal, (HomerGeneral::template HomerGlobal<Object>))
@@ -2115,10 +2152,23 @@ private:
     using MotionPlannerAxes = MapTypeList<AxesList, GetMemberType_PlannerAxisSpec>;
     using MotionPlannerLasers = MapTypeList<LasersList, GetMemberType_PlannerLaserSpec>;
     
+    AMBRO_STRUCT_IF(PlannerInputShaperHelper, Params::InputShaperParams::Enabled) {
+        using ShaperParams = typename Params::InputShaperParams;
+        using PlannerParams = InputShaperParams<
+            typename ShaperParams::ShaperType,
+            decltype(Config::e(ShaperParams::Frequency::i())),
+            decltype(Config::e(ShaperParams::Damping::i())),
+            ShaperParams::HistorySize
+        >;
+    } AMBRO_STRUCT_ELSE(PlannerInputShaperHelper) {
+        using PlannerParams = NoInputShaperParams;
+    };
+    using MotionPlannerInputShaper = typename PlannerInputShaperHelper::PlannerParams;
+    
 public:
     APRINTER_MAKE_INSTANCE(ThePlanner, (MotionPlannerArg<
         Context, typename PlannerUnionPlanner::Object, Config, MotionPlannerAxes, Params::StepperSegmentBufferSize,
-        Params::LookaheadBufferSize, Params::LookaheadCommitCount, FpType, MaxStepsPerCycle,
+        Params::LookaheadBufferSize, Params::LookaheadCommitCount, FpType, typename Params::LinearPlannerService, MotionPlannerInputShaper, MaxStepsPerCycle,
         PlannerPullHandler, PlannerFinishedHandler, PlannerAbortedHandler, PlannerUnderrunCallback,
         MotionPlannerChannels, MotionPlannerLasers
     >))
@@ -2311,6 +2361,16 @@ public:
         return get_command_in_state(c, COMMAND_LOCKED, true);
     }
     
+    static int get_planner_free_slots (Context c)
+    {
+        auto *ob = Object::self(c);
+        
+        if (ob->planner_state == PLANNER_NONE) {
+            return Params::LookaheadBufferSize;
+        }
+        return ThePlanner::getNumFreeSegments(c);
+    }
+    
     static MsgOutputStream * get_msg_output (Context c)
     {
         auto *ob = Object::self(c);
@@ -2504,7 +2564,7 @@ private:
                         char code = cmd->getPartCode(c, part);
                         
                         if (!is_dwell && code == 'F') {
-                            time_freq_by_max_speed = (FpType)(TimeConversion::value() / Params::SpeedLimitMultiply::value()) / FloatMakePosOrPosZero(cmd->getPartFpValue(c, part));
+                            time_freq_by_max_speed = feedrate_to_time_freq_by_max_speed(cmd->getPartFpValue(c, part));
                             if (save_f) {
                                 ob->time_freq_by_max_speed = time_freq_by_max_speed;
                             }
@@ -2853,6 +2913,29 @@ public:
         o->move_time_freq_by_max_speed = time_freq_by_max_speed * o->speed_ratio_rec;
     }
     
+    static FpType feedrate_to_time_freq_by_max_speed (FpType feedrate)
+    {
+        return (FpType)(TimeConversion::value() / Params::SpeedLimitMultiply::value()) / FloatMakePosOrPosZero(feedrate);
+    }
+    
+    static FpType get_modal_time_freq_by_max_speed (Context c)
+    {
+        auto *o = Object::self(c);
+        return o->time_freq_by_max_speed;
+    }
+    
+    static void set_modal_time_freq_by_max_speed (Context c, FpType time_freq_by_max_speed)
+    {
+        auto *o = Object::self(c);
+        o->time_freq_by_max_speed = time_freq_by_max_speed;
+    }
+    
+    static PhysVirtAxisMaskType get_relative_axes (Context c)
+    {
+        auto *o = Object::self(c);
+        return o->axis_relative;
+    }
+    
     static void move_end (Context c, TheCommand *err_output, MoveEndCallback callback, bool is_rapid_move=true)
     {
         auto *ob = Object::self(c);
@@ -42,6 +42,7 @@
 #include <aprinter/base/Hints.h>
 #include <aprinter/misc/ClockUtils.h>
 #include <aprinter/printer/actuators/AxisDriverConsumer.h>
+#include <aprinter/printer/actuators/AxisDriverDelay.h>
 
 namespace APrinter {
 
@@ -106,6 +107,7 @@ public:
     using AMulType = decltype(AXIS_STEPPER_AMUL_EXPR_HELPER(AXIS_STEPPER_DUMMY_VARS));
     using ADiscShiftedType = decltype(AccelFixedType().template shiftBits<(-discriminant_prec)>());
     using DelayParams = typename Params::DelayParams;
+    using DelayFeature = AxisDriverDelay<Context, Object, DelayParams, PreloadCommands, TimeFixedType>;
     using StepContext = typename TimerInstance::HandlerContext;
     
 private:
@@ -170,6 +172,9 @@ private:
 public:
     static constexpr double AsyncMinStepTime() { return DelayFeature::AsyncMinStepTime(); }
     static constexpr double SyncMinStepTime() { return DelayFeature::SyncMinStepTime(); }
+    static constexpr double AccelPeakFactor() { return 1.0; }
+    static constexpr double JerkFactor() { return 0.0; }
+    static bool const SmoothAccelChanges = false;
     
     struct Command {
         DirStepFixedType dir_x;
@@ -501,106 +506,6 @@ private:
     }
     struct TimerHandler : public AMBRO_WFUNC_TD(&AxisDriver::timer_handler) {};
     
-    AMBRO_STRUCT_IF(DelayFeature, DelayParams::Enabled) {
-        using DelayClockUtils = FastClockUtils<Context>;
-        using DelayTimeType = typename DelayClockUtils::TimeType;
-        
-        static_assert(TimeFixedType::maxValue().bitsValue() * Clock::time_unit <= DelayClockUtils::WorkingTimeSpan, "Fast clock is too fast");
-        
-        // Note +1.99 to assure we do actually wait at least that much not lesser:
-        // - +0.99 so that we effectively round up to an integer number of ticks (not down).
-        // - +1.0 because waitSafe() only waits for the clock to increment by at least the
-        //   requested number of ticks, which could takes less time than that number of
-        //   clock periods.
-        static DelayTimeType const MinDirSetTicks   = 1e-6 * DelayParams::DirSetTime::value()   * DelayClockUtils::time_freq + 1.99;
-        static DelayTimeType const MinStepHighTicks = 1e-6 * DelayParams::StepHighTime::value() * DelayClockUtils::time_freq + 1.99;
-        static DelayTimeType const MinStepLowTicks  = 1e-6 * DelayParams::StepLowTime::value()  * DelayClockUtils::time_freq + 1.99;
-        
-        static constexpr double MinStepTimeFactor = 1.2;
-        
-        static constexpr double AsyncMinStepTime ()
-        {
-            return MinStepTimeFactor * 1e-6 * ConstexprFmax(
-                (PreloadCommands ? DelayParams::DirSetTime::value() : 0.0),
-                DelayParams::StepLowTime::value()
-            );
-        }
-        
-        static constexpr double SyncMinStepTime ()
-        {
-            return MinStepTimeFactor * 1e-6 * (
-                (!PreloadCommands ? DelayParams::DirSetTime::value() : 0.0) +
-                DelayParams::StepHighTime::value()
-            );
-        }
-        
-        template <typename ThisContext>
-        static void wait_for_dir (ThisContext c)
-        {
-            auto *o = Object::self(c);
-            o->m_dir_timer.waitSafe(c, MinDirSetTicks);
-        }
-        
-        template <typename ThisContext>
-        static void wait_for_step_high (ThisContext c)
-        {
-            auto *o = Object::self(c);
-            o->m_step_timer.waitSafe(c, MinStepHighTicks);
-        }
-        
-        template <typename ThisContext>
-        static void wait_for_step_low (ThisContext c)
-        {
-            auto *o = Object::self(c);
-            o->m_step_timer.waitSafe(c, MinStepLowTicks);
-        }
-        
-        template <typename ThisContext>
-        static void set_dir_timer_for_step (ThisContext c)
-        {
-            auto *o = Object::self(c);
-            o->m_dir_timer.setAfter(c, MinDirSetTicks);
-        }
-        
-        template <typename ThisContext>
-        static void set_step_timer_to_now (ThisContext c)
-        {
-            auto *o = Object::self(c);
-            o->m_step_timer.setAfter(c, 0);
-        }
-        
-        template <typename ThisContext>
-        static void set_step_timer_for_high (ThisContext c)
-        {
-            auto *o = Object::self(c);
-            o->m_step_timer.setAfter(c, MinStepHighTicks);
-        }
-        
-        template <typename ThisContext>
-        static void set_step_timer_for_low (ThisContext c)
-        {
-            auto *o = Object::self(c);
-            o->m_step_timer.setAfter(c, MinStepLowTicks);
-        }
-        
-        struct Object : public ObjBase<DelayFeature, typename AxisDriver::Object, EmptyTypeList> {
-            typename DelayClockUtils::PollTimer m_dir_timer;
-            typename DelayClockUtils::PollTimer m_step_timer;
-        };
-    }
-    AMBRO_STRUCT_ELSE(DelayFeature) {
-        static constexpr double AsyncMinStepTime () { return 0.0; }
-        static constexpr double SyncMinStepTime () { return 0.0; }
-        template <typename ThisContext> static void wait_for_dir (ThisContext c) {}
-        template <typename ThisContext> static void wait_for_step_high (ThisContext c) {}
-        template <typename ThisContext> static void wait_for_step_low (ThisContext c) {}
-        template <typename ThisContext> static void set_dir_timer_for_step (ThisContext c) {}
-        template <typename ThisContext> static void set_step_timer_to_now (ThisContext c) {}
-        template <typename ThisContext> static void set_step_timer_for_high (ThisContext c) {}
-        template <typename ThisContext> static void set_step_timer_for_low (ThisContext c) {}
-        struct Object {};
-    };
-    
 public:
     struct Object : public ObjBase<AxisDriver, ParentObject, MakeTypeList<
         TheDebugObject,
@@ -628,18 +533,6 @@ public:
     };
 };
 
-struct AxisDriverNoDelayParams {
-    static bool const Enabled = false;
-};
-
-APRINTER_ALIAS_STRUCT_EXT(AxisDriverDelayParams, (
-    APRINTER_AS_TYPE(DirSetTime),
-    APRINTER_AS_TYPE(StepHighTime),
-    APRINTER_AS_TYPE(StepLowTime)
-), (
-    static bool const Enabled = true;
-))
-
 APRINTER_ALIAS_STRUCT_EXT(AxisDriverService, (
     APRINTER_AS_TYPE(TimerService),
     APRINTER_AS_TYPE(PrecisionParams),
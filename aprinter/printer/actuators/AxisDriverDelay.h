@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AMBROLIB_AXIS_DRIVER_DELAY_H
+#define AMBROLIB_AXIS_DRIVER_DELAY_H
+
+#include <aprinter/meta/ConstexprMath.h>
+#include <aprinter/meta/TypeListUtils.h>
+#include <aprinter/meta/ServiceUtils.h>
+#include <aprinter/base/Object.h>
+#include <aprinter/misc/ClockUtils.h>
+
+namespace APrinter {
+
+struct AxisDriverNoDelayParams {
+    static bool const Enabled = false;
+};
+
+APRINTER_ALIAS_STRUCT_EXT(AxisDriverDelayParams, (
+    APRINTER_AS_TYPE(DirSetTime),
+    APRINTER_AS_TYPE(StepHighTime),
+    APRINTER_AS_TYPE(StepLowTime)
+), (
+    static bool const Enabled = true;
+))
+
+/**
+ * Busy-wait delays between direction and step pin changes, shared by the
+ * stepper drivers. The DelayParams::Enabled=false variant does nothing.
+ */
+template <typename Context, typename ParentObject, typename DelayParams, bool PreloadCommands, typename TimeFixedType, bool Enabled = DelayParams::Enabled>
+class AxisDriverDelay {
+    using Clock = typename Context::Clock;
+    
+public:
+    struct Object;
+    
+    using DelayClockUtils = FastClockUtils<Context>;
+    using DelayTimeType = typename DelayClockUtils::TimeType;
+    
+    static_assert(TimeFixedType::maxValue().bitsValue() * Clock::time_unit <= DelayClockUtils::WorkingTimeSpan, "Fast clock is too fast");
+    
+    // Note +1.99 to assure we do actually wait at least that much not lesser:
+    // - +0.99 so that we effectively round up to an integer number of ticks (not down).
+    // - +1.0 because waitSafe() only waits for the clock to increment by at least the
+    //   requested number of ticks, which could takes less time than that number of
+    //   clock periods.
+    static DelayTimeType const MinDirSetTicks   = 1e-6 * DelayParams::DirSetTime::value()   * DelayClockUtils::time_freq + 1.99;
+    static DelayTimeType const MinStepHighTicks = 1e-6 * DelayParams::StepHighTime::value() * DelayClockUtils::time_freq + 1.99;
+    static DelayTimeType const MinStepLowTicks  = 1e-6 * DelayParams::StepLowTime::value()  * DelayClockUtils::time_freq + 1.99;
+    
+    static constexpr double MinStepTimeFactor = 1.2;
+    
+    static constexpr double AsyncMinStepTime ()
+    {
+        return MinStepTimeFactor * 1e-6 * ConstexprFmax(
+            (PreloadCommands ? DelayParams::DirSetTime::value() : 0.0),
+            DelayParams::StepLowTime::value()
+        );
+    }
+    
+    static constexpr double SyncMinStepTime ()
+    {
+        return MinStepTimeFactor * 1e-6 * (
+            (!PreloadCommands ? DelayParams::DirSetTime::value() : 0.0) +
+            DelayParams::StepHighTime::value()
+        );
+    }
+    
+    template <typename ThisContext>
+    static void wait_for_dir (ThisContext c)
+    {
+        auto *o = Object::self(c);
+        o->m_dir_timer.waitSafe(c, MinDirSetTicks);
+    }
+    
+    template <typename ThisContext>
+    static void wait_for_step_high (ThisContext c)
+    {
+        auto *o = Object::self(c);
+        o->m_step_timer.waitSafe(c, MinStepHighTicks);
+    }
+    
+    template <typename ThisContext>
+    static void wait_for_step_low (ThisContext c)
+    {
+        auto *o = Object::self(c);
+        o->m_step_timer.waitSafe(c, MinStepLowTicks);
+    }
+    
+    template <typename ThisContext>
+    static void set_dir_timer_for_step (ThisContext c)
+    {
+        auto *o = Object::self(c);
+        o->m_dir_timer.setAfter(c, MinDirSetTicks);
+    }
+    
+    template <typename ThisContext>
+    static void set_step_timer_to_now (ThisContext c)
+    {
+        auto *o = Object::self(c);
+        o->m_step_timer.setAfter(c, 0);
+    }
+    
+    template <typename ThisContext>
+    static void set_step_timer_for_high (ThisContext c)
+    {
+        auto *o = Object::self(c);
+        o->m_step_timer.setAfter(c, MinStepHighTicks);
+    }
+    
+    template <typename ThisContext>
+    static void set_step_timer_for_low (ThisContext c)
+    {
+        auto *o = Object::self(c);
+        o->m_step_timer.setAfter(c, MinStepLowTicks);
+    }
+    
+    struct Object : public ObjBase<AxisDriverDelay, ParentObject, EmptyTypeList> {
+        typename DelayClockUtils::PollTimer m_dir_timer;
+        typename DelayClockUtils::PollTimer m_step_timer;
+    };
+};
+
+template <typename Context, typename ParentObject, typename DelayParams, bool PreloadCommands, typename TimeFixedType>
+class AxisDriverDelay<Context, ParentObject, DelayParams, PreloadCommands, TimeFixedType, false> {
+public:
+    static constexpr double AsyncMinStepTime () { return 0.0; }
+    static constexpr double SyncMinStepTime () { return 0.0; }
+    template <typename ThisContext> static void wait_for_dir (ThisContext c) {}
+    template <typename ThisContext> static void wait_for_step_high (ThisContext c) {}
+    template <typename ThisContext> static void wait_for_step_low (ThisContext c) {}
+    template <typename ThisContext> static void set_dir_timer_for_step (ThisContext c) {}
+    template <typename ThisContext> static void set_step_timer_to_now (ThisContext c) {}
+    template <typename ThisContext> static void set_step_timer_for_high (ThisContext c) {}
+    template <typename ThisContext> static void set_step_timer_for_low (ThisContext c) {}
+    struct Object : public ObjBase<AxisDriverDelay, ParentObject, EmptyTypeList> {};
+};
+
+}
+
+#endif
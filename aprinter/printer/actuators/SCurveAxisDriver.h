@@ -0,0 +1,535 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AMBROLIB_SCURVE_AXIS_DRIVER_H
+#define AMBROLIB_SCURVE_AXIS_DRIVER_H
+
+#include <stdint.h>
+
+#include <aprinter/meta/FixedPoint.h>
+#include <aprinter/meta/WrapFunction.h>
+#include <aprinter/meta/TypeListUtils.h>
+#include <aprinter/meta/ListForEach.h>
+#include <aprinter/meta/ServiceUtils.h>
+#include <aprinter/base/Object.h>
+#include <aprinter/base/DebugObject.h>
+#include <aprinter/base/Assert.h>
+#include <aprinter/base/Hints.h>
+#include <aprinter/math/FloatTools.h>
+#include <aprinter/printer/actuators/AxisDriverConsumer.h>
+#include <aprinter/printer/actuators/AxisDriverDelay.h>
+
+namespace APrinter {
+
+/**
+ * Position of an S-curve command as a polynomial in u = time/T,
+ *   p(u) = u*(v0 + u*(k2 + u*(k3 + u*(k4 + u*k5)))),
+ * see SCurveAxisDriver.
+ */
+template <typename FpType>
+struct SCurvePoly {
+    FpType v0;
+    FpType k2;
+    FpType k3;
+    FpType k4;
+    FpType k5;
+};
+
+/**
+ * Profiles of S-curve commands, by which ends of the command
+ * the acceleration is brought to zero at.
+ */
+enum SCurveProfile : uint8_t {
+    SCURVE_PROFILE_NONE  = 0,
+    SCURVE_PROFILE_START = 1 << 0,
+    SCURVE_PROFILE_END   = 1 << 1,
+    SCURVE_PROFILE_BOTH  = SCURVE_PROFILE_START | SCURVE_PROFILE_END
+};
+
+/**
+ * Returns the position polynomial of a command of x steps with
+ * acceleration term a, given v0 = x-a.
+ */
+template <typename FpType>
+SCurvePoly<FpType> SCurveMakePoly (FpType v0, FpType a, uint8_t profile)
+{
+    switch (profile) {
+        case SCURVE_PROFILE_START:
+            return SCurvePoly<FpType>{v0, 0.0f, 3.0f * a, -3.0f * a, a};
+        case SCURVE_PROFILE_END:
+            return SCurvePoly<FpType>{v0, a, -a, 2.0f * a, -a};
+        case SCURVE_PROFILE_BOTH:
+            return SCurvePoly<FpType>{v0, 0.0f, 2.0f * a, -a, 0.0f};
+        default:
+            return SCurvePoly<FpType>{v0, a, 0.0f, 0.0f, 0.0f};
+    }
+}
+
+/**
+ * Iteration limits of SCurveSolveStepTime. The first step of a command may
+ * start from rest, where Newton iteration cannot be used and it takes some
+ * bisection, so it is solved when the command is generated. The following
+ * steps are solved in the step interrupt starting from the previous step;
+ * nearly all converge in three iterations, and the limit bounds the time
+ * spent in the interrupt for the rest.
+ */
+static int const SCurveCommandSolveIterations = 32;
+static int const SCurveStepSolveIterations = 4;
+
+/**
+ * The largest acceleration of any of the profiles relative to the planned
+ * (average) acceleration of the command, see SCurveAxisDriver.
+ */
+static constexpr double SCurveAccelPeakFactor = 1.5;
+
+/**
+ * Returns the fraction of the command's duration at which the position
+ * reaches k, given the fraction u_prev at which it was below k. Gives up
+ * after max_iterations, returning the best estimate so far, which is
+ * still no less than u_prev.
+ */
+template <typename FpType>
+FpType SCurveSolveStepTime (SCurvePoly<FpType> const &p, FpType tolerance, FpType k, FpType u_prev, int max_iterations)
+{
+    FpType lo = u_prev;
+    FpType hi = 1.0f;
+    FpType u = u_prev;
+    
+    for (int i = 0; i < max_iterations; i++) {
+        FpType err = u * (p.v0 + u * (p.k2 + u * (p.k3 + u * (p.k4 + u * p.k5)))) - k;
+        FpType deriv = p.v0 + u * (2.0f * p.k2 + u * (3.0f * p.k3 + u * (4.0f * p.k4 + u * (5.0f * p.k5))));
+        
+        if (err < 0.0f) {
+            lo = u;
+        } else {
+            hi = u;
+        }
+        
+        // Done when the Newton step is within tolerance. Otherwise take it
+        // if it stays inside the bracket, else bisect.
+        FpType next = 0.5f * (lo + hi);
+        if (deriv > 0.0f) {
+            FpType newton = u - err / deriv;
+            if (FloatAbs(newton - u) <= tolerance) {
+                return FloatMax(lo, FloatMin(hi, newton));
+            }
+            if (newton > lo && newton < hi) {
+                next = newton;
+            }
+        }
+        
+        u = next;
+        if (hi - lo <= tolerance) {
+            break;
+        }
+    }
+    
+    return u;
+}
+
+/**
+ * Stepper driver which executes the planner's constant-acceleration commands
+ * with a jerk-limited (S-curve) velocity profile.
+ * 
+ * A command of x steps, duration T and acceleration term a (|a| <= x) has
+ * the same normalized start and end velocities (x-a) and (x+a) as in
+ * AxisDriver, and takes exactly the time the planner gave it, so the
+ * planner and the other axes are unaffected. Where the acceleration stays
+ * the same from one command to the next, the command keeps it up to the
+ * boundary; where it changes, the acceleration of both commands is brought
+ * to zero at the boundary. The planner tells which is the case for each end
+ * of the command (SmoothAccelChanges), which selects one of the profiles,
+ * with p(u) = (x-a)*u + a*f(u), u = time/T in [0, 1]:
+ * 
+ *   none:  f(u) = u^2                          (constant acceleration)
+ *   start: f(u) = 3*u^3 - 3*u^4 + u^5
+ *   end:   f(u) = u^2 - u^3 + 2*u^4 - u^5
+ *   both:  f(u) = 2*u^3 - u^4                  (smoothstep velocity)
+ * 
+ * Each has f(1) = 1 and f'(1) = 2, with f'' zero at the smoothed ends and
+ * equal to the planned 2 at the others. Velocity is monotonic within each
+ * command. The acceleration peaks at 1.5 times the planned (average)
+ * acceleration for "both" and at about 1.37 times for "start" and "end".
+ * The planner divides the maximum acceleration of the axis by the larger
+ * of these (AccelPeakFactor), so the peaks stay within it.
+ * 
+ * The jerk a*f'''(u)/T^3 of a command with planned acceleration A = 2*a/T^2
+ * is at most 6*A/T for "both" and 9*A/T for "start" and "end" (JerkFactor),
+ * so it depends on how long the command is. The planner keeps it within
+ * the configured maximum jerk by giving short commands a lower acceleration.
+ * 
+ * Like in AxisDriver, step k of a command is generated when the position
+ * reaches k, for k = 0..x-1. There is no closed form inverse of p, so step
+ * times are found by Newton iteration starting from the previous step,
+ * safeguarded by bisection for the ends of phases where p'(u) may be zero.
+ * The time of step 1 is found when the command is generated, and the step
+ * interrupt does at most SCurveStepSolveIterations iterations per step.
+ * The arithmetic is done in FpType, so this driver needs a hardware FPU
+ * for FpType, which the configuration generator enforces.
+ */
+template <typename Arg>
+class SCurveAxisDriver {
+    using Context       = typename Arg::Context;
+    using ParentObject  = typename Arg::ParentObject;
+    using Stepper       = typename Arg::Stepper;
+    using ConsumersList = typename Arg::ConsumersList;
+    using Params        = typename Arg::Params;
+    
+private:
+    static const int step_bits = Params::PrecisionParams::step_bits;
+    static const int time_bits = Params::PrecisionParams::time_bits;
+    
+    struct TimerHandler;
+    
+public:
+    struct Object;
+    using Clock = typename Context::Clock;
+    using TimeType = typename Clock::TimeType;
+    using FpType = typename Params::FpType;
+    APRINTER_MAKE_INSTANCE(TimerInstance, (Params::TimerService::template InterruptTimer<Context, Object, TimerHandler>))
+    using StepFixedType = FixedPoint<step_bits, false, 0>;
+    using DirStepFixedType = FixedPoint<step_bits + 1, false, 0>;
+    using DirStepIntType = typename DirStepFixedType::IntType;
+    using AccelFixedType = FixedPoint<step_bits, true, 0>;
+    using TimeFixedType = FixedPoint<time_bits, false, 0>;
+    using CommandCallbackContext = typename TimerInstance::HandlerContext;
+    using DelayParams = typename Params::DelayParams;
+    using DelayFeature = AxisDriverDelay<Context, Object, DelayParams, false, TimeFixedType>;
+    using StepContext = typename TimerInstance::HandlerContext;
+    
+private:
+    using TheDebugObject = DebugObject<Context, Object>;
+    
+public:
+    static constexpr double AsyncMinStepTime() { return DelayFeature::AsyncMinStepTime(); }
+    static constexpr double SyncMinStepTime() { return DelayFeature::SyncMinStepTime(); }
+    static constexpr double AccelPeakFactor() { return SCurveAccelPeakFactor; }
+    static constexpr double JerkFactor() { return 9.0; }
+    static bool const SmoothAccelChanges = true;
+    
+    struct Command {
+        DirStepFixedType dir_x;
+        TimeFixedType t;
+        FpType v0;
+        FpType a;
+        FpType tolerance;
+        FpType u1;
+        uint8_t profile;
+    };
+    
+    static void generate_command (bool dir, StepFixedType x, TimeFixedType t, AccelFixedType a, bool smooth_start, bool smooth_end, Command *cmd)
+    {
+        AMBRO_ASSERT(a >= -x)
+        AMBRO_ASSERT(a <= x)
+        
+        cmd->dir_x = DirStepFixedType::importBits(x.bitsValue() | ((DirStepIntType)dir << step_bits));
+        cmd->t = t;
+        cmd->v0 = (FpType)x.bitsValue() - (FpType)a.bitsValue();
+        cmd->a = a.bitsValue();
+        cmd->profile = (smooth_start ? SCURVE_PROFILE_START : 0) | (smooth_end ? SCURVE_PROFILE_END : 0);
+        // Solve the step times to a quarter of a clock tick.
+        cmd->tolerance = (t.bitsValue() == 0) ? (FpType)1.0f : (FpType)0.25f / t.bitsValue();
+        cmd->u1 = 0.0f;
+        if (x.bitsValue() > 1) {
+            SCurvePoly<FpType> poly = SCurveMakePoly<FpType>(cmd->v0, cmd->a, cmd->profile);
+            cmd->u1 = SCurveSolveStepTime<FpType>(poly, cmd->tolerance, 1.0f, 0.0f, SCurveCommandSolveIterations);
+        }
+    }
+    
+    static void init (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        TimerInstance::init(c);
+#ifdef AMBROLIB_ASSERTIONS
+        o->m_running = false;
+#endif
+#ifdef AXISDRIVER_DETECT_OVERLOAD
+        o->m_overload = false;
+#endif
+        
+        TheDebugObject::init(c);
+    }
+    
+    static void deinit (Context c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::deinit(c);
+        AMBRO_ASSERT(!o->m_running)
+        
+        TimerInstance::deinit(c);
+    }
+    
+    static void setPrestepCallbackEnabled (Context c, bool enabled)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        AMBRO_ASSERT(!o->m_running)
+        
+        o->m_prestep_callback_enabled = enabled;
+    }
+    
+    template <typename TheConsumer>
+    static void start (Context c, TimeType start_time, Command *first_command)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        AMBRO_ASSERT(!o->m_running)
+        AMBRO_ASSERT(first_command)
+
+#ifdef AMBROLIB_ASSERTIONS
+        o->m_running = true;
+#endif
+#ifdef AXISDRIVER_DETECT_OVERLOAD
+        o->m_overload = false;
+#endif
+        o->m_consumer_id = TypeListIndex<typename ConsumersList::List, TheConsumer>::Value;
+        o->m_time = start_time;
+        
+        bool command_completed = load_command(c, first_command);
+        TimeType timer_t = command_completed ? o->m_time : start_time;
+        
+        DelayFeature::set_step_timer_to_now(c);
+        TimerInstance::setFirst(c, timer_t);
+    }
+    
+    static void stop (Context c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        
+        TimerInstance::unset(c);
+#ifdef AMBROLIB_ASSERTIONS
+        o->m_running = false;
+#endif
+    }
+    
+    static StepFixedType getAbortedCmdSteps (Context c, bool *dir)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        AMBRO_ASSERT(!o->m_running)
+        
+        *dir = (o->m_current_command->dir_x.bitsValue() & ((DirStepIntType)1 << step_bits));
+        if (!o->m_notend) {
+            return StepFixedType::importBits(0);
+        }
+        return StepFixedType::importBits(o->m_x.bitsValue() - o->m_pos.bitsValue());
+    }
+    
+    static StepFixedType getPendingCmdSteps (Context c, Command const *cmd, bool *dir)
+    {
+        *dir = (cmd->dir_x.bitsValue() & ((DirStepIntType)1 << step_bits));
+        return StepFixedType::importBits(cmd->dir_x.bitsValue() & (((DirStepIntType)1 << step_bits) - 1));
+    }
+
+#ifdef AXISDRIVER_DETECT_OVERLOAD
+    static bool overloadOccurred (Context c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        AMBRO_ASSERT(!o->m_running)
+        
+        return o->m_overload;
+    }
+#endif
+    
+    using GetTimer = TimerInstance;
+    
+private:
+    template <int ConsumerIndex>
+    struct CallbackHelper {
+        using TheConsumer = TypeListGet<typename ConsumersList::List, ConsumerIndex>;
+        
+        template <typename... Args>
+        AMBRO_ALWAYS_INLINE
+        static bool call_command_callback (Args... args)
+        {
+            return TheConsumer::CommandCallback::call(args...);
+        }
+        
+        template <typename... Args>
+        AMBRO_ALWAYS_INLINE
+        static bool call_prestep_callback (Args... args)
+        {
+            return TheConsumer::PrestepCallback::call(args...);
+        }
+    };
+    
+    template <typename This=SCurveAxisDriver>
+    using CallbackHelperList = IndexElemList<typename This::ConsumersList::List, CallbackHelper>;
+    
+    template <typename T>
+    inline static T volatile_read (T &x)
+    {
+        return *(T volatile *)&x;
+    }
+    
+    template <typename ThisContext>
+    AMBRO_ALWAYS_INLINE
+    static bool load_command (ThisContext c, Command *command)
+    {
+        auto *o = Object::self(c);
+        
+        Stepper::setDir(c, command->dir_x.bitsValue() & ((DirStepIntType)1 << step_bits));
+        DelayFeature::set_dir_timer_for_step(c);
+        
+        // Volatile read so that the computations below happen after setDir(),
+        // giving the direction signal time to settle before the step.
+        DirStepFixedType dir_x = DirStepFixedType::importBits(volatile_read(command->dir_x.m_bits.m_int));
+        
+        o->m_current_command = command;
+        o->m_x = StepFixedType::importBits(dir_x.bitsValue() & (((DirStepIntType)1 << step_bits) - 1));
+        o->m_notend = (o->m_x.bitsValue() != 0);
+        
+        if (AMBRO_UNLIKELY(!o->m_notend)) {
+            o->m_time += command->t.bitsValue();
+            return true;
+        }
+        
+        o->m_pos = StepFixedType::importBits(0);
+        o->m_u = 0.0f;
+        o->m_poly = SCurveMakePoly<FpType>(command->v0, command->a, command->profile);
+        
+        return false;
+    }
+    
+    static bool timer_handler (StepContext c)
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(o->m_running)
+
+#ifdef AXISDRIVER_DETECT_OVERLOAD
+        if ((TimeType)(Clock::getTime(c) - TimerInstance::getLastSetTime(c)) >= (TimeType)(0.001 * Clock::time_freq)) {
+            o->m_overload = true;
+        }
+#endif
+        
+        Command *current_command = o->m_current_command;
+        
+        if (AMBRO_LIKELY(!o->m_notend)) {
+            bool res = ListForOne<CallbackHelperList<>, 0, bool>(o->m_consumer_id, [&] APRINTER_TL(helper, return helper::call_command_callback(c, &current_command)));
+            if (AMBRO_UNLIKELY(!res)) {
+#ifdef AMBROLIB_ASSERTIONS
+                o->m_running = false;
+#endif
+                return false;
+            }
+            
+            bool command_completed = load_command(c, current_command);
+            if (command_completed) {
+                DelayFeature::wait_for_step_low(c);
+                TimerInstance::setNext(c, o->m_time);
+                return true;
+            }
+        }
+        
+        if (AMBRO_UNLIKELY(o->m_prestep_callback_enabled)) {
+            bool res = ListForOne<CallbackHelperList<>, 0, bool>(o->m_consumer_id, [&] APRINTER_TL(helper, return helper::call_prestep_callback(c)));
+            if (AMBRO_UNLIKELY(res)) {
+#ifdef AMBROLIB_ASSERTIONS
+                o->m_running = false;
+#endif
+                return false;
+            }
+        }
+        
+        DelayFeature::wait_for_dir(c);
+        
+        DelayFeature::wait_for_step_low(c);
+        Stepper::stepOn(c);
+        DelayFeature::set_step_timer_for_high(c);
+        
+        // The next step time is computed while the step signal is high,
+        // which also makes sure the pulse is long enough for the driver.
+        
+        o->m_pos.m_bits.m_int++;
+        
+        TimeType next_time;
+        if (AMBRO_UNLIKELY(o->m_pos == o->m_x)) {
+            o->m_time += current_command->t.bitsValue();
+            o->m_notend = false;
+            next_time = o->m_time;
+        } else {
+            if (o->m_pos.bitsValue() == 1) {
+                o->m_u = current_command->u1;
+            } else {
+                o->m_u = SCurveSolveStepTime<FpType>(o->m_poly, current_command->tolerance, o->m_pos.bitsValue(), o->m_u, SCurveStepSolveIterations);
+            }
+            next_time = o->m_time + (TimeType)(o->m_u * current_command->t.bitsValue());
+        }
+        
+        DelayFeature::wait_for_step_high(c);
+        Stepper::stepOff(c);
+        DelayFeature::set_step_timer_for_low(c);
+        
+        TimerInstance::setNext(c, next_time);
+        return true;
+    }
+    struct TimerHandler : public AMBRO_WFUNC_TD(&SCurveAxisDriver::timer_handler) {};
+    
+public:
+    struct Object : public ObjBase<SCurveAxisDriver, ParentObject, MakeTypeList<
+        TheDebugObject,
+        TimerInstance,
+        DelayFeature
+    >> {
+#ifdef AMBROLIB_ASSERTIONS
+        bool m_running;
+#endif
+#ifdef AXISDRIVER_DETECT_OVERLOAD
+        bool m_overload;
+#endif
+        bool m_prestep_callback_enabled;
+        bool m_notend;
+        uint8_t m_consumer_id;
+        StepFixedType m_x;
+        StepFixedType m_pos;
+        FpType m_u;
+        SCurvePoly<FpType> m_poly;
+        TimeType m_time;
+        Command *m_current_command;
+    };
+};
+
+APRINTER_ALIAS_STRUCT_EXT(SCurveAxisDriverService, (
+    APRINTER_AS_TYPE(TimerService),
+    APRINTER_AS_TYPE(PrecisionParams),
+    APRINTER_AS_TYPE(DelayParams),
+    APRINTER_AS_TYPE(FpType)
+), (
+    APRINTER_ALIAS_STRUCT_EXT(Driver, (
+        APRINTER_AS_TYPE(Context),
+        APRINTER_AS_TYPE(ParentObject),
+        APRINTER_AS_TYPE(Stepper),
+        APRINTER_AS_TYPE(ConsumersList)
+    ), (
+        using Params = SCurveAxisDriverService;
+        APRINTER_DEF_INSTANCE(Driver, SCurveAxisDriver)
+    ))
+))
+
+}
+
+#endif
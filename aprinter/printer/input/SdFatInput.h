@@ -76,6 +76,9 @@ private:
     static size_t const DirListReplyRequestExtra = 24;
     static_assert(BlockSize == 512, "BlockSize must be 512");
     
+    using TheFile = typename TheFs::template File<false>;
+    static typename TheFile::IoMode const FileIoMode = Params::StreamFromCache ? TheFile::IoMode::FS_BUFFER : TheFile::IoMode::USER_BUFFER;
+    
     // NOTE: Check bit field widths at the bottom before adding new state values.
     enum InitState {
         INIT_STATE_INACTIVE,
@@ -112,6 +115,11 @@ public:
     static size_t const ReadBlockSize = BlockSize;
     using DataWordType = typename TheBlockAccess::DataWordType;
     
+    // In streaming mode, the file is read through the block cache, and the
+    // client consumes the data in place using startReadBlock, getBlockData
+    // and releaseBlock instead of having it copied by startRead.
+    static bool const StreamFromCache = Params::StreamFromCache;
+    
     static void init (Context c)
     {
         TheBlockAccess::init(c);
@@ -153,7 +161,7 @@ public:
         o->file_state = FILE_STATE_PAUSED;
     }
     
-    static bool rewind (Context c, typename ThePrinterMain::TheCommand *err_output)
+    static bool seek (Context c, typename ThePrinterMain::TheCommand *err_output, uint32_t block)
     {
         auto *o = Object::self(c);
         auto *fs_o = UnionFsPart::Object::self(c);
@@ -163,7 +171,18 @@ public:
         if (!check_file_paused(c, err_output)) {
             return false;
         }
+        if (block > 0 && block >= (fs_o->file.getSize(c) + (BlockSize - 1)) / BlockSize) {
+            err_output->reply_append_error(c, AMBRO_PSTR("SeekBeyondEof"));
+            return false;
+        }
+        // Seeking to the start is done right away, other positions are sought
+        // asynchronously as part of the first read.
+        if (o->file_block_held) {
+            release_block(c);
+        }
         fs_o->file.rewind(c);
+        o->file_seek_pending = (block != 0);
+        o->seek_block = block;
         o->file_eof = false;
         ClientParams::ClearBufferHandler::call(c);
         return true;
@@ -194,11 +213,58 @@ public:
         TheDebugObject::access(c);
         AMBRO_ASSERT(o->file_state == FILE_STATE_RUNNING)
         AMBRO_ASSERT(!o->file_eof)
+        AMBRO_ASSERT(!StreamFromCache)
         
-        fs_o->file.startReadUserBuf(c, buf);
+        if (o->file_seek_pending) {
+            o->seek_buf = buf;
+            fs_o->file.startSeek(c, o->seek_block * BlockSize);
+        } else {
+            fs_o->file.startReadUserBuf(c, buf);
+        }
         o->file_state = FILE_STATE_READING;
     }
     
+    // Streaming mode: reads the next block into the cache and keeps it
+    // referenced until releaseBlock. The ReadHandler gets the number of
+    // bytes available at getBlockData, a nonzero length meaning that the
+    // block is held. Clearing the buffer implies that the block was released.
+    static void startReadBlock (Context c)
+    {
+        auto *o = Object::self(c);
+        auto *fs_o = UnionFsPart::Object::self(c);
+        TheDebugObject::access(c);
+        AMBRO_ASSERT(o->file_state == FILE_STATE_RUNNING)
+        AMBRO_ASSERT(!o->file_eof)
+        AMBRO_ASSERT(StreamFromCache)
+        AMBRO_ASSERT(!o->file_block_held)
+        
+        if (o->file_seek_pending) {
+            fs_o->file.startSeek(c, o->seek_block * BlockSize);
+        } else {
+            fs_o->file.startRead(c);
+        }
+        o->file_state = FILE_STATE_READING;
+    }
+    
+    static char const * getBlockData (Context c)
+    {
+        auto *o = Object::self(c);
+        auto *fs_o = UnionFsPart::Object::self(c);
+        TheDebugObject::access(c);
+        AMBRO_ASSERT(o->file_block_held)
+        
+        return fs_o->file.getReadPointer(c);
+    }
+    
+    static void releaseBlock (Context c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        AMBRO_ASSERT(o->file_block_held)
+        
+        release_block(c);
+    }
+    
     static bool checkCommand (Context c, typename ThePrinterMain::TheCommand *cmd)
     {
         TheDebugObject::access(c);
@@ -261,6 +327,7 @@ private:
         o->listing_state = LISTING_STATE_INACTIVE;
         o->file_state = FILE_STATE_INACTIVE;
         o->write_mount_state = WRITEMOUNT_STATE_NOT_MOUNTED;
+        o->file_block_held = false;
     }
     
     static void cleanup (Context c)
@@ -712,12 +779,17 @@ private:
                 }
                 
                 if (o->file_state != FILE_STATE_INACTIVE) {
+                    if (o->file_block_held) {
+                        release_block(c);
+                    }
                     fs_o->file.deinit(c);
                 }
                 
-                fs_o->file.init(c, entry, APRINTER_CB_STATFUNC_T(&SdFatInput::file_handler));
+                fs_o->file.init(c, entry, APRINTER_CB_STATFUNC_T(&SdFatInput::file_handler), FileIoMode);
                 o->file_state = FILE_STATE_PAUSED;
                 o->file_eof = false;
+                o->file_seek_pending = false;
+                o->file_block_held = false;
                 ClientParams::ClearBufferHandler::call(c);
                 
                 if (o->open_start_stream) {
@@ -778,13 +850,41 @@ private:
         AMBRO_ASSERT(o->file_state == FILE_STATE_READING)
         AMBRO_ASSERT(!o->file_eof)
         
+        if (o->file_seek_pending) {
+            if (is_error) {
+                o->file_state = FILE_STATE_RUNNING;
+                return ClientParams::ReadHandler::call(c, true, 0);
+            }
+            o->file_seek_pending = false;
+            auto *fs_o = UnionFsPart::Object::self(c);
+            if (StreamFromCache) {
+                fs_o->file.startRead(c);
+            } else {
+                fs_o->file.startReadUserBuf(c, o->seek_buf);
+            }
+            return;
+        }
+        
         if (!is_error && length < BlockSize) {
             o->file_eof = true;
         }
+        if (StreamFromCache && !is_error && length > 0) {
+            o->file_block_held = true;
+        }
         o->file_state = FILE_STATE_RUNNING;
         return ClientParams::ReadHandler::call(c, is_error, length);
     }
     
+    static void release_block (Context c)
+    {
+        auto *o = Object::self(c);
+        auto *fs_o = UnionFsPart::Object::self(c);
+        AMBRO_ASSERT(o->file_block_held)
+        
+        fs_o->file.finishRead(c);
+        o->file_block_held = false;
+    }
+    
     APRINTER_FUNCTION_IF_OR_EMPTY_EXT(TheFs::FsWritable, static, void, start_write_mount (Context c, bool is_mount))
     {
         auto *o = Object::self(c);
@@ -1010,7 +1110,7 @@ private:
             TheFs
         >> {
             typename TheFs::FsEntry current_directory;
-            typename TheFs::template File<false> file;
+            TheFile file;
         };
     };
     
@@ -1025,6 +1125,8 @@ public:
         uint8_t listing_state : 3;
         uint8_t file_state : 2;
         uint8_t file_eof : 1;
+        uint8_t file_seek_pending : 1;
+        uint8_t file_block_held : 1;
         uint8_t write_mount_state : 2;
         uint8_t for_command : 1;
         uint8_t mount_writable : 1;
@@ -1042,13 +1144,16 @@ public:
                 typename TheFs::Opener opener;
             } open_or_chdir;
         } listing_u;
+        uint32_t seek_block;
+        DataWordType *seek_buf;
     };
 };
 
 APRINTER_ALIAS_STRUCT_EXT(SdFatInputService, (
     APRINTER_AS_TYPE(SdCardService),
     APRINTER_AS_TYPE(FsService),
-    APRINTER_AS_VALUE(bool, HaveAccessInterface)
+    APRINTER_AS_VALUE(bool, HaveAccessInterface),
+    APRINTER_AS_VALUE(bool, StreamFromCache)
 ), (
     static bool const ProvidesFsAccess = HaveAccessInterface;
     
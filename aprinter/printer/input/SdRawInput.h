@@ -60,6 +60,7 @@ private:
 public:
     static size_t const ReadBlockSize = BlockSize;
     using DataWordType = typename TheSdCard::DataWordType;
+    static bool const StreamFromCache = false;
     
     static void init (Context c)
     {
@@ -100,7 +101,7 @@ public:
         o->state = STATE_PAUSED;
     }
     
-    static bool rewind (Context c, typename ThePrinterMain::TheCommand *cmd)
+    static bool seek (Context c, typename ThePrinterMain::TheCommand *cmd, uint32_t block)
     {
         auto *o = Object::self(c);
         TheDebugObject::access(c);
@@ -109,7 +110,7 @@ public:
         if (!check_file_paused(c, cmd)) {
             return false;
         }
-        o->block = 0;
+        o->block = block;
         ClientParams::ClearBufferHandler::call(c);
         return true;
     }
@@ -0,0 +1,337 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef APRINTER_ARC_MOVE_MODULE_H
+#define APRINTER_ARC_MOVE_MODULE_H
+
+#include <stdint.h>
+
+#include <aprinter/meta/ListForEach.h>
+#include <aprinter/meta/TypeListUtils.h>
+#include <aprinter/meta/ServiceUtils.h>
+#include <aprinter/base/Object.h>
+#include <aprinter/base/Assert.h>
+#include <aprinter/base/ProgramMemory.h>
+#include <aprinter/base/LoopUtils.h>
+#include <aprinter/math/FloatTools.h>
+#include <aprinter/printer/Configuration.h>
+#include <aprinter/printer/utils/ModuleUtils.h>
+
+namespace APrinter {
+
+/**
+ * Implements arc moves in the XY plane, G2 (clockwise) and G3 (counter-clockwise).
+ * 
+ * The arc center is given either by I/J (offsets from the start position)
+ * or by R (radius, negative for the longer of the two possible arcs).
+ * Other axes, such as Z or E, are interpolated linearly along the arc,
+ * so helical moves are possible. If the end position equals the start
+ * position with I/J, a full circle is made.
+ * 
+ * The arc is approximated with line segments such that the distance
+ * between a segment and the true arc does not exceed the configured
+ * chordal tolerance. Segments are submitted to the planner one by one
+ * as it asks for commands, using the same path as G1. Hence on machines
+ * with a coordinate transform, each segment is further split by the
+ * transform splitter.
+ */
+template <typename ModuleArg>
+class ArcMoveModule {
+    APRINTER_UNPACK_MODULE_ARG(ModuleArg)
+    
+public:
+    struct Object;
+    
+private:
+    using FpType = typename ThePrinterMain::FpType;
+    using Config = typename ThePrinterMain::Config;
+    using TheCommand = typename ThePrinterMain::TheCommand;
+    using PartRef = typename TheCommand::PartRef;
+    using PhysVirtAxisMaskType = typename ThePrinterMain::PhysVirtAxisMaskType;
+    
+    static int const NumPhysVirtAxes = ThePrinterMain::NumPhysVirtAxes;
+    static int const AxisIndexX = ThePrinterMain::template FindPhysVirtAxis<'X'>::Value;
+    static int const AxisIndexY = ThePrinterMain::template FindPhysVirtAxis<'Y'>::Value;
+    
+    using CChordalTolerance = decltype(ExprCast<FpType>(Config::e(Params::ChordalTolerance::i())));
+    
+    static constexpr FpType Pi () { return 3.14159265358979323846f; }
+    
+    // Bounds for the angle covered by one segment. The lower bound limits
+    // the number of segments when the tolerance is very small compared to
+    // the radius, and the upper bound keeps small arcs recognizable.
+    static constexpr FpType MinSegmentAngle () { return 0.002f; }
+    static constexpr FpType MaxSegmentAngle () { return Pi() / 4.0f; }
+    
+public:
+    static void init (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        o->active = false;
+    }
+    
+    static bool check_g_command (Context c, TheCommand *cmd)
+    {
+        auto *o = Object::self(c);
+        
+        auto cmd_number = cmd->getCmdNumber(c);
+        if (cmd_number == 2 || cmd_number == 3) {
+            if (!cmd->tryPlannedCommand(c)) {
+                return false;
+            }
+            if (!o->active && !start_arc(c, cmd, cmd_number == 2)) {
+                return false;
+            }
+            submit_segment(c, cmd);
+            return false;
+        }
+        
+        return true;
+    }
+    
+private:
+    static bool start_arc (Context c, TheCommand *cmd, bool clockwise)
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(!o->active)
+        
+        PhysVirtAxisMaskType axis_relative = ThePrinterMain::get_relative_axes(c);
+        ListFor<AxisHelperList>([&] APRINTER_TL(axis, axis::init_arc(c)));
+        
+        FpType i = 0.0f;
+        FpType j = 0.0f;
+        FpType r = 0.0f;
+        bool have_r = false;
+        
+        for (auto k : LoopRangeAuto(cmd->getNumParts(c))) {
+            PartRef part = cmd->getPart(c, k);
+            
+            if (!ListForBreak<AxisHelperList>([&] APRINTER_TL(axis, return axis::collect_end_pos(c, cmd, part, axis_relative)))) {
+                continue;
+            }
+            
+            char code = cmd->getPartCode(c, part);
+            if (code == 'I') {
+                i = cmd->getPartFpValue(c, part);
+            }
+            else if (code == 'J') {
+                j = cmd->getPartFpValue(c, part);
+            }
+            else if (code == 'R') {
+                r = cmd->getPartFpValue(c, part);
+                have_r = true;
+            }
+            else if (code == 'F') {
+                ThePrinterMain::set_modal_time_freq_by_max_speed(c, ThePrinterMain::feedrate_to_time_freq_by_max_speed(cmd->getPartFpValue(c, part)));
+            }
+        }
+        
+        FpType start_x = o->start_pos[AxisIndexX];
+        FpType start_y = o->start_pos[AxisIndexY];
+        FpType dx = o->end_pos[AxisIndexX] - start_x;
+        FpType dy = o->end_pos[AxisIndexY] - start_y;
+        
+        if (have_r) {
+            // Find the center on the perpendicular bisector of the chord.
+            // Which of the two candidates is used depends on the direction
+            // and the sign of R.
+            FpType d_squared = dx * dx + dy * dy;
+            FpType h_squared = 4.0f * r * r - d_squared;
+            if (!(d_squared > 0.0f) || h_squared < 0.0f) {
+                return arc_error(c, cmd);
+            }
+            FpType h_x2_div_d = -FloatSqrt(h_squared / d_squared);
+            if (!clockwise) {
+                h_x2_div_d = -h_x2_div_d;
+            }
+            if (r < 0.0f) {
+                h_x2_div_d = -h_x2_div_d;
+            }
+            i = 0.5f * (dx - dy * h_x2_div_d);
+            j = 0.5f * (dy + dx * h_x2_div_d);
+        }
+        
+        FpType radius = FloatSqrt(i * i + j * j);
+        if (!(radius > 0.0f)) {
+            return arc_error(c, cmd);
+        }
+        
+        // Vectors from the center to the start and end points.
+        FpType sx = -i;
+        FpType sy = -j;
+        FpType ex = dx - i;
+        FpType ey = dy - j;
+        
+        FpType angle = FloatAtan2(sx * ey - sy * ex, sx * ex + sy * ey);
+        if (clockwise) {
+            if (angle >= 0.0f) {
+                angle -= 2.0f * Pi();
+            }
+        } else {
+            if (angle <= 0.0f) {
+                angle += 2.0f * Pi();
+            }
+        }
+        
+        FpType tolerance = APRINTER_CFG(Config, CChordalTolerance, c);
+        FpType segment_angle = 2.0f * FloatAcos(FloatMax((FpType)0.0f, 1.0f - tolerance / radius));
+        segment_angle = FloatMin(MaxSegmentAngle(), FloatMax(MinSegmentAngle(), segment_angle));
+        
+        o->center_x = start_x + i;
+        o->center_y = start_y + j;
+        o->radius = radius;
+        o->start_angle = FloatAtan2(sy, sx);
+        o->total_angle = angle;
+        o->num_segments = (uint32_t)FloatMax((FpType)1.0f, FloatCeil(FloatAbs(angle) / segment_angle));
+        o->segment_index = 0;
+        o->cmd = cmd;
+        o->active = true;
+        
+        return true;
+    }
+    
+    static bool arc_error (Context c, TheCommand *cmd)
+    {
+        cmd->reportError(c, AMBRO_PSTR("BadArc"));
+        cmd->finishCommand(c);
+        return false;
+    }
+    
+    static void submit_segment (Context c, TheCommand *cmd)
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(o->active)
+        AMBRO_ASSERT(o->cmd == cmd)
+        AMBRO_ASSERT(o->segment_index < o->num_segments)
+        
+        o->segment_index++;
+        bool last = (o->segment_index == o->num_segments);
+        FpType frac = last ? 1.0f : (FpType)o->segment_index / o->num_segments;
+        
+        ThePrinterMain::move_begin(c);
+        
+        if (last) {
+            ThePrinterMain::template move_add_axis<AxisIndexX>(c, o->end_pos[AxisIndexX]);
+            ThePrinterMain::template move_add_axis<AxisIndexY>(c, o->end_pos[AxisIndexY]);
+        } else {
+            FpType angle = o->start_angle + frac * o->total_angle;
+            ThePrinterMain::template move_add_axis<AxisIndexX>(c, o->center_x + o->radius * FloatCos(angle));
+            ThePrinterMain::template move_add_axis<AxisIndexY>(c, o->center_y + o->radius * FloatSin(angle));
+        }
+        ListFor<AxisHelperList>([&] APRINTER_TL(axis, axis::add_segment_pos(c, frac, last)));
+        
+        ThePrinterMain::move_set_max_speed_opt(c, ThePrinterMain::get_modal_time_freq_by_max_speed(c));
+        
+        return ThePrinterMain::move_end(c, cmd, ArcMoveModule::move_end_callback, false);
+    }
+    
+    static void move_end_callback (Context c, bool error)
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(o->active)
+        
+        TheCommand *cmd = o->cmd;
+        
+        if (error || o->segment_index == o->num_segments) {
+            o->active = false;
+            if (error) {
+                cmd->reportError(c, nullptr);
+            }
+            return cmd->finishCommand(c);
+        }
+        
+        // The planner has just taken a command, so this will wait for the
+        // next pull, which brings us back to check_g_command.
+        if (cmd->tryPlannedCommand(c)) {
+            return submit_segment(c, cmd);
+        }
+    }
+    
+    template <int PhysVirtAxisIndex>
+    struct AxisHelper {
+        using TheAxisHelper = typename ThePrinterMain::template PhysVirtAxisHelper<PhysVirtAxisIndex>;
+        static bool const IsArcAxis = (PhysVirtAxisIndex == AxisIndexX || PhysVirtAxisIndex == AxisIndexY);
+        
+        static void init_arc (Context c)
+        {
+            auto *o = Object::self(c);
+            o->start_pos[PhysVirtAxisIndex] = TheAxisHelper::get_position(c);
+            o->end_pos[PhysVirtAxisIndex] = o->start_pos[PhysVirtAxisIndex];
+        }
+        
+        static bool collect_end_pos (Context c, TheCommand *cmd, PartRef part, PhysVirtAxisMaskType axis_relative)
+        {
+            auto *o = Object::self(c);
+            if (AMBRO_UNLIKELY(cmd->getPartCode(c, part) == TheAxisHelper::AxisName)) {
+                FpType req = cmd->getPartFpValue(c, part);
+                if ((axis_relative & TheAxisHelper::AxisMask)) {
+                    req += o->start_pos[PhysVirtAxisIndex];
+                }
+                o->end_pos[PhysVirtAxisIndex] = req;
+                return false;
+            }
+            return true;
+        }
+        
+        static void add_segment_pos (Context c, FpType frac, bool last)
+        {
+            auto *o = Object::self(c);
+            FpType start = o->start_pos[PhysVirtAxisIndex];
+            FpType end = o->end_pos[PhysVirtAxisIndex];
+            if (!IsArcAxis && end != start) {
+                FpType pos = last ? end : (start + frac * (end - start));
+                ThePrinterMain::template move_add_axis<PhysVirtAxisIndex>(c, pos);
+            }
+        }
+    };
+    using AxisHelperList = IndexElemListCount<NumPhysVirtAxes, AxisHelper>;
+    
+public:
+    using ConfigExprs = MakeTypeList<CChordalTolerance>;
+    
+    struct Object : public ObjBase<ArcMoveModule, ParentObject, EmptyTypeList> {
+        TheCommand *cmd;
+        FpType start_pos[NumPhysVirtAxes];
+        FpType end_pos[NumPhysVirtAxes];
+        FpType center_x;
+        FpType center_y;
+        FpType radius;
+        FpType start_angle;
+        FpType total_angle;
+        uint32_t num_segments;
+        uint32_t segment_index;
+        bool active;
+    };
+};
+
+APRINTER_ALIAS_STRUCT_EXT(ArcMoveModuleService, (
+    APRINTER_AS_TYPE(ChordalTolerance)
+), (
+    APRINTER_MODULE_TEMPLATE(ArcMoveModuleService, ArcMoveModule)
+))
+
+}
+
+#endif
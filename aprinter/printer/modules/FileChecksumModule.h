@@ -0,0 +1,325 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef APRINTER_FILE_CHECKSUM_MODULE_H
+#define APRINTER_FILE_CHECKSUM_MODULE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <aprinter/meta/ServiceUtils.h>
+#include <aprinter/meta/TypeListUtils.h>
+#include <aprinter/base/Object.h>
+#include <aprinter/base/DebugObject.h>
+#include <aprinter/base/Assert.h>
+#include <aprinter/base/ProgramMemory.h>
+#include <aprinter/base/Callback.h>
+#include <aprinter/base/MemRef.h>
+#include <aprinter/misc/Crc32.h>
+#include <aprinter/misc/StringTools.h>
+#include <aprinter/fs/BufferedFile.h>
+#include <aprinter/printer/ServiceList.h>
+#include <aprinter/printer/utils/WebRequest.h>
+#include <aprinter/printer/utils/ModuleUtils.h>
+
+namespace APrinter {
+
+/**
+ * Computes the CRC-32 of a file in the background.
+ * 
+ * M939 F<file> starts the computation and completes once the file is open.
+ * The result is then reported as a message, "//FileCrc32 C<crc> S<size>".
+ * The web API request "fileCrc32" with the parameter "file" responds with
+ * the result once it is available.
+ * 
+ * Only one file is processed at a time. After each block, the next read is
+ * queued behind any other pending events, so that the computation does not
+ * delay other work such as motion planning.
+ */
+template <typename ModuleArg>
+class FileChecksumModule {
+    APRINTER_UNPACK_MODULE_ARG(ModuleArg)
+    
+public:
+    struct Object;
+    
+private:
+    using TheDebugObject = DebugObject<Context, Object>;
+    using TheFsAccess = typename ThePrinterMain::template GetFsAccess<>;
+    using TheBufferedFile = BufferedFile<Context, TheFsAccess>;
+    
+    enum class State : uint8_t {IDLE, OPEN, READ, YIELD};
+    
+    using JobHandler = Callback<void(Context c, bool error, uint32_t crc, uint32_t size)>;
+    
+public:
+    static void init (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        o->buffered_file.init(c, APRINTER_CB_STATFUNC_T(&FileChecksumModule::file_handler));
+        o->yield_event.init(c, APRINTER_CB_STATFUNC_T(&FileChecksumModule::yield_event_handler));
+        o->state = State::IDLE;
+        
+        TheDebugObject::init(c);
+    }
+    
+    static void deinit (Context c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::deinit(c);
+        
+        o->yield_event.deinit(c);
+        o->buffered_file.deinit(c);
+    }
+    
+    static bool check_command (Context c, typename ThePrinterMain::TheCommand *cmd)
+    {
+        TheDebugObject::access(c);
+        
+        if (cmd->getCmdNumber(c) == 939) {
+            handle_checksum_command(c, cmd);
+            return false;
+        }
+        return true;
+    }
+    
+    template <typename WebApiConfig>
+    struct WebApi {
+        static bool handle_web_request (Context c, MemRef req_type, WebRequest<Context> *request)
+        {
+            if (req_type.equalTo("fileCrc32")) {
+                MemRef file_path;
+                if (!request->getParam(c, "file", &file_path)) {
+                    return request->badParams(c);
+                }
+                if (is_busy(c)) {
+                    return request->completeHandling(c, HttpStatusCodes::ServiceUnavailable());
+                }
+                return request->template acceptRequest<ChecksumRequest>(c, file_path.ptr);
+            }
+            return true;
+        }
+        
+        class ChecksumRequest : public WebRequestHandler<Context, ChecksumRequest> {
+        public:
+            void init (Context c, char const *file_path)
+            {
+                m_file_path = file_path;
+                m_have_job = true;
+                start_job(c, file_path, false, WebApiConfig::UploadBasePath(), APRINTER_CB_OBJFUNC_T(&ChecksumRequest::job_handler, this));
+            }
+            
+            void deinit (Context c)
+            {
+                if (m_have_job) {
+                    cancel_job(c);
+                }
+            }
+            
+        private:
+            void job_handler (Context c, bool error, uint32_t crc, uint32_t size)
+            {
+                AMBRO_ASSERT(m_have_job)
+                
+                m_have_job = false;
+                
+                if (error) {
+                    return this->completeHandling(c, HttpStatusCodes::InternalServerError());
+                }
+                
+                char crc_str[9];
+                StringEncodeHexUint32(crc, crc_str);
+                crc_str[8] = '\0';
+                
+                JsonBuilder *json = this->startJson(c);
+                json->startObject();
+                json->addSafeKeyVal("file", JsonString{m_file_path});
+                json->addSafeKeyVal("size", JsonUint32{size});
+                json->addSafeKeyVal("crc32", JsonSafeString{crc_str});
+                json->endObject();
+                this->endJson(c);
+                this->completeHandling(c);
+            }
+            
+            char const *m_file_path;
+            bool m_have_job;
+        };
+        
+        using WebApiRequestHandlers = MakeTypeList<ChecksumRequest>;
+    };
+    
+private:
+    static bool is_busy (Context c)
+    {
+        auto *o = Object::self(c);
+        return (o->state != State::IDLE);
+    }
+    
+    static void start_job (Context c, char const *file_path, bool in_current_dir, char const *basedir, JobHandler handler)
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(o->state == State::IDLE)
+        
+        o->job_handler = handler;
+        o->crc = Crc32Initial;
+        o->size = 0;
+        o->state = State::OPEN;
+        o->gcode_locked = false;
+        o->buffered_file.startOpen(c, file_path, in_current_dir, TheBufferedFile::OpenMode::OPEN_READ, basedir);
+    }
+    
+    static void cancel_job (Context c)
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(o->state != State::IDLE)
+        
+        o->buffered_file.reset(c);
+        o->yield_event.unset(c);
+        o->state = State::IDLE;
+    }
+    
+    static void complete_job (Context c, bool error)
+    {
+        auto *o = Object::self(c);
+        
+        o->buffered_file.reset(c);
+        o->state = State::IDLE;
+        
+        return o->job_handler(c, error, Crc32Final(o->crc), o->size);
+    }
+    
+    static void file_handler (Context c, typename TheBufferedFile::Error error, size_t read_length)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        AMBRO_ASSERT(o->state == State::OPEN || o->state == State::READ)
+        
+        if (error != TheBufferedFile::Error::NO_ERROR) {
+            return complete_job(c, true);
+        }
+        
+        if (o->state == State::OPEN) {
+            if (o->gcode_locked) {
+                o->gcode_locked = false;
+                ThePrinterMain::get_locked(c)->finishCommand(c);
+            }
+        } else {
+            if (read_length == 0) {
+                return complete_job(c, false);
+            }
+            o->crc = Crc32Update(o->crc, o->buffered_file.getReadBlockData(c), read_length);
+            o->size += read_length;
+        }
+        
+        // Let everything else that is pending run before reading the next block.
+        o->state = State::YIELD;
+        o->yield_event.appendNowNotAlready(c);
+    }
+    
+    static void yield_event_handler (Context c)
+    {
+        auto *o = Object::self(c);
+        TheDebugObject::access(c);
+        AMBRO_ASSERT(o->state == State::YIELD)
+        
+        o->state = State::READ;
+        o->buffered_file.startReadBlock(c);
+    }
+    
+    static void handle_checksum_command (Context c, typename ThePrinterMain::TheCommand *cmd)
+    {
+        auto *o = Object::self(c);
+        
+        if (!cmd->tryLockedCommand(c)) {
+            return;
+        }
+        
+        if (is_busy(c)) {
+            cmd->reportError(c, AMBRO_PSTR("ChecksumBusy"));
+            return cmd->finishCommand(c);
+        }
+        
+        char const *file_name = cmd->get_command_param_str(c, 'F', nullptr);
+        if (!file_name) {
+            cmd->reportError(c, AMBRO_PSTR("NoFileSpecified"));
+            return cmd->finishCommand(c);
+        }
+        
+        // The command is held until the file is open, since the file name
+        // points into the command.
+        start_job(c, file_name, true, nullptr, APRINTER_CB_STATFUNC_T(&FileChecksumModule::gcode_job_handler));
+        o->gcode_locked = true;
+    }
+    
+    static void gcode_job_handler (Context c, bool error, uint32_t crc, uint32_t size)
+    {
+        auto *o = Object::self(c);
+        
+        if (o->gcode_locked) {
+            AMBRO_ASSERT(error)
+            o->gcode_locked = false;
+            auto *cmd = ThePrinterMain::get_locked(c);
+            cmd->reportError(c, AMBRO_PSTR("Open"));
+            return cmd->finishCommand(c);
+        }
+        
+        auto *output = ThePrinterMain::get_msg_output(c);
+        if (error) {
+            output->reply_append_pstr(c, AMBRO_PSTR("//FileCrc32 Error\n"));
+        } else {
+            char crc_str[8];
+            StringEncodeHexUint32(crc, crc_str);
+            output->reply_append_pstr(c, AMBRO_PSTR("//FileCrc32 C"));
+            output->reply_append_buffer(c, crc_str, sizeof(crc_str));
+            output->reply_append_pstr(c, AMBRO_PSTR(" S"));
+            output->reply_append_uint32(c, size);
+            output->reply_append_ch(c, '\n');
+        }
+        output->reply_poke(c);
+    }
+    
+public:
+    struct Object : public ObjBase<FileChecksumModule, ParentObject, MakeTypeList<
+        TheDebugObject
+    >> {
+        TheBufferedFile buffered_file;
+        typename Context::EventLoop::QueuedEvent yield_event;
+        JobHandler job_handler;
+        uint32_t crc;
+        uint32_t size;
+        State state;
+        bool gcode_locked;
+    };
+};
+
+struct FileChecksumModuleService {
+    APRINTER_MODULE_TEMPLATE(FileChecksumModuleService, FileChecksumModule)
+    using ProvidedServices = MakeTypeList<ServiceDefinition<ServiceList::WebApiHandlerService>>;
+};
+
+}
+
+#endif
@@ -52,6 +52,9 @@ public:
 private:
     static uint16_t const MCodeStartGcodeUpload = 28;
     static uint16_t const MCodeStopGcodeUpload  = 29;
+    static uint16_t const MCodeRemove           = 30;
+    static uint16_t const MCodeMakeDir          = 470;
+    static uint16_t const MCodeRename           = 471;
     
     static size_t const MaxCommandSize = Params::MaxCommandSize;
     static_assert(MaxCommandSize >= 32, "");
@@ -59,8 +62,11 @@ private:
     using TheCommand = typename ThePrinterMain::TheCommand;
     using TheFsAccess = typename ThePrinterMain::template GetFsAccess<>;
     using TheBufferedFile = BufferedFile<Context, TheFsAccess>;
+    using TheFs = typename TheFsAccess::TheFileSystem;
+    using TheDirModifier = typename TheFs::template DirModifier<>;
     
     enum class State {IDLE, OPENING, READY, WRITING, CLOSING};
+    enum class ModifyState {IDLE, ACCESS, MODIFYING, FLUSHING};
     
 public:
     static void init (Context c)
@@ -69,11 +75,19 @@ public:
         o->file.init(c, APRINTER_CB_STATFUNC_T(&GcodeUploadModule::file_handler));
         o->state = State::IDLE;
         o->captured_stream = nullptr;
+        o->modify_client.init(c, APRINTER_CB_STATFUNC_T(&GcodeUploadModule::modify_client_handler));
+        o->modifier.init(c, APRINTER_CB_STATFUNC_T(&GcodeUploadModule::modifier_handler));
+        o->modify_state = ModifyState::IDLE;
     }
     
     static void deinit (Context c)
     {
         auto *o = Object::self(c);
+        if (o->modify_state == ModifyState::FLUSHING) {
+            o->modify_flush.deinit(c);
+        }
+        o->modifier.deinit(c);
+        o->modify_client.deinit(c);
         o->file.deinit(c);
     }
     
@@ -87,6 +101,10 @@ public:
             handle_stop_command(c, cmd);
             return false;
         }
+        if (cmd->getCmdNumber(c) == MCodeRemove || cmd->getCmdNumber(c) == MCodeMakeDir || cmd->getCmdNumber(c) == MCodeRename) {
+            handle_modify_command(c, cmd);
+            return false;
+        }
         return true;
     }
     
@@ -130,6 +148,109 @@ private:
         start_closing(c, true);
     }
     
+    static void handle_modify_command (Context c, TheCommand *cmd)
+    {
+        auto *o = Object::self(c);
+        
+        if (!cmd->tryLockedCommand(c)) {
+            return;
+        }
+        
+        if (o->modify_state != ModifyState::IDLE) {
+            cmd->reportError(c, AMBRO_PSTR("FsModifyBusy"));
+            return cmd->finishCommand(c);
+        }
+        
+        o->modify_cmd_num = cmd->getCmdNumber(c);
+        o->modify_path = cmd->get_command_param_str(c, (o->modify_cmd_num == MCodeMakeDir) ? 'D' : 'F', nullptr);
+        o->modify_dst_path = (o->modify_cmd_num == MCodeRename) ? cmd->get_command_param_str(c, 'T', nullptr) : "";
+        if (!o->modify_path || !o->modify_dst_path) {
+            cmd->reportError(c, AMBRO_PSTR("BadParams"));
+            return cmd->finishCommand(c);
+        }
+        
+        o->modify_state = ModifyState::ACCESS;
+        o->modify_client.requestAccess(c, true);
+    }
+    
+    static void modify_client_handler (Context c, bool error)
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(o->modify_state == ModifyState::ACCESS)
+        
+        if (error) {
+            return complete_modify(c, AMBRO_PSTR("SdNotWritable"));
+        }
+        
+        auto src_dir = base_dir_for_path(c, o->modify_path);
+        
+        o->modify_state = ModifyState::MODIFYING;
+        switch (o->modify_cmd_num) {
+            case MCodeRemove: {
+                o->modifier.startRemove(c, src_dir, o->modify_path);
+            } break;
+            case MCodeMakeDir: {
+                o->modifier.startCreate(c, src_dir, o->modify_path, TheFs::EntryType::DIR_TYPE);
+            } break;
+            default: {
+                o->modifier.startRename(c, src_dir, o->modify_path, base_dir_for_path(c, o->modify_dst_path), o->modify_dst_path);
+            } break;
+        }
+    }
+    
+    static void modifier_handler (Context c, typename TheDirModifier::ModifierStatus status, typename TheFs::FsEntry entry)
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(o->modify_state == ModifyState::MODIFYING)
+        
+        using Status = typename TheDirModifier::ModifierStatus;
+        switch (status) {
+            case Status::SUCCESS: {
+                o->modify_state = ModifyState::FLUSHING;
+                o->modify_flush.init(c, APRINTER_CB_STATFUNC_T(&GcodeUploadModule::modify_flush_handler));
+                o->modify_flush.requestFlush(c);
+            } return;
+            case Status::NOT_FOUND: return complete_modify(c, AMBRO_PSTR("NotFound"));
+            case Status::EXISTS:    return complete_modify(c, AMBRO_PSTR("AlreadyExists"));
+            case Status::NOT_EMPTY: return complete_modify(c, AMBRO_PSTR("DirNotEmpty"));
+            case Status::BAD_NAME:  return complete_modify(c, AMBRO_PSTR("BadName"));
+            case Status::BAD_MOVE:  return complete_modify(c, AMBRO_PSTR("BadMove"));
+            case Status::BUSY:      return complete_modify(c, AMBRO_PSTR("FileOpen"));
+            default:                return complete_modify(c, AMBRO_PSTR("InputOutput"));
+        }
+    }
+    
+    static void modify_flush_handler (Context c, bool error)
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(o->modify_state == ModifyState::FLUSHING)
+        
+        complete_modify(c, error ? AMBRO_PSTR("InputOutput") : nullptr);
+    }
+    
+    static void complete_modify (Context c, AMBRO_PGM_P errstr)
+    {
+        auto *o = Object::self(c);
+        
+        if (o->modify_state == ModifyState::FLUSHING) {
+            o->modify_flush.deinit(c);
+        }
+        o->modify_client.reset(c);
+        o->modify_state = ModifyState::IDLE;
+        
+        auto *cmd = ThePrinterMain::get_locked(c);
+        if (errstr) {
+            cmd->reportError(c, errstr);
+        }
+        cmd->finishCommand(c);
+    }
+    
+    static typename TheFs::FsEntry base_dir_for_path (Context c, char const *path)
+    {
+        auto *o = Object::self(c);
+        return (path[0] == '/') ? TheFs::getRootEntry(c) : o->modify_client.getCurrentDirectory(c);
+    }
+    
     static void file_handler (Context c, typename TheBufferedFile::Error error, size_t read_length)
     {
         auto *o = Object::self(c);
@@ -327,7 +448,14 @@ private:
 public:
     struct Object : public ObjBase<GcodeUploadModule, ParentObject, EmptyTypeList> {
         TheBufferedFile file;
+        typename TheFsAccess::Client modify_client;
+        TheDirModifier modifier;
+        typename TheFs::template FlushRequest<> modify_flush;
         State state;
+        ModifyState modify_state;
+        uint16_t modify_cmd_num;
+        char const *modify_path;
+        char const *modify_dst_path;
         TheCommand *captured_stream;
         bool closing_for_command;
         char command_buf[MaxCommandSize];
@@ -36,6 +36,8 @@
 #include <aprinter/meta/TypeList.h>
 #include <aprinter/meta/TypeListUtils.h>
 #include <aprinter/meta/ServiceUtils.h>
+#include <aprinter/meta/FunctionIf.h>
+#include <aprinter/meta/StructIf.h>
 #include <aprinter/base/Object.h>
 #include <aprinter/base/Callback.h>
 #include <aprinter/base/ProgramMemory.h>
@@ -67,17 +69,27 @@ private:
     
     using DataWordType = typename TheInput::DataWordType;
     
+    // When the input streams from the FS cache, commands are parsed from
+    // cache blocks referenced by the input, and the ring buffer
+    // (BufferBaseSize) is not used. A line within a block is parsed in
+    // place, with the parser told not to write to the block since cached
+    // data is shared, and string values go to a line buffer of
+    // MaxCommandSize. A line crossing into the next block is copied into the
+    // line buffer, and so is the last line of a block, so that the block can
+    // be released and the next one read while that command executes.
+    static bool const StreamFromCache = TheInput::StreamFromCache;
+    
     static const size_t BufferBaseSize = Params::BufferBaseSize;
-    static_assert(BufferBaseSize % sizeof(DataWordType) == 0, "Buffer size must be a multiple of data word size");
+    static_assert(StreamFromCache || BufferBaseSize % sizeof(DataWordType) == 0, "Buffer size must be a multiple of data word size");
     static const size_t BufferBaseSizeWords = BufferBaseSize / sizeof(DataWordType);
     
     static const size_t BlockSize = TheInput::ReadBlockSize;
     static_assert(BlockSize % sizeof(DataWordType) == 0, "");
-    static_assert(BufferBaseSize % BlockSize == 0, "Buffer size must be a multiple of block size");
+    static_assert(StreamFromCache || BufferBaseSize % BlockSize == 0, "Buffer size must be a multiple of block size");
     
     static const size_t MaxCommandSize = Params::MaxCommandSize;
     static_assert(MaxCommandSize > 0, "");
-    static_assert(BufferBaseSize >= BlockSize + (MaxCommandSize - 1), "");
+    static_assert(StreamFromCache || BufferBaseSize >= BlockSize + (MaxCommandSize - 1), "");
     
     static const size_t WrapExtraSize = MaxCommandSize - 1;
     static const size_t WrapExtraSizeWords = (WrapExtraSize + (sizeof(DataWordType) - 1)) / sizeof(DataWordType);
@@ -173,11 +185,8 @@ private:
             }
             
             AMBRO_ASSERT(!o->gcode_parser.haveCommand(c))
-            AMBRO_ASSERT(o->gcode_parser.getLength(c) <= o->m_length)
             
-            size_t cmd_len = o->gcode_parser.getLength(c);
-            o->m_start = buf_add(o->m_start, cmd_len);
-            o->m_length -= cmd_len;
+            consume_command(c, o->gcode_parser.getLength(c));
             
             o->m_next_event.prependNowNotAlready(c);
             
@@ -356,13 +365,13 @@ private:
                 break;
             }
             uint32_t seek_pos = cmd->get_command_param_uint32(c, 'S', 0);
-            if (seek_pos != 0) {
-                cmd->reportError(c, AMBRO_PSTR("CanOnlySeekToZero"));
-                break;
-            }
-            if (!TheInput::rewind(c, cmd)) {
+            if (!TheInput::seek(c, cmd, seek_pos / BlockSize)) {
                 cmd->reportError(c, nullptr);
+                break;
             }
+            // The input is positioned at the start of the block, the rest
+            // is skipped when the data arrives.
+            o->m_skip = seek_pos % BlockSize;
         } while (false);
         cmd->finishCommand(c);
     }
@@ -373,21 +382,13 @@ private:
         AMBRO_ASSERT(o->m_state == SDCARD_RUNNING || o->m_state == SDCARD_PAUSING)
         buf_sanity(c);
         AMBRO_ASSERT(o->m_reading)
-        AMBRO_ASSERT(bytes_read <= BufferBaseSize - o->m_length)
         AMBRO_ASSERT(!o->m_retry_timer.isSet(c))
         AMBRO_ASSERT(o->m_retry_counter <= ReadRetryCount)
         
         o->m_reading = false;
         
         if (!error) {
-            size_t write_offset = buf_add(o->m_start, o->m_length);
-            if (write_offset < WrapExtraSize) {
-                memcpy((char *)o->m_buffer + BufferBaseSize + write_offset, (char *)o->m_buffer + write_offset, MinValue(bytes_read, WrapExtraSize - write_offset));
-            }
-            if (bytes_read > BufferBaseSize - write_offset) {
-                memcpy((char *)o->m_buffer + BufferBaseSize, (char *)o->m_buffer, MinValue(bytes_read - (BufferBaseSize - write_offset), WrapExtraSize));
-            }
-            o->m_length += bytes_read;
+            accept_read_data(c, bytes_read);
         }
         
         if (o->m_state == SDCARD_PAUSING) {
@@ -454,10 +455,10 @@ private:
         }
         
         if (!o->gcode_parser.haveCommand(c)) {
-            o->gcode_parser.startCommand(c, (char *)o->m_buffer + o->m_start, 0);
+            start_command(c);
         }
         
-        avail = MinValue(MaxCommandSize, o->m_length);
+        avail = get_command_avail(c);
         line_buffer_exhausted = (avail == MaxCommandSize);
         
         if (o->gcode_parser.extendCommand(c, avail, line_buffer_exhausted)) {
@@ -468,6 +469,10 @@ private:
             return o->command_stream.startCommand(c, &o->gcode_parser);
         }
         
+        if (restart_command_copied(c)) {
+            return o->m_next_event.prependNowNotAlready(c);
+        }
+        
         if (line_buffer_exhausted) {
             eof_str = AMBRO_PSTR("//SdLnEr\n");
             goto eof;
@@ -506,8 +511,8 @@ private:
         auto *o = Object::self(c);
         
         o->gcode_parser.init(c);
-        o->m_start = 0;
-        o->m_length = 0;
+        o->m_skip = 0;
+        reset_buffer(c);
     }
     
     static void deinit_buffering (Context c)
@@ -517,9 +522,90 @@ private:
     }
     
     static bool can_read (Context c)
+    {
+        return (have_buffer_space(c) && TheInput::canRead(c));
+    }
+    
+    static void start_read (Context c)
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(!o->m_reading)
+        AMBRO_ASSERT(can_read(c))
+        
+        o->m_reading = true;
+        start_input_read(c);
+    }
+    
+    APRINTER_FUNCTION_IF_EXT(!StreamFromCache, static, void, reset_buffer (Context c))
+    {
+        auto *o = Object::self(c);
+        o->m_start = 0;
+        o->m_length = 0;
+    }
+    
+    APRINTER_FUNCTION_IF_EXT(!StreamFromCache, static, bool, have_buffer_space (Context c))
+    {
+        auto *o = Object::self(c);
+        return (BufferBaseSize - o->m_length >= BlockSize);
+    }
+    
+    APRINTER_FUNCTION_IF_EXT(!StreamFromCache, static, void, start_input_read (Context c))
+    {
+        auto *o = Object::self(c);
+        size_t write_offset = buf_add(o->m_start, o->m_length);
+        AMBRO_ASSERT(write_offset % BlockSize == 0)
+        TheInput::startRead(c, o->m_buffer + write_offset / sizeof(DataWordType));
+    }
+    
+    APRINTER_FUNCTION_IF_EXT(!StreamFromCache, static, void, accept_read_data (Context c, size_t bytes_read))
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(bytes_read <= BufferBaseSize - o->m_length)
+        
+        size_t write_offset = buf_add(o->m_start, o->m_length);
+        if (write_offset < WrapExtraSize) {
+            memcpy((char *)o->m_buffer + BufferBaseSize + write_offset, (char *)o->m_buffer + write_offset, MinValue(bytes_read, WrapExtraSize - write_offset));
+        }
+        if (bytes_read > BufferBaseSize - write_offset) {
+            memcpy((char *)o->m_buffer + BufferBaseSize, (char *)o->m_buffer, MinValue(bytes_read - (BufferBaseSize - write_offset), WrapExtraSize));
+        }
+        o->m_length += bytes_read;
+        
+        if (o->m_skip > 0) {
+            size_t skip = MinValue(o->m_skip, o->m_length);
+            o->m_start = buf_add(o->m_start, skip);
+            o->m_length -= skip;
+            o->m_skip -= skip;
+            if (o->gcode_parser.haveCommand(c)) {
+                o->gcode_parser.resetCommand(c);
+            }
+        }
+    }
+    
+    APRINTER_FUNCTION_IF_EXT(!StreamFromCache, static, void, start_command (Context c))
+    {
+        auto *o = Object::self(c);
+        o->gcode_parser.startCommand(c, (char *)o->m_buffer + o->m_start, 0);
+    }
+    
+    APRINTER_FUNCTION_IF_EXT(!StreamFromCache, static, bool, restart_command_copied (Context c))
+    {
+        return false;
+    }
+    
+    APRINTER_FUNCTION_IF_EXT(!StreamFromCache, static, size_t, get_command_avail (Context c))
+    {
+        auto *o = Object::self(c);
+        return MinValue(MaxCommandSize, o->m_length);
+    }
+    
+    APRINTER_FUNCTION_IF_EXT(!StreamFromCache, static, void, consume_command (Context c, size_t cmd_len))
     {
         auto *o = Object::self(c);
-        return (BufferBaseSize - o->m_length >= BlockSize && TheInput::canRead(c));
+        AMBRO_ASSERT(cmd_len <= o->m_length)
+        
+        o->m_start = buf_add(o->m_start, cmd_len);
+        o->m_length -= cmd_len;
     }
     
     static size_t buf_add (size_t start, size_t count)
@@ -532,23 +618,165 @@ private:
         return x;
     }
     
-    static void start_read (Context c)
+    APRINTER_FUNCTION_IF_EXT(!StreamFromCache, static, void, buf_sanity (Context c))
     {
         auto *o = Object::self(c);
-        AMBRO_ASSERT(!o->m_reading)
-        AMBRO_ASSERT(can_read(c))
+        AMBRO_ASSERT(o->m_start < BufferBaseSize)
+        AMBRO_ASSERT(o->m_length <= BufferBaseSize)
+    }
+    
+    APRINTER_FUNCTION_IF_EXT(StreamFromCache, static, void, reset_buffer (Context c))
+    {
+        auto *o = Object::self(c);
+        o->m_block_held = false;
+        o->m_in_place = false;
+        o->m_line_length = 0;
+    }
+    
+    APRINTER_FUNCTION_IF_EXT(StreamFromCache, static, bool, have_buffer_space (Context c))
+    {
+        auto *o = Object::self(c);
+        return !o->m_block_held;
+    }
+    
+    APRINTER_FUNCTION_IF_EXT(StreamFromCache, static, void, start_input_read (Context c))
+    {
+        TheInput::startReadBlock(c);
+    }
+    
+    APRINTER_FUNCTION_IF_EXT(StreamFromCache, static, void, accept_read_data (Context c, size_t bytes_read))
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(!o->m_block_held)
+        AMBRO_ASSERT(bytes_read <= BlockSize)
         
-        o->m_reading = true;
-        size_t write_offset = buf_add(o->m_start, o->m_length);
-        AMBRO_ASSERT(write_offset % BlockSize == 0)
-        TheInput::startRead(c, o->m_buffer + write_offset / sizeof(DataWordType));
+        if (bytes_read == 0) {
+            return;
+        }
+        
+        o->m_block_held = true;
+        o->m_block_data = TheInput::getBlockData(c);
+        o->m_block_pos = 0;
+        o->m_block_length = bytes_read;
+        
+        if (o->m_skip > 0) {
+            size_t skip = MinValue(o->m_skip, bytes_read);
+            o->m_block_pos = skip;
+            o->m_skip -= skip;
+            if (o->gcode_parser.haveCommand(c)) {
+                o->gcode_parser.resetCommand(c);
+            }
+            release_block_if_consumed(c);
+        }
     }
     
-    static void buf_sanity (Context c)
+    APRINTER_FUNCTION_IF_EXT(StreamFromCache, static, void, start_command (Context c))
     {
         auto *o = Object::self(c);
-        AMBRO_ASSERT(o->m_start < BufferBaseSize)
-        AMBRO_ASSERT(o->m_length <= BufferBaseSize)
+        AMBRO_ASSERT(!o->m_in_place)
+        
+        // Parse in place if the held block has the whole line and more.
+        if (o->m_line_length == 0 && o->m_block_held) {
+            char const *src = o->m_block_data + o->m_block_pos;
+            size_t amount = MinValue(MaxCommandSize, o->m_block_length - o->m_block_pos);
+            char const *newline = (char const *)memchr(src, '\n', amount);
+            if (newline && (size_t)((newline + 1) - o->m_block_data) < o->m_block_length) {
+                o->m_in_place = true;
+                o->m_in_place_length = (newline + 1) - src;
+                o->gcode_parser.startCommand(c, const_cast<char *>(src), 0, o->m_line);
+                return;
+            }
+        }
+        
+        o->gcode_parser.startCommand(c, o->m_line, 0);
+    }
+    
+    // A parser which needs more than the line (a binary one) starts over
+    // from the line buffer.
+    APRINTER_FUNCTION_IF_EXT(StreamFromCache, static, bool, restart_command_copied (Context c))
+    {
+        auto *o = Object::self(c);
+        
+        if (!o->m_in_place) {
+            return false;
+        }
+        o->gcode_parser.resetCommand(c);
+        o->m_in_place = false;
+        o->gcode_parser.startCommand(c, o->m_line, 0);
+        return true;
+    }
+    
+    APRINTER_FUNCTION_IF_EXT(StreamFromCache, static, size_t, get_command_avail (Context c))
+    {
+        auto *o = Object::self(c);
+        
+        if (o->m_in_place) {
+            return o->m_in_place_length;
+        }
+        
+        // Copy data from the held block up to the end of the line, or as much
+        // as fits. The block is released as soon as all of it is copied, so
+        // that the next one can be read while the command executes.
+        if (o->m_block_held) {
+            char const *src = o->m_block_data + o->m_block_pos;
+            size_t amount = MinValue(MaxCommandSize - o->m_line_length, o->m_block_length - o->m_block_pos);
+            char const *newline = (char const *)memchr(src, '\n', amount);
+            if (newline) {
+                amount = (newline + 1) - src;
+            }
+            memcpy(o->m_line + o->m_line_length, src, amount);
+            o->m_line_length += amount;
+            o->m_block_pos += amount;
+            
+            release_block_if_consumed(c);
+            if (!o->m_reading && can_read(c) && o->m_retry_counter == 0) {
+                start_read(c);
+            }
+        }
+        
+        return o->m_line_length;
+    }
+    
+    APRINTER_FUNCTION_IF_EXT(StreamFromCache, static, void, consume_command (Context c, size_t cmd_len))
+    {
+        auto *o = Object::self(c);
+        
+        if (o->m_in_place) {
+            AMBRO_ASSERT(o->m_block_held)
+            AMBRO_ASSERT(cmd_len <= o->m_in_place_length)
+            
+            o->m_in_place = false;
+            o->m_block_pos += cmd_len;
+            return;
+        }
+        
+        AMBRO_ASSERT(cmd_len <= o->m_line_length)
+        
+        // Usually the line buffer contains just this command.
+        o->m_line_length -= cmd_len;
+        if (o->m_line_length > 0) {
+            memmove(o->m_line, o->m_line + cmd_len, o->m_line_length);
+        }
+    }
+    
+    APRINTER_FUNCTION_IF_EXT(StreamFromCache, static, void, release_block_if_consumed (Context c))
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(o->m_block_held)
+        
+        if (o->m_block_pos == o->m_block_length) {
+            TheInput::releaseBlock(c);
+            o->m_block_held = false;
+        }
+    }
+    
+    APRINTER_FUNCTION_IF_EXT(StreamFromCache, static, void, buf_sanity (Context c))
+    {
+        auto *o = Object::self(c);
+        AMBRO_ASSERT(o->m_line_length <= MaxCommandSize)
+        AMBRO_ASSERT(!o->m_in_place || (o->m_block_held && o->m_line_length == 0))
+        AMBRO_ASSERT(!o->m_block_held || o->m_block_pos < o->m_block_length)
+        AMBRO_ASSERT(!o->m_block_held || o->m_block_length <= BlockSize)
     }
     
     static void complete_pause (Context c)
@@ -562,10 +790,27 @@ private:
         o->m_state = SDCARD_PAUSED;
     }
     
+    APRINTER_STRUCT_IF_TEMPLATE(RingBufferMembers) {
+        size_t m_start;
+        size_t m_length;
+        DataWordType m_buffer[BufferBaseSizeWords + WrapExtraSizeWords];
+    };
+    
+    APRINTER_STRUCT_IF_TEMPLATE(StreamingMembers) {
+        char const *m_block_data;
+        size_t m_block_pos;
+        size_t m_block_length;
+        bool m_block_held;
+        bool m_in_place;
+        size_t m_in_place_length;
+        size_t m_line_length;
+        char m_line[MaxCommandSize];
+    };
+    
 public:
     struct Object : public ObjBase<SdCardModule, ParentObject, MakeTypeList<
         TheInput
-    >> {
+    >>, public RingBufferMembers<!StreamFromCache>, public StreamingMembers<StreamFromCache> {
         TheGcodeParser gcode_parser;
         typename ThePrinterMain::CommandStream command_stream;
         StreamCallback callback;
@@ -579,9 +824,7 @@ public:
         uint8_t m_echo_pending : 1;
         uint8_t m_poke_pending : 1;
         uint8_t m_retry_counter;
-        size_t m_start;
-        size_t m_length;
-        DataWordType m_buffer[BufferBaseSizeWords + WrapExtraSizeWords];
+        size_t m_skip;
     };
 };
 
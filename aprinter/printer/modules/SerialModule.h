@@ -32,11 +32,14 @@
 #include <aprinter/meta/WrapFunction.h>
 #include <aprinter/meta/TypeListUtils.h>
 #include <aprinter/meta/ServiceUtils.h>
+#include <aprinter/meta/StructIf.h>
 #include <aprinter/base/Object.h>
 #include <aprinter/base/ProgramMemory.h>
 #include <aprinter/base/Assert.h>
 #include <aprinter/printer/input/InputCommon.h>
 #include <aprinter/printer/utils/GcodeCommand.h>
+#include <aprinter/printer/utils/BinaryFrameParser.h>
+#include <aprinter/printer/utils/LineFlowControl.h>
 #include <aprinter/printer/utils/ModuleUtils.h>
 
 namespace APrinter {
@@ -55,6 +58,7 @@ private:
     using RecvSizeType = typename TheSerial::RecvSizeType;
     using SendSizeType = typename TheSerial::SendSizeType;
     using TheGcodeParser = typename Params::TheGcodeParserService::template Parser<Context, typename RecvSizeType::IntType, typename ThePrinterMain::FpType>;
+    using TheLineFlowControl = LineFlowControl<Context, ThePrinterMain>;
     
     static_assert(SendSizeType::maxIntValue() >= ThePrinterMain::CommandSendBufClearance, "Serial send buffer is too small");
     
@@ -64,15 +68,17 @@ public:
         auto *o = Object::self(c);
         TheSerial::init(c, Params::Baud);
         o->gcode_parser.init(c);
+        BinaryFramingFeature::init(c);
         o->command_stream.init(c, &o->callback, &o->callback);
         o->m_recv_next_error = 0;
-        o->m_line_number = 1;
+        o->flow_control.init(c);
     }
     
     static void deinit (Context c)
     {
         auto *o = Object::self(c);
         o->command_stream.deinit(c);
+        BinaryFramingFeature::deinit(c);
         o->gcode_parser.deinit(c);
         TheSerial::deinit(c);
     }
@@ -92,25 +98,10 @@ private:
             auto *o = Object::self(c);
             AMBRO_ASSERT(o->command_stream.hasCommand(c))
             
-            bool is_m110 = (o->gcode_parser.getCmdCode(c) == 'M' && o->gcode_parser.getCmdNumber(c) == 110);
-            if (is_m110) {
-                o->m_line_number = o->command_stream.get_command_param_uint32(c, 'L', (o->gcode_parser.getCmd(c)->have_line_number ? o->gcode_parser.getCmd(c)->line_number : (uint32_t)-1));
-            }
-            if (o->gcode_parser.getCmd(c)->have_line_number) {
-                if (o->gcode_parser.getCmd(c)->line_number != o->m_line_number) {
-                    o->command_stream.reply_append_pstr(c, AMBRO_PSTR("Error:Line Number is not Last Line Number+1, Last Line:"));
-                    o->command_stream.reply_append_uint32(c, (uint32_t)(o->m_line_number - 1));
-                    o->command_stream.reply_append_ch(c, '\n');
-                    return false;
-                }
-            }
-            if (o->gcode_parser.getCmd(c)->have_line_number || is_m110) {
-                o->m_line_number++;
-            }
-            if (is_m110) {
+            if (!BinaryFramingFeature::is_active(c) && !o->flow_control.startCommand(c, &o->command_stream, o->gcode_parser.getCmd(c), RecvSizeType::maxIntValue())) {
                 return false;
             }
-            return true;
+            return BinaryFramingFeature::start_command(c);
         }
         
         void finish_command_impl (Context c)
@@ -118,7 +109,9 @@ private:
             auto *o = Object::self(c);
             AMBRO_ASSERT(o->command_stream.hasCommand(c))
             
-            TheSerial::recvConsume(c, RecvSizeType::import(o->gcode_parser.getLength(c)));
+            auto length = BinaryFramingFeature::is_active(c) ? BinaryFramingFeature::get_length(c) : o->gcode_parser.getLength(c);
+            TheSerial::recvConsume(c, RecvSizeType::import(length));
+            BinaryFramingFeature::command_finished(c);
             TheSerial::recvForceEvent(c);
         }
         
@@ -127,6 +120,23 @@ private:
             TheSerial::sendPoke(c);
         }
         
+        void reply_append_ok_impl (Context c)
+        {
+            auto *o = Object::self(c);
+            AMBRO_ASSERT(o->command_stream.hasCommand(c))
+            
+            typename RecvSizeType::IntType length;
+            if (BinaryFramingFeature::is_active(c)) {
+                length = BinaryFramingFeature::get_length(c);
+            } else {
+                o->flow_control.handleParseResult(c, &o->command_stream, o->gcode_parser.getCmd(c), o->gcode_parser.getNumParts(c));
+                length = o->gcode_parser.getLength(c);
+            }
+            bool overrun;
+            RecvSizeType avail = TheSerial::recvQuery(c, &overrun);
+            o->flow_control.appendOk(c, &o->command_stream, RecvSizeType::maxIntValue() - avail.value() + length);
+        }
+        
         void reply_append_buffer_impl (Context c, char const *str, size_t length)
         {
             SendSizeType avail = TheSerial::sendQuery(c);
@@ -187,19 +197,30 @@ private:
         if (o->command_stream.hasCommand(c)) {
             return;
         }
-        if (!o->gcode_parser.haveCommand(c)) {
-            o->gcode_parser.startCommand(c, TheSerial::recvGetChunkPtr(c), o->m_recv_next_error);
+        if (BinaryFramingFeature::is_active(c)) {
+            return BinaryFramingFeature::recv(c);
+        }
+        recv_with_parser(c, &o->gcode_parser);
+    }
+    
+    template <typename Parser>
+    static void recv_with_parser (Context c, Parser *parser)
+    {
+        auto *o = Object::self(c);
+        
+        if (!parser->haveCommand(c)) {
+            parser->startCommand(c, TheSerial::recvGetChunkPtr(c), o->m_recv_next_error);
             o->m_recv_next_error = 0;
         }
         bool overrun;
         RecvSizeType avail = TheSerial::recvQuery(c, &overrun);
-        if (o->gcode_parser.extendCommand(c, avail.value())) {
-            return o->command_stream.startCommand(c, &o->gcode_parser);
+        if (parser->extendCommand(c, avail.value())) {
+            return o->command_stream.startCommand(c, parser);
         }
         if (overrun) {
             TheSerial::recvConsume(c, avail);
             TheSerial::recvClearOverrun(c);
-            o->gcode_parser.resetCommand(c);
+            parser->resetCommand(c);
             o->m_recv_next_error = GCODE_ERROR_RECV_OVERRUN;
         }
     }
@@ -212,15 +233,119 @@ private:
     }
     struct SerialSendHandler : public AMBRO_WFUNC_TD(&SerialModule::serial_send_handler) {};
     
+    AMBRO_STRUCT_IF(BinaryFramingFeature, Params::BinaryFrameParserService::Enabled) {
+        struct Object;
+        using TheFrameParser = typename Params::BinaryFrameParserService::template Parser<Context, typename RecvSizeType::IntType, typename ThePrinterMain::FpType>;
+        
+        static_assert(RecvSizeType::maxIntValue() >= TheFrameParser::MaxFrameSize, "Serial receive buffer is too small for binary framing");
+        
+        static void init (Context c)
+        {
+            auto *o = Object::self(c);
+            o->frame_parser.init(c);
+            o->active = false;
+            o->switch_pending = false;
+        }
+        
+        static void deinit (Context c)
+        {
+            auto *o = Object::self(c);
+            o->frame_parser.deinit(c);
+        }
+        
+        static bool is_active (Context c)
+        {
+            auto *o = Object::self(c);
+            return o->active;
+        }
+        
+        static typename RecvSizeType::IntType get_length (Context c)
+        {
+            auto *o = Object::self(c);
+            return o->frame_parser.getLength(c);
+        }
+        
+        static void recv (Context c)
+        {
+            auto *o = Object::self(c);
+            recv_with_parser(c, &o->frame_parser);
+        }
+        
+        static bool start_command (Context c)
+        {
+            auto *o = Object::self(c);
+            auto *mo = SerialModule::Object::self(c);
+            
+            if (!(mo->command_stream.getCmdCode(c) == 'M' && mo->command_stream.getCmdNumber(c) == 948)) {
+                return true;
+            }
+            bool enable = mo->command_stream.get_command_param_uint32(c, 'S', 1);
+            if (enable) {
+                mo->command_stream.reply_append_pstr(c, AMBRO_PSTR("BinaryFraming Window:"));
+                mo->command_stream.reply_append_uint32(c, RecvSizeType::maxIntValue());
+                mo->command_stream.reply_append_pstr(c, AMBRO_PSTR(" MaxParts:"));
+                mo->command_stream.reply_append_uint32(c, Params::BinaryFrameParserService::MaxParts);
+                mo->command_stream.reply_append_ch(c, '\n');
+            }
+            o->switch_pending = (enable != o->active);
+            return false;
+        }
+        
+        static void command_finished (Context c)
+        {
+            auto *o = Object::self(c);
+            auto *mo = SerialModule::Object::self(c);
+            
+            if (o->active) {
+                auto reply = o->frame_parser.getReply(c);
+                if (reply != TheFrameParser::Reply::NONE) {
+                    if (reply == TheFrameParser::Reply::SYNC) {
+                        mo->command_stream.reply_append_pstr(c, AMBRO_PSTR("Sync:"));
+                        mo->command_stream.reply_append_uint32(c, o->frame_parser.getSyncToken(c));
+                        mo->command_stream.reply_append_pstr(c, AMBRO_PSTR(" Next:"));
+                    } else {
+                        mo->command_stream.reply_append_pstr(c, AMBRO_PSTR("Resend:"));
+                    }
+                    mo->command_stream.reply_append_uint32(c, o->frame_parser.getExpectedSequence(c));
+                    mo->command_stream.reply_append_ch(c, '\n');
+                    mo->command_stream.reply_poke(c);
+                }
+            }
+            if (o->switch_pending) {
+                o->switch_pending = false;
+                o->active = !o->active;
+                if (o->active) {
+                    o->frame_parser.resetSequence(c);
+                }
+            }
+        }
+        
+        struct Object : public ObjBase<BinaryFramingFeature, typename SerialModule::Object, EmptyTypeList> {
+            TheFrameParser frame_parser;
+            bool active;
+            bool switch_pending;
+        };
+    } AMBRO_STRUCT_ELSE(BinaryFramingFeature) {
+        static void init (Context c) {}
+        static void deinit (Context c) {}
+        static bool is_active (Context c) { return false; }
+        static typename RecvSizeType::IntType get_length (Context c) { return 0; }
+        static void recv (Context c) {}
+        static bool start_command (Context c) { return true; }
+        static void command_finished (Context c) {}
+        struct Object {};
+    };
+    
 public:
     struct Object : public ObjBase<SerialModule, ParentObject, MakeTypeList<
-        TheSerial
+        TheSerial,
+        BinaryFramingFeature
     >> {
         TheGcodeParser gcode_parser;
         typename ThePrinterMain::CommandStream command_stream;
         StreamCallback callback;
         int8_t m_recv_next_error;
-        uint32_t m_line_number;
+        TheLineFlowControl flow_control;
     };
 };
 
@@ -229,6 +354,7 @@ APRINTER_ALIAS_STRUCT_EXT(SerialModuleService, (
     APRINTER_AS_VALUE(int, RecvBufferSizeExp),
     APRINTER_AS_VALUE(int, SendBufferSizeExp),
     APRINTER_AS_TYPE(TheGcodeParserService),
+    APRINTER_AS_TYPE(BinaryFrameParserService),
     APRINTER_AS_TYPE(SerialService)
 ), (
     APRINTER_MODULE_TEMPLATE(SerialModuleService, SerialModule)
@@ -31,6 +31,7 @@
 
 #include <aprinter/meta/MinMax.h>
 #include <aprinter/meta/ServiceUtils.h>
+#include <aprinter/meta/StructIf.h>
 #include <aprinter/base/Object.h>
 #include <aprinter/base/ProgramMemory.h>
 #include <aprinter/base/Assert.h>
@@ -38,6 +39,8 @@
 #include <aprinter/base/OneOf.h>
 #include <aprinter/base/Preprocessor.h>
 #include <aprinter/printer/utils/ConvenientCommandStream.h>
+#include <aprinter/printer/utils/BinaryFrameParser.h>
+#include <aprinter/printer/utils/LineFlowControl.h>
 #include <aprinter/printer/utils/ModuleUtils.h>
 
 #include <aipstack/infra/Buf.h>
@@ -63,7 +66,7 @@ private:
     using TimeType = typename Context::Clock::TimeType;
     using Network = typename Context::Network;
     APRINTER_USE_TYPES1(Network, (TcpArg))
-
+    
     using TcpListener = AIpStack::TcpListener<TcpArg>;
     using TcpConnection = AIpStack::TcpConnection<TcpArg>;
     using SendRingBuffer = AIpStack::SendRingBuffer<TcpArg>;
@@ -72,6 +75,7 @@ private:
     using TheConvenientStream = ConvenientCommandStream<Context, ThePrinterMain>;
     
     using TheGcodeParser = typename Params::TheGcodeParserService::template Parser<Context, size_t, typename ThePrinterMain::FpType>;
+    using TheLineFlowControl = LineFlowControl<Context, ThePrinterMain>;
     
     static int const MaxClients = Params::MaxClients;
     static_assert(MaxClients > 0, "");
@@ -91,6 +95,8 @@ private:
     
     static size_t const RecvMirrorSize = MaxCommandSize - 1;
     
+    static bool const BinaryFramingEnabled = Params::BinaryFrameParserService::Enabled;
+    
     static TimeType const SendBufTimeoutTicks = Params::SendBufTimeout::value() * Context::Clock::time_freq;
     static TimeType const SendEndTimeoutTicks = Params::SendEndTimeout::value() * Context::Clock::time_freq;
     
@@ -141,7 +147,18 @@ private:
         ThePrinterMain::print_pgm_string(c, AMBRO_PSTR("//TcpConsoleAcceptNoSlot\n"));
     }
     
+    APRINTER_STRUCT_IF_TEMPLATE(BinaryFramingMembers) {
+        using TheFrameParser = typename Params::BinaryFrameParserService::template Parser<Context, size_t, typename ThePrinterMain::FpType>;
+        
+        static_assert(MaxCommandSize >= TheFrameParser::MaxFrameSize, "TCP console MaxCommandSize is too small for binary framing");
+        
+        TheFrameParser m_frame_parser;
+        bool m_framing_active;
+        bool m_framing_switch_pending;
+    };
+    
     struct Client :
+        public BinaryFramingMembers<BinaryFramingEnabled>,
         private TheConvenientStream::UserCallback,
         private TcpConnection
     {
@@ -162,6 +179,7 @@ private:
             if (m_state != State::NOT_CONNECTED) {
                 m_send_timeout_event.deinit(c);
                 m_command_stream.deinit(c);
+                BinaryFramingFeature::deinit(c, this);
                 m_gcode_parser.deinit(c);
             }
             TcpConnection::reset();
@@ -183,6 +201,8 @@ private:
                                   Network::TcpWndUpdThrDiv, AIpStack::IpBufRef{});
             
             m_gcode_parser.init(c);
+            BinaryFramingFeature::init(c, this);
+            m_flow_control.init(c);
             m_command_stream.init(c, SendBufTimeoutTicks, this, APRINTER_CB_OBJFUNC_T(&Client::next_event_handler, this));
             m_send_timeout_event.init(c, APRINTER_CB_OBJFUNC_T(&Client::send_timeout_event_handler, this));
             
@@ -195,6 +215,7 @@ private:
             
             m_send_timeout_event.deinit(c);
             m_command_stream.deinit(c);
+            BinaryFramingFeature::deinit(c, this);
             m_gcode_parser.deinit(c);
             
             TcpConnection::reset();
@@ -282,16 +303,12 @@ private:
                 return disconnect(c);
             }
             
-            AIpStack::IpBufRef read_range = m_recv_ring_buf.getReadRange(*this);
-            size_t avail = MinValue(MaxCommandSize, read_range.tot_len);
-            bool line_buffer_exhausted = (avail == MaxCommandSize);
-            
-            if (!m_gcode_parser.haveCommand(c)) {
-                m_gcode_parser.startCommand(c, read_range.getChunkPtr(), 0);
-            }
-            
-            if (m_gcode_parser.extendCommand(c, avail, line_buffer_exhausted)) {
-                return m_command_stream.startCommand(c, &m_gcode_parser);
+            bool line_buffer_exhausted;
+            bool started = BinaryFramingFeature::is_active(this) ?
+                BinaryFramingFeature::recv(c, this, &line_buffer_exhausted) :
+                recv_with_parser(c, &m_gcode_parser, &line_buffer_exhausted);
+            if (started) {
+                return;
             }
             
             if (line_buffer_exhausted || TcpConnection::wasEndReceived()) {
@@ -303,14 +320,48 @@ private:
             }
         }
         
+        template <typename Parser>
+        bool recv_with_parser (Context c, Parser *parser, bool *out_line_buffer_exhausted)
+        {
+            AIpStack::IpBufRef read_range = m_recv_ring_buf.getReadRange(*this);
+            size_t avail = MinValue(MaxCommandSize, read_range.tot_len);
+            bool line_buffer_exhausted = (avail == MaxCommandSize);
+            *out_line_buffer_exhausted = line_buffer_exhausted;
+            
+            if (!parser->haveCommand(c)) {
+                parser->startCommand(c, read_range.getChunkPtr(), 0);
+            }
+            
+            if (parser->extendCommand(c, avail, line_buffer_exhausted)) {
+                m_command_stream.startCommand(c, parser);
+                return true;
+            }
+            
+            return false;
+        }
+        
+        bool start_command_impl (Context c) override
+        {
+            AMBRO_ASSERT(state_not_disconnected(m_state))
+            
+            if (!BinaryFramingFeature::is_active(this) && !m_flow_control.startCommand(c, m_command_stream.getCommandStream(c), m_gcode_parser.getCmd(c), RecvBufferSize)) {
+                return false;
+            }
+            return BinaryFramingFeature::start_command(c, this);
+        }
+        
         void finish_command_impl (Context c) override
         {
             AMBRO_ASSERT(state_not_disconnected(m_state))
             
             if (m_state == OneOf(State::CONNECTED, State::SENDING_END)) {
-                m_recv_ring_buf.consumeData(*this, m_gcode_parser.getLength(c));
+                size_t length = BinaryFramingFeature::is_active(this) ?
+                    BinaryFramingFeature::get_length(c, this) : m_gcode_parser.getLength(c);
+                m_recv_ring_buf.consumeData(*this, length);
             }
             
+            BinaryFramingFeature::command_finished(c, this);
+            
             if (m_state != State::SENDING_END) {
                 m_command_stream.setNextEventAfterCommandFinished(c);
             }
@@ -325,6 +376,25 @@ private:
             }
         }
         
+        void reply_append_ok_impl (Context c) override
+        {
+            AMBRO_ASSERT(state_not_disconnected(m_state))
+            
+            auto *cs = m_command_stream.getCommandStream(c);
+            size_t length;
+            if (BinaryFramingFeature::is_active(this)) {
+                length = BinaryFramingFeature::get_length(c, this);
+            } else {
+                m_flow_control.handleParseResult(c, cs, m_gcode_parser.getCmd(c), m_gcode_parser.getNumParts(c));
+                length = m_gcode_parser.getLength(c);
+            }
+            size_t buffer_free = 0;
+            if (m_state == OneOf(State::CONNECTED, State::SENDING_END)) {
+                buffer_free = RecvBufferSize - m_recv_ring_buf.getReadRange(*this).tot_len + length;
+            }
+            m_flow_control.appendOk(c, cs, buffer_free);
+        }
+        
         void reply_append_buffer_impl (Context c, char const *str, size_t length) override
         {
             AMBRO_ASSERT(state_not_disconnected(m_state))
@@ -380,17 +450,104 @@ private:
         RecvRingBuffer m_recv_ring_buf;
         TheGcodeParser m_gcode_parser;
         TheConvenientStream m_command_stream;
+        TheLineFlowControl m_flow_control;
         typename Context::EventLoop::TimedEvent m_send_timeout_event;
         State m_state;
         char m_send_buf[SendBufferSize];
         char m_recv_buf[RecvBufferSize+RecvMirrorSize];
     };
     
+    AMBRO_STRUCT_IF(BinaryFramingFeature, BinaryFramingEnabled) {
+        using TheFrameParser = typename BinaryFramingMembers<true>::TheFrameParser;
+        
+        static void init (Context c, Client *cl)
+        {
+            cl->m_frame_parser.init(c);
+            cl->m_framing_active = false;
+            cl->m_framing_switch_pending = false;
+        }
+        
+        static void deinit (Context c, Client *cl)
+        {
+            cl->m_frame_parser.deinit(c);
+        }
+        
+        static bool is_active (Client *cl)
+        {
+            return cl->m_framing_active;
+        }
+        
+        static size_t get_length (Context c, Client *cl)
+        {
+            return cl->m_frame_parser.getLength(c);
+        }
+        
+        static bool recv (Context c, Client *cl, bool *out_line_buffer_exhausted)
+        {
+            return cl->recv_with_parser(c, &cl->m_frame_parser, out_line_buffer_exhausted);
+        }
+        
+        static bool start_command (Context c, Client *cl)
+        {
+            auto *cs = &cl->m_command_stream;
+            
+            if (!(cs->getCmdCode(c) == 'M' && cs->getCmdNumber(c) == 948)) {
+                return true;
+            }
+            bool enable = cs->get_command_param_uint32(c, 'S', 1);
+            if (enable) {
+                cs->reply_append_pstr(c, AMBRO_PSTR("BinaryFraming Window:"));
+                cs->reply_append_uint32(c, RecvBufferSize);
+                cs->reply_append_pstr(c, AMBRO_PSTR(" MaxParts:"));
+                cs->reply_append_uint32(c, Params::BinaryFrameParserService::MaxParts);
+                cs->reply_append_ch(c, '\n');
+            }
+            cl->m_framing_switch_pending = (enable != cl->m_framing_active);
+            return false;
+        }
+        
+        static void command_finished (Context c, Client *cl)
+        {
+            auto *cs = &cl->m_command_stream;
+            
+            if (cl->m_framing_active) {
+                auto reply = cl->m_frame_parser.getReply(c);
+                if (reply != TheFrameParser::Reply::NONE) {
+                    if (reply == TheFrameParser::Reply::SYNC) {
+                        cs->reply_append_pstr(c, AMBRO_PSTR("Sync:"));
+                        cs->reply_append_uint32(c, cl->m_frame_parser.getSyncToken(c));
+                        cs->reply_append_pstr(c, AMBRO_PSTR(" Next:"));
+                    } else {
+                        cs->reply_append_pstr(c, AMBRO_PSTR("Resend:"));
+                    }
+                    cs->reply_append_uint32(c, cl->m_frame_parser.getExpectedSequence(c));
+                    cs->reply_append_ch(c, '\n');
+                    cs->reply_poke(c, true);
+                }
+            }
+            if (cl->m_framing_switch_pending) {
+                cl->m_framing_switch_pending = false;
+                cl->m_framing_active = !cl->m_framing_active;
+                if (cl->m_framing_active) {
+                    cl->m_frame_parser.resetSequence(c);
+                }
+            }
+        }
+    } AMBRO_STRUCT_ELSE(BinaryFramingFeature) {
+        static void init (Context c, Client *cl) {}
+        static void deinit (Context c, Client *cl) {}
+        static bool is_active (Client *cl) { return false; }
+        static size_t get_length (Context c, Client *cl) { return 0; }
+        static bool recv (Context c, Client *cl, bool *out_line_buffer_exhausted) { return false; }
+        static bool start_command (Context c, Client *cl) { return true; }
+        static void command_finished (Context c, Client *cl) {}
+    };
+    
 public:
     struct Object : public ObjBase<TcpConsoleModule, ParentObject, EmptyTypeList> {
         TcpListener listener;
         Client clients[MaxClients];
-
+        
         Object () :
             listener(&TcpConsoleModule::connectionEstablished)
         {}
@@ -399,6 +556,7 @@ public:
 
 APRINTER_ALIAS_STRUCT_EXT(TcpConsoleModuleService, (
     APRINTER_AS_TYPE(TheGcodeParserService),
+    APRINTER_AS_TYPE(BinaryFrameParserService),
     APRINTER_AS_VALUE(uint16_t, Port),
     APRINTER_AS_VALUE(int, MaxClients),
     APRINTER_AS_VALUE(int, MaxPcbs),
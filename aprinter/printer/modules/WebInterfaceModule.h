@@ -45,6 +45,7 @@
 #include <aprinter/base/MemRef.h>
 #include <aprinter/net/http/HttpServer.h>
 #include <aprinter/fs/BufferedFile.h>
+#include <aprinter/math/PrintInt.h>
 #include <aprinter/misc/StringTools.h>
 #include <aprinter/printer/ServiceList.h>
 #include <aprinter/printer/utils/JsonBuilder.h>
@@ -79,7 +80,7 @@ private:
         typename Params::HttpServerNetParams,
         128,   // MaxRequestLineLength
         64,    // MaxHeaderLineLength
-        283,   // ExpectedResponseLength
+        320,   // ExpectedResponseLength
         10000, // MaxRequestHeadLength
         256,   // MaxChunkHeaderLength
         1024,  // MaxTrailerLength
@@ -87,8 +88,26 @@ private:
     >;
     
     static size_t const GetSdChunkSize = 512;
+    static size_t const GetSdMaxChunkBlocks = 4;
     static size_t const GcodeParseChunkSize = 16;
     
+    // Cache-Control for files from the web root other than the index page.
+    // Everything else is revalidated using the ETag on each use.
+    static constexpr char const * StaticCacheControl() { return "max-age=3600"; }
+    static constexpr char const * DefaultCacheControl() { return "no-cache"; }
+    
+    // Buffer for the ETag, Cache-Control, Accept-Ranges or Content-Range and
+    // content-coding headers of file responses. Together with the rest of the
+    // response head this must stay within ExpectedResponseLength. While the
+    // file is being opened, it holds the name of the ".gz" variant.
+    static size_t const FileHeadersSize = 168;
+    
+    // ETag, longest Cache-Control, Vary, Content-Encoding, longest Content-Range
+    // with three 10-digit numbers, and the null terminator.
+    static_assert(FileHeadersSize >= 36 + 29 + 23 + 24 + 55 + 1, "");
+    
+    static constexpr char const * GzipSuffix() { return ".gz"; }
+    
 private:
     using TimeType = typename Context::Clock::TimeType;
     
@@ -153,6 +172,13 @@ private:
     static_assert(TheHttpServer::GuaranteedTxChunkSizeWithoutPoke >= JsonBufferSize, "HTTP send buffer too small for JsonBufferSize");
     static_assert(TheHttpServer::GuaranteedTxChunkSizeWithoutPoke >= GetSdChunkSize, "HTTP send buffer too small for SD card transfer");
     
+    // File data is read from several blocks straight into the send buffer (possibly
+    // across its wrap-around) and submitted as one HTTP chunk, which results in fewer
+    // and fuller TCP segments than submitting each block. The chunk must fit into the
+    // send buffer space which is guaranteed to become available.
+    static size_t const GetSdSendChunkSize = MinValue(GetSdMaxChunkBlocks * GetSdChunkSize,
+        TheHttpServer::GuaranteedTxChunkSizeWithoutPoke / GetSdChunkSize * GetSdChunkSize);
+    
     static TimeType const GcodeSendBufTimeoutTicks = Params::GcodeSendBufTimeout::value() * Context::Clock::time_freq;
     
 public:
@@ -235,15 +261,19 @@ private:
             if (path.ptr[0] == '/') {
                 char const *base_dir = WebRootPath();
                 char const *file_path;
+                bool static_asset = false;
+                bool try_gzip = request->acceptsGzip(c);
                 if (path.equalTo("/")) {
                     file_path = IndexPage();
                 } else if (path.removePrefix(RootAccessPath())) {
                     base_dir = nullptr;
                     file_path = path.ptr;
+                    try_gzip = false;
                 } else {
                     file_path = path.ptr + 1;
+                    static_asset = (strcmp(file_path, IndexPage()) != 0);
                 }
-                return state->acceptGetFileRequest(c, request, file_path, base_dir);
+                return state->acceptGetFileRequest(c, request, file_path, base_dir, static_asset, try_gzip);
             }
         }
         else if (!strcmp(method, "POST")) {
@@ -320,7 +350,7 @@ private:
     private:
         enum class State : uint8_t {
             NO_CLIENT,
-            READ_OPEN, READ_WAIT, READ_READ,
+            READ_OPEN, READ_SEEK, READ_WAIT, READ_READ,
             WRITE_OPEN, WRITE_WAIT, WRITE_WRITE, WRITE_EOF,
             JSONRESP_WAITBUF, JSONRESP_CUSTOM_TRY, JSONRESP_CUSTOM,
             GCODE,
@@ -378,14 +408,30 @@ private:
         }
         
     public:
-        void acceptGetFileRequest (Context c, TheRequestInterface *request, char const *file_path, char const *base_dir)
+        // With try_gzip, the precompressed variant (file_path + ".gz") is served if it
+        // exists, otherwise the file itself. This is only done for the web root.
+        void acceptGetFileRequest (Context c, TheRequestInterface *request, char const *file_path, char const *base_dir, bool static_asset, bool try_gzip)
         {
+            AMBRO_ASSERT(!try_gzip || base_dir)
+            
             accept_request_common(c, request);
             
             m_file_path = file_path;
+            m_static_asset = static_asset;
+            m_negotiated = (base_dir != nullptr);
+            m_gzip = false;
             m_state = State::READ_OPEN;
             init_file(c);
-            m_buffered_file.startOpen(c, file_path, false, TheBufferedFile::OpenMode::OPEN_READ, base_dir);
+            
+            size_t path_len = strlen(file_path);
+            char const *open_path = file_path;
+            if (try_gzip && path_len + strlen(GzipSuffix()) < FileHeadersSize) {
+                memcpy(m_file_headers, file_path, path_len);
+                strcpy(m_file_headers + path_len, GzipSuffix());
+                open_path = m_file_headers;
+                m_gzip = true;
+            }
+            m_buffered_file.startOpen(c, open_path, false, TheBufferedFile::OpenMode::OPEN_READ, base_dir);
         }
         
         void acceptUploadFileRequest (Context c, TheRequestInterface *request, char const *file_path)
@@ -497,9 +543,9 @@ private:
             switch (m_state) {
                 case State::READ_WAIT: {
                     AIpStack::IpBufRef resp_buf = m_request->getResponseBodyBuffer(c);
-                    size_t allowed_length = MinValue(GetSdChunkSize, resp_buf.tot_len);
+                    size_t allowed_length = MinValue(GetSdSendChunkSize, resp_buf.tot_len);
                     if (allowed_length > m_cur_chunk_size) {
-                        size_t avail_len = allowed_length - m_cur_chunk_size;
+                        size_t avail_len = MinValue(allowed_length - m_cur_chunk_size, (size_t)MinValue(m_rem_length, (uint32_t)GetSdSendChunkSize));
                         resp_buf = AIpStack::ipBufSkipBytes(resp_buf, m_cur_chunk_size);
                         m_buffered_file.startReadData(c, resp_buf.getChunkPtr(),
                             MinValue(resp_buf.getChunkLength(), avail_len));
@@ -508,6 +554,7 @@ private:
                     }
                 } break;
                 
+                case State::READ_SEEK:
                 case State::READ_READ:
                     break;
                 
@@ -597,6 +644,13 @@ private:
             switch (m_state) {
                 case State::READ_OPEN:
                 case State::WRITE_OPEN: {
+                    // If there is no precompressed variant, serve the file itself.
+                    if (m_state == State::READ_OPEN && m_gzip && error == TheBufferedFile::Error::NOT_FOUND) {
+                        m_gzip = false;
+                        m_buffered_file.startOpen(c, m_file_path, false, TheBufferedFile::OpenMode::OPEN_READ, WebRootPath());
+                        return;
+                    }
+                    
                     if (error != TheBufferedFile::Error::NO_ERROR) {
                         auto status = (error == TheBufferedFile::Error::NOT_FOUND) ? HttpStatusCodes::NotFound() : HttpStatusCodes::InternalServerError();
                         m_request->setResponseStatus(c, status);
@@ -604,12 +658,7 @@ private:
                     }
                     
                     if (m_state == State::READ_OPEN) {
-                        m_request->setResponseContentType(c, get_content_type(m_file_path));
-                        m_request->adoptResponseBody(c);
-                        
-                        m_state = State::READ_WAIT;
-                        m_cur_chunk_size = 0;
-                        m_request->controlResponseBodyTimeout(c, true);
+                        return start_file_response(c);
                     } else {
                         m_request->adoptRequestBody(c);
                         
@@ -618,21 +667,35 @@ private:
                     }
                 } break;
                 
+                case State::READ_SEEK: {
+                    if (error != TheBufferedFile::Error::NO_ERROR) {
+                        ThePrinterMain::print_pgm_string(c, AMBRO_PSTR("//HttpSdReadError\n"));
+                        m_request->setResponseStatus(c, HttpStatusCodes::InternalServerError());
+                        return complete_request(c);
+                    }
+                    
+                    start_file_body(c);
+                } break;
+                
                 case State::READ_READ: {
                     if (error != TheBufferedFile::Error::NO_ERROR) {
                         ThePrinterMain::print_pgm_string(c, AMBRO_PSTR("//HttpSdReadError\n"));
                         return complete_request(c);
                     }
                     
-                    AMBRO_ASSERT(read_length <= GetSdChunkSize - m_cur_chunk_size)
+                    AMBRO_ASSERT(read_length <= GetSdSendChunkSize - m_cur_chunk_size)
+                    AMBRO_ASSERT(read_length <= m_rem_length)
                     m_cur_chunk_size += read_length;
+                    m_rem_length -= read_length;
+                    
+                    bool end = (read_length == 0 || m_rem_length == 0);
                     
-                    if (m_cur_chunk_size == GetSdChunkSize || (read_length == 0 && m_cur_chunk_size > 0)) {
+                    if (m_cur_chunk_size == GetSdSendChunkSize || (end && m_cur_chunk_size > 0)) {
                         m_request->provideResponseBodyData(c, m_cur_chunk_size);
                         m_cur_chunk_size = 0;
                     }
                     
-                    if (read_length == 0) {
+                    if (end) {
                         return complete_request(c);
                     }
                     
@@ -664,6 +727,107 @@ private:
             }
         }
         
+        void start_file_response (Context c)
+        {
+            uint32_t file_size = m_buffered_file.getFileSize(c);
+            
+            // Strong entity tag from the size, modification time and first
+            // cluster in the directory entry, in the form
+            // "ssssssss-tttttttt-cccccccc". The file system gives each written
+            // or created file a time later than any it has seen, and the first
+            // cluster tells apart files which have been replaced.
+            char etag[29];
+            etag[0] = '"';
+            StringEncodeHexUint32(file_size, etag + 1);
+            etag[9] = '-';
+            StringEncodeHexUint32(m_buffered_file.getModTime(c), etag + 10);
+            etag[18] = '-';
+            StringEncodeHexUint32(m_buffered_file.getFirstCluster(c), etag + 19);
+            etag[27] = '"';
+            etag[28] = '\0';
+            AIpStack::MemRef etag_mr(etag, 28);
+            
+            char *headers = m_file_headers;
+            headers = append_header_str(headers, "ETag: ");
+            headers = append_header_str(headers, etag);
+            headers = append_header_str(headers, "\r\nCache-Control: ");
+            headers = append_header_str(headers, m_static_asset ? StaticCacheControl() : DefaultCacheControl());
+            headers = append_header_str(headers, "\r\n");
+            if (m_negotiated) {
+                headers = append_header_str(headers, "Vary: Accept-Encoding\r\n");
+            }
+            if (m_gzip) {
+                headers = append_header_str(headers, "Content-Encoding: gzip\r\n");
+            }
+            *headers = '\0';
+            m_request->setResponseExtraHeaders(c, m_file_headers);
+            
+            if (m_request->checkIfNoneMatch(c, etag_mr)) {
+                m_request->setResponseStatus(c, HttpStatusCodes::NotModified());
+                return complete_request(c);
+            }
+            
+            uint32_t offset = 0;
+            m_rem_length = file_size;
+            
+            HttpByteRange range;
+            if (m_request->getRequestRange(c, &range) && m_request->checkIfRange(c, etag_mr)) {
+                uint64_t range_offset;
+                uint64_t range_count;
+                if (!range.resolve(file_size, &range_offset, &range_count)) {
+                    headers = append_header_str(headers, "Content-Range: bytes */");
+                    headers += PrintNonnegativeIntDecimal<uint32_t>(file_size, headers);
+                    headers = append_header_str(headers, "\r\n");
+                    *headers = '\0';
+                    m_request->setResponseStatus(c, HttpStatusCodes::RangeNotSatisfiable());
+                    return complete_request(c);
+                }
+                
+                offset = range_offset;
+                m_rem_length = range_count;
+                
+                headers = append_header_str(headers, "Content-Range: bytes ");
+                headers += PrintNonnegativeIntDecimal<uint32_t>(offset, headers);
+                *headers++ = '-';
+                headers += PrintNonnegativeIntDecimal<uint32_t>(offset + m_rem_length - 1, headers);
+                *headers++ = '/';
+                headers += PrintNonnegativeIntDecimal<uint32_t>(file_size, headers);
+                headers = append_header_str(headers, "\r\n");
+                *headers = '\0';
+                m_request->setResponseStatus(c, HttpStatusCodes::PartialContent());
+            } else {
+                headers = append_header_str(headers, "Accept-Ranges: bytes\r\n");
+                *headers = '\0';
+            }
+            
+            if (offset > 0) {
+                m_state = State::READ_SEEK;
+                m_buffered_file.startSeek(c, offset);
+                return;
+            }
+            
+            start_file_body(c);
+        }
+        
+        // Appends to m_file_headers without terminating; the sizes of all the
+        // pieces are bounded so that FileHeadersSize is always enough.
+        static char * append_header_str (char *out, char const *str)
+        {
+            size_t len = strlen(str);
+            memcpy(out, str, len);
+            return out + len;
+        }
+        
+        void start_file_body (Context c)
+        {
+            m_request->setResponseContentType(c, get_content_type(m_file_path));
+            m_request->adoptResponseBody(c);
+            
+            m_state = State::READ_WAIT;
+            m_cur_chunk_size = 0;
+            m_request->controlResponseBodyTimeout(c, true);
+        }
+        
         void load_json_buffer (Context c)
         {
             auto *o = Object::self(c);
@@ -796,6 +960,11 @@ private:
             struct {
                 char const *m_file_path;
                 size_t m_cur_chunk_size;
+                uint32_t m_rem_length;
+                bool m_static_asset : 1;
+                bool m_negotiated : 1;
+                bool m_gzip : 1;
+                char m_file_headers[FileHeadersSize];
             };
             struct {
                 MemRef req_type;
@@ -0,0 +1,378 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AMBROLIB_BATCH_LINEAR_PLANNER_H
+#define AMBROLIB_BATCH_LINEAR_PLANNER_H
+
+#include <stddef.h>
+#include <math.h>
+
+#include <aprinter/meta/MinMax.h>
+#include <aprinter/base/Assert.h>
+#include <aprinter/base/Hints.h>
+#include <aprinter/math/FloatTools.h>
+#include <aprinter/printer/planning/LinearPlanner.h>
+
+namespace APrinter {
+
+/**
+ * Kernel with the same interface and results as LinearPlannerKernel,
+ * with the segment data stored as structure-of-arrays and the forward
+ * pass done over the given range of segments by forward(), which stores
+ * the results where pull() returns them from. The results of segments
+ * outside the range are left as they are, so pull() also returns those
+ * of the final segments before it from an earlier forward().
+ * 
+ * The forward pass of LinearPlanner carries the velocity from one
+ * segment to the next, but where a segment does not accelerate at
+ * full acceleration, its end velocity is the one found by the
+ * backward pass, which is also the max start velocity of the next
+ * segment. So forward() first plans every segment assuming that it
+ * starts at the end velocity of the previous one from the backward
+ * pass. This has no dependency between segments and no branches,
+ * and is done in blocks of a constant number of segments, which the
+ * compiler vectorizes where the target has vector instructions, with
+ * the segments at the ends of the range outside whole blocks done one
+ * at a time. It
+ * then follows the actual velocity from the start of the window,
+ * skipping over segments where it equals the assumed one up to the
+ * next segment which accelerates, and plans again only the segments
+ * after that which start below the assumed velocity. These are the
+ * segments of acceleration phases spanning more than one segment.
+ * 
+ * The computations are the same as in LinearPlanner, operation by
+ * operation, so the results are bit-identical. Minimums are computed
+ * by comparison, which is the same as FloatMin for the velocities,
+ * which are never NaN or negative zero, and halving by multiplication
+ * is exact like FloatLdexp(x, -1). The backward pass is sequential
+ * and incremental in the same way as in LinearPlannerKernel.
+ * 
+ * This needs memory for the results of all segments, so it is intended
+ * for large lookahead buffers on platforms with plenty of RAM. It is
+ * faster with float than with double, where fewer segments fit in a
+ * vector.
+ */
+template <typename FpType, int Size>
+class BatchLinearPlanner {
+    static size_t const BlockSize = 16;
+    
+public:
+    using SegmentResult = typename LinearPlanner<FpType>::SegmentResult;
+    
+    struct State {
+        // inputs
+        FpType a_x[Size];
+        FpType max_v[Size];
+        FpType max_start_v[Size];
+        FpType a_x_rec[Size];
+        // results of the backward pass, end_v[k + 1] is that of segment k
+        // and end_v[0] is set to that of the last segment by forward()
+        FpType end_v[Size + 1];
+        // results of the forward pass
+        FpType res_const_start[Size];
+        FpType res_const_end[Size];
+        FpType res_const_v[Size];
+        FpType res_end_v[Size];
+#ifdef AMBROLIB_ASSERTIONS
+        // the start velocity of each result, NAN if there is none
+        FpType res_start_v[Size];
+#endif
+    };
+    
+    // Initializes all slots, so that nothing ever computes on
+    // uninitialized values, even for segments never planned.
+    static void init (State *st)
+    {
+        for (size_t k = 0; k < Size; k++) {
+            st->a_x[k] = 0.0f;
+            st->max_v[k] = INFINITY;
+            st->max_start_v[k] = INFINITY;
+            st->a_x_rec[k] = 0.0f;
+            st->res_const_start[k] = 0.0f;
+            st->res_const_end[k] = 0.0f;
+            st->res_const_v[k] = 0.0f;
+            st->res_end_v[k] = 0.0f;
+#ifdef AMBROLIB_ASSERTIONS
+            st->res_start_v[k] = NAN;
+#endif
+        }
+        for (size_t k = 0; k <= Size; k++) {
+            st->end_v[k] = 0.0f;
+        }
+    }
+    
+    static void initSegment (State *st, size_t index, FpType prev_max_v, FpType max_start_v, FpType max_v, FpType a_x)
+    {
+        AMBRO_ASSERT(index < Size)
+        AMBRO_ASSERT(FloatIsPosOrPosZero(prev_max_v))
+        AMBRO_ASSERT(FloatIsPosOrPosZero(max_start_v))
+        AMBRO_ASSERT(FloatIsPosOrPosZero(max_v))
+        AMBRO_ASSERT(FloatIsPosOrPosZero(a_x))
+        
+        st->max_v[index] = max_v;
+        st->max_start_v[index] = FloatMin(prev_max_v, FloatMin(max_start_v, max_v));
+        st->a_x[index] = a_x;
+        st->a_x_rec[index] = 1.0f / a_x;
+    }
+    
+    static void initNeutralSegment (State *st, size_t index)
+    {
+        AMBRO_ASSERT(index < Size)
+        
+        st->a_x[index] = 0.0f;
+        st->max_v[index] = INFINITY;
+        st->max_start_v[index] = INFINITY;
+        st->a_x_rec[index] = 0.0f;
+    }
+    
+    static FpType getAccelRec (State const *st, size_t index)
+    {
+        AMBRO_ASSERT(index < Size)
+        
+        return st->a_x_rec[index];
+    }
+    
+    // The max start velocity of a segment found by the last backward pass.
+    static FpType getMaxStartV (State const *st, size_t index)
+    {
+        AMBRO_ASSERT(index < Size)
+        
+        return FloatMin(st->max_start_v[index], st->end_v[index + 1] + st->a_x[index]);
+    }
+    
+    static size_t backward (State *st, size_t start, size_t length, size_t planned_length)
+    {
+        AMBRO_ASSERT(start < Size)
+        AMBRO_ASSERT(length > 0)
+        AMBRO_ASSERT(length <= Size)
+        AMBRO_ASSERT(planned_length <= length)
+        
+        size_t end = start + length;
+        FpType v = 0.0f;
+        size_t final_index = Size;
+        bool more = true;
+        if (end > Size) {
+            size_t wrap_pos = Size - start;
+            size_t planned_end = (planned_length > wrap_pos) ? (planned_length - wrap_pos) : 0;
+            more = backward_range(st, 0, end - Size, planned_end, &v, &final_index);
+            end = Size;
+        }
+        if (more) {
+            backward_range(st, start, end, start + MinValue(planned_length, end - start), &v, &final_index);
+        }
+        
+        if (final_index == Size) {
+            return 0;
+        }
+        return (final_index >= start) ? (final_index - start) : (final_index + Size - start);
+    }
+    
+    static void forward (State *st, size_t start, size_t length, FpType start_v)
+    {
+        AMBRO_ASSERT(start < Size)
+        AMBRO_ASSERT(length > 0)
+        AMBRO_ASSERT(length <= Size)
+        AMBRO_ASSERT(FloatIsPosOrPosZero(start_v))
+        AMBRO_ASSERT(start_v <= getMaxStartV(st, start))
+        
+        FpType first_max_start_v = getMaxStartV(st, start);
+        size_t end = start + length;
+        if (end > Size) {
+            st->end_v[0] = st->end_v[Size];
+            assume_range(st, start, Size);
+            assume_range(st, 0, end - Size);
+        } else {
+            assume_range(st, start, end);
+        }
+        plan_segment(st, start, first_max_start_v);
+        
+        // Follow the actual velocity. A segment which starts at its assumed
+        // velocity has the right results. If it does not accelerate at full
+        // acceleration, so does the next one. Otherwise the following segments
+        // start lower and are planned again, up to and including the first one
+        // which does not accelerate at full acceleration from the actual velocity.
+        FpType v = start_v;
+        size_t i = 0;
+        if (v == first_max_start_v) {
+            i = find_accel(st, start, length, 0);
+            if (i == length) {
+                return;
+            }
+            v = st->res_end_v[wrap_index(start + i)];
+            i++;
+        }
+        while (i < length) {
+            size_t index = wrap_index(start + i);
+            FpType start_v_plus_a_x = v + st->a_x[index];
+            if (st->end_v[index + 1] > start_v_plus_a_x) {
+                st->res_const_start[index] = 1.0f;
+                st->res_const_end[index] = 0.0f;
+                st->res_const_v[index] = start_v_plus_a_x;
+                st->res_end_v[index] = start_v_plus_a_x;
+#ifdef AMBROLIB_ASSERTIONS
+                st->res_start_v[index] = v;
+#endif
+                v = start_v_plus_a_x;
+                i++;
+            } else {
+                plan_segment(st, index, v);
+                i = find_accel(st, start, length, i + 1);
+                if (i == length) {
+                    return;
+                }
+                v = st->res_end_v[wrap_index(start + i)];
+                i++;
+            }
+        }
+    }
+    
+    // Returns the results of the last forward() for a range containing the
+    // segment. The start velocity must be the one it was planned with, that
+    // is the end velocity of the previous segment, which neutral segments
+    // pass through unchanged.
+    static FpType pull (State *st, size_t index, FpType start_v, SegmentResult *result)
+    {
+        AMBRO_ASSERT(index < Size)
+        AMBRO_ASSERT(start_v == st->res_start_v[index])
+        
+        result->const_start = st->res_const_start[index];
+        result->const_end = st->res_const_end[index];
+        result->const_v = st->res_const_v[index];
+        return st->res_end_v[index];
+    }
+    
+private:
+    static size_t wrap_index (size_t index)
+    {
+        return (index >= Size) ? (index - Size) : index;
+    }
+    
+    static FpType min_v (FpType a, FpType b)
+    {
+        return (b < a) ? b : a;
+    }
+    
+    // Segments below planned_end have the results of the previous pass.
+    // Returns false if the pass can stop. Sets final_index to the first
+    // segment reached whose max start velocity is limited by its own
+    // constraints, if it is still Size.
+    static bool backward_range (State *st, size_t begin, size_t end, size_t planned_end, FpType *out_v, size_t *final_index)
+    {
+        FpType const *a_x = st->a_x;
+        FpType const *max_start_v = st->max_start_v;
+        FpType *end_v = st->end_v;
+        FpType v = *out_v;
+        
+        for (size_t i = end; i > begin; i--) {
+            size_t k = i - 1;
+            AMBRO_ASSERT(v <= st->max_v[k])
+            if (k < planned_end && end_v[k + 1] == v) {
+                return false;
+            }
+            end_v[k + 1] = v;
+            v = min_v(max_start_v[k], v + a_x[k]);
+            if (*final_index == Size && v == max_start_v[k]) {
+                *final_index = k;
+            }
+        }
+        
+        *out_v = v;
+        return true;
+    }
+    
+    // Plans a segment for the given start velocity, like LinearPlanner::pull(),
+    // and returns the end velocity.
+    AMBRO_ALWAYS_INLINE
+    static FpType plan_segment (State *st, size_t k, FpType start_v)
+    {
+        FpType end_v = st->end_v[k + 1];
+        FpType max_v = st->max_v[k];
+        FpType a_x_rec = st->a_x_rec[k];
+        
+        FpType start_v_plus_a_x = start_v + st->a_x[k];
+        bool accel = end_v > start_v_plus_a_x;
+        FpType half_start_v_plus_a_x_plus_end_v = (start_v_plus_a_x + end_v) * 0.5f;
+        bool cruise = half_start_v_plus_a_x_plus_end_v > max_v;
+        FpType const_v = cruise ? max_v : half_start_v_plus_a_x_plus_end_v;
+        FpType const_start = (const_v - start_v) * a_x_rec;
+        FpType const_end = cruise ? (max_v - end_v) * a_x_rec : 1.0f - const_start;
+        FpType res_end_v = accel ? start_v_plus_a_x : end_v;
+        
+        st->res_const_start[k] = accel ? (FpType)1.0f : const_start;
+        st->res_const_end[k] = accel ? (FpType)0.0f : const_end;
+        st->res_const_v[k] = accel ? start_v_plus_a_x : const_v;
+        st->res_end_v[k] = res_end_v;
+#ifdef AMBROLIB_ASSERTIONS
+        st->res_start_v[k] = start_v;
+#endif
+        
+        return res_end_v;
+    }
+    
+    // Plans the segments from begin to end assuming that each starts at the
+    // end velocity of the previous one. The whole blocks in the range have a
+    // constant size so that the compiler vectorizes them without a scalar
+    // remainder, the segments before and after them are planned one by one.
+    // A window smaller than a block has no whole blocks.
+    static void assume_range (State *st, size_t begin, size_t end)
+    {
+        size_t blocks_begin = MinValue(end, (begin + BlockSize - 1) / BlockSize * BlockSize);
+        size_t blocks_end = (Size >= BlockSize) ? MaxValue(blocks_begin, end / BlockSize * BlockSize) : blocks_begin;
+        for (size_t k = begin; k < blocks_begin; k++) {
+            plan_segment(st, k, st->end_v[k]);
+        }
+        for (size_t block = blocks_begin; block < blocks_end; block += BlockSize) {
+            for (size_t j = 0; j < BlockSize; j++) {
+                size_t k = block + j;
+                plan_segment(st, k, st->end_v[k]);
+            }
+        }
+        for (size_t k = blocks_end; k < end; k++) {
+            plan_segment(st, k, st->end_v[k]);
+        }
+    }
+    
+    // Returns the position in the window of the first segment at or after
+    // position i which accelerates at full acceleration from its assumed
+    // start velocity, or length if there is none. Only such a segment ends
+    // below its end velocity from the backward pass.
+    static size_t find_accel (State const *st, size_t start, size_t length, size_t i)
+    {
+        size_t index = wrap_index(start + i);
+        while (i < length && st->res_end_v[index] == st->end_v[index + 1]) {
+            i++;
+            index = (index == Size - 1) ? 0 : (index + 1);
+        }
+        return i;
+    }
+};
+
+struct BatchLinearPlannerService {
+    template <typename FpType, int Size>
+    using Kernel = BatchLinearPlanner<FpType, Size>;
+};
+
+}
+
+#endif
@@ -0,0 +1,408 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AMBROLIB_INPUT_SHAPER_H
+#define AMBROLIB_INPUT_SHAPER_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <aprinter/meta/ChooseInt.h>
+#include <aprinter/meta/MinMax.h>
+#include <aprinter/meta/ServiceUtils.h>
+#include <aprinter/base/Assert.h>
+#include <aprinter/math/FloatTools.h>
+
+namespace APrinter {
+
+/**
+ * Shaper types. All of them place the impulses at multiples of half the
+ * damped period of the resonance; they differ in the number of impulses
+ * and their relative amplitudes, given as functions of
+ * K = exp(-damping*pi/sqrt(1-damping^2)).
+ */
+struct InputShaperTypeZv {
+    static int const NumImpulses = 2;
+    
+    template <typename FpType>
+    static void weights (FpType k, FpType *w)
+    {
+        w[0] = 1.0f;
+        w[1] = k;
+    }
+};
+
+struct InputShaperTypeZvd {
+    static int const NumImpulses = 3;
+    
+    template <typename FpType>
+    static void weights (FpType k, FpType *w)
+    {
+        w[0] = 1.0f;
+        w[1] = 2.0f * k;
+        w[2] = k * k;
+    }
+};
+
+struct InputShaperTypeEi {
+    static int const NumImpulses = 3;
+    
+    template <typename FpType>
+    static void weights (FpType k, FpType *w)
+    {
+        // Extra-insensitive shaper for 5% residual vibration.
+        FpType const v = 0.05f;
+        w[0] = 0.25f * (1.0f + v);
+        w[1] = 0.5f * (1.0f - v) * k;
+        w[2] = 0.25f * (1.0f + v) * k * k;
+    }
+};
+
+/**
+ * Upper bounds for the number of output commands of an InputShaper. Each
+ * impulse crosses each input piece once, and each output piece may be split
+ * at a reversal. Additionally an impulse may cross all of the history before
+ * an input sequence (and the flush piece after it).
+ */
+template <typename ShaperType, int HistorySize>
+struct InputShaperBounds {
+    static int const MaxCommandsPerPiece = 2 * ShaperType::NumImpulses;
+    static int const MaxExtraCommands = 2 * ShaperType::NumImpulses * (HistorySize + 1);
+};
+
+/**
+ * Convolves the motion of one axis with a train of impulses, for
+ * suppressing resonances of the machine.
+ * 
+ * Input and output are pieces of constant acceleration in the same form as
+ * stepper commands (direction, steps x, duration t in clock ticks and
+ * acceleration term a, see AxisDriver). The output is the input delayed by
+ * each impulse and summed with the impulse amplitudes; this is again
+ * piecewise quadratic, with breakpoints at the delayed input breakpoints
+ * and additionally at any reversal of direction. Output positions are
+ * rounded to whole steps at the end of each output piece, the rounding
+ * error carrying over into the next piece.
+ * 
+ * The output advances in time together with the input. When the input
+ * ends, flush() outputs the remaining tail of duration equal to the
+ * largest delay and brings the shaper back to rest.
+ * 
+ * Input pieces are remembered as long as some impulse still needs them.
+ * If more than HistorySize pieces would be needed, the two adjacent
+ * pieces of least total duration which are not currently being read are
+ * merged into one, preserving duration and distance.
+ * 
+ * Output pieces are limited to 2^StepBits-1 steps and 2^TimeBits-1 ticks.
+ */
+template <typename FpType, typename ShaperType, int HistorySize, int StepBits, int TimeBits>
+class InputShaper {
+public:
+    static int const NumImpulses = ShaperType::NumImpulses;
+    
+    static_assert(NumImpulses >= 1, "");
+    static_assert(HistorySize >= 2 * NumImpulses + 2, "HistorySize too small");
+    
+    static int const MaxCommandsPerPiece = InputShaperBounds<ShaperType, HistorySize>::MaxCommandsPerPiece;
+    static int const MaxExtraCommands = InputShaperBounds<ShaperType, HistorySize>::MaxExtraCommands;
+    
+    using PieceIndexType = ChooseIntForMax<HistorySize, false>;
+    
+    struct Piece {
+        uint32_t duration;
+        FpType v0;
+        FpType accel;
+        FpType distance;
+    };
+    
+    struct Stream {
+        PieceIndexType index;
+        uint32_t offset;
+        FpType pos;
+    };
+    
+    struct State {
+        FpType amplitude[NumImpulses];
+        uint32_t delay[NumImpulses];
+        PieceIndexType num_pieces;
+        Stream streams[NumImpulses];
+        Piece pieces[HistorySize];
+    };
+    
+    /**
+     * Computes the impulses for the given resonance frequency [Hz] and
+     * damping ratio, with delays in ticks of a clock with frequency
+     * time_freq. A non-positive frequency results in no shaping.
+     */
+    static void computeImpulses (FpType frequency, FpType damping, FpType time_freq, FpType *amplitude, uint32_t *delay)
+    {
+        if (!(frequency > 0.0f)) {
+            for (int i = 0; i < NumImpulses; i++) {
+                amplitude[i] = (i == 0) ? 1.0f : 0.0f;
+                delay[i] = 0;
+            }
+            return;
+        }
+        
+        // Very low frequencies would result in impractically long delays.
+        frequency = FloatMax((FpType)1.0f, frequency);
+        damping = FloatMax((FpType)0.0f, FloatMin((FpType)0.9f, damping));
+        FpType damped_factor = FloatSqrt(1.0f - damping * damping);
+        FpType k = FloatExp(-damping * (FpType)3.14159265358979323846 / damped_factor);
+        FpType half_period = time_freq / (2.0f * frequency * damped_factor);
+        
+        ShaperType::weights(k, amplitude);
+        FpType sum = 0.0f;
+        for (int i = 0; i < NumImpulses; i++) {
+            sum += amplitude[i];
+        }
+        // Let the last amplitude absorb rounding so that they sum to one,
+        // for the output to end up exactly at the input position.
+        FpType rest = 1.0f;
+        for (int i = 0; i < NumImpulses; i++) {
+            amplitude[i] = (i < NumImpulses - 1) ? (amplitude[i] / sum) : rest;
+            rest -= amplitude[i];
+            delay[i] = FloatRound(i * half_period);
+        }
+    }
+    
+    /**
+     * Initializes the state to rest with the given impulses.
+     * The delays must be nondecreasing starting at zero.
+     */
+    static void reset (State *st, FpType const *amplitude, uint32_t const *delay)
+    {
+        AMBRO_ASSERT(delay[0] == 0)
+        
+        for (int i = 0; i < NumImpulses; i++) {
+            AMBRO_ASSERT(i == 0 || delay[i] >= delay[i - 1])
+            st->amplitude[i] = amplitude[i];
+            st->delay[i] = delay[i];
+        }
+        
+        // Before the start, the delayed impulses read a stationary piece.
+        uint32_t max_delay = delay[NumImpulses - 1];
+        st->num_pieces = 1;
+        st->pieces[0] = Piece{max_delay, 0.0f, 0.0f, 0.0f};
+        for (int i = 0; i < NumImpulses; i++) {
+            st->streams[i] = Stream{0, max_delay - delay[i], 0.0f};
+            normalize_stream(st, &st->streams[i]);
+        }
+    }
+    
+    /**
+     * Adds an input piece and outputs the shaped motion up to its end.
+     * The output is called as output(dir, x, t, a) with -x <= a <= x.
+     */
+    template <typename Output>
+    static void addPiece (State *st, bool dir, uint32_t x, uint32_t t, int32_t a, Output output)
+    {
+        AMBRO_ASSERT(a >= -(int32_t)x)
+        AMBRO_ASSERT(a <= (int32_t)x)
+        
+        FpType sign = dir ? 1.0f : -1.0f;
+        Piece piece;
+        piece.duration = t;
+        piece.distance = sign * (FpType)x;
+        if (t == 0) {
+            piece.v0 = 0.0f;
+            piece.accel = 0.0f;
+        } else {
+            FpType t_rec = 1.0f / (FpType)t;
+            piece.v0 = sign * ((FpType)x - (FpType)a) * t_rec;
+            piece.accel = sign * 2.0f * (FpType)a * (t_rec * t_rec);
+        }
+        
+        add_piece(st, piece);
+        emit(st, output);
+    }
+    
+    /**
+     * Outputs the remaining motion assuming the input stays at rest,
+     * and resets the state.
+     */
+    template <typename Output>
+    static void flush (State *st, Output output)
+    {
+        add_piece(st, Piece{st->delay[NumImpulses - 1], 0.0f, 0.0f, 0.0f});
+        emit(st, output);
+        
+        for (int i = 0; i < NumImpulses; i++) {
+            AMBRO_ASSERT(st->streams[i].pos == 0.0f)
+        }
+        
+        reset(st, st->amplitude, st->delay);
+    }
+    
+private:
+    static uint32_t const MaxSteps = ((uint32_t)1 << StepBits) - 1;
+    static uint32_t const MaxDuration = ((uint32_t)1 << TimeBits) - 1;
+    
+    static void normalize_stream (State *st, Stream *s)
+    {
+        while (s->index < st->num_pieces && s->offset == st->pieces[s->index].duration) {
+            s->pos += st->pieces[s->index].distance;
+            s->index++;
+            s->offset = 0;
+        }
+    }
+    
+    static void add_piece (State *st, Piece piece)
+    {
+        // Drop pieces which all impulses have passed.
+        PieceIndexType first_needed = st->streams[NumImpulses - 1].index;
+        for (int i = 0; i < NumImpulses - 1; i++) {
+            first_needed = MinValue(first_needed, st->streams[i].index);
+        }
+        if (first_needed > 0) {
+            memmove(st->pieces, st->pieces + first_needed, (st->num_pieces - first_needed) * sizeof(Piece));
+            st->num_pieces -= first_needed;
+            for (int i = 0; i < NumImpulses; i++) {
+                st->streams[i].index -= first_needed;
+            }
+        }
+        
+        if (st->num_pieces == HistorySize) {
+            merge_pieces(st);
+        }
+        
+        st->pieces[st->num_pieces++] = piece;
+        for (int i = 0; i < NumImpulses; i++) {
+            normalize_stream(st, &st->streams[i]);
+        }
+    }
+    
+    static void merge_pieces (State *st)
+    {
+        // A pair cannot be merged if an impulse is inside it or at the
+        // boundary between the two pieces, since the part already output
+        // would not agree with the merged piece.
+        int best = -1;
+        uint32_t best_duration = 0;
+        for (int k = 0; k + 1 < st->num_pieces; k++) {
+            bool blocked = false;
+            for (int i = 0; i < NumImpulses; i++) {
+                Stream const *s = &st->streams[i];
+                if ((s->index == k && s->offset > 0) || s->index == k + 1) {
+                    blocked = true;
+                }
+            }
+            uint32_t duration = st->pieces[k].duration + st->pieces[k + 1].duration;
+            if (!blocked && (best < 0 || duration < best_duration)) {
+                best = k;
+                best_duration = duration;
+            }
+        }
+        AMBRO_ASSERT(best >= 0)
+        
+        Piece *p = &st->pieces[best];
+        p->duration = best_duration;
+        p->distance += st->pieces[best + 1].distance;
+        if (best_duration == 0) {
+            p->v0 = 0.0f;
+            p->accel = 0.0f;
+        } else {
+            FpType t = best_duration;
+            p->accel = 2.0f * (p->distance - p->v0 * t) / (t * t);
+        }
+        
+        memmove(p + 1, p + 2, (st->num_pieces - (best + 2)) * sizeof(Piece));
+        st->num_pieces--;
+        for (int i = 0; i < NumImpulses; i++) {
+            if (st->streams[i].index > best + 1) {
+                st->streams[i].index--;
+            }
+        }
+    }
+    
+    template <typename Output>
+    static void emit (State *st, Output output)
+    {
+        while (st->streams[0].index < st->num_pieces) {
+            uint32_t span = MaxDuration;
+            FpType pos = 0.0f;
+            FpType v = 0.0f;
+            FpType accel = 0.0f;
+            for (int i = 0; i < NumImpulses; i++) {
+                Stream const *s = &st->streams[i];
+                AMBRO_ASSERT(s->index < st->num_pieces)
+                Piece const *p = &st->pieces[s->index];
+                FpType u = s->offset;
+                FpType amp = st->amplitude[i];
+                span = MinValue(span, p->duration - s->offset);
+                pos += amp * (s->pos + u * (p->v0 + 0.5f * p->accel * u));
+                v += amp * (p->v0 + p->accel * u);
+                accel += amp * p->accel;
+            }
+            
+            FpType v_end = v + accel * span;
+            if ((v < 0.0f && v_end > 0.0f) || (v > 0.0f && v_end < 0.0f)) {
+                FpType t_zero = FloatRound(-v / accel);
+                if (t_zero > 0.0f && t_zero < span) {
+                    span = t_zero;
+                }
+            }
+            
+            int32_t steps;
+            while (true) {
+                FpType t = span;
+                steps = FloatRound(pos + t * (v + 0.5f * accel * t));
+                if (AMBRO_LIKELY((uint32_t)(steps < 0 ? -steps : steps) <= MaxSteps) || span == 1) {
+                    break;
+                }
+                span /= 2;
+            }
+            
+            bool dir = (steps >= 0);
+            uint32_t x = dir ? steps : -steps;
+            FpType t = span;
+            int32_t a = FloatRound((dir ? 0.5f : -0.5f) * accel * (t * t));
+            a = MaxValue(-(int32_t)x, MinValue((int32_t)x, a));
+            output(dir, x, span, a);
+            
+            for (int i = 0; i < NumImpulses; i++) {
+                Stream *s = &st->streams[i];
+                s->offset += span;
+                s->pos -= steps;
+                normalize_stream(st, s);
+            }
+        }
+    }
+};
+
+struct NoInputShaperParams {
+    static bool const Enabled = false;
+};
+
+APRINTER_ALIAS_STRUCT_EXT(InputShaperParams, (
+    APRINTER_AS_TYPE(ShaperType),
+    APRINTER_AS_TYPE(Frequency),
+    APRINTER_AS_TYPE(Damping),
+    APRINTER_AS_VALUE(int, HistorySize)
+), (
+    static bool const Enabled = true;
+))
+
+}
+
+#endif
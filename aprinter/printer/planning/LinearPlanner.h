@@ -25,6 +25,9 @@
 #ifndef AMBROLIB_LINEAR_PLANNER_H
 #define AMBROLIB_LINEAR_PLANNER_H
 
+#include <stddef.h>
+#include <math.h>
+
 #include <aprinter/base/Assert.h>
 #include <aprinter/math/FloatTools.h>
 
@@ -76,6 +79,17 @@ struct LinearPlanner {
         return FloatMin(segment->max_start_v, end_v + segment->a_x);
     }
 
+    static bool isPushedWith (SegmentState const *s, FpType end_v)
+    {
+        return s->end_v == end_v;
+    }
+    
+    // The max start velocity found by the last push().
+    static FpType getMaxStartV (SegmentData const *segment, SegmentState const *s)
+    {
+        return FloatMin(segment->max_start_v, s->end_v + segment->a_x);
+    }
+    
     static FpType pull (SegmentData *segment, SegmentState *s, FpType start_v, SegmentResult *result)
     {
         AMBRO_ASSERT(s->end_v <= segment->max_v)
@@ -112,6 +126,141 @@ struct LinearPlanner {
     }
 };
 
+/**
+ * Plans a window of a ring buffer of segments using LinearPlanner,
+ * one segment at a time. This is the kernel interface used by
+ * MotionPlanner; see also BatchLinearPlanner.
+ * 
+ * Segments are identified by their index in the ring buffer. The
+ * backward pass is done by backward(). The forward pass is done
+ * by calling pull() for the segments in order, after a call to
+ * forward() for a range of them ending at the end of the window
+ * (which does nothing here). The state is set up by init() (which
+ * also does nothing here).
+ * 
+ * The backward pass is incremental. The caller passes the number
+ * of segments at the start of the window which were included in
+ * the previous backward pass (planned_length); these still have
+ * its results. When the pass reaches such a segment and the end
+ * velocity coming from its successor is the one it had before,
+ * the results of it and all preceding segments would not change,
+ * so the pass stops. When appending segments this is usually not
+ * far from the end of the window, because the max start velocity
+ * of most segments is limited by their own constraints.
+ * 
+ * Appending segments can only raise the end velocities found by the
+ * backward pass. So once the max start velocity of a segment is limited
+ * by its own constraints rather than by its successor, the results of
+ * the segments before it are final, provided that the window keeps its
+ * start velocity. backward() returns the position in the window of the
+ * latest such segment it reached, which is the number of segments with
+ * final results, or 0 if it reached none. MotionPlanner keeps the stepper
+ * commands of the final segments across plans. It calls forward() only
+ * for the segments after them, and pull() only for those and for the
+ * segments it commits. So the cost of a plan depends on how many
+ * segments change, not on the size of the window.
+ * 
+ * Neutral segments are those which do not represent motion. They
+ * pass the velocity through unchanged in both directions, so the
+ * passes need not check the types of segments.
+ */
+template <typename FpType, int Size>
+class LinearPlannerKernel {
+    using Planner = LinearPlanner<FpType>;
+    
+public:
+    using SegmentResult = typename Planner::SegmentResult;
+    
+    struct State {
+        typename Planner::SegmentData segs[Size];
+        typename Planner::SegmentState states[Size];
+    };
+    
+    static void init (State *st)
+    {
+    }
+    
+    static void initSegment (State *st, size_t index, FpType prev_max_v, FpType max_start_v, FpType max_v, FpType a_x)
+    {
+        AMBRO_ASSERT(index < Size)
+        
+        Planner::initSegment(&st->segs[index], prev_max_v, max_start_v, max_v, a_x);
+    }
+    
+    static void initNeutralSegment (State *st, size_t index)
+    {
+        AMBRO_ASSERT(index < Size)
+        
+        typename Planner::SegmentData *seg = &st->segs[index];
+        seg->a_x = 0.0f;
+        seg->max_v = INFINITY;
+        seg->max_start_v = INFINITY;
+        seg->a_x_rec = 0.0f;
+    }
+    
+    static FpType getAccelRec (State const *st, size_t index)
+    {
+        AMBRO_ASSERT(index < Size)
+        
+        return st->segs[index].a_x_rec;
+    }
+    
+    // The max start velocity of a segment found by the last backward pass.
+    static FpType getMaxStartV (State const *st, size_t index)
+    {
+        AMBRO_ASSERT(index < Size)
+        
+        return Planner::getMaxStartV(&st->segs[index], &st->states[index]);
+    }
+    
+    static size_t backward (State *st, size_t start, size_t length, size_t planned_length)
+    {
+        AMBRO_ASSERT(start < Size)
+        AMBRO_ASSERT(length > 0)
+        AMBRO_ASSERT(length <= Size)
+        AMBRO_ASSERT(planned_length <= length)
+        
+        FpType v = 0.0f;
+        size_t final_length = 0;
+        size_t i = length;
+        do {
+            i--;
+            size_t index = wrap_index(start + i);
+            if (i < planned_length && Planner::isPushedWith(&st->states[index], v)) {
+                break;
+            }
+            v = Planner::push(&st->segs[index], &st->states[index], v);
+            if (final_length == 0 && v == st->segs[index].max_start_v) {
+                final_length = i;
+            }
+        } while (i != 0);
+        
+        return final_length;
+    }
+    
+    static void forward (State *st, size_t start, size_t length, FpType start_v)
+    {
+    }
+    
+    static FpType pull (State *st, size_t index, FpType start_v, SegmentResult *result)
+    {
+        AMBRO_ASSERT(index < Size)
+        
+        return Planner::pull(&st->segs[index], &st->states[index], start_v, result);
+    }
+    
+private:
+    static size_t wrap_index (size_t index)
+    {
+        return (index >= Size) ? (index - Size) : index;
+    }
+};
+
+struct LinearPlannerService {
+    template <typename FpType, int Size>
+    using Kernel = LinearPlannerKernel<FpType, Size>;
+};
+
 }
 
 #endif
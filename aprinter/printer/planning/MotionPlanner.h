@@ -45,6 +45,7 @@
 #include <aprinter/meta/MemberType.h>
 #include <aprinter/meta/MinMax.h>
 #include <aprinter/meta/ServiceUtils.h>
+#include <aprinter/meta/StructIf.h>
 #include <aprinter/base/Object.h>
 #include <aprinter/base/Assert.h>
 #include <aprinter/base/Hints.h>
@@ -52,6 +53,8 @@
 #include <aprinter/system/InterruptLock.h>
 #include <aprinter/printer/actuators/AxisDriverConsumer.h>
 #include <aprinter/printer/planning/LinearPlanner.h>
+#include <aprinter/printer/planning/InputShaper.h>
+#include <aprinter/printer/planning/PressureAdvance.h>
 #include <aprinter/printer/Configuration.h>
 
 namespace APrinter {
@@ -63,9 +66,21 @@ APRINTER_ALIAS_STRUCT(MotionPlannerAxisSpec, (
     APRINTER_AS_TYPE(CorneringDistance),
     APRINTER_AS_TYPE(MaxSpeedRec),
     APRINTER_AS_TYPE(MaxAccelRec),
+    APRINTER_AS_TYPE(MaxJerkRec),
+    APRINTER_AS_TYPE(PressureAdvance),
     APRINTER_AS_TYPE(PrestepCallback)
 ))
 
+struct MotionPlannerNoPressureAdvance {
+    static bool const Enabled = false;
+};
+
+APRINTER_ALIAS_STRUCT_EXT(MotionPlannerPressureAdvance, (
+    APRINTER_AS_TYPE(AdvanceTime)
+), (
+    static bool const Enabled = true;
+))
+
 APRINTER_ALIAS_STRUCT(MotionPlannerChannelSpec, (
     APRINTER_AS_TYPE(Payload),
     APRINTER_AS_TYPE(Callback),
@@ -96,6 +111,8 @@ class MotionPlanner {
     static int const LookaheadBufferSize      = Arg::LookaheadBufferSize;
     static int const LookaheadCommitCount     = Arg::LookaheadCommitCount;
     using FpType                              = typename Arg::FpType;
+    using LinearPlannerService                = typename Arg::LinearPlannerService;
+    using InputShaperParams                   = typename Arg::InputShaperParams;
     using MaxStepsPerCycle                    = typename Arg::MaxStepsPerCycle;
     using PullHandler                         = typename Arg::PullHandler;
     using FinishedHandler                     = typename Arg::FinishedHandler;
@@ -119,16 +136,40 @@ private:
     static_assert(NumAxes > 0, "");
     static const int NumChannels = TypeListLength<ParamsChannelsList>::Value;
     using SegmentBufferSizeType = ChooseIntForMax<2 * LookaheadBufferSize, false>; // twice for segments_add()
-    static const size_t StepperCommitBufferSize = 3 * StepperSegmentBufferSize;
-    static const size_t StepperBackupBufferSize = 3 * (LookaheadBufferSize - LookaheadCommitCount);
-    using StepperCommitBufferSizeType = ChooseIntForMax<StepperCommitBufferSize, false>;
-    using StepperBackupBufferSizeType = ChooseIntForMax<2 * StepperBackupBufferSize, false>;
+    
+    AMBRO_STRUCT_IF(ShaperFeature, InputShaperParams::Enabled) {
+        using ShaperType = typename InputShaperParams::ShaperType;
+        static int const HistorySize = InputShaperParams::HistorySize;
+        using Bounds = InputShaperBounds<ShaperType, HistorySize>;
+        
+        // The shaped output of a piece usually consists of one command per impulse.
+        static int const TypicalCommandsPerPiece = ShaperType::NumImpulses;
+        static int const MaxCommandsPerPiece = Bounds::MaxCommandsPerPiece;
+        static int const ExtraCommands = Bounds::MaxExtraCommands;
+        
+        using CFrequency = decltype(ExprCast<FpType>(InputShaperParams::Frequency::e()));
+        using CDamping = decltype(ExprCast<FpType>(InputShaperParams::Damping::e()));
+        using ConfigExprs = MakeTypeList<CFrequency, CDamping>;
+    } AMBRO_STRUCT_ELSE(ShaperFeature) {
+        static int const TypicalCommandsPerPiece = 1;
+        static int const MaxCommandsPerPiece = 1;
+        static int const ExtraCommands = 0;
+        using ConfigExprs = EmptyTypeList;
+    };
+    
+    template <typename AxisSpec, typename AccumType>
+    using JerkLimitedHelper = WrapBool<(AccumType::Value || AxisSpec::TheAxisDriver::JerkFactor() != 0.0)>;
+    
+    // Whether some axis driver smooths acceleration changes, which makes the
+    // jerk depend on the duration of the commands (see JerkFeature).
+    static bool const JerkLimited = TypeListFold<ParamsAxesList, WrapBool<false>, JerkLimitedHelper>::Value;
+    
     using StepperFastEvent = typename Context::EventLoop::template FastEventSpec<MotionPlanner>;
     using CallbackFastEvent = typename Context::EventLoop::template FastEventSpec<StepperFastEvent>;
     static const int TypeBits = BitsInInt<NumChannels>::Value;
     using AxisMaskType = ChooseInt<NumAxes + TypeBits, false>;
     static const AxisMaskType TypeMask = ((AxisMaskType)1 << TypeBits) - 1;
-    using TheLinearPlanner = LinearPlanner<FpType>;
+    using TheLinearPlanner = typename LinearPlannerService::template Kernel<FpType, LookaheadBufferSize>;
     using Constants = MotionPlannerConstants<Context>;
     
     using MinSecondsPerStep = decltype(ExprRec(MaxStepsPerCycle() * typename Constants::FCpu()));
@@ -136,7 +177,7 @@ private:
     using CMinSegmentTime = decltype(ExprCast<FpType>(typename Constants::TimeConversion() * MinSecondsPerStep()));
     
 public:
-    using ConfigExprs = MakeTypeList<CMinSegmentTime>;
+    using ConfigExprs = JoinTypeLists<MakeTypeList<CMinSegmentTime>, typename ShaperFeature::ConfigExprs>;
     
 private:
     AMBRO_DECLARE_GET_MEMBER_TYPE_FUNC(GetMemberType_TheCommon, TheCommon)
@@ -230,8 +271,11 @@ private:
         SegmentLasersTuple * lasers () { return this; };
     };
     
-    struct SegmentAxesPart : public SegmentAxesHelper, public SegmentLasersHelper {
-        typename TheLinearPlanner::SegmentData lp_seg;
+    AMBRO_STRUCT_IF(SegmentJerkPart, JerkLimited) {
+        FpType jerk_dv_factor;
+    } AMBRO_STRUCT_ELSE(SegmentJerkPart) {};
+    
+    struct SegmentAxesPart : public SegmentAxesHelper, public SegmentLasersHelper, public SegmentJerkPart {
         FpType max_accel_rec;
         FpType rel_max_speed_rec;
     };
@@ -246,6 +290,68 @@ private:
     
     enum {STATE_BUFFERING, STATE_STEPPING, STATE_ABORTED};
     
+    // The state of a filter of the stepper commands of an axis, carried
+    // across segments. plan() regenerates the commands past the committed
+    // segments each time, so the filter works on a copy of its state at the
+    // last commit point, which commit_point() saves and commit() keeps.
+    // The state at the resume point of a plan is kept too, for the next
+    // plan to continue from there.
+    template <typename ParentObject, typename StateType>
+    struct CommittedFilterState {
+        struct Object;
+        
+        static StateType * work (Context c)
+        {
+            auto *o = Object::self(c);
+            return &o->m_work;
+        }
+        
+        // Makes the work state, set up by the filter, the committed one.
+        static void reset (Context c)
+        {
+            auto *o = Object::self(c);
+            o->m_states[0] = o->m_work;
+            o->m_committed = 0;
+        }
+        
+        static void start_commands (Context c)
+        {
+            auto *o = Object::self(c);
+            o->m_work = o->m_states[o->m_committed];
+        }
+        
+        static void commit_point (Context c)
+        {
+            auto *o = Object::self(c);
+            o->m_states[!o->m_committed] = o->m_work;
+        }
+        
+        static void commit (Context c)
+        {
+            auto *o = Object::self(c);
+            o->m_committed = !o->m_committed;
+        }
+        
+        static void resume_point (Context c)
+        {
+            auto *o = Object::self(c);
+            o->m_resume = o->m_work;
+        }
+        
+        static void resume (Context c)
+        {
+            auto *o = Object::self(c);
+            o->m_work = o->m_resume;
+        }
+        
+        struct Object : public ObjBase<CommittedFilterState, ParentObject, EmptyTypeList> {
+            StateType m_work;
+            StateType m_states[2];
+            StateType m_resume;
+            uint8_t m_committed;
+        };
+    };
+    
     template <typename TheAxis>
     struct AxisCommon {
         struct Object;
@@ -254,6 +360,16 @@ private:
         using StepperCommandCallbackContext = typename TheStepper::CommandCallbackContext;
         using ComputeState = typename TheAxis::ComputeState;
         
+        // Each piece of a segment (up to three per segment) normally results in
+        // TypicalCommandsPerPiece commands, but may result in up to MaxCommandsPerPiece,
+        // plus ExtraCommands once per plan. A commit must always fit, and beyond
+        // that the buffer fits the rest of the stepper segments in typical cases.
+        static size_t const StepperCommitSpace = 3 * TheAxis::MaxCommandsPerPiece * LookaheadCommitCount + TheAxis::ExtraCommands;
+        static size_t const StepperCommitBufferSize = StepperCommitSpace + 3 * TheAxis::TypicalCommandsPerPiece * (StepperSegmentBufferSize - LookaheadCommitCount);
+        static size_t const StepperBackupBufferSize = 3 * TheAxis::MaxCommandsPerPiece * (LookaheadBufferSize - LookaheadCommitCount) + TheAxis::ExtraCommands;
+        using StepperCommitBufferSizeType = ChooseIntForMax<StepperCommitBufferSize, false>;
+        using StepperBackupBufferSizeType = ChooseIntForMax<2 * StepperBackupBufferSize, false>;
+        
         static void init (Context c, bool prestep_callback_enabled)
         {
             auto *o = Object::self(c);
@@ -309,7 +425,7 @@ private:
         static bool have_commit_space (bool accum, Context c)
         {
             auto *o = Object::self(c);
-            return (accum && commit_avail(o->m_commit_start, o->m_commit_end) >= 3 * LookaheadCommitCount);
+            return (accum && commit_avail(o->m_commit_start, o->m_commit_end) >= StepperCommitSpace);
         }
         
         static void start_commands (Context c)
@@ -337,6 +453,30 @@ private:
             TheStepper::generate_command(args..., cmd);
         }
         
+        static void resume_point (Context c)
+        {
+            auto *o = Object::self(c);
+            auto *m = MotionPlanner::Object::self(c);
+            o->m_resume_backup_length = o->m_new_backup_end - (m->m_current_backup ? 0 : StepperBackupBufferSize);
+        }
+        
+        // Takes the backup commands of the previous plan up to its resume point,
+        // except those which this plan has generated into the commit buffer.
+        static void resume (Context c)
+        {
+            auto *o = Object::self(c);
+            auto *m = MotionPlanner::Object::self(c);
+            AMBRO_ASSERT(o->m_new_backup_end == (m->m_current_backup ? 0 : StepperBackupBufferSize))
+            
+            StepperBackupBufferSizeType old_base = m->m_current_backup ? StepperBackupBufferSize : 0;
+            StepperCommitBufferSizeType new_commits = commit_length(o->m_commit_end, o->m_new_commit_end);
+            AMBRO_ASSERT(new_commits <= o->m_resume_backup_length)
+            for (StepperBackupBufferSizeType i = new_commits; i < o->m_resume_backup_length; i++) {
+                o->m_backup_buffer[o->m_new_backup_end] = o->m_backup_buffer[old_base + i];
+                o->m_new_backup_end++;
+            }
+        }
+        
         static void do_commit (Context c)
         {
             auto *o = Object::self(c);
@@ -410,6 +550,11 @@ private:
             return (end >= start) ? ((StepperCommitBufferSize - 1) - (end - start)) : ((start - end) - 1);
         }
         
+        static StepperCommitBufferSizeType commit_length (StepperCommitBufferSizeType start, StepperCommitBufferSizeType end)
+        {
+            return (end >= start) ? (end - start) : (StepperCommitBufferSize - (start - end));
+        }
+        
         struct Object : public ObjBase<AxisCommon, typename MotionPlanner::Object, MakeTypeList<
             TheAxis
         >> {
@@ -419,6 +564,7 @@ private:
             StepperBackupBufferSizeType m_backup_end;
             StepperCommitBufferSizeType m_new_commit_end;
             StepperBackupBufferSizeType m_new_backup_end;
+            StepperBackupBufferSizeType m_resume_backup_length;
             bool m_busy;
             StepperCommand m_commit_buffer[StepperCommitBufferSize];
             StepperCommand m_backup_buffer[2 * StepperBackupBufferSize];
@@ -446,6 +592,225 @@ public:
         using TheAxisSegment = AxisSegment<AxisIndex>;
         static const AxisMaskType TheAxisMask = (AxisMaskType)1 << (AxisIndex + TypeBits);
         
+        // Drivers with SmoothAccelChanges need to know, for both ends of each
+        // command, whether the acceleration changes there. Each command is held
+        // back until the next one is known, the last one of a plan is followed
+        // by rest.
+        AMBRO_STRUCT_IF(AxisSmoothing, TheAxisDriver::SmoothAccelChanges) {
+            struct Object;
+            using TimeFixedType = typename TheAxisDriver::TimeFixedType;
+            using AccelFixedType = typename TheAxisDriver::AccelFixedType;
+            static int const ExtraCommands = 1;
+            
+            // Relative difference of accelerations still considered the same,
+            // covering the rounding of the acceleration term to whole steps.
+            static constexpr FpType AccelChangeTolerance () { return 0.05f; }
+            
+            // The acceleration of the last command is a_signed*2/t_squared, these
+            // are kept separately so that comparing needs no division.
+            struct SmoothState {
+                bool held;
+                bool held_smooth_start;
+                bool held_dir;
+                StepperStepFixedType held_x;
+                TimeFixedType held_t;
+                AccelFixedType held_a;
+                FpType a_signed;
+                FpType t_squared;
+            };
+            
+            using FilterState = CommittedFilterState<Object, SmoothState>;
+            using FilterStates = MakeTypeList<FilterState>;
+            
+            static void reset (Context c)
+            {
+                SmoothState *st = FilterState::work(c);
+                st->held = false;
+                set_rest(st);
+                FilterState::reset(c);
+            }
+            
+            static void gen_command (Context c, bool dir, StepperStepFixedType x, TimeFixedType t, AccelFixedType a)
+            {
+                SmoothState *st = FilterState::work(c);
+                
+                FpType a_signed = dir ? -(FpType)a.bitsValue() : (FpType)a.bitsValue();
+                FpType t_squared = (FpType)t.bitsValue() * (FpType)t.bitsValue();
+                if (t.bitsValue() == 0) {
+                    a_signed = 0.0f;
+                    t_squared = 1.0f;
+                }
+                bool changed = accel_changed(st, a_signed, t_squared);
+                
+                if (st->held) {
+                    emit_held(c, st, changed);
+                }
+                st->held = true;
+                st->held_smooth_start = changed;
+                st->held_dir = dir;
+                st->held_x = x;
+                st->held_t = t;
+                st->held_a = a;
+                st->a_signed = a_signed;
+                st->t_squared = t_squared;
+            }
+            
+            static void flush (Context c)
+            {
+                SmoothState *st = FilterState::work(c);
+                if (st->held) {
+                    emit_held(c, st, accel_changed(st, 0.0f, 1.0f));
+                    st->held = false;
+                    set_rest(st);
+                }
+            }
+            
+            static void set_rest (SmoothState *st)
+            {
+                st->a_signed = 0.0f;
+                st->t_squared = 1.0f;
+            }
+            
+            static bool accel_changed (SmoothState const *st, FpType a_signed, FpType t_squared)
+            {
+                FpType accel1 = st->a_signed * t_squared;
+                FpType accel2 = a_signed * st->t_squared;
+                return FloatAbs(accel1 - accel2) > AccelChangeTolerance() * FloatMax(FloatAbs(accel1), FloatAbs(accel2));
+            }
+            
+            static void emit_held (Context c, SmoothState const *st, bool smooth_end)
+            {
+                TheCommon::gen_stepper_command(c, st->held_dir, st->held_x, st->held_t, st->held_a, st->held_smooth_start, smooth_end);
+            }
+            
+            struct Object : public ObjBase<AxisSmoothing, typename Axis::Object, FilterStates> {};
+        } AMBRO_STRUCT_ELSE(AxisSmoothing) {
+            static int const ExtraCommands = 0;
+            using FilterStates = EmptyTypeList;
+            static void reset (Context c) {}
+            static void flush (Context c) {}
+            
+            template <typename... Args>
+            static void gen_command (Context c, Args... args)
+            {
+                TheCommon::gen_stepper_command(c, args...);
+            }
+            
+            struct Object {};
+        };
+        
+        AMBRO_STRUCT_IF(AxisShaper, InputShaperParams::Enabled) {
+            struct Object;
+            using TheInputShaper = InputShaper<FpType, typename ShaperFeature::ShaperType, ShaperFeature::HistorySize, StepperStepFixedType::num_bits, TheAxisDriver::TimeFixedType::num_bits>;
+            using FilterState = CommittedFilterState<Object, typename TheInputShaper::State>;
+            using FilterStates = MakeTypeList<FilterState>;
+            
+            // The impulses are computed from the configuration here, so changes
+            // take effect only when the planner is at rest.
+            static void reset (Context c)
+            {
+                FpType amplitude[TheInputShaper::NumImpulses];
+                uint32_t delay[TheInputShaper::NumImpulses];
+                TheInputShaper::computeImpulses(APRINTER_CFG(Config, typename ShaperFeature::CFrequency, c), APRINTER_CFG(Config, typename ShaperFeature::CDamping, c), (FpType)Clock::time_freq, amplitude, delay);
+                TheInputShaper::reset(FilterState::work(c), amplitude, delay);
+                FilterState::reset(c);
+            }
+            
+            template <typename TimeFixedType, typename AccelFixedType>
+            static void gen_command (Context c, bool dir, StepperStepFixedType x, TimeFixedType t, AccelFixedType a)
+            {
+                TheInputShaper::addPiece(FilterState::work(c), dir, x.bitsValue(), t.bitsValue(), a.bitsValue(), ShaperOutput{c});
+            }
+            
+            // The shaped motion past the last segment goes to the backup buffer
+            // only, so that a commit never leaves the axis away from where the
+            // committed segments end.
+            static void flush (Context c)
+            {
+                TheInputShaper::flush(FilterState::work(c), ShaperOutput{c});
+            }
+            
+            struct ShaperOutput {
+                void operator() (bool dir, uint32_t x, uint32_t t, int32_t a)
+                {
+                    AxisSmoothing::gen_command(c, dir, StepperStepFixedType::importBits(x), TheAxisDriver::TimeFixedType::importBits(t), TheAxisDriver::AccelFixedType::importBits(a));
+                }
+                
+                Context c;
+            };
+            
+            struct Object : public ObjBase<AxisShaper, typename Axis::Object, FilterStates> {};
+        } AMBRO_STRUCT_ELSE(AxisShaper) {
+            using FilterStates = EmptyTypeList;
+            static void reset (Context c) {}
+            static void flush (Context c) {}
+            
+            template <typename... Args>
+            static void gen_command (Context c, Args... args)
+            {
+                AxisSmoothing::gen_command(c, args...);
+            }
+            
+            struct Object {};
+        };
+        
+        AMBRO_STRUCT_IF(AxisAdvance, AxisSpec::PressureAdvance::Enabled) {
+            struct Object;
+            using ThePressureAdvance = PressureAdvance<FpType, StepperStepFixedType::num_bits>;
+            using FilterState = CommittedFilterState<Object, typename ThePressureAdvance::State>;
+            using FilterStates = MakeTypeList<FilterState>;
+            static int const MaxCommandsPerPiece = ThePressureAdvance::MaxCommandsPerPiece;
+            
+            static void reset (Context c)
+            {
+                ThePressureAdvance::reset(FilterState::work(c));
+                FilterState::reset(c);
+            }
+            
+            template <typename TimeFixedType, typename AccelFixedType>
+            static void gen_command (Context c, bool dir, StepperStepFixedType x, TimeFixedType t, AccelFixedType a)
+            {
+                FpType k = APRINTER_CFG(Config, CAdvanceTicks, c);
+                ThePressureAdvance::addPiece(FilterState::work(c), k, dir, x.bitsValue(), t.bitsValue(), a.bitsValue(), AdvanceOutput{c});
+            }
+            
+            struct AdvanceOutput {
+                void operator() (bool dir, uint32_t x, uint32_t t, int32_t a)
+                {
+                    AxisShaper::gen_command(c, dir, StepperStepFixedType::importBits(x), TheAxisDriver::TimeFixedType::importBits(t), TheAxisDriver::AccelFixedType::importBits(a));
+                }
+                
+                Context c;
+            };
+            
+            using CAdvanceTicks = decltype(ExprCast<FpType>(AxisSpec::PressureAdvance::AdvanceTime::e() * typename Constants::TimeConversion()));
+            using ConfigExprs = MakeTypeList<CAdvanceTicks>;
+            
+            struct Object : public ObjBase<AxisAdvance, typename Axis::Object, FilterStates> {};
+        } AMBRO_STRUCT_ELSE(AxisAdvance) {
+            static int const MaxCommandsPerPiece = 1;
+            using FilterStates = EmptyTypeList;
+            static void reset (Context c) {}
+            
+            template <typename... Args>
+            static void gen_command (Context c, Args... args)
+            {
+                AxisShaper::gen_command(c, args...);
+            }
+            
+            using ConfigExprs = EmptyTypeList;
+            struct Object {};
+        };
+        
+        static int const TypicalCommandsPerPiece = ShaperFeature::TypicalCommandsPerPiece;
+        static int const MaxCommandsPerPiece = AxisAdvance::MaxCommandsPerPiece * ShaperFeature::MaxCommandsPerPiece;
+        static int const ExtraCommands = ShaperFeature::ExtraCommands + AxisSmoothing::ExtraCommands;
+        
+        using FilterStatesList = JoinTypeLists<
+            typename AxisAdvance::FilterStates,
+            JoinTypeLists<typename AxisShaper::FilterStates, typename AxisSmoothing::FilterStates>
+        >;
+        
         struct ComputeState {
             FpType x;
         };
@@ -457,6 +822,7 @@ public:
             auto *o = Object::self(c);
             TheAxisDriver::setPrestepCallbackEnabled(c, prestep_callback_enabled);
             o->last_x_by_distance = 0.0f;
+            filters_reset(c);
         }
         
         static void deinit_impl (Context c)
@@ -552,6 +918,13 @@ public:
             return FloatMax(accum, cs->x * APRINTER_CFG(Config, CMaxAccelRec, c));
         }
         
+        template <typename AccumType, typename TheComputeStateTuple>
+        static FpType compute_segment_buffer_entry_jerk (AccumType accum, Context c, TheComputeStateTuple const *cst)
+        {
+            ComputeState const *cs = TupleFindElem<ComputeState>(cst);
+            return AxisJerk::jerk_rec(accum, c, cs->x);
+        }
+        
         template <typename AccumType, typename TheComputeStateTuple>
         static FpType do_junction_limit (AccumType accum, Context c, Segment const *entry, FpType distance_rec, TheComputeStateTuple const *cst)
         {
@@ -567,8 +940,49 @@ public:
             return FloatMax(accum, dm * APRINTER_CFG(Config, CCorneringSpeedComputationFactor, c));
         }
         
+        // The stepper commands of a segment pass through the pressure advance,
+        // the input shaper and the acceleration smoothing. These keep state
+        // across segments, each in a CommittedFilterState.
+        static void filters_reset (Context c)
+        {
+            AxisAdvance::reset(c);
+            AxisShaper::reset(c);
+            AxisSmoothing::reset(c);
+        }
+            
+        static void filters_start (Context c)
+        {
+            ListFor<FilterStatesList>([&] APRINTER_TL(state, state::start_commands(c)));
+        }
+            
+        static void filters_commit_point (Context c)
+        {
+            ListFor<FilterStatesList>([&] APRINTER_TL(state, state::commit_point(c)));
+        }
+            
+        static void filters_flush (Context c)
+        {
+            AxisShaper::flush(c);
+            AxisSmoothing::flush(c);
+        }
+            
+        static void filters_commit (Context c)
+        {
+            ListFor<FilterStatesList>([&] APRINTER_TL(state, state::commit(c)));
+        }
+            
+        static void filters_resume_point (Context c)
+        {
+            ListFor<FilterStatesList>([&] APRINTER_TL(state, state::resume_point(c)));
+        }
+            
+        static void filters_resume (Context c)
+        {
+            ListFor<FilterStatesList>([&] APRINTER_TL(state, state::resume(c)));
+        }
+        
         template <typename TheMinTimeType>
-        static void gen_segment_stepper_commands (Context c, Segment *entry, FpType frac_x0, FpType frac_x2, TheMinTimeType t0, TheMinTimeType t2, TheMinTimeType t1, FpType vdiff0_squared, FpType vdiff2_squared)
+        static void gen_segment_stepper_commands (Context c, Segment *entry, FpType a_x_rec, FpType frac_x0, FpType frac_x2, TheMinTimeType t0, TheMinTimeType t2, TheMinTimeType t1, FpType vdiff0_squared, FpType vdiff2_squared)
         {
             TheAxisSegment *axis_entry = TupleGetElem<AxisIndex>(entry->axes.axes());
             
@@ -596,16 +1010,16 @@ public:
             }
             
             bool dir = entry->dir_and_type & TheAxisMask;
-            FpType accel_conversion = entry->axes.lp_seg.a_x_rec * xfp;
+            FpType accel_conversion = a_x_rec * xfp;
             
             if (x0.bitsValue() != 0) {
-                TheCommon::gen_stepper_command(c, dir, x0, t0, FixedMin(x0, StepperStepFixedType::importFpSaturatedRound(accel_conversion * vdiff0_squared)));
+                AxisAdvance::gen_command(c, dir, x0, t0, FixedMin(x0, StepperStepFixedType::importFpSaturatedRound(accel_conversion * vdiff0_squared)));
             }
             if (!skip1) {
-                TheCommon::gen_stepper_command(c, dir, x1, t1, StepperStepFixedType::importBits(0));
+                AxisAdvance::gen_command(c, dir, x1, t1, StepperStepFixedType::importBits(0));
             }
             if (x2.bitsValue() != 0) {
-                TheCommon::gen_stepper_command(c, dir, x2, t2, -FixedMin(x2, StepperStepFixedType::importFpSaturatedRound(accel_conversion * vdiff2_squared)));
+                AxisAdvance::gen_command(c, dir, x2, t2, -FixedMin(x2, StepperStepFixedType::importFpSaturatedRound(accel_conversion * vdiff2_squared)));
             }
         }
         
@@ -658,10 +1072,10 @@ public:
                 StepperStepFixedType cmd_steps = TheAxisDriver::getAbortedCmdSteps(c, &dir);
                 add_steps(&steps, cmd_steps, dir);
             }
-            for (StepperCommitBufferSizeType i = co->m_commit_start; i != co->m_commit_end; i = TheCommon::commit_inc(i)) {
+            for (typename TheCommon::StepperCommitBufferSizeType i = co->m_commit_start; i != co->m_commit_end; i = TheCommon::commit_inc(i)) {
                 add_command_steps(c, &steps, &co->m_commit_buffer[i]);
             }
-            for (StepperBackupBufferSizeType i = co->m_backup_start; i < co->m_backup_end; i++) {
+            for (typename TheCommon::StepperBackupBufferSizeType i = co->m_backup_start; i < co->m_backup_end; i++) {
                 add_command_steps(c, &steps, &co->m_backup_buffer[i]);
             }
             for (SegmentBufferSizeType i = m->m_segments_staging_length; i < m->m_segments_length; i++) {
@@ -692,19 +1106,51 @@ public:
         
         using DriverSyncMinStepTime = APRINTER_FP_CONST_EXPR(TheAxisDriver::SyncMinStepTime());
         using DriverAsyncMinStepTime = APRINTER_FP_CONST_EXPR(TheAxisDriver::AsyncMinStepTime());
+        using DriverAccelPeakFactor = APRINTER_FP_CONST_EXPR(TheAxisDriver::AccelPeakFactor());
         
         using SyncMinStepTime = decltype(typename Constants::TimeConversion() * (MinSecondsPerStep() + DriverSyncMinStepTime()));
         
         using CDistanceFactor = decltype(ExprCast<FpType>(AxisSpec::DistanceFactor::e()));
         using CCorneringSpeedComputationFactor = decltype(ExprCast<FpType>(AxisSpec::MaxAccelRec::e() / (AxisSpec::CorneringDistance::e() * AxisSpec::DistanceFactor::e())));
         using CMaxSpeedRec = decltype(ExprCast<FpType>(AxisSpec::MaxSpeedRec::e()));
-        using CMaxAccelRec = decltype(ExprCast<FpType>(AxisSpec::MaxAccelRec::e()));
+        // Plan so that the peaks of the driver's acceleration profile stay within the limit.
+        using CMaxAccelRec = decltype(ExprCast<FpType>(AxisSpec::MaxAccelRec::e() * DriverAccelPeakFactor()));
         using CSyncMinStepTime = decltype(ExprCast<FpType>(SyncMinStepTime()));
         using CAsyncMinStepTime = decltype(ExprCast<FpType>(SyncMinStepTime() + typename Constants::TimeConversion() * DriverAsyncMinStepTime()));
         
-        using ConfigExprs = MakeTypeList<CDistanceFactor, CCorneringSpeedComputationFactor, CMaxSpeedRec, CMaxAccelRec, CSyncMinStepTime, CAsyncMinStepTime>;
+        // The jerk of a smoothed command is at most JerkFactor*a/t, for
+        // acceleration a and duration t. Drivers without smoothing have
+        // no jerk limit.
+        AMBRO_STRUCT_IF(AxisJerk, TheAxisDriver::JerkFactor() != 0.0) {
+            using DriverJerkFactor = APRINTER_FP_CONST_EXPR(TheAxisDriver::JerkFactor());
+            using CJerkRec = decltype(ExprCast<FpType>(AxisSpec::MaxJerkRec::e() * DriverJerkFactor()));
+            using ConfigExprs = MakeTypeList<CJerkRec>;
+            
+            template <typename AccumType>
+            static FpType jerk_rec (AccumType accum, Context c, FpType x)
+            {
+                return FloatMax(accum, x * APRINTER_CFG(Config, CJerkRec, c));
+            }
+        } AMBRO_STRUCT_ELSE(AxisJerk) {
+            using ConfigExprs = EmptyTypeList;
+            
+            template <typename AccumType>
+            static FpType jerk_rec (AccumType accum, Context c, FpType x)
+            {
+                return FloatMax(accum, (FpType)0.0f);
+            }
+        };
+        
+        using ConfigExprs = JoinTypeLists<
+            MakeTypeList<CDistanceFactor, CCorneringSpeedComputationFactor, CMaxSpeedRec, CMaxAccelRec, CSyncMinStepTime, CAsyncMinStepTime>,
+            JoinTypeLists<typename AxisAdvance::ConfigExprs, typename AxisJerk::ConfigExprs>
+        >;
         
-        struct Object : public ObjBase<Axis, typename TheCommon::Object, EmptyTypeList> {
+        struct Object : public ObjBase<Axis, typename TheCommon::Object, MakeTypeList<
+            AxisAdvance,
+            AxisShaper,
+            AxisSmoothing
+        >> {
             FpType last_x_by_distance;
         };
     };
@@ -724,6 +1170,9 @@ public:
     public: // private, workaround gcc bug
         using TheCommon = AxisCommon<Laser>;
         using TheStepper = TheLaserDriver;
+        static int const TypicalCommandsPerPiece = 1;
+        static int const MaxCommandsPerPiece = 1;
+        static int const ExtraCommands = 0;
         static bool const IsFirst = false;
         using TheLaserSegment = LaserSegment<LaserIndex>;
         static TimeType const AdjustmentIntervalTicks = LaserSpec::TheLaserDriverService::AdjustmentInterval::value() / Clock::time_unit;
@@ -937,6 +1386,28 @@ public:
             cmd->time = time;
         }
         
+        static void resume_point (Context c)
+        {
+            auto *o = Object::self(c);
+            auto *m = MotionPlanner::Object::self(c);
+            o->m_resume_backup_length = o->m_new_backup_end - (m->m_current_backup ? 0 : ChannelBackupBufferSize);
+        }
+        
+        static void resume (Context c)
+        {
+            auto *o = Object::self(c);
+            auto *m = MotionPlanner::Object::self(c);
+            AMBRO_ASSERT(o->m_new_backup_end == (m->m_current_backup ? 0 : ChannelBackupBufferSize))
+            
+            ChannelBackupBufferSizeType old_base = m->m_current_backup ? ChannelBackupBufferSize : 0;
+            ChannelCommitBufferSizeType new_commits = commit_length(o->m_commit_end, o->m_new_commit_end);
+            AMBRO_ASSERT(new_commits <= o->m_resume_backup_length)
+            for (ChannelBackupBufferSizeType i = new_commits; i < o->m_resume_backup_length; i++) {
+                o->m_backup_buffer[o->m_new_backup_end] = o->m_backup_buffer[old_base + i];
+                o->m_new_backup_end++;
+            }
+        }
+        
         static void do_commit_cold (Context c)
         {
             auto *o = Object::self(c);
@@ -1031,6 +1502,11 @@ public:
             return (end >= start) ? ((ChannelCommitBufferSize - 1) - (end - start)) : ((start - end) - 1);
         }
         
+        static ChannelCommitBufferSizeType commit_length (ChannelCommitBufferSizeType start, ChannelCommitBufferSizeType end)
+        {
+            return (end >= start) ? (end - start) : (ChannelCommitBufferSize - (start - end));
+        }
+        
         struct TimerHandler : public AMBRO_WFUNC_TD(&Channel::timer_handler) {};
         
         struct Object : public ObjBase<Channel, typename MotionPlanner::Object, MakeTypeList<
@@ -1042,6 +1518,7 @@ public:
             ChannelBackupBufferSizeType m_backup_end;
             ChannelCommitBufferSizeType m_new_commit_end;
             ChannelBackupBufferSizeType m_new_backup_end;
+            ChannelBackupBufferSizeType m_resume_backup_length;
             bool m_busy;
             TheChannelCommand m_commit_buffer[ChannelCommitBufferSize];
             TheChannelCommand m_backup_buffer[(size_t)2 * ChannelBackupBufferSize];
@@ -1061,6 +1538,105 @@ private:
     
     struct ComputeStateTuple : public Tuple<MapTypeList<AxisCommonList, GetMemberType_ComputeState>> {};
     
+    // With drivers which smooth acceleration changes, a command of acceleration
+    // A and duration T has a jerk of up to JerkFactor*A/T, so the jerk limit is
+    // a lower bound for the duration of each command relative to its acceleration.
+    // In the units of the linear planner (squared velocity, a_x = 2*A*distance),
+    // a phase with acceleration a_x changing the velocity by dv lasts long enough
+    // if a_x^2*jerk_dv_factor <= dv. A phase which takes the whole segment lasts
+    // at least rel_max_speed_rec, which is ensured by limiting a_x when the
+    // segment is added. Shorter phases are checked when planning and, if needed,
+    // done with a lower acceleration; the end velocity of the segment is kept,
+    // so the result of the backward pass stays valid.
+    AMBRO_STRUCT_IF(JerkFeature, JerkLimited) {
+        static int const SearchIterations = 12;
+        
+        static void limit_segment_accel (Context c, Segment *entry, FpType distance_rec, ComputeStateTuple const *cst, FpType *rel_max_accel_rec)
+        {
+            FpType rel_jerk_rec = ListForFold<AxesList>(FloatIdentity(), [&] APRINTER_TLA(axis, (auto accum), return axis::compute_segment_buffer_entry_jerk(accum, c, cst)));
+            *rel_max_accel_rec = FloatMax(*rel_max_accel_rec, rel_jerk_rec / entry->axes.rel_max_speed_rec);
+            entry->axes.jerk_dv_factor = FloatLdexp(rel_jerk_rec * (distance_rec * distance_rec * distance_rec), -2);
+        }
+        
+        static void limit_phases (Segment const *entry, FpType a_x_rec, FpType v_start, FpType v_end, FpType *v_const, FpType *frac0, FpType *frac2, FpType *accel_scale0, FpType *accel_scale2, FpType *t1_double)
+        {
+            FpType k = entry->axes.jerk_dv_factor;
+            FpType a_x = 1.0f / a_x_rec;
+            FpType min_dv = a_x * a_x * k;
+            if (AMBRO_LIKELY(phase_fits(*v_const - v_start, min_dv) && phase_fits(*v_const - v_end, min_dv))) {
+                return;
+            }
+            
+            FpType lo = FloatMax(v_start, v_end);
+            if (AMBRO_UNLIKELY(phases_frac(lo, v_start, v_end, a_x, a_x_rec, k) > 1.0f)) {
+                // Not even the velocity change alone fits with the lower acceleration,
+                // do it over the whole segment instead.
+                FpType accel_scale = a_x / (FloatAbs(v_end - v_start) * (v_start + v_end));
+                if (v_end > v_start) {
+                    *v_const = v_end;
+                    *frac0 = 1.0f;
+                    *frac2 = 0.0f;
+                    *accel_scale0 = accel_scale;
+                } else {
+                    *v_const = v_start;
+                    *frac0 = 0.0f;
+                    *frac2 = 1.0f;
+                    *accel_scale2 = accel_scale;
+                }
+                *t1_double = 0.0f;
+                return;
+            }
+            
+            FpType hi = *v_const;
+            if (phases_frac(hi, v_start, v_end, a_x, a_x_rec, k) > 1.0f) {
+                for (int i = 0; i < SearchIterations; i++) {
+                    FpType mid = 0.5f * (lo + hi);
+                    if (phases_frac(mid, v_start, v_end, a_x, a_x_rec, k) > 1.0f) {
+                        hi = mid;
+                    } else {
+                        lo = mid;
+                    }
+                }
+                *v_const = lo;
+            }
+            
+            *accel_scale0 = phase_accel_scale(*v_const - v_start, a_x, k);
+            *accel_scale2 = phase_accel_scale(*v_const - v_end, a_x, k);
+            *frac0 = phase_frac(*v_const, v_start, a_x_rec, *accel_scale0);
+            *frac2 = phase_frac(*v_const, v_end, a_x_rec, *accel_scale2);
+            FpType frac1 = FloatMax((FpType)0.0f, 1.0f - *frac0 - *frac2);
+            *t1_double = (frac1 == 0.0f) ? 0.0f : (frac1 * FloatLdexp(entry->axes.max_accel_rec * a_x, -1) / *v_const);
+        }
+        
+        static bool phase_fits (FpType dv, FpType min_dv)
+        {
+            return dv <= 0.0f || dv >= min_dv;
+        }
+        
+        // Returns a_x divided by the acceleration for a phase changing the velocity by dv.
+        static FpType phase_accel_scale (FpType dv, FpType a_x, FpType k)
+        {
+            if (dv <= 0.0f || a_x * a_x * k <= dv) {
+                return 1.0f;
+            }
+            return a_x * FloatSqrt(k / dv);
+        }
+        
+        static FpType phase_frac (FpType v_const, FpType v, FpType a_x_rec, FpType accel_scale)
+        {
+            return FloatMax((FpType)0.0f, (v_const - v) * (v_const + v)) * a_x_rec * accel_scale;
+        }
+        
+        static FpType phases_frac (FpType v_const, FpType v_start, FpType v_end, FpType a_x, FpType a_x_rec, FpType k)
+        {
+            return phase_frac(v_const, v_start, a_x_rec, phase_accel_scale(v_const - v_start, a_x, k)) +
+                   phase_frac(v_const, v_end, a_x_rec, phase_accel_scale(v_const - v_end, a_x, k));
+        }
+    } AMBRO_STRUCT_ELSE(JerkFeature) {
+        static void limit_segment_accel (Context c, Segment *entry, FpType distance_rec, ComputeStateTuple const *cst, FpType *rel_max_accel_rec) {}
+        static void limit_phases (Segment const *entry, FpType a_x_rec, FpType v_start, FpType v_end, FpType *v_const, FpType *frac0, FpType *frac2, FpType *accel_scale0, FpType *accel_scale2, FpType *t1_double) {}
+    };
+    
 public:
     static void init (Context c, bool prestep_callback_enabled)
     {
@@ -1071,6 +1647,10 @@ public:
         o->m_segments_start = 0;
         o->m_segments_staging_length = 0;
         o->m_segments_length = 0;
+        o->m_segments_planned_length = 0;
+        o->m_segments_final_length = 0;
+        o->m_resume_length = 0;
+        TheLinearPlanner::init(&o->m_linear_planner);
         o->m_staging_time = 0;
         o->m_staging_v_squared = 0.0f;
         o->m_staging_v = 0.0f;
@@ -1171,6 +1751,20 @@ public:
         Context::EventLoop::template triggerFastEvent<StepperFastEvent>(c);
     }
     
+    static int getNumFreeSegments (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        return LookaheadBufferSize - o->m_segments_length;
+    }
+    
+    static bool isStepping (Context c)
+    {
+        auto *o = Object::self(c);
+        
+        return o->m_state == STATE_STEPPING;
+    }
+    
     template <int AxisIndex, typename StepsType>
     static StepsType countAbortedRemSteps (Context c)
     {
@@ -1230,40 +1824,64 @@ private:
         AMBRO_LOCK_T(InterruptTempLock(), c, lock_c) { AMBRO_ASSERT(planner_have_commit_space(c)) }
 #endif
         
-        SegmentBufferSizeType i = o->m_segments_length;
-        FpType v = 0.0f;
-        do {
-            i--;
-            Segment *entry = &o->m_segments[segments_add(o->m_segments_start, i)];
-            if (AMBRO_LIKELY((entry->dir_and_type & TypeMask) == 0)) {
-                v = TheLinearPlanner::push(&entry->axes.lp_seg, &o->m_segment_state[i], v);
-            }
-        } while (i != 0);
+        SegmentBufferSizeType final_length = TheLinearPlanner::backward(&o->m_linear_planner, o->m_segments_start, o->m_segments_length, o->m_segments_planned_length);
+        o->m_segments_planned_length = o->m_segments_length;
+        o->m_segments_final_length = MaxValue(o->m_segments_final_length, final_length);
         
         SegmentBufferSizeType commit_count = MinValue(o->m_segments_length, (SegmentBufferSizeType)LookaheadCommitCount);
         
+        // The segments before the resume point of the previous plan have final
+        // results, so the backup commands which it generated for them are what
+        // we would generate again. If the resume point is past our commit point,
+        // we continue from there instead.
+        bool resume = (o->m_resume_length > commit_count);
+        SegmentBufferSizeType new_resume_length = 0;
+        
         o->m_new_to_backup = false;
         ListFor<AxisCommonList>([&] APRINTER_TL(axis, axis::start_commands(c)));
+        ListFor<AxesList>([&] APRINTER_TL(axis, axis::filters_start(c)));
         ListFor<ChannelsList>([&] APRINTER_TL(channel, channel::start_commands(c)));
         
         TimeType time = o->m_staging_time;
-        v = o->m_staging_v_squared;
+        FpType v = o->m_staging_v_squared;
         FpType v_start = o->m_staging_v;
         
+        if (resume) {
+            AMBRO_ASSERT(o->m_resume_length < o->m_segments_length)
+            TheLinearPlanner::forward(&o->m_linear_planner, segments_add(o->m_segments_start, o->m_resume_length), o->m_segments_length - o->m_resume_length, o->m_resume_v_squared);
+        } else {
+            TheLinearPlanner::forward(&o->m_linear_planner, o->m_segments_start, o->m_segments_length, v);
+        }
+        
+        SegmentBufferSizeType i = 0;
         do {
-            Segment *entry = &o->m_segments[segments_add(o->m_segments_start, i)];
+            if (AMBRO_UNLIKELY(i == o->m_segments_final_length && i > commit_count)) {
+                new_resume_length = i;
+                o->m_resume_time = time;
+                o->m_resume_v_squared = v;
+                o->m_resume_v = v_start;
+                ListFor<AxisCommonList>([&] APRINTER_TL(axis, axis::resume_point(c)));
+                ListFor<AxesList>([&] APRINTER_TL(axis, axis::filters_resume_point(c)));
+                ListFor<ChannelsList>([&] APRINTER_TL(channel, channel::resume_point(c)));
+            }
+            SegmentBufferSizeType index = segments_add(o->m_segments_start, i);
+            Segment *entry = &o->m_segments[index];
             if (AMBRO_LIKELY((entry->dir_and_type & TypeMask) == 0)) {
                 typename TheLinearPlanner::SegmentResult result;
-                v = TheLinearPlanner::pull(&entry->axes.lp_seg, &o->m_segment_state[i], v, &result);
+                v = TheLinearPlanner::pull(&o->m_linear_planner, index, v, &result);
                 FpType v_end = FloatSqrt(v);
                 FpType v_const = FloatSqrt(result.const_v);
+                FpType a_x_rec = TheLinearPlanner::getAccelRec(&o->m_linear_planner, index);
+                FpType t1_double = (1.0f - result.const_start - result.const_end) * entry->axes.rel_max_speed_rec;
+                FpType accel_scale0 = 1.0f;
+                FpType accel_scale2 = 1.0f;
+                JerkFeature::limit_phases(entry, a_x_rec, v_start, v_end, &v_const, &result.const_start, &result.const_end, &accel_scale0, &accel_scale2, &t1_double);
                 FpType vdiff0 = v_const - v_start;
                 FpType vdiff2 = v_const - v_end;
-                FpType t0_double = vdiff0 * entry->axes.max_accel_rec;
+                FpType t0_double = vdiff0 * accel_scale0 * entry->axes.max_accel_rec;
                 MinTimeType t0 = MinTimeType::importFpSaturatedRound(t0_double);
-                FpType t2_double = vdiff2 * entry->axes.max_accel_rec;
+                FpType t2_double = vdiff2 * accel_scale2 * entry->axes.max_accel_rec;
                 MinTimeType t2 = MinTimeType::importFpSaturatedRound(t2_double);
-                FpType t1_double = (1.0f - result.const_start - result.const_end) * entry->axes.rel_max_speed_rec;
                 MinTimeType t1 = MinTimeType::importFpSaturatedRound(t1_double);
                 auto t_sum = t0 + t2 + t1;
                 if (AMBRO_UNLIKELY(t_sum > MinTimeType::maxValue())) {
@@ -1275,9 +1893,9 @@ private:
                     t1.m_bits.m_int -= t2.bitsValue();
                 }
                 time += t_sum.bitsValue();
-                ListFor<AxesList>([&] APRINTER_TL(axis, axis::gen_segment_stepper_commands(c, entry,
+                ListFor<AxesList>([&] APRINTER_TL(axis, axis::gen_segment_stepper_commands(c, entry, a_x_rec,
                                     result.const_start, result.const_end, t0, t2, t1,
-                                    vdiff0 * vdiff0, vdiff2 * vdiff2)));
+                                    vdiff0 * vdiff0 * accel_scale0, vdiff2 * vdiff2 * accel_scale2)));
                 ListFor<LasersList>([&] APRINTER_TL(laser, laser::gen_segment_stepper_commands(c, entry,
                     t0, t2, t1, v_start, v_end, v_const)));
                 v_start = v_end;
@@ -1293,9 +1911,21 @@ private:
                 o->m_staging_time = time;
                 o->m_staging_v_squared = v;
                 o->m_staging_v = v_start;
+                ListFor<AxesList>([&] APRINTER_TL(axis, axis::filters_commit_point(c)));
+                if (resume) {
+                    i = o->m_resume_length;
+                    time = o->m_resume_time;
+                    v = o->m_resume_v_squared;
+                    v_start = o->m_resume_v;
+                    ListFor<AxisCommonList>([&] APRINTER_TL(axis, axis::resume(c)));
+                    ListFor<AxesList>([&] APRINTER_TL(axis, axis::filters_resume(c)));
+                    ListFor<ChannelsList>([&] APRINTER_TL(channel, channel::resume(c)));
+                }
             }
         } while (i != o->m_segments_length);
         
+        ListFor<AxesList>([&] APRINTER_TL(axis, axis::filters_flush(c)));
+        
         bool ok;
         if (AMBRO_UNLIKELY(o->m_state == STATE_BUFFERING)) {
             ok = true;
@@ -1314,8 +1944,12 @@ private:
         }
         
         if (AMBRO_LIKELY(ok)) {
+            ListFor<AxesList>([&] APRINTER_TL(axis, axis::filters_commit(c)));
             o->m_segments_start = segments_add(o->m_segments_start, commit_count);
             o->m_segments_length -= commit_count;
+            o->m_segments_planned_length -= commit_count;
+            o->m_segments_final_length -= MinValue(o->m_segments_final_length, commit_count);
+            o->m_resume_length = (new_resume_length > 0) ? (new_resume_length - commit_count) : 0;
             o->m_segments_staging_length = o->m_segments_length;
 #ifdef AMBROLIB_ASSERTIONS
             o->m_planned = true;
@@ -1334,6 +1968,7 @@ private:
         o->m_state = STATE_STEPPING;
         TimeType start_time = Clock::getTime(c) + (TimeType)(0.05 * Context::Clock::time_freq);
         o->m_staging_time += start_time;
+        o->m_resume_time += start_time;
         ListFor<AxisCommonList>([&] APRINTER_TL(axis, axis::start_stepping(c, start_time)));
         ListFor<ChannelsList>([&] APRINTER_TL(channel, channel::start_stepping(c, start_time)));
     }
@@ -1472,10 +2107,15 @@ private:
         o->m_state = STATE_BUFFERING;
         o->m_segments_start = segments_add(o->m_segments_start, o->m_segments_staging_length);
         o->m_segments_length -= o->m_segments_staging_length;
+        o->m_segments_planned_length -= o->m_segments_staging_length;
         o->m_segments_staging_length = 0;
+        // Nothing is final once we start from a stop instead.
+        o->m_segments_final_length = 0;
+        o->m_resume_length = 0;
         o->m_staging_time = 0;
         o->m_staging_v_squared = 0.0f;
         o->m_staging_v = 0.0f;
+        ListFor<AxesList>([&] APRINTER_TL(axis, axis::filters_reset(c)));
 #ifdef AMBROLIB_ASSERTIONS
         o->m_planned = false;
 #endif
@@ -1489,7 +2129,8 @@ private:
         AMBRO_ASSERT(o->m_split_buffer.type != 0xFF)
         AMBRO_ASSERT(o->m_split_buffer.type != 0 || o->m_split_buffer.axes.split_pos < o->m_split_buffer.axes.split_count)
         
-        Segment *entry = &o->m_segments[segments_add(o->m_segments_start, o->m_segments_length)];
+        SegmentBufferSizeType index = segments_add(o->m_segments_start, o->m_segments_length);
+        Segment *entry = &o->m_segments[index];
         entry->dir_and_type = o->m_split_buffer.type;
         
         if (AMBRO_LIKELY(o->m_split_buffer.type == 0)) {
@@ -1515,6 +2156,7 @@ private:
             ListFor<LasersList>([&] APRINTER_TL(laser, laser::write_segment_buffer_entry_extra(c, entry, distance_rec)));
             
             FpType rel_max_accel_rec = ListForFold<AxesList>(FloatIdentity(), [&] APRINTER_TLA(axis, (auto accum), return axis::compute_segment_buffer_entry_accel(accum, c, &cst)));
+            JerkFeature::limit_segment_accel(c, entry, distance_rec, &cst, &rel_max_accel_rec);
             entry->axes.max_accel_rec = rel_max_accel_rec * distance_rec;
             FpType half_rel_max_accel = 0.5f / rel_max_accel_rec;
             
@@ -1526,7 +2168,7 @@ private:
             FpType distance_squared = distance * distance;
             FpType max_v = distance_squared / (entry->axes.rel_max_speed_rec * entry->axes.rel_max_speed_rec);
             FpType a_x = FloatLdexp(half_rel_max_accel * distance_squared, 2);
-            TheLinearPlanner::initSegment(&entry->axes.lp_seg, o->m_last_max_v, junction_max_start_v, max_v, a_x);
+            TheLinearPlanner::initSegment(&o->m_linear_planner, index, o->m_last_max_v, junction_max_start_v, max_v, a_x);
             o->m_last_max_v = max_v;
             
             if (AMBRO_LIKELY(o->m_split_buffer.axes.split_pos == o->m_split_buffer.axes.split_count)) {
@@ -1534,6 +2176,7 @@ private:
             }
         } else {
             ListForOne<ChannelsList, 1>((entry->dir_and_type & TypeMask), [&] APRINTER_TL(channel, channel::write_segment(c, entry)));
+            TheLinearPlanner::initNeutralSegment(&o->m_linear_planner, index);
             o->m_split_buffer.type = 0xFF;
         }
         
@@ -1561,9 +2204,15 @@ public:
         SegmentBufferSizeType m_segments_start;
         SegmentBufferSizeType m_segments_staging_length;
         SegmentBufferSizeType m_segments_length;
+        SegmentBufferSizeType m_segments_planned_length;
+        SegmentBufferSizeType m_segments_final_length;
+        SegmentBufferSizeType m_resume_length;
         TimeType m_staging_time;
         FpType m_staging_v_squared;
         FpType m_staging_v;
+        TimeType m_resume_time;
+        FpType m_resume_v_squared;
+        FpType m_resume_v;
         FpType m_last_max_v;
         AxisMaskType m_last_dir_and_type;
         uint8_t m_state;
@@ -1578,7 +2227,7 @@ public:
 #endif
         SplitBuffer m_split_buffer;
         Segment m_segments[LookaheadBufferSize];
-        typename TheLinearPlanner::SegmentState m_segment_state[LookaheadBufferSize];
+        typename TheLinearPlanner::State m_linear_planner;
     };
 };
 
@@ -1591,6 +2240,8 @@ APRINTER_ALIAS_STRUCT_EXT(MotionPlannerArg, (
     APRINTER_AS_VALUE(int, LookaheadBufferSize),
     APRINTER_AS_VALUE(int, LookaheadCommitCount),
     APRINTER_AS_TYPE(FpType),
+    APRINTER_AS_TYPE(LinearPlannerService),
+    APRINTER_AS_TYPE(InputShaperParams),
     APRINTER_AS_TYPE(MaxStepsPerCycle),
     APRINTER_AS_TYPE(PullHandler),
     APRINTER_AS_TYPE(FinishedHandler),
@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AMBROLIB_PRESSURE_ADVANCE_H
+#define AMBROLIB_PRESSURE_ADVANCE_H
+
+#include <stdint.h>
+
+#include <aprinter/meta/MinMax.h>
+#include <aprinter/base/Assert.h>
+#include <aprinter/base/Hints.h>
+#include <aprinter/math/FloatTools.h>
+
+namespace APrinter {
+
+/**
+ * Velocity feed-forward for extruder axes, compensating for the pressure
+ * in the nozzle. The output position leads the input position by K times
+ * the input velocity, with K given in clock ticks.
+ * 
+ * Input and output are stepper commands (direction, steps x, duration t in
+ * clock ticks and acceleration term a, see AxisDriver). Since the velocity
+ * is linear within a piece of constant acceleration, so is the advance, and
+ * the output piece differs from the input piece only by a linear term.
+ * A jump of the input velocity between pieces (e.g. between segments with
+ * different extrusion ratios) is spread over the following piece.
+ * 
+ * The advance is kept in whole steps and is zero whenever the input piece
+ * ends at rest, so the output always comes back to the input position.
+ * It is limited to 1/8 of the maximum steps of a command, which allows
+ * any input piece to be output as at most two commands: split where the
+ * velocity changes sign (retraction while decelerating), or otherwise in
+ * half if the piece would have too many steps.
+ */
+template <typename FpType, int StepBits>
+class PressureAdvance {
+    static_assert(StepBits >= 4, "");
+    static_assert(StepBits < 31, "");
+    
+public:
+    static int const MaxCommandsPerPiece = 2;
+    
+    struct State {
+        int32_t advance;
+    };
+    
+    static void reset (State *st)
+    {
+        st->advance = 0;
+    }
+    
+    /**
+     * Outputs the advanced version of an input piece, as one or two calls
+     * output(dir, x, t, a) with -x <= a <= x.
+     */
+    template <typename Output>
+    static void addPiece (State *st, FpType k, bool dir, uint32_t x, uint32_t t, int32_t a, Output output)
+    {
+        AMBRO_ASSERT(x <= (uint32_t)MaxSteps)
+        AMBRO_ASSERT(a >= -(int32_t)x)
+        AMBRO_ASSERT(a <= (int32_t)x)
+        
+        // Nothing can be added to a piece of no duration.
+        if (AMBRO_UNLIKELY(t == 0)) {
+            output(dir, x, t, a);
+            return;
+        }
+        
+        FpType sign = dir ? 1.0f : -1.0f;
+        FpType t_rec = 1.0f / (FpType)t;
+        int32_t d = dir ? (int32_t)x : -(int32_t)x;
+        
+        // The end velocity is proportional to x+a. Consider anything below one
+        // step per piece to be at rest, so that rounding of the acceleration
+        // term does not leave a residual advance when the motion stops.
+        int32_t target = 0;
+        if ((uint32_t)((int32_t)x + a) > 1) {
+            FpType target_fp = FloatRound(k * sign * (FpType)((int32_t)x + a) * t_rec);
+            target = FloatMax((FpType)-MaxAdvance, FloatMin((FpType)MaxAdvance, target_fp));
+        }
+        
+        // A single tick cannot be split, so limit the advance to what fits.
+        int32_t extra = target - st->advance;
+        if (AMBRO_UNLIKELY(t == 1)) {
+            extra = MaxValue(-MaxSteps - d, MinValue(MaxSteps - d, extra));
+        }
+        st->advance += extra;
+        
+        if (AMBRO_LIKELY(extra == 0)) {
+            output(dir, x, t, a);
+            return;
+        }
+        
+        int32_t total = d + extra;
+        FpType v0 = (sign * (FpType)((int32_t)x - a) + (FpType)extra) * t_rec;
+        FpType accel = sign * 2.0f * (FpType)a * (t_rec * t_rec);
+        FpType v_end = v0 + accel * (FpType)t;
+        
+        // Where the velocity changes sign, the pieces on either side cover at
+        // most max(|d|, |extra|) steps. Otherwise, if there are too many steps,
+        // each half covers at most 3/4 of |d| plus half of |extra|.
+        uint32_t split = 0;
+        if ((v0 < 0.0f && v_end > 0.0f) || (v0 > 0.0f && v_end < 0.0f)) {
+            FpType t_zero = FloatRound(-v0 / accel);
+            if (t_zero > 0.0f && t_zero < t) {
+                split = t_zero;
+            }
+        }
+        if (split == 0 && (uint32_t)(total < 0 ? -total : total) > (uint32_t)MaxSteps) {
+            split = t / 2;
+        }
+        
+        int32_t pos = 0;
+        if (split > 0) {
+            FpType s = split;
+            pos = FloatRound(s * (v0 + 0.5f * accel * s));
+            output_part(pos, split, accel, output);
+        }
+        output_part(total - pos, t - split, accel, output);
+    }
+    
+private:
+    static int32_t const MaxSteps = ((int32_t)1 << StepBits) - 1;
+    static int32_t const MaxAdvance = MaxSteps / 8;
+    
+    template <typename Output>
+    static void output_part (int32_t steps, uint32_t t, FpType accel, Output output)
+    {
+        AMBRO_ASSERT((uint32_t)(steps < 0 ? -steps : steps) <= (uint32_t)MaxSteps)
+        
+        bool dir = (steps >= 0);
+        uint32_t x = dir ? steps : -steps;
+        FpType t_fp = t;
+        int32_t a = FloatRound((dir ? 0.5f : -0.5f) * accel * (t_fp * t_fp));
+        a = MaxValue(-(int32_t)x, MinValue((int32_t)x, a));
+        output(dir, x, t, a);
+    }
+};
+
+}
+
+#endif
@@ -83,6 +83,7 @@ class AxisHomer {
     using ThePrinterMain   = typename GeneralParams::ThePrinterMain;
     using MaxStepsPerCycle = typename GeneralParams::MaxStepsPerCycle;
     using MaxAccel         = typename GeneralParams::MaxAccel;
+    using MaxJerk          = typename GeneralParams::MaxJerk;
     using DistConversion   = typename GeneralParams::DistConversion;
     using TimeConversion   = typename GeneralParams::TimeConversion;
     using HomeDir          = typename GeneralParams::HomeDir;
@@ -109,6 +110,7 @@ private:
     
     using SpeedConversion = decltype(DistConversion() / TimeConversion());
     using AccelConversion = decltype(DistConversion() / (TimeConversion() * TimeConversion()));
+    using JerkConversion = decltype(DistConversion() / (TimeConversion() * TimeConversion() * TimeConversion()));
     
     using FastSteps = decltype(Config::e(Params::FastMaxDist::i()) * DistConversion());
     using RetractSteps = decltype(Config::e(Params::RetractDist::i()) * DistConversion());
@@ -116,12 +118,13 @@ private:
     
     using PlannerMaxSpeedRec = APRINTER_FP_CONST_EXPR(0.0);
     using PlannerMaxAccelRec = decltype(ExprRec(MaxAccel() * AccelConversion()));
+    using PlannerMaxJerkRec = decltype(ExprRec(MaxJerk() * JerkConversion()));
     using PlannerDistanceFactor = APRINTER_FP_CONST_EXPR(1.0);
     using PlannerCorneringDistance = APRINTER_FP_CONST_EXPR(1.0);
     
-    struct PlannerAxisSpec : public MotionPlannerAxisSpec<TheAxisDriver, PlannerStepBits, PlannerDistanceFactor, PlannerCorneringDistance, PlannerMaxSpeedRec, PlannerMaxAccelRec, PlannerPrestepCallback> {};
+    struct PlannerAxisSpec : public MotionPlannerAxisSpec<TheAxisDriver, PlannerStepBits, PlannerDistanceFactor, PlannerCorneringDistance, PlannerMaxSpeedRec, PlannerMaxAccelRec, PlannerMaxJerkRec, MotionPlannerNoPressureAdvance, PlannerPrestepCallback> {};
     using PlannerAxes = MakeTypeList<PlannerAxisSpec>;
-    APRINTER_MAKE_INSTANCE(Planner, (MotionPlannerArg<Context, Object, Config, PlannerAxes, StepperSegmentBufferSize, LookaheadBufferSize, LookaheadCommitCount, FpType, MaxStepsPerCycle, PlannerPullHandler, PlannerFinishedHandler, PlannerAbortedHandler, PlannerUnderrunCallback, EmptyTypeList, EmptyTypeList>))
+    APRINTER_MAKE_INSTANCE(Planner, (MotionPlannerArg<Context, Object, Config, PlannerAxes, StepperSegmentBufferSize, LookaheadBufferSize, LookaheadCommitCount, FpType, LinearPlannerService, NoInputShaperParams, MaxStepsPerCycle, PlannerPullHandler, PlannerFinishedHandler, PlannerAbortedHandler, PlannerUnderrunCallback, EmptyTypeList, EmptyTypeList>))
     using PlannerCommand = typename Planner::SplitBuffer;
     
     using TheDebugObject = DebugObject<Context, Object>;
@@ -302,6 +305,7 @@ APRINTER_ALIAS_STRUCT_EXT(AxisHomerService, (
         APRINTER_AS_VALUE(int, MaxLookaheadBufferSize),
         APRINTER_AS_TYPE(MaxStepsPerCycle),
         APRINTER_AS_TYPE(MaxAccel),
+        APRINTER_AS_TYPE(MaxJerk),
         APRINTER_AS_TYPE(DistConversion),
         APRINTER_AS_TYPE(TimeConversion),
         APRINTER_AS_TYPE(HomeDir)
@@ -0,0 +1,341 @@
+/*
+ * Copyright (c) 2015 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef APRINTER_BINARY_FRAME_PARSER_H
+#define APRINTER_BINARY_FRAME_PARSER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <aprinter/meta/ServiceUtils.h>
+#include <aprinter/base/DebugObject.h>
+#include <aprinter/base/Assert.h>
+#include <aprinter/misc/CrcItuT.h>
+#include <aprinter/printer/utils/GcodeCommand.h>
+#include <aprinter/printer/utils/BinaryGcodeParser.h>
+
+namespace APrinter {
+
+/**
+ * Parser for binary g-code packets (doc/encoding.txt) wrapped in frames
+ * with a sequence number and a CRC, for streaming over serial or TCP.
+ * 
+ * Frame = 0xA5 Seq Len Packet[Len] CrcLow CrcHigh
+ * 
+ * The CRC is CRC-ITU-T (initial value 0) over Seq, Len and the packet.
+ * Frames must arrive with consecutive sequence numbers (modulo 256).
+ * Bytes before a sync byte are skipped silently. A frame with a bad CRC,
+ * a bad length or a sequence gap, as well as a receive overrun, results
+ * in a resend request for the expected sequence number. Frames behind the
+ * expected sequence number are duplicates of frames already accepted and
+ * are dropped. A frame with an empty packet is a sync request; its Seq
+ * is an arbitrary token to be echoed back along with the expected sequence
+ * number, and the sequence is not affected.
+ * 
+ * Anything but an accepted frame is reported as GCODE_ERROR_NO_PARTS so
+ * that the command stream finishes it silently, and getReply() tells the
+ * user what to report instead. Each accepted frame produces exactly one
+ * command.
+ */
+template <typename Context, typename TBufferSizeType, typename FpType, typename Params>
+class BinaryFrameParser
+: public GcodeCommand<Context, FpType>,
+  private SimpleDebugObject<Context>
+{
+    static uint8_t const SyncByte = 0xA5;
+    static uint8_t const HeaderSize = 3;
+    static uint8_t const CrcSize = 2;
+
+public:
+    using BufferSizeType = TBufferSizeType;
+    using PartsSizeType = int8_t;
+    using TheGcodeCommand = GcodeCommand<Context, FpType>;
+    using PartRef = typename TheGcodeCommand::PartRef;
+    using ThePacketParser = BinaryGcodeParser<Context, BufferSizeType, FpType, Params>;
+    
+    static size_t const MaxPacketSize = 3 + 5 * Params::MaxParts;
+    static size_t const MaxFrameSize = HeaderSize + MaxPacketSize + CrcSize;
+    static_assert(MaxPacketSize <= UINT8_MAX, "");
+    
+    enum class Reply : uint8_t {NONE, RESEND, SYNC};
+    
+    void init (Context c)
+    {
+        m_state = STATE_NOCMD;
+        m_expected_seq = 0;
+        m_packet_parser.init(c);
+        
+        this->debugInit(c);
+    }
+    
+    void deinit (Context c)
+    {
+        this->debugDeinit(c);
+        
+        m_packet_parser.deinit(c);
+    }
+    
+    void resetSequence (Context c)
+    {
+        this->debugAccess(c);
+        AMBRO_ASSERT(m_state == STATE_NOCMD)
+        
+        m_expected_seq = 0;
+    }
+    
+    bool haveCommand (Context c)
+    {
+        this->debugAccess(c);
+        
+        return (m_state != STATE_NOCMD);
+    }
+    
+    void startCommand (Context c, char *buffer, int8_t assume_error)
+    {
+        this->debugAccess(c);
+        AMBRO_ASSERT(m_state == STATE_NOCMD)
+        AMBRO_ASSERT(buffer)
+        AMBRO_ASSERT(assume_error <= 0)
+        
+        m_state = STATE_FRAME;
+        m_buffer = (uint8_t *)buffer;
+        m_length = 0;
+        m_num_parts = assume_error;
+        m_reply = Reply::NONE;
+    }
+    
+    bool extendCommand (Context c, BufferSizeType avail, bool line_buffer_exhausted=false)
+    {
+        this->debugAccess(c);
+        AMBRO_ASSERT(m_state == STATE_FRAME)
+        
+        if (m_num_parts < 0) {
+            // Whatever was lost needs to be sent again.
+            m_reply = Reply::RESEND;
+            goto finish_silent;
+        }
+        
+        while (m_length < avail && m_buffer[m_length] != SyncByte) {
+            m_length++;
+        }
+        if (m_length > 0) {
+            goto finish_silent;
+        }
+        
+        {
+            if (avail < HeaderSize) {
+                return false;
+            }
+            
+            uint8_t seq = m_buffer[1];
+            uint8_t packet_len = m_buffer[2];
+            
+            if (packet_len > MaxPacketSize) {
+                goto bad_frame;
+            }
+            
+            BufferSizeType frame_len = HeaderSize + packet_len + CrcSize;
+            if (avail < frame_len) {
+                return false;
+            }
+            
+            uint16_t crc = CrcItuTUpdate(CrcItuTInitial, (char const *)m_buffer + 1, HeaderSize - 1 + packet_len);
+            uint8_t const *crc_ptr = m_buffer + HeaderSize + packet_len;
+            if (crc != (crc_ptr[0] | ((uint16_t)crc_ptr[1] << 8))) {
+                goto bad_frame;
+            }
+            
+            m_length = frame_len;
+            
+            if (packet_len == 0) {
+                m_reply = Reply::SYNC;
+                m_sync_token = seq;
+                goto finish_silent;
+            }
+            
+            uint8_t seq_offset = (uint8_t)(seq - m_expected_seq);
+            if (seq_offset != 0) {
+                // A frame ahead of the expected one means frames were lost,
+                // one behind it is a retransmission of an accepted frame.
+                if (seq_offset < 128) {
+                    m_reply = Reply::RESEND;
+                }
+                goto finish_silent;
+            }
+            
+            m_expected_seq++;
+            
+            m_packet_parser.startCommand(c, (char *)m_buffer + HeaderSize, 0);
+            if (!m_packet_parser.extendCommand(c, packet_len)) {
+                m_packet_parser.resetCommand(c);
+                m_num_parts = GCODE_ERROR_INVALID_PART;
+            }
+            else if (m_packet_parser.getLength(c) != packet_len) {
+                m_num_parts = GCODE_ERROR_INVALID_PART;
+            }
+            else {
+                m_num_parts = m_packet_parser.getNumParts(c);
+            }
+            goto finish;
+        }
+    
+    bad_frame:
+        // Skip just the sync byte, the real next frame may start within.
+        m_length = 1;
+        m_reply = Reply::RESEND;
+    
+    finish_silent:
+        m_num_parts = GCODE_ERROR_NO_PARTS;
+    
+    finish:
+        m_state = STATE_NOCMD;
+        return true;
+    }
+    
+    void resetCommand (Context c)
+    {
+        this->debugAccess(c);
+        AMBRO_ASSERT(m_state != STATE_NOCMD)
+        
+        m_state = STATE_NOCMD;
+    }
+    
+    BufferSizeType getLength (Context c)
+    {
+        this->debugAccess(c);
+        AMBRO_ASSERT(m_state == STATE_NOCMD)
+        
+        return m_length;
+    }
+    
+    Reply getReply (Context c)
+    {
+        this->debugAccess(c);
+        AMBRO_ASSERT(m_state == STATE_NOCMD)
+        
+        return m_reply;
+    }
+    
+    uint8_t getSyncToken (Context c)
+    {
+        this->debugAccess(c);
+        AMBRO_ASSERT(m_state == STATE_NOCMD)
+        AMBRO_ASSERT(m_reply == Reply::SYNC)
+        
+        return m_sync_token;
+    }
+    
+    uint8_t getExpectedSequence (Context c)
+    {
+        this->debugAccess(c);
+        
+        return m_expected_seq;
+    }
+    
+    PartsSizeType getNumParts (Context c)
+    {
+        this->debugAccess(c);
+        AMBRO_ASSERT(m_state == STATE_NOCMD)
+        
+        return m_num_parts;
+    }
+    
+    char getCmdCode (Context c)
+    {
+        AMBRO_ASSERT(m_num_parts >= 0)
+        
+        return m_packet_parser.getCmdCode(c);
+    }
+    
+    uint16_t getCmdNumber (Context c)
+    {
+        AMBRO_ASSERT(m_num_parts >= 0)
+        
+        return m_packet_parser.getCmdNumber(c);
+    }
+    
+    PartRef getPart (Context c, PartsSizeType i)
+    {
+        AMBRO_ASSERT(m_num_parts >= 0)
+        
+        return m_packet_parser.getPart(c, i);
+    }
+    
+    char getPartCode (Context c, PartRef part)
+    {
+        AMBRO_ASSERT(m_num_parts >= 0)
+        
+        return m_packet_parser.getPartCode(c, part);
+    }
+    
+    FpType getPartFpValue (Context c, PartRef part)
+    {
+        AMBRO_ASSERT(m_num_parts >= 0)
+        
+        return m_packet_parser.getPartFpValue(c, part);
+    }
+    
+    uint32_t getPartUint32Value (Context c, PartRef part)
+    {
+        AMBRO_ASSERT(m_num_parts >= 0)
+        
+        return m_packet_parser.getPartUint32Value(c, part);
+    }
+    
+    char const * getPartStringValue (Context c, PartRef part)
+    {
+        AMBRO_ASSERT(m_num_parts >= 0)
+        
+        return m_packet_parser.getPartStringValue(c, part);
+    }
+
+private:
+    enum {STATE_NOCMD, STATE_FRAME};
+    
+    uint8_t m_state;
+    uint8_t m_expected_seq;
+    Reply m_reply;
+    uint8_t m_sync_token;
+    PartsSizeType m_num_parts;
+    uint8_t *m_buffer;
+    BufferSizeType m_length;
+    ThePacketParser m_packet_parser;
+};
+
+APRINTER_ALIAS_STRUCT_EXT(BinaryFrameParserService, (
+    APRINTER_AS_VALUE(int, MaxParts)
+), (
+    static bool const Enabled = true;
+    
+    template <typename Context, typename TBufferSizeType, typename FpType>
+    using Parser = BinaryFrameParser<Context, TBufferSizeType, FpType, BinaryFrameParserService>;
+))
+
+struct NoBinaryFrameParserService {
+    static bool const Enabled = false;
+};
+
+}
+
+#endif
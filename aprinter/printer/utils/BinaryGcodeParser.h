@@ -96,7 +96,9 @@ public:
         return (m_state != STATE_NOCMD);
     }
     
-    void startCommand (Context c, char *buffer, int8_t assume_error)
+    // The buffer is never written, so string_buffer is not needed (see
+    // GcodeParser::startCommand).
+    void startCommand (Context c, char *buffer, int8_t assume_error, char *string_buffer=nullptr)
     {
         this->debugAccess(c);
         AMBRO_ASSERT(m_state == STATE_NOCMD)
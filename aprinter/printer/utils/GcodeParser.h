@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
 
 #include <aprinter/meta/ServiceUtils.h>
 #include <aprinter/math/FloatTools.h>
@@ -84,6 +85,7 @@ public:
     template <typename Dummy>
     struct CommandExtra<GcodeParserTypeSerial, Dummy> {
         bool have_line_number;
+        bool have_checksum;
         uint32_t line_number;
     };
     
@@ -107,7 +109,12 @@ public:
         return (m_state != STATE_NOCMD);
     }
     
-    void startCommand (Context c, char *buffer, int8_t assume_error)
+    // If string_buffer is given, the command is parsed without writing to
+    // buffer, so that it may be shared data. Part values are then not null
+    // terminated in buffer, which the numeric accessors do not need, and
+    // string values are copied to string_buffer when asked for. It must be
+    // as large as the command.
+    void startCommand (Context c, char *buffer, int8_t assume_error, char *string_buffer=nullptr)
     {
         this->debugAccess(c);
         AMBRO_ASSERT(m_state == STATE_NOCMD)
@@ -116,6 +123,8 @@ public:
         
         m_state = STATE_OUTSIDE;
         m_buffer = buffer;
+        m_string_buffer = string_buffer;
+        m_string_length = 0;
         m_command.length = 0;
         m_command.num_parts = assume_error;
         TheTypeHelper::init_command_hook(c, this);
@@ -145,6 +154,8 @@ public:
                             m_command.cmd_number = atoi(m_command.parts[0].data);
                         }
                     }
+                } else if (TheTypeHelper::ChecksumEnabled && m_state == STATE_CHECKSUM) {
+                    TheTypeHelper::checksum_check_hook(c, this);
                 }
                 m_command.length++;
                 m_state = STATE_NOCMD;
@@ -152,12 +163,14 @@ public:
                 return true;
             }
             
-            if (AMBRO_UNLIKELY(m_command.num_parts < 0 || (TheTypeHelper::ChecksumEnabled && m_state == STATE_CHECKSUM))) {
+            if (AMBRO_UNLIKELY(TheTypeHelper::ChecksumEnabled && m_state == STATE_CHECKSUM)) {
                 continue;
             }
             
+            // The checksum is also verified for lines which failed to parse,
+            // so that a damaged line can be told apart from a malformed one.
             if (AMBRO_UNLIKELY(TheTypeHelper::ChecksumEnabled && ch == '*')) {
-                if (m_state == STATE_INSIDE) {
+                if (m_state == STATE_INSIDE && m_command.num_parts >= 0) {
                     finish_part(c);
                 }
                 m_temp = m_command.length;
@@ -167,6 +180,10 @@ public:
             
             TheTypeHelper::checksum_add_hook(c, this, ch);
             
+            if (AMBRO_UNLIKELY(m_command.num_parts < 0)) {
+                continue;
+            }
+            
             if (TheTypeHelper::CommentsEnabled) {
                 if (AMBRO_UNLIKELY(m_state == STATE_COMMENT)) {
                     continue;
@@ -281,7 +298,7 @@ public:
         AMBRO_ASSERT(m_state == STATE_NOCMD)
         AMBRO_ASSERT(m_command.num_parts >= 0)
         
-        return StrToFloat<FpType>(cast_part_ref(part)->data, NULL);
+        return FastStrToFloat<FpType>(cast_part_ref(part)->data, NULL);
     }
     
     uint32_t getPartUint32Value (Context c, PartRef part)
@@ -299,7 +316,22 @@ public:
         AMBRO_ASSERT(m_state == STATE_NOCMD)
         AMBRO_ASSERT(m_command.num_parts >= 0)
         
-        return cast_part_ref(part)->data;
+        CommandPart *the_part = cast_part_ref(part);
+        
+        // Without a writable buffer, copy the value out the first time.
+        if (m_string_buffer && the_part->data >= m_buffer && the_part->data < m_buffer + m_command.length) {
+            char *dst = m_string_buffer + m_string_length;
+            BufferSizeType length = 0;
+            while (!is_part_end(the_part->data[length])) {
+                dst[length] = the_part->data[length];
+                length++;
+            }
+            dst[length] = '\0';
+            m_string_length += length + 1;
+            the_part->data = dst;
+        }
+        
+        return the_part->data;
     }
     
     char * getBuffer (Context c)
@@ -338,6 +370,7 @@ private:
         {
             o->m_checksum = 0;
             o->m_command.have_line_number = false;
+            o->m_command.have_checksum = false;
         }
         
         static bool finish_part_hook (Context c, GcodeParser *o, char code)
@@ -357,13 +390,15 @@ private:
         
         static void checksum_check_hook (Context c, GcodeParser *o)
         {
-            AMBRO_ASSERT(o->m_command.num_parts >= 0)
             AMBRO_ASSERT(o->m_state == STATE_CHECKSUM)
             
             char *received = o->m_buffer + (o->m_temp + 1);
             BufferSizeType received_len = o->m_command.length - (o->m_temp + 1);
             
-            if (AMBRO_UNLIKELY(!compare_checksum(o->m_checksum, received, received_len))) {
+            o->m_command.have_checksum = true;
+            
+            // A receive overrun is reported as such, the start of the line is missing anyway.
+            if (AMBRO_UNLIKELY(!compare_checksum(o->m_checksum, received, received_len)) && o->m_command.num_parts != GCODE_ERROR_RECV_OVERRUN) {
                 o->m_command.num_parts = GCODE_ERROR_CHECKSUM;
             }
         }
@@ -443,6 +478,14 @@ private:
         return (ch == ' ' || ch == '\t' || ch == '\r');
     }
     
+    // Whether the character ends a part (see extendCommand).
+    static bool is_part_end (char ch)
+    {
+        return ch == '\n' || is_space(ch) ||
+            (TheTypeHelper::CommentsEnabled && ch == ';') ||
+            (TheTypeHelper::ChecksumEnabled && ch == '*');
+    }
+    
     static bool compare_checksum (uint8_t expected, char const *received, BufferSizeType received_len)
     {
         while (received_len > 0 && is_space(received[received_len - 1])) {
@@ -473,39 +516,65 @@ private:
         }
         
         char code = m_buffer[m_temp];
+        char *data = m_buffer + (m_temp + 1);
+        BufferSizeType length = m_command.length - (m_temp + 1);
+        
+        // The value is decoded in place, or, if the buffer is not to be
+        // written, left as it is unless it has escapes to decode.
+        if (!m_string_buffer) {
+            if (decode_part(data, length, data) < 0) {
+                return;
+            }
+        } else if (m_command.num_parts > 0 && memchr(data, '\\', length)) {
+            char *dst = m_string_buffer + m_string_length;
+            int decoded_length = decode_part(data, length, dst);
+            if (decoded_length < 0) {
+                return;
+            }
+            m_string_length += decoded_length + 1;
+            data = dst;
+        }
+        
+        if (TheTypeHelper::finish_part_hook(c, this, code)) {
+            return;
+        }
         
-        BufferSizeType in_pos = m_temp + 1;
-        BufferSizeType out_pos = in_pos;
+        m_command.parts[m_command.num_parts].code = code;
+        m_command.parts[m_command.num_parts].data = data;
+        m_command.num_parts++;
+    }
+    
+    // Copies a part value to dst, which may be the same as src, decoding
+    // escapes except in the first part, and adds a null terminator.
+    // Returns the decoded length, or -1 after setting the error for a bad
+    // escape.
+    int decode_part (char const *src, BufferSizeType length, char *dst)
+    {
+        BufferSizeType in_pos = 0;
+        BufferSizeType out_pos = 0;
         
-        while (in_pos < m_command.length) {
-            char ch = m_buffer[in_pos++];
+        while (in_pos < length) {
+            char ch = src[in_pos++];
             if (ch == '\\' && m_command.num_parts > 0) {
-                if (m_command.length - in_pos < 2) {
+                if (length - in_pos < 2) {
                     m_command.num_parts = GCODE_ERROR_BAD_ESCAPE;
-                    return;
+                    return -1;
                 }
-                int digit_h = read_hex_digit(m_buffer[in_pos++]);
-                int digit_l = read_hex_digit(m_buffer[in_pos++]);
+                int digit_h = read_hex_digit(src[in_pos++]);
+                int digit_l = read_hex_digit(src[in_pos++]);
                 if (digit_h < 0 || digit_l < 0) {
                     m_command.num_parts = GCODE_ERROR_BAD_ESCAPE;
-                    return;
+                    return -1;
                 }
                 unsigned char byte = (digit_h << 4) | digit_l;
-                m_buffer[out_pos++] = *(char *)&byte;
+                dst[out_pos++] = *(char *)&byte;
             } else {
-                m_buffer[out_pos++] = ch;
+                dst[out_pos++] = ch;
             }
         }
         
-        m_buffer[out_pos] = '\0';
-        
-        if (TheTypeHelper::finish_part_hook(c, this, code)) {
-            return;
-        }
-        
-        m_command.parts[m_command.num_parts].code = code;
-        m_command.parts[m_command.num_parts].data = m_buffer + (m_temp + 1);
-        m_command.num_parts++;
+        dst[out_pos] = '\0';
+        return out_pos;
     }
     
     static int read_hex_digit (char ch)
@@ -520,6 +589,8 @@ private:
 private:
     uint8_t m_state;
     char *m_buffer;
+    char *m_string_buffer;
+    BufferSizeType m_string_length;
     BufferSizeType m_temp;
     Command m_command;
 };
@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2015 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef APRINTER_LINE_FLOW_CONTROL_H
+#define APRINTER_LINE_FLOW_CONTROL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <aprinter/base/ProgramMemory.h>
+#include <aprinter/printer/utils/GcodeCommand.h>
+
+namespace APrinter {
+
+/**
+ * Line number checking (M110) for text consoles, and the windowed flow
+ * control mode enabled by M949.
+ * 
+ * In this mode every line must have a line number and a checksum, and
+ * the host may send further lines without waiting for the "ok" of the
+ * previous ones, as long as the unacknowledged lines fit into the window
+ * reported by M949. Each "ok" reports the last accepted line number and
+ * the free space in the planner and the receive buffer:
+ * 
+ *   ok N<line> P<free planner slots> B<free receive buffer bytes>
+ * 
+ * A damaged line results in "Resend:<line>" for the expected line number,
+ * and lines are then dropped until that one arrives. Of the lines ahead
+ * of the expected one, only the first one after an accepted line results
+ * in a resend request, the others were most likely sent before the host
+ * saw it. Lines behind the expected line number are retransmissions of
+ * lines already accepted and are dropped silently.
+ * 
+ * An "ok" is sent for every line received, but damage to a newline merges
+ * or splits lines, so the host cannot count them. It must go by the line
+ * number and take the receive buffer space from B, minus what it has sent
+ * since (or, over a link which buffers data, minus all it may have in
+ * transit).
+ */
+template <typename Context, typename ThePrinterMain>
+class LineFlowControl {
+    using CommandStream = typename ThePrinterMain::CommandStream;
+    
+public:
+    void init (Context c)
+    {
+        m_line_number = 1;
+        m_enabled = false;
+        m_resend_pending = false;
+    }
+    
+    bool isEnabled (Context c)
+    {
+        return m_enabled;
+    }
+    
+    /**
+     * To be called from start_command_impl for text commands. Returns false
+     * if the command was handled here and must not be executed.
+     */
+    template <typename Command>
+    bool startCommand (Context c, CommandStream *cs, Command *cmd, size_t window)
+    {
+        bool is_m110 = (cs->getCmdCode(c) == 'M' && cs->getCmdNumber(c) == 110);
+        if (is_m110) {
+            m_line_number = cs->get_command_param_uint32(c, 'L', (cmd->have_line_number ? cmd->line_number : (uint32_t)-1));
+        }
+        if (!check_line(c, cs, cmd, is_m110) || is_m110) {
+            return false;
+        }
+        if (cs->getCmdCode(c) == 'M' && cs->getCmdNumber(c) == 949) {
+            m_enabled = cs->get_command_param_uint32(c, 'S', 1);
+            m_resend_pending = false;
+            cs->setCustomOk(c, m_enabled);
+            if (m_enabled) {
+                cs->reply_append_pstr(c, AMBRO_PSTR("FlowControl Window:"));
+                cs->reply_append_uint32(c, window);
+                cs->reply_append_ch(c, '\n');
+            }
+            return false;
+        }
+        return true;
+    }
+    
+    /**
+     * To be called from reply_append_ok_impl for a text command.
+     * Lines rejected by the parser are either damaged, so they are
+     * requested again, or malformed by the host, in which case they
+     * are accepted if they are the next line (and fail).
+     */
+    template <typename Command>
+    void handleParseResult (Context c, CommandStream *cs, Command *cmd, int8_t num_parts)
+    {
+        if (num_parts == GCODE_ERROR_CHECKSUM || num_parts == GCODE_ERROR_RECV_OVERRUN) {
+            request_resend(c, cs);
+        }
+        else if (num_parts < 0) {
+            check_line(c, cs, cmd, false);
+        }
+    }
+    
+    void appendOk (Context c, CommandStream *cs, size_t buffer_free)
+    {
+        cs->reply_append_pstr(c, AMBRO_PSTR("ok N"));
+        cs->reply_append_uint32(c, (uint32_t)(m_line_number - 1));
+        cs->reply_append_pstr(c, AMBRO_PSTR(" P"));
+        cs->reply_append_uint32(c, ThePrinterMain::get_planner_free_slots(c));
+        cs->reply_append_pstr(c, AMBRO_PSTR(" B"));
+        cs->reply_append_uint32(c, buffer_free);
+        cs->reply_append_ch(c, '\n');
+    }
+    
+private:
+    template <typename Command>
+    bool check_line (Context c, CommandStream *cs, Command *cmd, bool is_m110)
+    {
+        if (m_enabled && !is_m110 && !(cmd->have_line_number && cmd->have_checksum)) {
+            cs->reply_append_pstr(c, AMBRO_PSTR("Error:Missing line number or checksum\n"));
+            request_resend(c, cs);
+            return false;
+        }
+        if (cmd->have_line_number && cmd->line_number != m_line_number) {
+            // When streaming, a line ahead of the expected one means lines were
+            // lost, and one behind it is a retransmission of an accepted line.
+            bool ahead = ((uint32_t)(cmd->line_number - m_line_number) < UINT32_C(0x80000000));
+            if (!m_enabled || (ahead && !m_resend_pending)) {
+                cs->reply_append_pstr(c, AMBRO_PSTR("Error:Line Number is not Last Line Number+1, Last Line:"));
+                cs->reply_append_uint32(c, (uint32_t)(m_line_number - 1));
+                cs->reply_append_ch(c, '\n');
+                if (m_enabled) {
+                    request_resend(c, cs);
+                }
+            }
+            return false;
+        }
+        if (cmd->have_line_number || is_m110) {
+            m_line_number++;
+        }
+        m_resend_pending = false;
+        return true;
+    }
+    
+    void request_resend (Context c, CommandStream *cs)
+    {
+        m_resend_pending = true;
+        cs->reply_append_pstr(c, AMBRO_PSTR("Resend:"));
+        cs->reply_append_uint32(c, m_line_number);
+        cs->reply_append_ch(c, '\n');
+    }
+    
+private:
+    uint32_t m_line_number;
+    bool m_enabled;
+    bool m_resend_pending;
+};
+
+}
+
+#endif
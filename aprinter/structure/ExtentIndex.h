@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef APRINTER_EXTENT_INDEX_H
+#define APRINTER_EXTENT_INDEX_H
+
+namespace APrinter {
+
+/**
+ * Compact index of a mapping from positions to values where consecutive
+ * positions usually map to consecutive values, such as the clusters of a
+ * file to the clusters of the file system.
+ * 
+ * The mapping is learned in order of position by add(). It is stored as
+ * extents of consecutive values, which are found by binary search. When
+ * all Capacity extents are used, every other extent is dropped. A lookup
+ * then returns the nearest known position below the requested one, and
+ * the caller has to find the rest of the mapping by other means.
+ */
+template <typename IndexType, int Capacity>
+class ExtentIndex {
+    static_assert(Capacity >= 2, "");
+    
+public:
+    void init ()
+    {
+        m_num_extents = 0;
+        m_known_length = 0;
+    }
+    
+    /**
+     * Returns the number of positions from zero for which the mapping
+     * has been added (not necessarily still known).
+     */
+    IndexType getKnownLength () const
+    {
+        return m_known_length;
+    }
+    
+    /**
+     * Records the value of a position. Positions must be added in order;
+     * a position below getKnownLength() is ignored, as is one above it.
+     */
+    void add (IndexType pos, IndexType value)
+    {
+        if (pos != m_known_length) {
+            return;
+        }
+        
+        if (m_num_extents > 0) {
+            Extent *last = &m_extents[m_num_extents - 1];
+            if (last->pos + last->length == pos && last->value + last->length == value) {
+                last->length++;
+                m_known_length++;
+                return;
+            }
+        }
+        
+        if (m_num_extents == Capacity) {
+            for (int i = 0; i < (Capacity + 1) / 2; i++) {
+                m_extents[i] = m_extents[2 * i];
+            }
+            m_num_extents = (Capacity + 1) / 2;
+        }
+        
+        m_extents[m_num_extents++] = Extent{pos, value, 1};
+        m_known_length++;
+    }
+    
+    /**
+     * Finds the greatest position not above pos whose value is known.
+     * Returns false if there is no such position.
+     */
+    bool lookup (IndexType pos, IndexType *out_pos, IndexType *out_value) const
+    {
+        if (m_num_extents == 0 || pos < m_extents[0].pos) {
+            return false;
+        }
+        
+        int low = 0;
+        int high = m_num_extents - 1;
+        while (low < high) {
+            int mid = low + (high - low + 1) / 2;
+            if (m_extents[mid].pos <= pos) {
+                low = mid;
+            } else {
+                high = mid - 1;
+            }
+        }
+        
+        Extent const *ext = &m_extents[low];
+        IndexType offset = pos - ext->pos;
+        if (offset >= ext->length) {
+            offset = ext->length - 1;
+        }
+        *out_pos = ext->pos + offset;
+        *out_value = ext->value + offset;
+        return true;
+    }
+    
+    /**
+     * Forgets the values of positions from length onward.
+     */
+    void truncate (IndexType length)
+    {
+        while (m_num_extents > 0 && m_extents[m_num_extents - 1].pos >= length) {
+            m_num_extents--;
+        }
+        if (m_num_extents > 0) {
+            Extent *last = &m_extents[m_num_extents - 1];
+            if (last->length > length - last->pos) {
+                last->length = length - last->pos;
+            }
+        }
+        if (m_known_length > length) {
+            m_known_length = length;
+        }
+    }
+    
+private:
+    struct Extent {
+        IndexType pos;
+        IndexType value;
+        IndexType length;
+    };
+    
+    int m_num_extents;
+    IndexType m_known_length;
+    Extent m_extents[Capacity];
+};
+
+}
+
+#endif
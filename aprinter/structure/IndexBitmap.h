@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef APRINTER_INDEX_BITMAP_H
+#define APRINTER_INDEX_BITMAP_H
+
+#include <stdint.h>
+
+namespace APrinter {
+
+/**
+ * Fixed-size array of bits with a search for the next set bit which
+ * skips over whole words of clear bits.
+ */
+template <typename IndexType, IndexType NumBits>
+class IndexBitmap {
+    static_assert(NumBits > 0, "");
+    
+    using WordType = uint32_t;
+    static int const WordBits = 32;
+    static IndexType const NumWords = (NumBits - 1) / WordBits + 1;
+    
+public:
+    static IndexType const Size = NumBits;
+    
+    void clearAll ()
+    {
+        for (IndexType i = 0; i < NumWords; i++) {
+            m_words[i] = 0;
+        }
+    }
+    
+    bool get (IndexType index) const
+    {
+        return (m_words[index / WordBits] >> (index % WordBits)) & 1;
+    }
+    
+    void set (IndexType index, bool value)
+    {
+        WordType mask = (WordType)1 << (index % WordBits);
+        if (value) {
+            m_words[index / WordBits] |= mask;
+        } else {
+            m_words[index / WordBits] &= ~mask;
+        }
+    }
+    
+    /**
+     * Returns the lowest index of a set bit in the range [start, end),
+     * or end if there is none.
+     */
+    IndexType findSet (IndexType start, IndexType end) const
+    {
+        if (start >= end) {
+            return end;
+        }
+        IndexType word_index = start / WordBits;
+        WordType word = m_words[word_index] & ((WordType)-1 << (start % WordBits));
+        while (word == 0) {
+            word_index++;
+            if (word_index >= (end - 1) / WordBits + 1) {
+                return end;
+            }
+            word = m_words[word_index];
+        }
+        IndexType index = word_index * WordBits + __builtin_ctzl(word);
+        return (index < end) ? index : end;
+    }
+    
+private:
+    WordType m_words[NumWords];
+};
+
+}
+
+#endif
@@ -429,6 +429,7 @@ def setup_platform(gen, config, key):
         
         platformType[0] = 'arm'
         platformFlags.extend(['-mcpu=cortex-m3', '-mthumb', '-Wno-psabi'])
+        gen.register_singleton_object('hardware_float_type', None)
         platformFlagsCXX.extend(['-Wno-register'])
         linkerScript[0] = {'base': 'asf', 'path':
             'sam/utils/linker_scripts/{0:}/{0:}{1:}/gcc/flash.ld'.format(arch1, arch2)}
@@ -506,6 +507,7 @@ def setup_platform(gen, config, key):
     def option(platform):
         platformType[0] = 'arm'
         platformFlags.extend(['-mcpu=cortex-m4', '-mthumb', '-msoft-float'])
+        gen.register_singleton_object('hardware_float_type', None)
         linkerScript[0] = {'base': 'teensyCores', 'path': 'teensy3/mk20dx256.ld'}
         extraLinkFlags.extend(['-nostartfiles', '-lm'])
 
@@ -549,6 +551,7 @@ def setup_platform(gen, config, key):
         
         platformType[0] = 'avr'
         platformFlags.extend(['-mmcu={}'.format(mcu)])
+        gen.register_singleton_object('hardware_float_type', None)
         extraLinkFlags.extend(['-Wl,-u,vfprintf', '-lprintf_flt'])
         extraObjCopyFlags.extend(['-j', '.text',  '-j', '.data'])
 
@@ -574,6 +577,7 @@ def setup_platform(gen, config, key):
         
         platformType[0] = 'arm'
         platformFlags.extend(['-mcpu=cortex-m4', '-mthumb', '-mfpu=fpv4-sp-d16', '-mfloat-abi=hard'])
+        gen.register_singleton_object('hardware_float_type', 'float')
         platformFlagsCXX.extend(['-Wno-register'])
         linkerScript[0] = {'base': 'aprinter', 'path': 'aprinter/platform/stm32f4/{}.ld'.format(platform_name)}
         extraLinkFlags.extend(['-nostartfiles', '-lm'])
@@ -639,6 +643,7 @@ def setup_platform(gen, config, key):
     @platform_sel.option('Linux')
     def option(platform):
         platformType[0] = 'linux'
+        gen.register_singleton_object('hardware_float_type', 'double')
         extraLinkFlags.extend(['-lpthread', '-lrt', '-lm', '-lstdc++'])
 
         gen.add_extra_source('aprinter', 'aprinter/platform/linux/linux_support.cpp')
@@ -924,6 +929,16 @@ def setup_pins (gen, config, key):
         pin_regexes.append('\\AStubPin\\Z')
         return TemplateLiteral('StubPinsService')
     
+    @pins_sel.option('LinuxTracePins')
+    def options(pin_config):
+        gen.add_aprinter_include('hal/linux/LinuxTracePins.h')
+        pin_regexes.append('\\AStubPin\\Z')
+        pin_regexes.append('\\ALinuxTrace(Step|Dir)Pin<[0-9]{1,3}>\\Z')
+        return TemplateExpr('LinuxTracePinsService', [
+            pin_config.get_int('NumChannels'),
+            pin_config.get_int('RingSizeBits'),
+        ])
+    
     service_expr = config.do_selection(key, pins_sel)
     service_code = 'using PinsService = {};'.format(service_expr.build(indent=0))
     pins_expr = TemplateExpr('PinsService::Pins', ['Context', 'Program'])
@@ -1465,6 +1480,7 @@ def use_sdcard(gen, config, key, user):
             linux_sd.get_int('BlockSize'),
             linux_sd.get_int('MaxIoBlocks'),
             linux_sd.get_int('MaxIoDescriptors'),
+            linux_sd.get_int('MaxConcurrentCommands') if linux_sd.has('MaxConcurrentCommands') else 1,
         ])
     
     return config.do_selection(key, sd_service_sel)
@@ -1580,6 +1596,11 @@ def get_heap_structure(gen, config, key):
     gen.add_aprinter_include('structure/{}.h'.format(structure_name))
     return 'APrinter::{}Service'.format(structure_name)
 
+def get_binary_framing(config, key, max_parts):
+    if not (config.has(key) and config.get_bool(key)):
+        return 'NoBinaryFrameParserService'
+    return TemplateExpr('BinaryFrameParserService', [min(max_parts, 14)])
+
 class NetworkConfigState(object):
     def __init__(self, min_send_buf, min_recv_buf):
         self.min_send_buf = min_send_buf
@@ -1859,6 +1880,7 @@ def generate(config_root_data, cfg_name, main_template):
                         TemplateExpr('SerialGcodeParserService', [
                             serial.get_int_constant('GcodeMaxParts'),
                         ]),
+                        get_binary_framing(serial, 'BinaryFraming', serial.get_int('GcodeMaxParts')),
                         use_serial(gen, serial, 'Service', serial_user),
                     ]))
                 
@@ -1907,13 +1929,31 @@ def generate(config_root_data, cfg_name, main_template):
                             fs_config.key_path('MaxFileNameSize').error('Bad value.')
                         
                         num_cache_entries = fs_config.get_int('NumCacheEntries')
-                        if not (1 <= num_cache_entries <= 64):
+                        if not (1 <= num_cache_entries <= 8192):
                             fs_config.key_path('NumCacheEntries').error('Bad value.')
                         
                         max_io_blocks = fs_config.get_int('MaxIoBlocks')
                         if not (1 <= max_io_blocks <= num_cache_entries):
                             fs_config.key_path('MaxIoBlocks').error('Bad value.')
                         
+                        seek_index_entries = fs_config.get_int('SeekIndexEntries') if fs_config.has('SeekIndexEntries') else 0
+                        if not (seek_index_entries == 0 or 2 <= seek_index_entries <= 1024):
+                            fs_config.key_path('SeekIndexEntries').error('Bad value.')
+                        
+                        free_bitmap_clusters = fs_config.get_int('FreeBitmapClusters') if fs_config.has('FreeBitmapClusters') else 0
+                        if not (0 <= free_bitmap_clusters <= 268435445):
+                            fs_config.key_path('FreeBitmapClusters').error('Bad value.')
+                        
+                        write_behind_dirty_count = fs_config.get_int('WriteBehindDirtyCount') if fs_config.has('WriteBehindDirtyCount') else 0
+                        if not (0 <= write_behind_dirty_count <= num_cache_entries):
+                            fs_config.key_path('WriteBehindDirtyCount').error('Bad value.')
+                        
+                        write_behind_delay = fs_config.get_float('WriteBehindDelay') if fs_config.has('WriteBehindDelay') else 0.0
+                        if not (0.0 <= write_behind_delay <= 3600.0):
+                            fs_config.key_path('WriteBehindDelay').error('Bad value.')
+                        
+                        stream_from_cache = fs_config.get_bool('StreamFromCache') if fs_config.has('StreamFromCache') else False
+                        
                         gen.add_aprinter_include('printer/input/SdFatInput.h')
                         gen.add_aprinter_include('fs/FatFs.h')
                         
@@ -1922,6 +1962,13 @@ def generate(config_root_data, cfg_name, main_template):
                             fs_test_module = gen.add_module()
                             fs_test_module.set_expr('FsTestModuleService')
                         
+                        if fs_config.has('EnableFileChecksum') and fs_config.get_bool('EnableFileChecksum'):
+                            if not fs_config.get_bool('HaveAccessInterface'):
+                                fs_config.key_path('EnableFileChecksum').error('Requires the FS access interface.')
+                            gen.add_aprinter_include('printer/modules/FileChecksumModule.h')
+                            file_checksum_module = gen.add_module()
+                            file_checksum_module.set_expr('FileChecksumModuleService')
+                        
                         gcode_upload_sel = selection.Selection()
                         
                         @gcode_upload_sel.option('NoGcodeUpload')
@@ -1953,8 +2000,13 @@ def generate(config_root_data, cfg_name, main_template):
                                 fs_config.get_bool_constant('CaseInsensFileName'),
                                 fs_config.get_bool_constant('FsWritable'),
                                 fs_config.get_bool_constant('EnableReadHinting'),
+                                seek_index_entries,
+                                free_bitmap_clusters,
+                                write_behind_dirty_count,
+                                gen.add_float_constant('FsWriteBehindDelay', write_behind_delay),
                             ]),
                             fs_config.get_bool_constant('HaveAccessInterface'),
+                            stream_from_cache,
                         ])
                     
                     sdcard_module.set_expr(TemplateExpr('SdCardModuleService', [
@@ -2028,6 +2080,7 @@ def generate(config_root_data, cfg_name, main_template):
                                 TemplateExpr('SerialGcodeParserService', [
                                     console_max_parts,
                                 ]),
+                                get_binary_framing(tcpconsole_config, 'BinaryFraming', console_max_parts),
                                 console_port,
                                 console_max_clients,
                                 console_max_pcbs,
@@ -2157,6 +2210,24 @@ def generate(config_root_data, cfg_name, main_template):
             for advanced in config.enter_config('advanced'):
                 gen.add_float_constant('LedBlinkInterval', advanced.get_float('LedBlinkInterval'))
                 gen.add_float_config('ForceTimeout', advanced.get_float('ForceTimeout'))
+                if advanced.has('EnableArcMoves') and advanced.get_bool('EnableArcMoves'):
+                    gen.add_aprinter_include('printer/modules/ArcMoveModule.h')
+                    arc_move_module = gen.add_module()
+                    arc_move_module.set_expr(TemplateExpr('ArcMoveModuleService', [
+                        gen.add_float_config('ArcChordalTolerance', advanced.get_float('ArcChordalTolerance')),
+                    ]))
+                acceleration_profile = advanced.get_string('AccelerationProfile') if advanced.has('AccelerationProfile') else 'Trapezoidal'
+                if acceleration_profile == 'SCurve':
+                    # The S-curve driver solves step times in FpType in the step
+                    # interrupt, which is too slow with software floating point.
+                    hardware_float_type = gen.get_singleton_object('hardware_float_type')
+                    if hardware_float_type is None:
+                        advanced.key_path('AccelerationProfile').error('SCurve requires a platform with a hardware FPU.')
+                    if performance.get_identifier('FpType') == 'double' and hardware_float_type != 'double':
+                        performance.key_path('FpType').error('SCurve requires FpType float on this platform, the FPU is single precision.')
+                    gen.add_aprinter_include('printer/actuators/SCurveAxisDriver.h')
+                elif acceleration_profile != 'Trapezoidal':
+                    advanced.key_path('AccelerationProfile').error('Invalid value.')
             
             current_control_channel_list = []
             microstep_axis_list = []
@@ -2263,6 +2334,31 @@ def generate(config_root_data, cfg_name, main_template):
                 if first_stepper_port.get_config('StepperTimer').get_string('_compoundName') != 'interrupt_timer':
                     first_stepper_port.key_path('StepperTimer').error('Stepper port of first stepper in axis must have a timer unit defined.')
                 
+                stepper_timer_expr = use_interrupt_timer(gen, first_stepper_port, 'StepperTimer', user='MyPrinter::GetAxisTimer<{}>'.format(stepper_index))
+                
+                if acceleration_profile == 'SCurve':
+                    axis_driver_expr = TemplateExpr('SCurveAxisDriverService', [
+                        stepper_timer_expr,
+                        'TheAxisDriverPrecisionParams',
+                        stepper.do_selection('delay', delay_sel),
+                        performance.get_identifier('FpType', lambda x: x in ('float', 'double')),
+                    ])
+                else:
+                    axis_driver_expr = TemplateExpr('AxisDriverService', [
+                        stepper_timer_expr,
+                        'TheAxisDriverPrecisionParams',
+                        stepper.get_bool('PreloadCommands'),
+                        stepper.do_selection('delay', delay_sel),
+                    ])
+                
+                if stepper.get_bool('IsExtruder'):
+                    pressure_advance = stepper.get_float('PressureAdvance') if stepper.has('PressureAdvance') else 0.0
+                    pressure_advance_expr = TemplateExpr('PrinterMainPressureAdvanceParams', [
+                        gen.add_float_config('{}PressureAdvance'.format(name), pressure_advance),
+                    ])
+                else:
+                    pressure_advance_expr = 'PrinterMainNoPressureAdvanceParams'
+                
                 return TemplateExpr('PrinterMainAxisParams', [
                     TemplateChar(name),
                     gen.add_float_config('{}StepsPerUnit'.format(name), stepper.get_float('StepsPerUnit')),
@@ -2270,18 +2366,15 @@ def generate(config_root_data, cfg_name, main_template):
                     gen.add_float_config('{}MaxPos'.format(name), stepper.get_float('MaxPos')),
                     gen.add_float_config('{}MaxSpeed'.format(name), stepper.get_float('MaxSpeed')),
                     gen.add_float_config('{}MaxAccel'.format(name), stepper.get_float('MaxAccel')),
+                    gen.add_float_config('{}MaxJerk'.format(name), stepper.get_float('MaxJerk') if stepper.has('MaxJerk') else 1000000.0),
                     gen.add_float_config('{}DistanceFactor'.format(name), stepper.get_float('DistanceFactor')),
                     gen.add_float_config('{}CorneringDistance'.format(name), stepper.get_float('CorneringDistance')),
                     stepper.do_selection('homing', homing_sel),
                     stepper.get_bool('EnableCartesianSpeedLimit'),
                     stepper.get_bool('IsExtruder'),
+                    pressure_advance_expr,
                     32,
-                    TemplateExpr('AxisDriverService', [
-                        use_interrupt_timer(gen, first_stepper_port, 'StepperTimer', user='MyPrinter::GetAxisTimer<{}>'.format(stepper_index)),
-                        'TheAxisDriverPrecisionParams',
-                        stepper.get_bool('PreloadCommands'),
-                        stepper.do_selection('delay', delay_sel),
-                    ]),
+                    axis_driver_expr,
                     slave_steppers_expr,
                 ])
             
@@ -2810,6 +2903,35 @@ def generate(config_root_data, cfg_name, main_template):
                 millisecond_clock_module = gen.add_module()
                 millisecond_clock_module.set_expr('MillisecondClockInfoModuleService')
             
+            linear_planner_kernel = performance.get_string('LinearPlannerKernel') if performance.has('LinearPlannerKernel') else 'Sequential'
+            if linear_planner_kernel == 'Sequential':
+                linear_planner_service = 'LinearPlannerService'
+            elif linear_planner_kernel == 'Batch':
+                gen.add_aprinter_include('printer/planning/BatchLinearPlanner.h')
+                linear_planner_service = 'BatchLinearPlannerService'
+            else:
+                performance.key_path('LinearPlannerKernel').error('Invalid value.')
+            
+            input_shaper_sel = selection.Selection()
+            
+            @input_shaper_sel.option('NoInputShaper')
+            def option(input_shaper):
+                return 'NoInputShaperParams'
+            
+            @input_shaper_sel.option('InputShaper')
+            def option(input_shaper):
+                shaper_type = input_shaper.get_string('Type')
+                if shaper_type not in ('Zv', 'Zvd', 'Ei'):
+                    input_shaper.key_path('Type').error('Invalid value.')
+                return TemplateExpr('InputShaperParams', [
+                    'InputShaperType{}'.format(shaper_type),
+                    gen.add_float_config('InputShaperFrequency', input_shaper.get_float('Frequency')),
+                    gen.add_float_config('InputShaperDamping', input_shaper.get_float('Damping')),
+                    input_shaper.get_int_constant('HistorySize'),
+                ])
+            
+            input_shaper_params = config.do_selection('input_shaper', input_shaper_sel) if config.has('input_shaper') else 'NoInputShaperParams'
+            
             printer_params = TemplateExpr('PrinterMainParams', [
                 led_pin_expr,
                 'LedBlinkInterval',
@@ -2824,6 +2946,8 @@ def generate(config_root_data, cfg_name, main_template):
                 performance.get_int_constant('LookaheadCommitCount'),
                 'ForceTimeout',
                 performance.get_identifier('FpType', lambda x: x in ('float', 'double')),
+                linear_planner_service,
+                input_shaper_params,
                 setup_watchdog(gen, platform, 'watchdog', 'MyPrinter::GetWatchdog'),
                 watchdog_debug_mode,
                 config_manager_expr,
@@ -332,8 +332,15 @@ def platform_Linux():
         ]),
         ce.Compound('NoAdc', key='adc', title='ADC', attrs=[]),
         ce.Compound('NullWatchdog', key='watchdog', title='Watchdog', attrs=[]),
-        ce.Compound('StubPins', key='pins', title='Pins', attrs=[
-            ce.Constant(key='input_mode_type', value='StubPinInputMode'),
+        ce.OneOf(key='pins', title='Pins', choices=[
+            ce.Compound('StubPins', title='Stub pins', attrs=[
+                ce.Constant(key='input_mode_type', value='StubPinInputMode'),
+            ]),
+            ce.Compound('LinuxTracePins', title='Step trace pins', attrs=[
+                ce.Constant(key='input_mode_type', value='StubPinInputMode'),
+                ce.Integer(key='NumChannels', title='Number of trace channels (LinuxTraceStepPin<N>/LinuxTraceDirPin<N>)', default=4),
+                ce.Integer(key='RingSizeBits', title='Ring buffer size per channel (log2 of events)', default=16),
+            ]),
         ]),
         heap_structure_choice(key='TimersStructure', title='Data structure for timers'),
     ])
@@ -507,6 +514,18 @@ def editor():
             ce.Compound('advanced', key='advanced', title='Advanced parameters', collapsable=True, attrs=[
                 ce.Float(key='LedBlinkInterval', title='LED blink interval [s]', default=0.5),
                 ce.Float(key='ForceTimeout', title='Force motion timeout [s]', default=0.1),
+                ce.Boolean(key='EnableArcMoves', title='Enable arc moves (G2/G3, requires X and Y axes)', default=False),
+                ce.Float(key='ArcChordalTolerance', title='Maximum deviation of arc segments from the true arc [mm]', default=0.01),
+                ce.String(key='AccelerationProfile', title='Acceleration profile (S-curve is jerk-limited by the steppers\' max. jerk, needs a hardware FPU)', enum=['Trapezoidal', 'SCurve'], default='Trapezoidal'),
+            ]),
+            ce.OneOf(key='input_shaper', title='Input shaping (vibration compensation)', choices=[
+                ce.Compound('NoInputShaper', title='Disabled', attrs=[]),
+                ce.Compound('InputShaper', title='Enabled', attrs=[
+                    ce.String(key='Type', title='Shaper type (ZV is shortest, EI is most robust to frequency errors)', enum=['Zv', 'Zvd', 'Ei'], default='Zvd'),
+                    ce.Float(key='Frequency', title='Resonance frequency (0 to disable) [Hz]', default=40),
+                    ce.Float(key='Damping', title='Damping ratio', default=0.1),
+                    ce.Integer(key='HistorySize', title='Number of remembered motion pieces per axis', default=16),
+                ]),
             ]),
             ce.Array(key='steppers', title='Axes', copy_name_key='Name', copy_name_suffix='?', elem=ce.Compound('stepper', title='Axis', title_key='Name', collapsable=True, ident='id_configuration_stepper', attrs=[
                 ce.String(key='Name', title='Name (cartesian X/Y/Z, extruders E/U/V, delta A/B/C)'),
@@ -521,10 +540,12 @@ def editor():
                 ce.Float(key='MaxPos', title='Maximum position [mm] (~40000 for extruders)', default=200),
                 ce.Float(key='MaxSpeed', title='Maximum speed [mm/s]', default=300),
                 ce.Float(key='MaxAccel', title='Maximum acceleration [mm/s^2]', default=1500),
+                ce.Float(key='MaxJerk', title='Maximum jerk, with the S-curve acceleration profile [mm/s^3]', default=1000000),
                 ce.Float(key='DistanceFactor', title='Distance factor [1]', default=1),
                 ce.Float(key='CorneringDistance', title='Cornering distance (greater values allow greater change of speed at corners) [step]', default=40),
                 ce.Boolean(key='EnableCartesianSpeedLimit', title='Is cartesian (Yes for X/Y/Z, No for extruders)', default=True),
                 ce.Boolean(key='IsExtruder', title='Is an extruder (e.g. subject to M82/M83)', default=False),
+                ce.Float(key='PressureAdvance', title='Pressure advance for extruders (velocity feed-forward time) [s]', default=0),
                 stepper_homing_params(key='homing'),
                 ce.Boolean(key='PreloadCommands', title='Command loading mode', default=False, false_title='At first step', true_title='At last step of previous command (use when direction-ahead-of-step-time is large)'),
                 ce.OneOf(key='delay', title='Step signals timing', choices=[
@@ -824,6 +845,7 @@ def editor():
                 ce.Integer(key='RecvBufferSizeExp', title='Receive buffer size (power of two exponent)'),
                 ce.Integer(key='SendBufferSizeExp', title='Send buffer size (power of two exponent)'),
                 ce.Integer(key='GcodeMaxParts', title='Max parts in GCode command'),
+                ce.Boolean(key='BinaryFraming', title='Allow binary g-code streaming (M948)', default=False),
                 ce.OneOf(key='Service', title='Backend', choices=[
                     ce.Compound('AsfUsbSerial', title='AT91 USB', attrs=[]),
                     ce.Compound('At91Sam3xSerial', title='AT91 UART', attrs=[
@@ -848,11 +870,17 @@ def editor():
                                 ce.Integer(key='MaxFileNameSize', title='Maximum filename size', default=32),
                                 ce.Integer(key='NumCacheEntries', title='Block cache size (in blocks)', default=2),
                                 ce.Integer(key='MaxIoBlocks', title='Maximum blocks in single I/O command', default=1),
+                                ce.Integer(key='SeekIndexEntries', title='File seek index size (in extents, 0 to disable)', default=16),
+                                ce.Integer(key='FreeBitmapClusters', title='Free cluster bitmap size (max. clusters, 0 to disable; needs 1 bit of RAM per cluster)', default=0),
+                                ce.Integer(key='WriteBehindDirtyCount', title='Write-behind when this many blocks are dirty (0 to disable)', default=0),
+                                ce.Float(key='WriteBehindDelay', title='Write-behind delay after a block is dirtied (0 to disable) [s]', default=0.0),
                                 ce.Boolean(key='CaseInsensFileName', title='Case-insensitive filename matching', default=True),
                                 ce.Boolean(key='FsWritable', title='Writable filesystem', default=False),
                                 ce.Boolean(key='EnableReadHinting', title='Enable read-ahead hinting', default=False),
+                                ce.Boolean(key='StreamFromCache', title='Parse G-code from the block cache (Buffer size is not used)', default=False),
                                 ce.Boolean(key='HaveAccessInterface', title='Enable internal FS access interface', default=False),
                                 ce.Boolean(key='EnableFsTest', title='Enable FS test module', default=False),
+                                ce.Boolean(key='EnableFileChecksum', title='Enable file checksum command and web API (M939, needs FS access interface)', default=False),
                                 ce.OneOf(key='GcodeUpload', title='G-code upload', choices=[
                                     ce.Compound('NoGcodeUpload', title='Disabled', attrs=[]),
                                     ce.Compound('GcodeUpload', title='Enabled', attrs=[
@@ -884,6 +912,7 @@ def editor():
                                 ce.Integer(key='BlockSize', default=512),
                                 ce.Integer(key='MaxIoBlocks', default=1024),
                                 ce.Integer(key='MaxIoDescriptors', default=32),
+                                ce.Integer(key='MaxConcurrentCommands', title='Maximum concurrent I/O commands', default=4),
                             ]),
                         ])
                     ])
@@ -928,6 +957,7 @@ def editor():
                                 ce.Integer(key='MaxPcbs', title='Maximum number of PCBs', default=4),
                                 ce.Integer(key='MaxParts', title='Max parts in GCode command', default=16),
                                 ce.Integer(key='MaxCommandSize', title='Maximum command size', default=128),
+                                ce.Boolean(key='BinaryFraming', title='Allow binary g-code streaming (M948)', default=False),
                                 ce.Integer(key='SendBufferSize', title='Send buffer size [bytes]', default=3*1460),
                                 ce.Integer(key='RecvBufferSize', title='Receive buffer size [bytes]', default=2*1460),
                                 ce.Float(key='SendBufTimeout', title='Timeout when waiting for send buffer space [s]', default=5.0),
@@ -944,7 +974,7 @@ def editor():
                                 ce.Integer(key='QueueRecvBufferSize', title='Receive buffer size for queued clients [bytes]', default=410),
                                 ce.Integer(key='SendBufferSize', title='Send buffer size [bytes]', default=3*1460),
                                 ce.Integer(key='RecvBufferSize', title='Receive buffer size [bytes]', default=2*1460),
-                                ce.Boolean(key='AllowPersistent', title='Allow persistent connections', default=False),
+                                ce.Boolean(key='AllowPersistent', title='Allow persistent connections', default=True),
                                 ce.Float(key='QueueTimeout', title='Timeout for queued clients [s]', default=10),
                                 ce.Float(key='InactivityTimeout', title='Network inactivity timeout [s]', default=10),
                                 ce.Boolean(key='EnableDebug', title='Enable debug messages', default=False),
@@ -968,6 +998,7 @@ def editor():
                 ce.Integer(key='LookaheadBufferSize', title='Lookahead buffer size'),
                 ce.Integer(key='LookaheadCommitCount', title='Lookahead commit count'),
                 ce.String(key='FpType', enum=['float', 'double']),
+                ce.String(key='LinearPlannerKernel', title='Lookahead planner kernel (Batch needs more RAM, for large lookahead)', enum=['Sequential', 'Batch'], default='Sequential'),
                 ce.String(key='AxisDriverPrecisionParams', title='Stepping precision parameters', enum=['AxisDriverAvrPrecisionParams', 'AxisDriverDuePrecisionParams']),
                 ce.Float(key='EventChannelTimerClearance', title='Event channel timer clearance'),
                 ce.Boolean(key='OptimizeForSize', title='Optimize compilation for program size', default=False),
@@ -1,5 +1,6 @@
 { stdenv, fetchurl, unzip, typescript, aprinterSource
 , useDebugReact ? false
+, precompressAssets ? true
 }:
 let
     jquery = fetchurl {
@@ -70,6 +71,12 @@ stdenv.mkDerivation {
             ${aprinterSource}/webif/reprap.tsx \
             --outDir $out \
             || [[ $? = 2 ]]
+    '' + stdenv.lib.optionalString precompressAssets ''
+        
+        # Store gzip-compressed variants next to the text assets. The firmware
+        # serves these to clients that accept gzip content-coding.
+        find $out -type f \( -name '*.htm' -o -name '*.css' -o -name '*.js' \) \
+            -exec gzip -9 -n -k {} \;
     '';
 }
 
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef APRINTER_TESTS_SIMULATED_LINK_H
+#define APRINTER_TESTS_SIMULATED_LINK_H
+
+#include <stdlib.h>
+#include <stddef.h>
+
+#include <string>
+
+#include <aprinter/base/Assert.h>
+
+// The host to firmware link of the streaming tests. Bytes are dropped or
+// damaged at random, where damage flips a bit or, one time in four, turns
+// the byte into a newline, so that lines also get split and merged. The
+// receive buffer must never overflow.
+struct SimulatedLink {
+    double corrupt_prob;
+    double drop_prob;
+    
+    void deliver (std::string const &data, char *rx_buf, size_t *rx_len, size_t rx_size)
+    {
+        for (char ch : data) {
+            if (rand() < drop_prob * RAND_MAX) {
+                continue;
+            }
+            if (rand() < corrupt_prob * RAND_MAX) {
+                if (rand() % 4 == 0) {
+                    ch = '\n';
+                } else {
+                    ch ^= 1 << (rand() % 8);
+                }
+            }
+            AMBRO_ASSERT_FORCE(*rx_len < rx_size)
+            rx_buf[(*rx_len)++] = ch;
+        }
+    }
+};
+
+#endif
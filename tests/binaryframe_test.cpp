@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Runs the host streamer from tools/aprinter_stream against the firmware
+// frame parser over a simulated link which corrupts and drops bytes, and
+// checks that every command arrives exactly once and in order, without
+// the receive buffer ever overflowing.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include <aprinter/system/InterruptLockCommon.h>
+
+#define APRINTER_INTERRUPT_LOCK_MODE APRINTER_INTERRUPT_LOCK_MODE_SIMPLE
+
+inline static void cli (void) {}
+inline static void sei (void) {}
+
+#include <aprinter/base/Assert.h>
+#include <aprinter/printer/utils/BinaryFrameParser.h>
+#include <tools/aprinter_stream/BinaryStream.h>
+
+#include "SimulatedLink.h"
+
+using namespace APrinter;
+
+struct Context {};
+
+static int const MaxParts = 10;
+static size_t const Window = 256;
+
+using Parser = BinaryFrameParserService<MaxParts>::Parser<Context, size_t, float>;
+
+static std::string describe (Parser *p, Context c)
+{
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%c%d", p->getCmdCode(c), (int)p->getCmdNumber(c));
+    std::string str = buf;
+    for (int i = 0; i < p->getNumParts(c); i++) {
+        auto part = p->getPart(c, i);
+        snprintf(buf, sizeof(buf), " %c%g", p->getPartCode(c, part), (double)p->getPartFpValue(c, part));
+        str += buf;
+    }
+    return str;
+}
+
+static void run (unsigned int seed, int num_commands, double corrupt_prob, double drop_prob, int cmds_per_tick)
+{
+    srand(seed);
+    Context c;
+    
+    std::vector<std::string> expected;
+    std::vector<std::string> packets;
+    for (int i = 0; i < num_commands; i++) {
+        char line[128];
+        snprintf(line, sizeof(line), "G1 X%d.5 Y%d F%d", i, i % 1000, 1000 + i % 7);
+        std::string packet;
+        char const *err;
+        AMBRO_ASSERT_FORCE(BinaryStream::encodeLine(line, MaxParts, &packet, &err) == BinaryStream::EncodeResult::OK)
+        packets.push_back(packet);
+        snprintf(line, sizeof(line), "G1 X%g Y%g F%g", i + 0.5, (double)(i % 1000), (double)(1000 + i % 7));
+        expected.push_back(line);
+    }
+    
+    Parser parser;
+    parser.init(c);
+    char rx_buf[Window];
+    size_t rx_len = 0;
+    int8_t next_error = 0;
+    std::string replies;
+    std::vector<std::string> received;
+    
+    SimulatedLink link{corrupt_prob, drop_prob};
+    BinaryStream::FrameStreamer streamer(Window);
+    size_t next_packet = 0;
+    int idle_ticks = 0;
+    
+    for (int tick = 0; tick < 10000000; tick++) {
+        // Host.
+        while (next_packet < packets.size() && streamer.canQueue(packets[next_packet].size())) {
+            streamer.queuePacket(packets[next_packet++]);
+        }
+        std::string out;
+        streamer.takeOutput(&out);
+        
+        link.deliver(out, rx_buf, &rx_len, Window);
+        
+        // Firmware, a limited number of commands per tick.
+        for (int i = 0; i < cmds_per_tick; i++) {
+            if (!parser.haveCommand(c)) {
+                parser.startCommand(c, rx_buf, next_error);
+                next_error = 0;
+            }
+            if (!parser.extendCommand(c, rx_len)) {
+                break;
+            }
+            int num_parts = parser.getNumParts(c);
+            if (num_parts >= 0) {
+                received.push_back(describe(&parser, c));
+                replies += "ok\n";
+            } else if (num_parts != GCODE_ERROR_NO_PARTS) {
+                replies += "Error:\nok\n";
+            }
+            auto reply = parser.getReply(c);
+            if (reply == Parser::Reply::SYNC) {
+                replies += "Sync:" + std::to_string(parser.getSyncToken(c)) + " Next:" + std::to_string(parser.getExpectedSequence(c)) + "\n";
+            } else if (reply == Parser::Reply::RESEND) {
+                replies += "Resend:" + std::to_string(parser.getExpectedSequence(c)) + "\n";
+            }
+            size_t length = parser.getLength(c);
+            memmove(rx_buf, rx_buf + length, rx_len - length);
+            rx_len -= length;
+        }
+        
+        // Link to the host, reliable.
+        if (replies.empty()) {
+            if (++idle_ticks == 50) {
+                idle_ticks = 0;
+                streamer.handleTimeout();
+            }
+        } else {
+            idle_ticks = 0;
+        }
+        size_t pos;
+        while ((pos = replies.find('\n')) != std::string::npos) {
+            std::string line = replies.substr(0, pos);
+            replies.erase(0, pos + 1);
+            auto type = streamer.handleLine(line.c_str());
+            AMBRO_ASSERT_FORCE(type != BinaryStream::FrameStreamer::LineType::ERROR)
+            AMBRO_ASSERT_FORCE(type != BinaryStream::FrameStreamer::LineType::OTHER)
+        }
+        
+        if (next_packet == packets.size() && streamer.isIdle()) {
+            break;
+        }
+    }
+    
+    AMBRO_ASSERT_FORCE(next_packet == packets.size() && streamer.isIdle())
+    AMBRO_ASSERT_FORCE(received == expected)
+    
+    parser.deinit(c);
+    
+    printf("seed=%u corrupt=%g drop=%g: %d commands, %u resend requests\n",
+           seed, corrupt_prob, drop_prob, num_commands, (unsigned int)streamer.numResends());
+}
+
+int main ()
+{
+    run(1, 20000, 0.0, 0.0, 3);
+    run(2, 20000, 0.0005, 0.0, 3);
+    run(3, 20000, 0.0, 0.0005, 2);
+    run(4, 20000, 0.002, 0.002, 5);
+    run(5, 5000, 0.01, 0.01, 1);
+    
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Instantiates a write-behind BlockCache inside an object union, the way
+// the file system is placed in SdFatInput, over a fake event loop whose
+// TimedEvent is not trivially constructible like the real ones. Dirties
+// blocks in scrambled order and checks that the write-behind flush writes
+// them out in block order as runs of up to MaxIoBlocks.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include <deque>
+#include <vector>
+#include <algorithm>
+
+#include <aprinter/system/InterruptLockCommon.h>
+
+#define APRINTER_INTERRUPT_LOCK_MODE APRINTER_INTERRUPT_LOCK_MODE_SIMPLE
+
+inline static void cli (void) {}
+inline static void sei (void) {}
+
+#include <aprinter/base/Object.h>
+#include <aprinter/base/Callback.h>
+#include <aprinter/base/TransferVector.h>
+#include <aprinter/fs/BlockCache.h>
+
+using namespace APrinter;
+
+struct FakeClock;
+struct FakeEventLoop;
+
+struct Context {
+    using Clock = FakeClock;
+    using EventLoop = FakeEventLoop;
+};
+
+using Handler = Callback<void(Context)>;
+
+struct FakeClock {
+    using TimeType = uint32_t;
+    static constexpr double time_freq = 1000.0;
+    static TimeType now;
+    static TimeType getTime (Context c) { return now; }
+};
+
+FakeClock::TimeType FakeClock::now = 0;
+
+class FakeQueuedEvent;
+static std::deque<FakeQueuedEvent *> queued_events;
+
+class FakeQueuedEvent {
+public:
+    void init (Context c, Handler handler) { m_handler = handler; m_set = false; }
+    void deinit (Context c) { unset(c); }
+    bool isSet (Context c) { return m_set; }
+    void prependNowNotAlready (Context c) { m_set = true; queued_events.push_front(this); }
+    void appendNowNotAlready (Context c) { m_set = true; queued_events.push_back(this); }
+    void prependNow (Context c) { unset(c); prependNowNotAlready(c); }
+    void appendNow (Context c) { unset(c); appendNowNotAlready(c); }
+    
+    void unset (Context c)
+    {
+        if (m_set) {
+            queued_events.erase(std::find(queued_events.begin(), queued_events.end(), this));
+            m_set = false;
+        }
+    }
+    
+    void dispatch (Context c) { m_set = false; m_handler(c); }
+    
+private:
+    Handler m_handler;
+    bool m_set;
+};
+
+// Virtual like the real TimedEvent, which makes it non-trivial.
+class FakeTimedEvent {
+public:
+    void init (Context c, Handler handler) { m_handler = handler; m_set = false; }
+    void deinit (Context c) { m_set = false; }
+    bool isSet (Context c) { return m_set; }
+    void unset (Context c) { m_set = false; }
+    void appendAt (Context c, FakeClock::TimeType time) { m_set = true; m_time = time; }
+    FakeClock::TimeType getSetTime (Context c) { return m_time; }
+    
+    virtual void dispatch (Context c) { m_set = false; m_handler(c); }
+    
+private:
+    Handler m_handler;
+    bool m_set;
+    FakeClock::TimeType m_time;
+};
+
+struct FakeEventLoop {
+    using QueuedEvent = FakeQueuedEvent;
+    using TimedEvent = FakeTimedEvent;
+};
+
+struct WriteOp {
+    uint32_t block;
+    size_t num_blocks;
+};
+
+static std::vector<WriteOp> write_ops;
+static std::deque<Callback<void(Context, bool)>> io_completions;
+
+struct FakeBlockAccess {
+    using BlockIndexType = uint32_t;
+    using DataWordType = uint32_t;
+    static size_t const BlockSize = 512;
+    static size_t const MaxIoBlocks = 4;
+    static int const MaxIoDescriptors = 4;
+    static int const MaxBufferLocks = 1;
+    
+    class User {
+    public:
+        void init (Context c, Callback<void(Context, bool)> handler) { m_handler = handler; }
+        void deinit (Context c) {}
+        
+        void startReadOrWrite (Context c, bool is_write, uint32_t block, size_t num_blocks, TransferVector<uint32_t> data)
+        {
+            if (is_write) {
+                write_ops.push_back(WriteOp{block, num_blocks});
+            }
+            io_completions.push_back(m_handler);
+        }
+        
+    private:
+        Callback<void(Context, bool)> m_handler;
+    };
+    
+    class UserFull : public User {
+    public:
+        void setLocker (Context c, Callback<void(Context, bool)> locker) {}
+    };
+};
+
+struct WriteBehindDelay { static constexpr double value () { return 1.0; } };
+
+struct Program;
+
+struct CacheUnion {
+    struct Object;
+    
+    APRINTER_MAKE_INSTANCE(TheCache, (BlockCacheArg<Context, Object, FakeBlockAccess, 16, 2, 4, true, 8, WriteBehindDelay>))
+    
+    struct OtherPart {
+        struct Object : public ObjBase<OtherPart, typename CacheUnion::Object, EmptyTypeList> {
+            int dummy;
+        };
+    };
+    
+    struct Object : public ObjUnionBase<CacheUnion, Program, MakeTypeList<
+        TheCache,
+        OtherPart
+    >> {};
+};
+
+using TheCache = typename CacheUnion::TheCache;
+
+struct Program : public ObjBase<void, void, MakeTypeList<
+    CacheUnion
+>> {
+    static Program * self (Context c);
+};
+
+Program program;
+
+Program * Program::self (Context c) { return &program; }
+
+static void run_events (Context c)
+{
+    while (true) {
+        if (!queued_events.empty()) {
+            FakeQueuedEvent *ev = queued_events.front();
+            queued_events.pop_front();
+            ev->dispatch(c);
+        }
+        else if (!io_completions.empty()) {
+            auto handler = io_completions.front();
+            io_completions.pop_front();
+            handler(c, false);
+        }
+        else {
+            break;
+        }
+    }
+}
+
+static bool ref_error = false;
+
+static void ref_handler (Context c, bool error)
+{
+    if (error) {
+        ref_error = true;
+    }
+}
+
+static bool check (bool cond, char const *msg)
+{
+    if (!cond) {
+        printf("FAIL: %s\n", msg);
+    }
+    return cond;
+}
+
+int main ()
+{
+    Context c;
+    TheCache::init(c);
+    
+    uint32_t const blocks[] = {107, 100, 103, 101, 102, 110, 111, 105, 104, 112};
+    int const num_blocks = sizeof(blocks) / sizeof(blocks[0]);
+    
+    // Dirty the blocks, holding on to the references.
+    typename TheCache::CacheRef refs[num_blocks];
+    for (int i = 0; i < num_blocks; i++) {
+        refs[i].init(c, APRINTER_CB_STATFUNC_T(&ref_handler));
+        refs[i].requestBlock(c, blocks[i], 0, 1, TheCache::CacheRef::FLAG_NO_IMMEDIATE_COMPLETION | TheCache::CacheRef::FLAG_NO_NEED_TO_READ);
+        run_events(c);
+        if (!check(!ref_error && refs[i].isAvailable(c), "block not available")) {
+            return 1;
+        }
+        refs[i].getData(c, WrapBool<true>())[0] = i;
+        refs[i].markDirty(c);
+        run_events(c);
+    }
+    
+    // Reaching the dirty count must not write referenced entries.
+    bool ok = check(write_ops.empty(), "referenced entries written");
+    
+    for (int i = 0; i < num_blocks; i++) {
+        refs[i].reset(c);
+    }
+    run_events(c);
+    
+    // Let the delay expire.
+    FakeTimedEvent *timer = &*TheCache::Object::self(c)->write_behind_timer;
+    ok = check(timer->isSet(c), "timer not set") && ok;
+    FakeClock::now = timer->getSetTime(c);
+    timer->dispatch(c);
+    run_events(c);
+    
+    WriteOp const expected[] = {{100, 4}, {104, 2}, {107, 1}, {110, 3}};
+    size_t const num_expected = sizeof(expected) / sizeof(expected[0]);
+    ok = check(write_ops.size() == num_expected, "wrong number of writes") && ok;
+    for (size_t i = 0; i < write_ops.size() && i < num_expected; i++) {
+        ok = check(write_ops[i].block == expected[i].block && write_ops[i].num_blocks == expected[i].num_blocks, "wrong write") && ok;
+    }
+    
+    for (int i = 0; i < num_blocks; i++) {
+        refs[i].deinit(c);
+    }
+    TheCache::deinit(c);
+    
+    if (!ok) {
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
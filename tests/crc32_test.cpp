@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <aprinter/base/Assert.h>
+#include <aprinter/meta/ConstexprCrc32.h>
+#include <aprinter/meta/ConstexprHash.h>
+#include <aprinter/misc/Crc32.h>
+
+using namespace APrinter;
+
+constexpr char const check_data[] = "123456789";
+
+int main ()
+{
+    // Standard check value.
+    uint32_t crc = Crc32Final(Crc32Update(Crc32Initial, check_data, sizeof(check_data) - 1));
+    AMBRO_ASSERT_FORCE(crc == UINT32_C(0xCBF43926))
+    
+    // Agrees with the compile-time hash, and does not depend on how the data is split.
+    static constexpr uint32_t ConstCrc = ConstexprHash<ConstexprCrc32>().addString(check_data, sizeof(check_data) - 1).end();
+    for (size_t split = 0; split < sizeof(check_data); split++) {
+        uint32_t acc = Crc32Initial;
+        acc = Crc32Update(acc, check_data, split);
+        acc = Crc32Update(acc, check_data + split, (sizeof(check_data) - 1) - split);
+        AMBRO_ASSERT_FORCE(Crc32Final(acc) == ConstCrc)
+    }
+    
+    // Empty data.
+    AMBRO_ASSERT_FORCE(Crc32Final(Crc32Update(Crc32Initial, check_data, 0)) == 0)
+    
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <vector>
+
+#include <aprinter/base/Assert.h>
+#include <aprinter/structure/ExtentIndex.h>
+
+using namespace APrinter;
+
+static int const Capacity = 8;
+static int const NumIterations = 10000;
+
+using Index = ExtentIndex<uint32_t, Capacity>;
+
+static void check_lookups (Index const &index, std::vector<uint32_t> const &chain)
+{
+    for (uint32_t pos = 0; pos < chain.size(); pos++) {
+        uint32_t out_pos;
+        uint32_t out_value;
+        if (index.lookup(pos, &out_pos, &out_value)) {
+            AMBRO_ASSERT_FORCE(out_pos <= pos)
+            AMBRO_ASSERT_FORCE(out_pos < index.getKnownLength())
+            AMBRO_ASSERT_FORCE(out_value == chain[out_pos])
+        } else {
+            AMBRO_ASSERT_FORCE(index.getKnownLength() == 0)
+        }
+    }
+}
+
+int main ()
+{
+    srand(1);
+    
+    for (int iter = 0; iter < NumIterations; iter++) {
+        // Make a chain consisting of runs of consecutive values.
+        std::vector<uint32_t> chain;
+        size_t length = rand() % 200;
+        while (chain.size() < length) {
+            uint32_t value = rand() % 100000;
+            size_t run = 1 + rand() % 20;
+            for (size_t i = 0; i < run && chain.size() < length; i++) {
+                chain.push_back(value + i);
+            }
+        }
+        
+        Index index;
+        index.init();
+        
+        size_t known = chain.size() == 0 ? 0 : rand() % (chain.size() + 1);
+        for (uint32_t pos = 0; pos < known; pos++) {
+            index.add(pos, chain[pos]);
+            // Positions not directly following the known part are ignored.
+            if (pos > 0) {
+                index.add(pos - 1, chain[pos - 1] + 1);
+            }
+            index.add(pos + 2, 0);
+        }
+        AMBRO_ASSERT_FORCE(index.getKnownLength() == known)
+        
+        // The first position is only forgotten by truncation.
+        if (known > 0) {
+            uint32_t out_pos;
+            uint32_t out_value;
+            AMBRO_ASSERT_FORCE(index.lookup(known - 1, &out_pos, &out_value))
+        }
+        check_lookups(index, chain);
+        
+        // Truncate and continue with different values.
+        uint32_t trunc_length = rand() % (known + 1);
+        index.truncate(trunc_length);
+        AMBRO_ASSERT_FORCE(index.getKnownLength() == trunc_length)
+        for (uint32_t pos = trunc_length; pos < chain.size(); pos++) {
+            chain[pos] = rand() % 100000;
+        }
+        for (uint32_t pos = trunc_length; pos < chain.size(); pos++) {
+            index.add(pos, chain[pos]);
+        }
+        AMBRO_ASSERT_FORCE(index.getKnownLength() == chain.size())
+        check_lookups(index, chain);
+    }
+    
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,614 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Mounts a small FAT32 image in memory and checks that a file which is open,
+// for reading or for writing, can be neither removed nor renamed, and that
+// both work once the file is closed. Also checks that a file created in place
+// of a removed one gets a later, valid modification time. Finally, creates,
+// removes and moves files and directories, flushes the cache and checks the
+// raw directory entries in the image: long name entries, short name aliases
+// and case bits, reuse of deleted entries, and the dot entries of directories.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <deque>
+#include <vector>
+#include <algorithm>
+
+#include <aprinter/system/InterruptLockCommon.h>
+
+#define APRINTER_INTERRUPT_LOCK_MODE APRINTER_INTERRUPT_LOCK_MODE_SIMPLE
+
+inline static void cli (void) {}
+inline static void sei (void) {}
+
+#include <aprinter/base/Object.h>
+#include <aprinter/base/Callback.h>
+#include <aprinter/base/BinaryTools.h>
+#include <aprinter/base/TransferVector.h>
+#include <aprinter/meta/WrapFunction.h>
+#include <aprinter/fs/FatFs.h>
+
+using namespace APrinter;
+
+struct FakeClock;
+struct FakeEventLoop;
+
+struct Context {
+    using Clock = FakeClock;
+    using EventLoop = FakeEventLoop;
+};
+
+using Handler = Callback<void(Context)>;
+
+struct FakeClock {
+    using TimeType = uint32_t;
+    static constexpr double time_freq = 1000.0;
+    static TimeType getTime (Context c) { return 0; }
+};
+
+class FakeQueuedEvent;
+static std::deque<FakeQueuedEvent *> queued_events;
+
+class FakeQueuedEvent {
+public:
+    void init (Context c, Handler handler) { m_handler = handler; m_set = false; }
+    void deinit (Context c) { unset(c); }
+    bool isSet (Context c) { return m_set; }
+    void prependNowNotAlready (Context c) { m_set = true; queued_events.push_front(this); }
+    void appendNowNotAlready (Context c) { m_set = true; queued_events.push_back(this); }
+    void prependNow (Context c) { unset(c); prependNowNotAlready(c); }
+    void appendNow (Context c) { unset(c); appendNowNotAlready(c); }
+    
+    void unset (Context c)
+    {
+        if (m_set) {
+            queued_events.erase(std::find(queued_events.begin(), queued_events.end(), this));
+            m_set = false;
+        }
+    }
+    
+    void dispatch (Context c) { m_set = false; m_handler(c); }
+    
+private:
+    Handler m_handler;
+    bool m_set;
+};
+
+struct FakeEventLoop {
+    using QueuedEvent = FakeQueuedEvent;
+};
+
+// The image: reserved sectors (boot sector and FS Information Sector),
+// one FAT of one sector, then the data clusters, one sector each.
+static size_t const SectorSize = 512;
+static uint32_t const ReservedSectors = 2;
+static uint32_t const NumClusters = 100;
+static uint32_t const NumBlocks = ReservedSectors + 1 + NumClusters;
+
+static uint32_t image[NumBlocks][SectorSize / 4];
+
+static std::deque<Callback<void(Context, bool)>> io_completions;
+
+struct MemBlockAccess {
+    using BlockIndexType = uint32_t;
+    using DataWordType = uint32_t;
+    static size_t const BlockSize = SectorSize;
+    static size_t const MaxIoBlocks = 4;
+    static int const MaxIoDescriptors = 4;
+    static int const MaxBufferLocks = 1;
+    
+    static bool isWritable (Context c) { return true; }
+    
+    class User {
+    public:
+        void init (Context c, Callback<void(Context, bool)> handler) { m_handler = handler; }
+        void deinit (Context c) {}
+        
+        void startReadOrWrite (Context c, bool is_write, uint32_t block, size_t num_blocks, TransferVector<uint32_t> data)
+        {
+            uint32_t *ptr = image[block];
+            for (int i = 0; i < data.num_descriptors; i++) {
+                size_t bytes = data.descriptors[i].num_words * sizeof(uint32_t);
+                if (is_write) {
+                    memcpy(ptr, data.descriptors[i].buffer_ptr, bytes);
+                } else {
+                    memcpy(data.descriptors[i].buffer_ptr, ptr, bytes);
+                }
+                ptr += data.descriptors[i].num_words;
+            }
+            io_completions.push_back(m_handler);
+        }
+        
+    private:
+        Callback<void(Context, bool)> m_handler;
+    };
+    
+    class UserFull : public User {
+    public:
+        void setLocker (Context c, Callback<void(Context, bool)> locker) {}
+    };
+};
+
+static void format_image ()
+{
+    char *boot = (char *)image[0];
+    WriteBinaryInt<uint16_t, BinaryLittleEndian>(SectorSize, boot + 0xB);
+    WriteBinaryInt<uint8_t, BinaryLittleEndian>(1, boot + 0xD);
+    WriteBinaryInt<uint16_t, BinaryLittleEndian>(ReservedSectors, boot + 0xE);
+    WriteBinaryInt<uint8_t, BinaryLittleEndian>(1, boot + 0x10);
+    WriteBinaryInt<uint32_t, BinaryLittleEndian>(1, boot + 0x24);
+    WriteBinaryInt<uint32_t, BinaryLittleEndian>(2, boot + 0x2C);
+    WriteBinaryInt<uint16_t, BinaryLittleEndian>(1, boot + 0x30);
+    WriteBinaryInt<uint8_t, BinaryLittleEndian>(0x29, boot + 0x42);
+    
+    char *fs_info = (char *)image[1];
+    WriteBinaryInt<uint32_t, BinaryLittleEndian>(UINT32_C(0x41615252), fs_info + 0x0);
+    WriteBinaryInt<uint32_t, BinaryLittleEndian>(UINT32_C(0x61417272), fs_info + 0x1E4);
+    WriteBinaryInt<uint32_t, BinaryLittleEndian>(UINT32_C(0xFFFFFFFF), fs_info + 0x1E8);
+    WriteBinaryInt<uint32_t, BinaryLittleEndian>(UINT32_C(0xFFFFFFFF), fs_info + 0x1EC);
+    WriteBinaryInt<uint32_t, BinaryLittleEndian>(UINT32_C(0xAA550000), fs_info + 0x1FC);
+    
+    // Cluster 2 is the root directory.
+    uint32_t *fat = image[ReservedSectors];
+    fat[0] = UINT32_C(0x0FFFFFF8);
+    fat[1] = UINT32_C(0x0FFFFFFF);
+    fat[2] = UINT32_C(0x0FFFFFFF);
+}
+
+struct WriteBehindDelay { static constexpr double value () { return 0.0; } };
+
+struct Program;
+
+static uint8_t init_error = 255;
+static int write_mount_result = -1;
+
+static void fs_init_handler (Context c, uint8_t error_code) { init_error = error_code; }
+static void fs_write_mount_handler (Context c, bool error) { write_mount_result = error; }
+
+struct FsInitHandler : public AMBRO_WFUNC_TD(&fs_init_handler) {};
+struct FsWriteMountHandler : public AMBRO_WFUNC_TD(&fs_write_mount_handler) {};
+
+using FsService = FatFsService<64, 4, 1, 4, true, true, false, 0, 0, 0, WriteBehindDelay>;
+
+APRINTER_MAKE_INSTANCE(TheFs, (FsService::template Fs<Context, Program, MemBlockAccess, FsInitHandler, FsWriteMountHandler>))
+
+using DirModifier = typename TheFs::template DirModifier<>;
+using Status = typename DirModifier::ModifierStatus;
+using FsEntry = typename TheFs::FsEntry;
+using File = typename TheFs::template File<true>;
+
+struct Program : public ObjBase<void, void, MakeTypeList<
+    TheFs
+>> {
+    static Program * self (Context c);
+};
+
+Program program;
+
+Program * Program::self (Context c) { return &program; }
+
+static void run_events (Context c)
+{
+    while (true) {
+        if (!queued_events.empty()) {
+            FakeQueuedEvent *ev = queued_events.front();
+            queued_events.pop_front();
+            ev->dispatch(c);
+        }
+        else if (!io_completions.empty()) {
+            auto handler = io_completions.front();
+            io_completions.pop_front();
+            handler(c, false);
+        }
+        else {
+            break;
+        }
+    }
+}
+
+struct ModifierResult {
+    bool done;
+    Status status;
+    FsEntry entry;
+    
+    void handler (Context c, Status the_status, FsEntry the_entry)
+    {
+        done = true;
+        status = the_status;
+        entry = the_entry;
+    }
+};
+
+struct FileResult {
+    bool done;
+    bool error;
+    
+    void handler (Context c, bool the_error, size_t length)
+    {
+        done = true;
+        error = the_error;
+    }
+    
+    void flush_handler (Context c, bool the_error)
+    {
+        done = true;
+        error = the_error;
+    }
+};
+
+static DirModifier modifier;
+static ModifierResult modifier_result;
+
+// Operations: 0 - create file, 1 - remove, 2 - rename, 3 - create directory.
+static Status modify (Context c, int op, char const *path, char const *dst_path=nullptr)
+{
+    FsEntry root = TheFs::getRootEntry(c);
+    modifier_result.done = false;
+    switch (op) {
+        case 0: modifier.startCreate(c, root, path, TheFs::EntryType::FILE_TYPE); break;
+        case 1: modifier.startRemove(c, root, path); break;
+        case 2: modifier.startRename(c, root, path, root, dst_path); break;
+        default: modifier.startCreate(c, root, path, TheFs::EntryType::DIR_TYPE); break;
+    }
+    run_events(c);
+    AMBRO_ASSERT_FORCE(modifier_result.done)
+    return modifier_result.status;
+}
+
+static bool check (bool cond, char const *msg)
+{
+    if (!cond) {
+        printf("FAIL: %s\n", msg);
+    }
+    return cond;
+}
+
+static bool flush (Context c)
+{
+    FileResult result;
+    result.done = false;
+    typename TheFs::template FlushRequest<> req;
+    req.init(c, APRINTER_CB_OBJFUNC(&FileResult::flush_handler, &result));
+    req.requestFlush(c);
+    run_events(c);
+    req.deinit(c);
+    return result.done && !result.error;
+}
+
+// A raw directory entry read from the image, with its index in the directory.
+struct RawEntry {
+    uint32_t index;
+    uint32_t cluster;
+    uint8_t const *data;
+};
+
+static uint8_t const * cluster_data (uint32_t cluster)
+{
+    return (uint8_t const *)image[ReservedSectors + 1 + (cluster - 2)];
+}
+
+static uint32_t entry_cluster (uint8_t const *e)
+{
+    return ((uint32_t)ReadBinaryInt<uint16_t, BinaryLittleEndian>((char const *)e + 0x14) << 16) |
+           ReadBinaryInt<uint16_t, BinaryLittleEndian>((char const *)e + 0x1A);
+}
+
+// Reads all entries of a directory, following its cluster chain in the FAT.
+static std::vector<RawEntry> read_dir (uint32_t cluster)
+{
+    std::vector<RawEntry> entries;
+    uint32_t const *fat = image[ReservedSectors];
+    while (cluster >= 2 && cluster < 2 + NumClusters) {
+        for (size_t i = 0; i < SectorSize / 32; i++) {
+            entries.push_back(RawEntry{(uint32_t)entries.size(), cluster, cluster_data(cluster) + 32 * i});
+        }
+        cluster = fat[cluster] & UINT32_C(0x0FFFFFFF);
+    }
+    return entries;
+}
+
+static int find_short (std::vector<RawEntry> const &entries, char const *short_name)
+{
+    for (RawEntry const &e : entries) {
+        if (e.data[0] == 0) {
+            break;
+        }
+        if (e.data[0xB] != 0xF && !memcmp(e.data, short_name, 11)) {
+            return e.index;
+        }
+    }
+    return -1;
+}
+
+static uint8_t vfat_checksum (uint8_t const *short_name)
+{
+    uint8_t csum = 0;
+    for (int i = 0; i < 11; i++) {
+        csum = ((csum & 1) << 7) + (csum >> 1) + short_name[i];
+    }
+    return csum;
+}
+
+// Checks that the short entry at index is preceded by a complete set of long
+// name entries for the (ASCII) name, with the right sequence numbers and
+// checksums, and padding after the terminating zero.
+static bool check_lfn (std::vector<RawEntry> const &entries, int index, char const *name)
+{
+    size_t len = strlen(name);
+    int num_lfn = (len + 12) / 13;
+    if (index < num_lfn) {
+        return false;
+    }
+    uint8_t csum = vfat_checksum(entries[index].data);
+    for (int seq = 1; seq <= num_lfn; seq++) {
+        uint8_t const *e = entries[index - seq].data;
+        if (e[0] != (seq | (seq == num_lfn ? 0x40 : 0)) || e[0xB] != 0xF || e[0xC] != 0 || e[0xD] != csum) {
+            return false;
+        }
+        for (int i = 0; i < 13; i++) {
+            size_t offset = (i < 5) ? (0x1 + 2 * i) : (i < 11) ? (0xE + 2 * (i - 5)) : (0x1C + 2 * (i - 11));
+            uint16_t ch = ReadBinaryInt<uint16_t, BinaryLittleEndian>((char const *)e + offset);
+            size_t pos = (seq - 1) * 13 + i;
+            uint16_t expected = (pos < len) ? (uint8_t)name[pos] : (pos == len) ? 0 : 0xFFFF;
+            if (ch != expected) {
+                return false;
+            }
+        }
+    }
+    // There must not be another long name entry before the first one.
+    return index == num_lfn || entries[index - num_lfn - 1].data[0xB] != 0xF || entries[index - num_lfn - 1].data[0] == 0xE5;
+}
+
+// The short name alias generated for a long name which has the given basis,
+// with either a numeric tail or a hash of the long name and a numeric tail.
+// Returns false if the alias does not fit in 8.3 characters.
+static bool make_alias (char const *basis, char const *ext, char const *long_name, bool hashed, int num, char (&out)[12])
+{
+    char tail[8];
+    int tail_len = snprintf(tail, sizeof(tail), "~%d", num);
+    if (tail_len < 0 || tail_len >= 8) {
+        return false;
+    }
+    size_t basis_len = strlen(basis);
+    char name[9];
+    int name_len;
+    if (!hashed) {
+        size_t pos = std::min(basis_len, (size_t)(8 - tail_len));
+        name_len = snprintf(name, sizeof(name), "%.*s%s", (int)pos, basis, tail);
+    } else {
+        uint16_t hash = 0;
+        for (char const *ptr = long_name; *ptr; ptr++) {
+            hash = (uint16_t)((hash << 5) | (hash >> 11)) + (uint8_t)*ptr;
+        }
+        name_len = snprintf(name, sizeof(name), "%.*s%04X%s", (int)std::min(basis_len, (size_t)2), basis, (unsigned int)hash, tail);
+    }
+    if (name_len < 0 || name_len >= (int)sizeof(name) || strlen(ext) > 3) {
+        return false;
+    }
+    snprintf(out, sizeof(out), "%-8s%-3s", name, ext);
+    return true;
+}
+
+static bool is_dot_entry (uint8_t const *e, char const *name, uint32_t cluster)
+{
+    return !memcmp(e, name, 11) && (e[0xB] & 0x10) && entry_cluster(e) == cluster;
+}
+
+int main ()
+{
+    Context c;
+    format_image();
+    
+    TheFs::init(c, BlockRange<uint32_t>{0, NumBlocks});
+    run_events(c);
+    if (!check(init_error == 0, "init failed")) {
+        return 1;
+    }
+    
+    TheFs::startWriteMount(c);
+    run_events(c);
+    if (!check(write_mount_result == 0, "write mount failed")) {
+        return 1;
+    }
+    
+    modifier.init(c, APRINTER_CB_OBJFUNC(&ModifierResult::handler, &modifier_result));
+    
+    bool ok = true;
+    ok = check(modify(c, 0, "first.gcode") == Status::SUCCESS, "create first") && ok;
+    FsEntry first = modifier_result.entry;
+    ok = check(modify(c, 0, "second.gcode") == Status::SUCCESS, "create second") && ok;
+    FsEntry second = modifier_result.entry;
+    
+    // Open the first file for writing and write a block.
+    FileResult file_result;
+    File file;
+    file.init(c, first, APRINTER_CB_OBJFUNC(&FileResult::handler, &file_result), File::IoMode::FS_BUFFER);
+    file_result.done = false;
+    file.startOpenWritable(c);
+    run_events(c);
+    ok = check(file_result.done && !file_result.error, "open writable") && ok;
+    file_result.done = false;
+    file.startWrite(c, true);
+    run_events(c);
+    ok = check(file_result.done && !file_result.error, "write") && ok;
+    memset(file.getWritePointer(c), 'x', 100);
+    file.finishWrite(c, 100);
+    
+    // And the second one for reading.
+    FileResult reader_result;
+    File reader;
+    reader.init(c, second, APRINTER_CB_OBJFUNC(&FileResult::handler, &reader_result));
+    
+    ok = check(modify(c, 1, "first.gcode") == Status::BUSY, "remove of file open for writing") && ok;
+    ok = check(modify(c, 2, "first.gcode", "third.gcode") == Status::BUSY, "rename of file open for writing") && ok;
+    ok = check(modify(c, 1, "second.gcode") == Status::BUSY, "remove of file open for reading") && ok;
+    ok = check(modify(c, 2, "second.gcode", "third.gcode") == Status::BUSY, "rename of file open for reading") && ok;
+    
+    file.closeWritable(c);
+    run_events(c);
+    file.deinit(c);
+    reader.deinit(c);
+    
+    ok = check(modify(c, 2, "first.gcode", "third.gcode") == Status::SUCCESS, "rename of closed file") && ok;
+    ok = check(modifier_result.entry.getFileSize() == 100, "renamed file size") && ok;
+    uint32_t written_mod_time = modifier_result.entry.getModTime();
+    ok = check(written_mod_time > first.getModTime(), "mod time not advanced by write") && ok;
+    ok = check(modify(c, 1, "third.gcode") == Status::SUCCESS, "remove of closed file") && ok;
+    ok = check(modify(c, 1, "second.gcode") == Status::SUCCESS, "remove of closed file") && ok;
+    ok = check(modify(c, 1, "first.gcode") == Status::NOT_FOUND, "removed file still found") && ok;
+    
+    // A file created in place of a removed one must not get its time back.
+    ok = check(modify(c, 0, "third.gcode") == Status::SUCCESS, "create in place of removed") && ok;
+    uint32_t mod_time = modifier_result.entry.getModTime();
+    ok = check(mod_time > written_mod_time, "mod time of replacing file not later") && ok;
+    ok = check(((mod_time >> 16) & 0x1F) != 0 && ((mod_time >> 21) & 0xF) != 0, "invalid date of new file") && ok;
+    ok = check(modify(c, 1, "third.gcode") == Status::SUCCESS, "remove of new file") && ok;
+    
+    // Create a directory, it gets the all-lowercase case bit and no long name.
+    ok = check(modify(c, 3, "lfntest") == Status::SUCCESS, "mkdir") && ok;
+    ok = check(flush(c), "flush") && ok;
+    int dir_index = find_short(read_dir(2), "LFNTEST    ");
+    uint32_t dir_cluster = (dir_index >= 0) ? entry_cluster(read_dir(2)[dir_index].data) : 0;
+    ok = check(dir_cluster >= 3, "directory cluster not allocated") && ok;
+    
+    // Create files whose names need long name entries and share the alias
+    // basis: 31 of them get numeric tails, then hashed aliases are used.
+    int const num_long_files = 33;
+    char long_names[num_long_files][32];
+    for (int i = 0; i < num_long_files; i++) {
+        char path[48];
+        int name_len = snprintf(long_names[i], sizeof(long_names[i]), "long name %02d.gcode", i + 1);
+        int path_len = snprintf(path, sizeof(path), "lfntest/%s", long_names[i]);
+        ok = check(name_len > 0 && name_len < (int)sizeof(long_names[i]) && path_len > 0 && path_len < (int)sizeof(path), "long name too long") && ok;
+        ok = check(modify(c, 0, path) == Status::SUCCESS, "create long name") && ok;
+    }
+    
+    // Create files with 8.3 names in different case.
+    ok = check(modify(c, 0, "lfntest/lower.txt") == Status::SUCCESS, "create lower.txt") && ok;
+    ok = check(modify(c, 0, "lfntest/LOWER.TXT") == Status::EXISTS, "create LOWER.TXT") && ok;
+    ok = check(modify(c, 0, "lfntest/base.TXT") == Status::SUCCESS, "create base.TXT") && ok;
+    ok = check(modify(c, 0, "lfntest/UPPER.txt") == Status::SUCCESS, "create UPPER.txt") && ok;
+    ok = check(modify(c, 0, "lfntest/Mixed.txt") == Status::SUCCESS, "create Mixed.txt") && ok;
+    
+    ok = check(flush(c), "flush") && ok;
+    
+    std::vector<RawEntry> root_entries = read_dir(2);
+    ok = check(dir_index >= 0 && (root_entries[dir_index].data[0xB] & 0x10), "directory entry not found") && ok;
+    if (dir_index >= 0) {
+        ok = check((root_entries[dir_index].data[0xC] & 0x18) == 0x08, "case bits of lfntest") && ok;
+        ok = check(dir_index == 0 || root_entries[dir_index - 1].data[0xB] != 0xF, "lfntest has a long name") && ok;
+    }
+    
+    std::vector<RawEntry> entries = read_dir(dir_cluster);
+    ok = check(entries.size() > 2 && is_dot_entry(entries[0].data, ".          ", dir_cluster), "dot entry of mkdir") && ok;
+    ok = check(entries.size() > 2 && is_dot_entry(entries[1].data, "..         ", 0), "dotdot entry of mkdir") && ok;
+    
+    for (int i = 0; i < num_long_files; i++) {
+        char alias[12];
+        if (!check(make_alias("LONGNAME", "GCO", long_names[i], i >= 31, (i < 31) ? (i + 1) : 1, alias), "alias too long")) {
+            ok = false;
+            continue;
+        }
+        int index = find_short(entries, alias);
+        ok = check(index >= 0, "alias not found") && ok;
+        if (index >= 0) {
+            ok = check(check_lfn(entries, index, long_names[i]), "bad long name entries") && ok;
+            ok = check((entries[index].data[0xC] & 0x18) == 0, "case bits of aliased name") && ok;
+            // Each file takes three entries, after the dot entries.
+            ok = check(index == 2 + 3 * i + 2, "long name entries not contiguous") && ok;
+        }
+    }
+    
+    int lower_index = find_short(entries, "LOWER   TXT");
+    ok = check(lower_index >= 0 && (entries[lower_index].data[0xC] & 0x18) == 0x18, "case bits of lower.txt") && ok;
+    ok = check(lower_index >= 0 && entries[lower_index - 1].data[0xB] != 0xF, "lower.txt has a long name") && ok;
+    int base_index = find_short(entries, "BASE    TXT");
+    ok = check(base_index >= 0 && (entries[base_index].data[0xC] & 0x18) == 0x08, "case bits of base.TXT") && ok;
+    int upper_index = find_short(entries, "UPPER   TXT");
+    ok = check(upper_index >= 0 && (entries[upper_index].data[0xC] & 0x18) == 0x10, "case bits of UPPER.txt") && ok;
+    int mixed_index = find_short(entries, "MIXED   TXT");
+    ok = check(mixed_index >= 0 && check_lfn(entries, mixed_index, "Mixed.txt"), "long name of Mixed.txt") && ok;
+    ok = check(mixed_index >= 0 && (entries[mixed_index].data[0xC] & 0x18) == 0, "case bits of Mixed.txt") && ok;
+    ok = check(mixed_index >= 0 && (size_t)mixed_index + 1 < entries.size() && entries[mixed_index + 1].data[0] == 0, "end marker after last entry") && ok;
+    
+    // The fifth long name file takes entries 14 to 16, across the boundary of
+    // the first two (one-sector) clusters. Removing it frees these entries and
+    // its alias, and a new file with a long name of the same length reuses both.
+    ok = check(modify(c, 1, "lfntest/long name 05.gcode") == Status::SUCCESS, "remove long name") && ok;
+    ok = check(modify(c, 0, "lfntest/long name 99.gcode") == Status::SUCCESS, "create in removed slot") && ok;
+    ok = check(flush(c), "flush") && ok;
+    
+    entries = read_dir(dir_cluster);
+    int reused_index = find_short(entries, "LONGNA~5GCO");
+    ok = check(reused_index == 16, "removed entries not reused") && ok;
+    if (reused_index == 16) {
+        ok = check(entries[14].cluster != entries[16].cluster, "reused entries not across clusters") && ok;
+        ok = check(check_lfn(entries, reused_index, "long name 99.gcode"), "bad long name entries in reused slot") && ok;
+    }
+    
+    // Make a subdirectory and move it to the root.
+    ok = check(modify(c, 3, "lfntest/inner") == Status::SUCCESS, "mkdir inner") && ok;
+    ok = check(flush(c), "flush") && ok;
+    entries = read_dir(dir_cluster);
+    int inner_index = find_short(entries, "INNER      ");
+    uint32_t inner_cluster = (inner_index >= 0) ? entry_cluster(entries[inner_index].data) : 0;
+    entries = read_dir(inner_cluster);
+    ok = check(is_dot_entry(entries[0].data, ".          ", inner_cluster), "dot entry of inner") && ok;
+    ok = check(is_dot_entry(entries[1].data, "..         ", dir_cluster), "dotdot entry of inner") && ok;
+    
+    ok = check(modify(c, 2, "lfntest/inner", "moved") == Status::SUCCESS, "move inner") && ok;
+    ok = check(flush(c), "flush") && ok;
+    root_entries = read_dir(2);
+    int moved_index = find_short(root_entries, "MOVED      ");
+    ok = check(moved_index >= 0 && entry_cluster(root_entries[moved_index].data) == inner_cluster, "moved directory not in destination") && ok;
+    entries = read_dir(inner_cluster);
+    ok = check(is_dot_entry(entries[0].data, ".          ", inner_cluster), "dot entry of moved") && ok;
+    ok = check(is_dot_entry(entries[1].data, "..         ", 0), "dotdot entry of moved") && ok;
+    ok = check(find_short(read_dir(dir_cluster), "INNER      ") < 0, "moved directory still in source") && ok;
+    
+    // A directory with files cannot be removed, and a directory cannot be
+    // moved into itself or its subdirectory.
+    ok = check(modify(c, 1, "lfntest") == Status::NOT_EMPTY, "remove of non-empty directory") && ok;
+    ok = check(modify(c, 3, "moved/deep") == Status::SUCCESS, "mkdir deep") && ok;
+    ok = check(modify(c, 2, "moved", "moved/x") == Status::BAD_MOVE, "move into itself") && ok;
+    ok = check(modify(c, 2, "moved", "moved/deep/x") == Status::BAD_MOVE, "move into subdirectory") && ok;
+    ok = check(modify(c, 1, "moved") == Status::NOT_EMPTY, "remove of directory with subdirectory") && ok;
+    ok = check(modify(c, 1, "moved/deep") == Status::SUCCESS, "remove of empty directory") && ok;
+    ok = check(modify(c, 1, "moved") == Status::SUCCESS, "remove of emptied directory") && ok;
+    ok = check(flush(c), "flush") && ok;
+    ok = check(find_short(read_dir(2), "MOVED      ") < 0, "removed directory still present") && ok;
+    
+    modifier.deinit(c);
+    TheFs::deinit(c);
+    
+    if (!ok) {
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <aprinter/math/FloatTools.h>
+
+using namespace APrinter;
+
+static int num_errors = 0;
+
+template <typename T>
+static void check_str (char const *str, T (*libc_func) (char const *, char **))
+{
+    char *fast_end;
+    char *libc_end;
+    T fast = FastStrToFloat<T>(str, &fast_end);
+    T libc = libc_func(str, &libc_end);
+    
+    if (memcmp(&fast, &libc, sizeof(T)) != 0 || fast_end != libc_end) {
+        printf("MISMATCH %s: %.17g (%d) vs %.17g (%d)\n", str, (double)fast, (int)(fast_end - str), (double)libc, (int)(libc_end - str));
+        num_errors++;
+    }
+}
+
+static void check (char const *str)
+{
+    check_str<float>(str, strtof);
+    check_str<double>(str, strtod);
+}
+
+int main ()
+{
+    char const *const fixed[] = {
+        "0", "-0", "+0", "0.0", "-0.0", "1", "-1", "10", "100.5", "0.1", "-0.1",
+        "123.456", "0.000123", ".5", "-.25", "5.", "1.50000000000000", "007.250",
+        "16777216", "16777217", "123456789", "0.123456789", "4294967295",
+        "4294967296", "1e3", "1.5E-2", "0x10", "inf", "-nan", "", "-", ".", "abc",
+        "12abc", "3.14.15", "1-2", "0.00000000001", "99999999999999999999",
+    };
+    for (char const *str : fixed) {
+        check(str);
+    }
+    
+    srand(1);
+    for (int i = 0; i < 1000000; i++) {
+        char buf[32];
+        int int_digits = rand() % 7;
+        int frac_digits = rand() % 8;
+        int pos = 0;
+        if (rand() % 4 == 0) {
+            buf[pos++] = '-';
+        }
+        for (int j = 0; j < int_digits; j++) {
+            buf[pos++] = '0' + rand() % 10;
+        }
+        if (frac_digits > 0 || rand() % 2 == 0) {
+            buf[pos++] = '.';
+            for (int j = 0; j < frac_digits; j++) {
+                buf[pos++] = '0' + rand() % 10;
+            }
+        }
+        buf[pos] = '\0';
+        check(buf);
+    }
+    
+    if (num_errors > 0) {
+        printf("%d errors\n", num_errors);
+        return 1;
+    }
+    
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Parses g-code lines with escapes and comments both in the usual way and
+// without writing to the buffer (as SdCardModule does from cache blocks),
+// and checks that the results agree and the buffer is left as it was.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+#include <aprinter/system/InterruptLockCommon.h>
+
+#define APRINTER_INTERRUPT_LOCK_MODE APRINTER_INTERRUPT_LOCK_MODE_SIMPLE
+
+inline static void cli (void) {}
+inline static void sei (void) {}
+
+#include <aprinter/base/Assert.h>
+#include <aprinter/printer/utils/GcodeParser.h>
+
+using namespace APrinter;
+
+struct Context {};
+
+static int const MaxParts = 10;
+
+using Parser = FileGcodeParserService<MaxParts>::Parser<Context, size_t, float>;
+
+// Describes the command, getting string values for parts with code
+// 'F' or 'V' and numeric values for the others.
+static std::string parse (std::string const &line, bool in_place)
+{
+    Context c;
+    Parser parser;
+    parser.init(c);
+    
+    std::string buffer = line + "G1 X9\n";
+    std::string const original = buffer;
+    char string_buffer[128];
+    
+    parser.startCommand(c, &buffer[0], 0, in_place ? string_buffer : nullptr);
+    if (!parser.extendCommand(c, buffer.size())) {
+        return "incomplete";
+    }
+    if (in_place && buffer != original) {
+        return "buffer written";
+    }
+    
+    char out[64];
+    snprintf(out, sizeof(out), "%d len=%d", (int)parser.getNumParts(c), (int)parser.getLength(c));
+    std::string desc = out;
+    if (parser.getNumParts(c) < 0) {
+        parser.deinit(c);
+        return desc;
+    }
+    snprintf(out, sizeof(out), " %c%d", parser.getCmdCode(c), (int)parser.getCmdNumber(c));
+    desc += out;
+    for (int i = 0; i < parser.getNumParts(c); i++) {
+        auto part = parser.getPart(c, i);
+        char code = parser.getPartCode(c, part);
+        if (code == 'F' || code == 'V') {
+            desc += std::string(" ") + code + "\"" + parser.getPartStringValue(c, part) + "\"";
+        } else {
+            snprintf(out, sizeof(out), " %c%g/%u", code, (double)parser.getPartFpValue(c, part), (unsigned)parser.getPartUint32Value(c, part));
+            desc += out;
+        }
+    }
+    if (in_place && buffer != original) {
+        return "buffer written";
+    }
+    
+    parser.deinit(c);
+    return desc;
+}
+
+int main ()
+{
+    char const *lines[] = {
+        "G1 X10.5 Y-3 F1200\n",
+        "M23 Fdir/file.gco\n",
+        "M23 Fa\\20b\\5cc V\\3B\n",
+        "M23 F;comment\n",
+        "M23 Fx\\2\n",
+        "M104\tS210 T1 ; set temp\n",
+        "G28\r\n",
+        "; only a comment\n",
+        "M117 Vhello F F\n",
+    };
+    
+    bool ok = true;
+    for (char const *line : lines) {
+        std::string normal = parse(line, false);
+        std::string in_place = parse(line, true);
+        if (normal != in_place) {
+            printf("FAIL: %s  normal: %s\n  in place: %s\n", line, normal.c_str(), in_place.c_str());
+            ok = false;
+        }
+    }
+    
+    if (!ok) {
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
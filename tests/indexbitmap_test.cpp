@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <vector>
+
+#include <aprinter/base/Assert.h>
+#include <aprinter/structure/IndexBitmap.h>
+
+using namespace APrinter;
+
+static uint32_t const NumBits = 1000;
+static int const NumIterations = 1000;
+
+using Bitmap = IndexBitmap<uint32_t, NumBits>;
+
+static Bitmap bitmap;
+
+int main ()
+{
+    srand(1);
+    
+    for (int iter = 0; iter < NumIterations; iter++) {
+        std::vector<bool> ref(NumBits);
+        bitmap.clearAll();
+        
+        // Vary the density so that both long runs of clear bits and
+        // dense regions are seen.
+        int density = 1 + rand() % 100;
+        for (uint32_t i = 0; i < NumBits; i++) {
+            bool value = (rand() % 1000 < density);
+            ref[i] = value;
+            bitmap.set(i, value);
+        }
+        for (int i = 0; i < 100; i++) {
+            uint32_t index = rand() % NumBits;
+            ref[index] = !ref[index];
+            bitmap.set(index, ref[index]);
+        }
+        
+        for (uint32_t i = 0; i < NumBits; i++) {
+            AMBRO_ASSERT_FORCE(bitmap.get(i) == ref[i])
+        }
+        
+        for (int i = 0; i < 100; i++) {
+            uint32_t start = rand() % (NumBits + 1);
+            uint32_t end = start + rand() % (NumBits - start + 1);
+            uint32_t expected = start;
+            while (expected < end && !ref[expected]) {
+                expected++;
+            }
+            AMBRO_ASSERT_FORCE(bitmap.findSet(start, end) == expected)
+        }
+    }
+    
+    printf("OK\n");
+    return 0;
+}
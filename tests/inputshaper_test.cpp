@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <math.h>
+#include <stdio.h>
+
+#include <vector>
+
+#include <aprinter/system/InterruptLockCommon.h>
+
+#define APRINTER_INTERRUPT_LOCK_MODE APRINTER_INTERRUPT_LOCK_MODE_SIMPLE
+
+inline static void cli (void) {}
+inline static void sei (void) {}
+
+#include <aprinter/base/Assert.h>
+#include <aprinter/printer/planning/InputShaper.h>
+
+using namespace APrinter;
+
+using FpType = double;
+
+static int const StepBits = 13;
+static int const TimeBits = 22;
+
+struct Command {
+    bool dir;
+    uint32_t x;
+    uint32_t t;
+    int32_t a;
+};
+
+// Position at time t of a sequence of commands starting at time zero.
+static long double sequence_position (std::vector<Command> const &cmds, long double t)
+{
+    long double pos = 0.0L;
+    long double start = 0.0L;
+    for (Command const &cmd : cmds) {
+        if (t <= start) {
+            break;
+        }
+        long double sign = cmd.dir ? 1.0L : -1.0L;
+        if (t >= start + cmd.t) {
+            pos += sign * cmd.x;
+        } else {
+            long double u = (t - start) / cmd.t;
+            pos += sign * ((cmd.x - cmd.a) * u + cmd.a * u * u);
+        }
+        start += cmd.t;
+    }
+    return pos;
+}
+
+static long double shaped_position (std::vector<Command> const &cmds, FpType const *amplitude, uint32_t const *delay, int num_impulses, long double t)
+{
+    long double pos = 0.0L;
+    for (int i = 0; i < num_impulses; i++) {
+        pos += amplitude[i] * sequence_position(cmds, t - delay[i]);
+    }
+    return pos;
+}
+
+template <typename ShaperType, int HistorySize>
+static void test_sequence (int num_pieces, bool check_shape)
+{
+    using Shaper = InputShaper<FpType, ShaperType, HistorySize, StepBits, TimeBits>;
+    static int const N = Shaper::NumImpulses;
+    
+    FpType amplitude[N];
+    uint32_t delay[N];
+    FpType frequency = 20.0 + rand() % 80;
+    FpType damping = (rand() % 20) / 100.0;
+    Shaper::computeImpulses(frequency, damping, 1e6, amplitude, delay);
+    
+    FpType amp_sum = 0.0;
+    for (int i = 0; i < N; i++) {
+        AMBRO_ASSERT_FORCE(amplitude[i] > 0.0)
+        amp_sum += amplitude[i];
+    }
+    AMBRO_ASSERT_FORCE(fabs(amp_sum - 1.0) < 1e-9)
+    
+    typename Shaper::State st;
+    Shaper::reset(&st, amplitude, delay);
+    
+    std::vector<Command> input;
+    std::vector<Command> output;
+    auto out = [&](bool dir, uint32_t x, uint32_t t, int32_t a) {
+        AMBRO_ASSERT_FORCE(t > 0)
+        AMBRO_ASSERT_FORCE(t < ((uint32_t)1 << TimeBits))
+        AMBRO_ASSERT_FORCE(x < ((uint32_t)1 << StepBits))
+        AMBRO_ASSERT_FORCE(a >= -(int32_t)x && a <= (int32_t)x)
+        output.push_back(Command{dir, x, t, a});
+    };
+    
+    long double input_steps = 0.0L;
+    uint64_t input_time = 0;
+    for (int j = 0; j < num_pieces; j++) {
+        Command cmd;
+        cmd.dir = rand() % 2;
+        cmd.x = (rand() % 4 == 0) ? 0 : rand() % 500;
+        cmd.t = 100 + rand() % ((rand() % 4 == 0) ? 50000 : 2000);
+        cmd.a = (cmd.x == 0) ? 0 : (rand() % (2 * cmd.x + 1)) - (int32_t)cmd.x;
+        input.push_back(cmd);
+        input_steps += (cmd.dir ? 1.0L : -1.0L) * cmd.x;
+        input_time += cmd.t;
+        
+        size_t prev_output = output.size();
+        Shaper::addPiece(&st, cmd.dir, cmd.x, cmd.t, cmd.a, out);
+        
+        // The output must keep up with the input exactly.
+        uint64_t output_time = 0;
+        for (Command const &o : output) {
+            output_time += o.t;
+        }
+        AMBRO_ASSERT_FORCE(output_time == input_time)
+        AMBRO_ASSERT_FORCE(output.size() - prev_output <= Shaper::MaxCommandsPerPiece + Shaper::MaxExtraCommands)
+    }
+    
+    Shaper::flush(&st, out);
+    
+    uint64_t output_time = 0;
+    long double output_steps = 0.0L;
+    for (Command const &o : output) {
+        output_time += o.t;
+        output_steps += (o.dir ? 1.0L : -1.0L) * o.x;
+    }
+    AMBRO_ASSERT_FORCE(output_time == input_time + delay[N - 1])
+    AMBRO_ASSERT_FORCE(output_steps == input_steps)
+    
+    if (check_shape) {
+        // At the end of every output command the position must be the
+        // rounded convolution of the input with the impulses, and in the
+        // middle it must be close to it.
+        long double time = 0.0L;
+        long double pos = 0.0L;
+        for (Command const &o : output) {
+            long double sign = o.dir ? 1.0L : -1.0L;
+            long double mid_pos = pos + sign * (0.5L * (o.x - o.a) + 0.25L * o.a);
+            long double mid_exact = shaped_position(input, amplitude, delay, N, time + 0.5L * o.t);
+            time += o.t;
+            pos += sign * o.x;
+            long double exact = shaped_position(input, amplitude, delay, N, time);
+            if (!(fabsl(pos - exact) <= 0.5L + 1e-6L) || !(fabsl(mid_pos - mid_exact) <= 1.0L)) {
+                printf("time=%Lf pos=%Lf exact=%Lf mid_pos=%Lf mid_exact=%Lf\n", time, pos, exact, mid_pos, mid_exact);
+                AMBRO_ASSERT_FORCE(0)
+            }
+        }
+    }
+}
+
+int main ()
+{
+    srand(1);
+    
+    for (int i = 0; i < 300; i++) {
+        test_sequence<InputShaperTypeZv, 64>(50, true);
+        test_sequence<InputShaperTypeZvd, 64>(50, true);
+        test_sequence<InputShaperTypeEi, 64>(50, true);
+    }
+    
+    // Small history, pieces get merged.
+    for (int i = 0; i < 300; i++) {
+        test_sequence<InputShaperTypeZvd, 8>(200, false);
+        test_sequence<InputShaperTypeEi, 10>(200, false);
+    }
+    
+    printf("All tests passed.\n");
+    return 0;
+}
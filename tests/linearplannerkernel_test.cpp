@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdio.h>
+
+#include <aprinter/meta/MinMax.h>
+#include <aprinter/base/Assert.h>
+#include <aprinter/printer/planning/LinearPlanner.h>
+#include <aprinter/printer/planning/BatchLinearPlanner.h>
+
+using namespace APrinter;
+
+static int const Size = 37;
+static int const NumWindows = 20000;
+static int const NumAppends = 100000;
+
+/*
+ * Checks that the planner kernels used by MotionPlanner give bit-identical
+ * results: the sequential and the batch kernel with incremental backward
+ * passes, against the sequential kernel doing full backward passes. When
+ * planning incrementally, the batch kernel plans forward only after the
+ * segments reported as final by the previous plan, so their results from
+ * earlier plans must still be right.
+ */
+
+template <typename FpType>
+struct KernelTest {
+    using Sequential = LinearPlannerKernel<FpType, Size>;
+    using Batch = BatchLinearPlanner<FpType, Size>;
+    
+    static typename Sequential::State ref_state;
+    static typename Sequential::State seq_state;
+    static typename Batch::State batch_state;
+    static bool neutral[Size];
+    static FpType end_v[Size];
+    static FpType prev_max_v;
+    
+    static FpType random_fp (FpType max)
+    {
+        return max * (FpType)rand() / (FpType)RAND_MAX;
+    }
+    
+    static bool same (FpType a, FpType b)
+    {
+        return !memcmp(&a, &b, sizeof(FpType));
+    }
+    
+    static void init_segment (size_t index)
+    {
+        neutral[index] = (rand() % 8 == 0);
+        if (neutral[index]) {
+            Sequential::initNeutralSegment(&ref_state, index);
+            Sequential::initNeutralSegment(&seq_state, index);
+            Batch::initNeutralSegment(&batch_state, index);
+        } else {
+            FpType max_v = (rand() % 2 == 0) ? 50.0f : random_fp(100.0f);
+            FpType max_start_v = (rand() % 4 == 0) ? random_fp(100.0f) : (FpType)INFINITY;
+            FpType a_x = random_fp(50.0f);
+            Sequential::initSegment(&ref_state, index, prev_max_v, max_start_v, max_v, a_x);
+            Sequential::initSegment(&seq_state, index, prev_max_v, max_start_v, max_v, a_x);
+            Batch::initSegment(&batch_state, index, prev_max_v, max_start_v, max_v, a_x);
+            AMBRO_ASSERT_FORCE(same(Sequential::getAccelRec(&seq_state, index), Batch::getAccelRec(&batch_state, index)))
+            prev_max_v = max_v;
+        }
+    }
+        
+    // Does the backward passes and returns the number of segments with
+    // final results, which must be the same for both kernels.
+    static size_t plan_backward (size_t start, size_t length, size_t planned_length)
+    {
+        Sequential::backward(&ref_state, start, length, 0);
+        size_t seq_final_length = Sequential::backward(&seq_state, start, length, planned_length);
+        size_t batch_final_length = Batch::backward(&batch_state, start, length, planned_length);
+        AMBRO_ASSERT_FORCE(batch_final_length == seq_final_length)
+        AMBRO_ASSERT_FORCE(same(Batch::getMaxStartV(&batch_state, start), Sequential::getMaxStartV(&ref_state, start)))
+        return seq_final_length;
+    }
+    
+    // Does the forward passes in the way MotionPlanner does it and compares
+    // the results. The batch kernel plans forward from resume_length, and
+    // end_v has the end velocities of the segments before it.
+    static void plan_forward_and_compare (size_t start, size_t length, FpType v, size_t resume_length)
+    {
+        AMBRO_ASSERT_FORCE(resume_length < length)
+        
+        FpType resume_v = (resume_length == 0) ? v : end_v[(start + resume_length - 1) % Size];
+        Sequential::forward(&ref_state, start, length, v);
+        Sequential::forward(&seq_state, start, length, v);
+        Batch::forward(&batch_state, (start + resume_length) % Size, length - resume_length, resume_v);
+        
+        // Neutral segments are skipped like MotionPlanner skips channel segments.
+        FpType ref_v = v;
+        FpType seq_v = v;
+        FpType batch_v = v;
+        for (size_t i = 0; i < length; i++) {
+            size_t index = (start + i) % Size;
+            if (neutral[index]) {
+                end_v[index] = ref_v;
+                continue;
+            }
+            typename Sequential::SegmentResult ref_result;
+            typename Sequential::SegmentResult seq_result;
+            typename Batch::SegmentResult batch_result;
+            ref_v = Sequential::pull(&ref_state, index, ref_v, &ref_result);
+            seq_v = Sequential::pull(&seq_state, index, seq_v, &seq_result);
+            batch_v = Batch::pull(&batch_state, index, batch_v, &batch_result);
+            
+            AMBRO_ASSERT_FORCE(same(seq_v, ref_v))
+            AMBRO_ASSERT_FORCE(same(seq_result.const_start, ref_result.const_start))
+            AMBRO_ASSERT_FORCE(same(seq_result.const_end, ref_result.const_end))
+            AMBRO_ASSERT_FORCE(same(seq_result.const_v, ref_result.const_v))
+            AMBRO_ASSERT_FORCE(same(batch_v, ref_v))
+            AMBRO_ASSERT_FORCE(same(batch_result.const_start, ref_result.const_start))
+            AMBRO_ASSERT_FORCE(same(batch_result.const_end, ref_result.const_end))
+            AMBRO_ASSERT_FORCE(same(batch_result.const_v, ref_result.const_v))
+            end_v[index] = ref_v;
+        }
+    }
+    
+    static void init ()
+    {
+        Sequential::init(&ref_state);
+        Sequential::init(&seq_state);
+        Batch::init(&batch_state);
+    }
+    
+    // Independent random windows, no incremental planning.
+    static void test_windows ()
+    {
+        init();
+        for (int i = 0; i < NumWindows; i++) {
+            size_t start = rand() % Size;
+            size_t length = 1 + rand() % Size;
+            prev_max_v = 0.0f;
+            for (size_t j = 0; j < length; j++) {
+                init_segment((start + j) % Size);
+            }
+            plan_backward(start, length, 0);
+            
+            // The start velocity is limited by the velocity which was planned
+            // for the first segment.
+            FpType v = 0.0f;
+            if (rand() % 2 == 0) {
+                v = random_fp(1.0f) * Sequential::getMaxStartV(&ref_state, start);
+            }
+            plan_forward_and_compare(start, length, v, 0);
+        }
+    }
+    
+    // A window which is appended to and committed from, like in MotionPlanner.
+    // It starts at the end velocity of the last committed segment.
+    static void test_incremental ()
+    {
+        init();
+        size_t start = 0;
+        size_t length = 0;
+        size_t planned_length = 0;
+        size_t final_length = 0;
+        FpType v = 0.0f;
+        prev_max_v = 0.0f;
+        
+        for (int i = 0; i < NumAppends; i++) {
+            size_t count = 1 + rand() % 4;
+            for (size_t j = 0; j < count && length < Size; j++) {
+                init_segment((start + length) % Size);
+                length++;
+            }
+            
+            size_t resume_length = final_length;
+            final_length = MaxValue(final_length, plan_backward(start, length, planned_length));
+            plan_forward_and_compare(start, length, v, resume_length);
+            planned_length = length;
+            
+            if (length == Size || rand() % 4 == 0) {
+                size_t commit_count = 1 + rand() % length;
+                v = end_v[(start + commit_count - 1) % Size];
+                start = (start + commit_count) % Size;
+                length -= commit_count;
+                planned_length -= commit_count;
+                final_length -= MinValue(final_length, commit_count);
+            }
+        }
+    }
+};
+
+template <typename FpType>
+typename KernelTest<FpType>::Sequential::State KernelTest<FpType>::ref_state;
+
+template <typename FpType>
+typename KernelTest<FpType>::Sequential::State KernelTest<FpType>::seq_state;
+
+template <typename FpType>
+typename KernelTest<FpType>::Batch::State KernelTest<FpType>::batch_state;
+
+template <typename FpType>
+bool KernelTest<FpType>::neutral[Size];
+
+template <typename FpType>
+FpType KernelTest<FpType>::end_v[Size];
+
+template <typename FpType>
+FpType KernelTest<FpType>::prev_max_v;
+
+int main ()
+{
+    srand(1);
+    KernelTest<float>::test_windows();
+    KernelTest<float>::test_incremental();
+    KernelTest<double>::test_windows();
+    KernelTest<double>::test_incremental();
+}
@@ -0,0 +1,1035 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Offline benchmark of the complete MotionPlanner pipeline.
+ * 
+ * The planner is instantiated with a simulated clock, a simulated event loop
+ * and stub axis drivers, which consume stepper commands in simulated time
+ * instead of generating steps. G-code moves (G0/G1) are read from files given
+ * on the command line, or generated synthetically (-g lines|arcs), and pushed
+ * through the planner for a sweep of lookahead buffer sizes.
+ * 
+ * Simulated time advances in two ways: while an event loop handler runs, it
+ * advances with the host clock multiplied by the CPU scale factor (-k), which
+ * allows emulating a slower microcontroller; when there is nothing to do, it
+ * jumps to the next stepper command completion. Timer events falling within
+ * the execution of a handler are delivered after the handler returns.
+ * 
+ * Build (from the repository root):
+ *   g++ -std=c++17 -O2 -DNDEBUG -ftemplate-depth=1024 \
+ *       -I. tests/motionplanner_bench.cpp -o motionplanner_bench
+ * 
+ * Options:
+ *   -g lines|arcs  Use a synthetic path instead of files.
+ *   -n <count>     Size of the synthetic path (number of shapes).
+ *   -d             Split moves like a delta transform would (min 0.1mm,
+ *                  max 4mm, 100 segments per second).
+ *   -k <factor>    CPU scale factor (simulated CPU is this much slower).
+ *   -j             Plan for drivers which smooth acceleration changes, with
+ *                  the jerk limits of bench_axes, and report the largest jerk
+ *                  of any command relative to its limit (jerk column).
+ *   -b             Use the BatchLinearPlanner kernel.
+ *   -f             Pass the stepper commands through the filters: pressure
+ *                  advance on E, a ZV input shaper on all axes, and drivers
+ *                  which smooth acceleration changes.
+ * 
+ * The cmds column is a hash of the stepper commands received by the drivers.
+ * It stays the same across changes to the planner which should not change
+ * its output, as long as there are no underruns.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include <aprinter/system/InterruptLockCommon.h>
+
+#define F_CPU (1.0)
+#define APRINTER_INTERRUPT_LOCK_MODE APRINTER_INTERRUPT_LOCK_MODE_SIMPLE
+
+inline static void cli (void) {}
+inline static void sei (void) {}
+
+#include <aprinter/meta/TypeList.h>
+#include <aprinter/meta/TypeListUtils.h>
+#include <aprinter/meta/BasicMetaUtils.h>
+#include <aprinter/meta/ListForEach.h>
+#include <aprinter/meta/FixedPoint.h>
+#include <aprinter/meta/Expr.h>
+#include <aprinter/meta/TupleGet.h>
+#include <aprinter/base/Object.h>
+#include <aprinter/base/Assert.h>
+#include <aprinter/printer/planning/MotionPlanner.h>
+#include <aprinter/printer/planning/BatchLinearPlanner.h>
+#include <aprinter/printer/planning/InputShaper.h>
+
+using namespace APrinter;
+
+using FpType = double;
+
+static int const NumAxes = 4;
+static constexpr double SimTimeFreq = 1048576.0;
+static constexpr double SimStartupTime = 0.05;
+
+struct BenchAxisParams {
+    char name;
+    bool is_cartesian;
+    double steps_per_unit;
+    double max_speed;
+    double max_accel;
+    double max_jerk;
+    double cornering_distance;
+};
+
+static constexpr BenchAxisParams bench_axes[NumAxes] = {
+    {'X', true,  80.0,  300.0, 1500.0, 1000000.0, 40.0},
+    {'Y', true,  80.0,  300.0, 1500.0, 1000000.0, 40.0},
+    {'Z', true,  400.0, 10.0,  100.0,  100000.0,  40.0},
+    {'E', false, 100.0, 50.0,  1000.0, 1000000.0, 40.0}
+};
+
+struct BenchMove {
+    int64_t steps[NumAxes];
+    double rel_max_v_rec;
+};
+
+struct BenchOptions {
+    char const *synthetic;
+    int synthetic_count;
+    bool delta_split;
+    double cpu_scale;
+    bool jerk;
+    bool batch;
+    bool filters;
+};
+
+/*
+ * Simulation state shared by all planner instances. The runs are
+ * done one after another, so this is reset at the start of each.
+ */
+
+struct SimState {
+    uint64_t now;
+    bool in_handler;
+    struct timespec handler_start;
+    double cpu_scale;
+};
+
+static SimState sim;
+
+static double host_time_since (struct timespec start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) + 1e-9 * (now.tv_nsec - start.tv_nsec);
+}
+
+static uint64_t sim_get_time ()
+{
+    uint64_t now = sim.now;
+    if (sim.in_handler) {
+        now += (uint64_t)(host_time_since(sim.handler_start) * sim.cpu_scale * SimTimeFreq);
+    }
+    return now;
+}
+
+struct BenchConfig {
+    template <typename TheExpr>
+    struct Helper {
+        static_assert(TheExpr::IsConstexpr, "Only constant expressions are supported.");
+        
+        static constexpr typename TheExpr::Type value ()
+        {
+            return TheExpr::value();
+        }
+        
+        template <typename ThisContext>
+        static typename TheExpr::Type eval (ThisContext c)
+        {
+            return TheExpr::value();
+        }
+    };
+    
+    template <typename TheExpr>
+    static TheExpr getExpr (TheExpr);
+    
+    template <typename TheExpr>
+    static Helper<TheExpr> getHelper (TheExpr);
+};
+
+struct BenchResult {
+    int lookahead;
+    int commit;
+    uint64_t segments;
+    uint64_t plans;
+    uint64_t underruns;
+    double plan_host_time;
+    double other_host_time;
+    uint64_t other_count;
+    uint64_t occupancy_samples;
+    uint64_t occupancy_sum;
+    size_t occupancy_min;
+    size_t commit_buffer_size;
+    double motion_time;
+    double max_jerk_ratio;
+    uint32_t commands_hash;
+    bool position_ok;
+};
+
+static uint32_t fnv_hash (uint32_t hash, uint32_t value)
+{
+    for (int i = 0; i < 4; i++) {
+        hash = (hash ^ ((value >> (8 * i)) & 0xFF)) * UINT32_C(16777619);
+    }
+    return hash;
+}
+
+// The jerk of a command is at most JerkFactor times its acceleration divided by
+// its duration, see SCurveAxisDriver.
+static constexpr double BenchJerkFactor = 9.0;
+
+// The peak acceleration of a command relative to its planned acceleration,
+// which the planner divides the max acceleration by.
+static constexpr double BenchAccelPeakFactor = 1.5;
+
+// Parameters of the filters used with -f.
+static constexpr double BenchAdvanceTime = 0.02;
+static constexpr double BenchShaperFrequency = 40.0;
+static constexpr double BenchShaperDamping = 0.1;
+static int const BenchShaperHistorySize = 16;
+
+template <int TLookaheadBufferSize, int TLookaheadCommitCount, bool TJerkLimited, typename TLinearPlannerService, bool TFilters>
+struct Bench {
+    static int const LookaheadBufferSize = TLookaheadBufferSize;
+    static int const LookaheadCommitCount = TLookaheadCommitCount;
+    static bool const JerkLimited = TJerkLimited;
+    using LinearPlannerService = TLinearPlannerService;
+    static bool const Filters = TFilters;
+    static int const StepperSegmentBufferSize = LookaheadCommitCount + 32;
+    
+    struct Context;
+    struct Program;
+    
+    struct Clock {
+        using TimeType = uint32_t;
+        
+        static constexpr double time_freq = SimTimeFreq;
+        static constexpr double time_unit = 1.0 / time_freq;
+        
+        template <typename ThisContext>
+        static TimeType getTime (ThisContext c)
+        {
+            return sim_get_time();
+        }
+    };
+    
+    struct EventLoop {
+        using FastHandlerType = void (*) (Context);
+        
+        template <typename Id>
+        struct FastEventSpec {};
+        
+        struct FastEvent {
+            FastHandlerType handler;
+            bool triggered;
+        };
+        
+        static int const MaxFastEvents = 4;
+        
+        static FastEvent * events () { static FastEvent ev[MaxFastEvents]; return ev; }
+        static int & num_events () { static int num; return num; }
+        
+        template <typename EventSpec>
+        static FastEvent * get_event ()
+        {
+            static FastEvent *ev = nullptr;
+            if (!ev) {
+                AMBRO_ASSERT_FORCE(num_events() < MaxFastEvents)
+                ev = &events()[num_events()++];
+            }
+            return ev;
+        }
+        
+        template <typename EventSpec>
+        static void initFastEvent (Context c, FastHandlerType handler)
+        {
+            FastEvent *ev = get_event<EventSpec>();
+            ev->handler = handler;
+            ev->triggered = false;
+        }
+        
+        template <typename EventSpec>
+        static void resetFastEvent (Context c)
+        {
+            get_event<EventSpec>()->triggered = false;
+        }
+        
+        template <typename EventSpec, typename ThisContext>
+        static void triggerFastEvent (ThisContext c)
+        {
+            get_event<EventSpec>()->triggered = true;
+        }
+        
+        // Returns the next triggered event in round-robin order.
+        static FastEvent * take_triggered ()
+        {
+            static int pos;
+            for (int i = 0; i < num_events(); i++) {
+                pos = (pos + 1) % num_events();
+                FastEvent *ev = &events()[pos];
+                if (ev->triggered) {
+                    ev->triggered = false;
+                    return ev;
+                }
+            }
+            return nullptr;
+        }
+    };
+    
+    template <int AxisIndex>
+    struct StubAxisDriver {
+        struct Object;
+        static int const Index = AxisIndex;
+        using TimeType = typename Clock::TimeType;
+        using StepFixedType = FixedPoint<11, false, 0>;
+        using AccelFixedType = FixedPoint<11, true, 0>;
+        using TimeFixedType = FixedPoint<28, false, 0>;
+        using CommandCallbackContext = Context;
+        
+        struct Command {
+            bool dir;
+            StepFixedType x;
+            TimeFixedType t;
+        };
+        
+        using CommandCallbackType = bool (*) (Context, Command **);
+        
+        static constexpr double AsyncMinStepTime () { return 0.0; }
+        static constexpr double SyncMinStepTime () { return 0.0; }
+        static constexpr double AccelPeakFactor () { return JerkLimited ? BenchAccelPeakFactor : 1.0; }
+        static constexpr double JerkFactor () { return JerkLimited ? BenchJerkFactor : 0.0; }
+        static bool const SmoothAccelChanges = Filters;
+        
+        static void generate_command (bool dir, StepFixedType x, TimeFixedType t, AccelFixedType a, bool smooth_start, bool smooth_end, Command *cmd)
+        {
+            generate_command(dir, x, t, a, cmd);
+        }
+        
+        static void generate_command (bool dir, StepFixedType x, TimeFixedType t, AccelFixedType a, Command *cmd)
+        {
+            AMBRO_ASSERT_FORCE(a >= -x)
+            AMBRO_ASSERT_FORCE(a <= x)
+            
+            // The acceleration is 2*a/t^2. Commands with only a few steps of
+            // acceleration are skipped, their a is mostly rounding.
+            if (JerkLimited && t.bitsValue() > 0 && (a.bitsValue() >= 8 || a.bitsValue() <= -8)) {
+                double t_fp = t.bitsValue();
+                double jerk = BenchJerkFactor * 2.0 * fabs((double)a.bitsValue()) / (t_fp * t_fp * t_fp);
+                double max_jerk = bench_axes[AxisIndex].max_jerk * bench_axes[AxisIndex].steps_per_unit / (SimTimeFreq * SimTimeFreq * SimTimeFreq);
+                BenchResult *r = &state()->result;
+                r->max_jerk_ratio = fmax(r->max_jerk_ratio, jerk / max_jerk);
+            }
+            
+            cmd->dir = dir;
+            cmd->x = x;
+            cmd->t = t;
+        }
+        
+        static void init (Context c)
+        {
+            auto *o = Object::self(c);
+            o->running = false;
+            o->position = 0;
+            o->hash = UINT32_C(2166136261);
+        }
+        
+        static void setPrestepCallbackEnabled (Context c, bool enabled)
+        {
+            AMBRO_ASSERT_FORCE(!enabled)
+        }
+        
+        template <typename TheConsumer>
+        static void start (Context c, TimeType start_time, Command *first_command)
+        {
+            auto *o = Object::self(c);
+            AMBRO_ASSERT_FORCE(!o->running)
+            
+            o->running = true;
+            o->callback = TheConsumer::CommandCallback::call;
+            o->end_time = start_time;
+            load_command(c, first_command);
+        }
+        
+        static void stop (Context c)
+        {
+            auto *o = Object::self(c);
+            o->running = false;
+        }
+        
+        static StepFixedType getAbortedCmdSteps (Context c, bool *dir)
+        {
+            *dir = false;
+            return StepFixedType::importBits(0);
+        }
+        
+        static StepFixedType getPendingCmdSteps (Context c, Command const *cmd, bool *dir)
+        {
+            *dir = cmd->dir;
+            return cmd->x;
+        }
+        
+        static void load_command (Context c, Command *cmd)
+        {
+            auto *o = Object::self(c);
+            o->end_time += cmd->t.bitsValue();
+            o->position += cmd->dir ? (int64_t)cmd->x.bitsValue() : -(int64_t)cmd->x.bitsValue();
+            o->hash = fnv_hash(fnv_hash(fnv_hash(o->hash, cmd->dir), cmd->x.bitsValue()), cmd->t.bitsValue());
+        }
+        
+        // Timer emulation: the current command completes at end_time.
+        static bool get_event_time (Context c, TimeType *time)
+        {
+            auto *o = Object::self(c);
+            *time = o->end_time;
+            return o->running;
+        }
+        
+        static void handle_event (Context c)
+        {
+            auto *o = Object::self(c);
+            AMBRO_ASSERT_FORCE(o->running)
+            
+            Command *cmd;
+            if (!o->callback(c, &cmd)) {
+                o->running = false;
+                return;
+            }
+            load_command(c, cmd);
+        }
+        
+        struct Object : public ObjBase<StubAxisDriver, Program, EmptyTypeList> {
+            bool running;
+            CommandCallbackType callback;
+            TimeType end_time;
+            int64_t position;
+            uint32_t hash;
+        };
+    };
+    
+    template <int AxisIndex>
+    struct AxisConsts {
+        static constexpr BenchAxisParams p = bench_axes[AxisIndex];
+        
+        using DistanceFactor = APRINTER_FP_CONST_EXPR(1.0);
+        using CorneringDistance = APRINTER_FP_CONST_EXPR(p.cornering_distance);
+        using MaxSpeedRec = APRINTER_FP_CONST_EXPR(SimTimeFreq / (p.max_speed * p.steps_per_unit));
+        using MaxAccelRec = APRINTER_FP_CONST_EXPR(SimTimeFreq * SimTimeFreq / (p.max_accel * p.steps_per_unit));
+        using MaxJerkRec = APRINTER_FP_CONST_EXPR(SimTimeFreq * SimTimeFreq * SimTimeFreq / (p.max_jerk * p.steps_per_unit));
+    };
+    
+    using AdvanceTime = APRINTER_FP_CONST_EXPR(BenchAdvanceTime);
+    
+    template <int AxisIndex>
+    using PressureAdvanceSpec = If<Filters && bench_axes[AxisIndex].name == 'E', MotionPlannerPressureAdvance<AdvanceTime>, MotionPlannerNoPressureAdvance>;
+    
+    using ShaperFrequency = APRINTER_FP_CONST_EXPR(BenchShaperFrequency);
+    using ShaperDamping = APRINTER_FP_CONST_EXPR(BenchShaperDamping);
+    using ShaperParams = If<Filters, InputShaperParams<InputShaperTypeZv, ShaperFrequency, ShaperDamping, BenchShaperHistorySize>, NoInputShaperParams>;
+    
+    struct PrestepCallback {
+        static bool call (Context c) { return false; }
+    };
+    
+    template <int AxisIndex>
+    using PlannerAxisSpec = MotionPlannerAxisSpec<
+        StubAxisDriver<AxisIndex>,
+        32,
+        typename AxisConsts<AxisIndex>::DistanceFactor,
+        typename AxisConsts<AxisIndex>::CorneringDistance,
+        typename AxisConsts<AxisIndex>::MaxSpeedRec,
+        typename AxisConsts<AxisIndex>::MaxAccelRec,
+        typename AxisConsts<AxisIndex>::MaxJerkRec,
+        PressureAdvanceSpec<AxisIndex>,
+        PrestepCallback
+    >;
+    
+    using MaxStepsPerCycle = APRINTER_FP_CONST_EXPR(100000.0);
+    
+    static void pull_handler (Context c);
+    static void finished_handler (Context c);
+    static void aborted_handler (Context c);
+    static void underrun_callback (Context c);
+    
+    struct PullHandler : public AMBRO_WFUNC_TD(&Bench::pull_handler) {};
+    struct FinishedHandler : public AMBRO_WFUNC_TD(&Bench::finished_handler) {};
+    struct AbortedHandler : public AMBRO_WFUNC_TD(&Bench::aborted_handler) {};
+    struct UnderrunCallback : public AMBRO_WFUNC_TD(&Bench::underrun_callback) {};
+    
+    using ThePlanner = MotionPlanner<MotionPlannerArg<
+        Context, Program, BenchConfig,
+        MakeTypeList<PlannerAxisSpec<0>, PlannerAxisSpec<1>, PlannerAxisSpec<2>, PlannerAxisSpec<3>>,
+        StepperSegmentBufferSize, LookaheadBufferSize, LookaheadCommitCount, FpType, LinearPlannerService, ShaperParams, MaxStepsPerCycle,
+        PullHandler, FinishedHandler, AbortedHandler, UnderrunCallback,
+        EmptyTypeList, EmptyTypeList
+    >>;
+    
+    using DriversList = MakeTypeList<StubAxisDriver<0>, StubAxisDriver<1>, StubAxisDriver<2>, StubAxisDriver<3>>;
+    
+    struct Context {
+        using Clock = Bench::Clock;
+        using EventLoop = Bench::EventLoop;
+    };
+    
+    struct Program : public ObjBase<void, void, JoinTypeLists<DriversList, MakeTypeList<ThePlanner>>> {
+        static Program * self (Context c) { static Program program; return &program; }
+    };
+    
+    struct State {
+        std::vector<BenchMove> const *moves;
+        size_t move_pos;
+        bool finished;
+        BenchResult result;
+    };
+    
+    static State * state () { static State st; return &st; }
+    
+    static void sample_occupancy (Context c)
+    {
+        auto *co = ThePlanner::template Axis<0>::TheCommon::Object::self(c);
+        using TheCommon = typename ThePlanner::template Axis<0>::TheCommon;
+        size_t avail = TheCommon::commit_avail(co->m_commit_start, co->m_commit_end);
+        size_t occupancy = (TheCommon::StepperCommitBufferSize - 1) - avail;
+        BenchResult *r = &state()->result;
+        r->occupancy_samples++;
+        r->occupancy_sum += occupancy;
+        if (occupancy < r->occupancy_min) {
+            r->occupancy_min = occupancy;
+        }
+    }
+    
+    static BenchResult run (std::vector<BenchMove> const *moves, double cpu_scale)
+    {
+        Context c;
+        State *st = state();
+        st->moves = moves;
+        st->move_pos = 0;
+        st->finished = false;
+        st->result = BenchResult();
+        st->result.lookahead = LookaheadBufferSize;
+        st->result.commit = LookaheadCommitCount;
+        using TheCommon = typename ThePlanner::template Axis<0>::TheCommon;
+        st->result.occupancy_min = TheCommon::StepperCommitBufferSize;
+        st->result.commit_buffer_size = TheCommon::StepperCommitBufferSize - 1;
+        
+        sim.now = 0;
+        sim.in_handler = false;
+        sim.cpu_scale = cpu_scale;
+        
+        ListFor<DriversList>([&] APRINTER_TL(driver, driver::init(c)));
+        ThePlanner::init(c, false);
+        
+        auto *po = ThePlanner::Object::self(c);
+        bool have_motion = false;
+        uint64_t motion_start = 0;
+        
+        while (!st->finished) {
+            typename EventLoop::FastEvent *ev = EventLoop::take_triggered();
+            if (ev) {
+                bool backup_before = po->m_current_backup;
+                
+                sim.in_handler = true;
+                clock_gettime(CLOCK_MONOTONIC, &sim.handler_start);
+                ev->handler(c);
+                double elapsed = host_time_since(sim.handler_start);
+                sim.in_handler = false;
+                sim.now += (uint64_t)(elapsed * cpu_scale * SimTimeFreq);
+                
+                if (po->m_current_backup != backup_before) {
+                    st->result.plans++;
+                    st->result.plan_host_time += elapsed;
+                    sample_occupancy(c);
+                } else {
+                    st->result.other_count++;
+                    st->result.other_host_time += elapsed;
+                }
+                
+                if (!have_motion && ThePlanner::isStepping(c)) {
+                    have_motion = true;
+                    motion_start = sim.now;
+                }
+                
+                deliver_timer_events(c, false);
+            } else {
+                if (!deliver_timer_events(c, true)) {
+                    break;
+                }
+            }
+        }
+        
+        AMBRO_ASSERT_FORCE(st->finished)
+        
+        st->result.motion_time = have_motion ? (sim.now - motion_start) / SimTimeFreq - SimStartupTime : 0.0;
+        st->result.position_ok = check_positions(c);
+        st->result.commands_hash = UINT32_C(2166136261);
+        ListFor<DriversList>([&] APRINTER_TL(driver, {
+            st->result.commands_hash = fnv_hash(st->result.commands_hash, driver::Object::self(c)->hash);
+        }));
+        
+        ThePlanner::deinit(c);
+        
+        return st->result;
+    }
+    
+    // Calls the stub drivers for all command completions up to the current time,
+    // in time order. If jump is true and there are no such completions, simulated
+    // time is advanced to the earliest one. Returns false if nothing was delivered
+    // and no driver is running.
+    static bool deliver_timer_events (Context c, bool jump)
+    {
+        bool delivered = false;
+        while (true) {
+            int first_index = -1;
+            typename Clock::TimeType first_time = 0;
+            ListFor<DriversList>([&] APRINTER_TL(driver, {
+                typename Clock::TimeType time;
+                if (driver::get_event_time(c, &time)) {
+                    if (first_index < 0 || (int32_t)(time - first_time) < 0) {
+                        first_index = driver::Index;
+                        first_time = time;
+                    }
+                }
+            }));
+            
+            if (first_index < 0) {
+                return delivered;
+            }
+            
+            int32_t diff = (int32_t)(first_time - (typename Clock::TimeType)sim.now);
+            if (diff > 0) {
+                if (!jump) {
+                    return true;
+                }
+                sim.now += diff;
+            }
+            jump = false;
+            delivered = true;
+            
+            ListForOne<DriversList, 0>(first_index, [&] APRINTER_TL(driver, driver::handle_event(c)));
+        }
+    }
+    
+    static bool check_positions (Context c)
+    {
+        State *st = state();
+        bool ok = true;
+        ListFor<DriversList>([&] APRINTER_TL(driver, {
+            int64_t expected = 0;
+            for (BenchMove const &move : *st->moves) {
+                expected += move.steps[driver::Index];
+            }
+            if (driver::Object::self(c)->position != expected) {
+                ok = false;
+            }
+        }));
+        return ok;
+    }
+};
+
+template <int L, int C, bool J, typename K, bool F>
+void Bench<L, C, J, K, F>::pull_handler (Context c)
+{
+    State *st = state();
+    
+    if (st->move_pos == st->moves->size()) {
+        ThePlanner::waitFinished(c);
+        return;
+    }
+    BenchMove const *move = &(*st->moves)[st->move_pos++];
+    
+    auto *cmd = ThePlanner::getBuffer(c);
+    ListFor<DriversList>([&] APRINTER_TL(driver, {
+        auto *mycmd = TupleGetElem<driver::Index>(cmd->axes.axes());
+        int64_t steps = move->steps[driver::Index];
+        mycmd->dir = (steps >= 0);
+        mycmd->x = decltype(mycmd->x)::importBits(steps >= 0 ? steps : -steps);
+    }));
+    cmd->axes.rel_max_v_rec = move->rel_max_v_rec;
+    st->result.segments++;
+    ThePlanner::axesCommandDone(c);
+}
+
+template <int L, int C, bool J, typename K, bool F>
+void Bench<L, C, J, K, F>::finished_handler (Context c)
+{
+    state()->finished = true;
+}
+
+template <int L, int C, bool J, typename K, bool F>
+void Bench<L, C, J, K, F>::aborted_handler (Context c)
+{
+    AMBRO_ASSERT_ABORT("unexpected abort");
+}
+
+template <int L, int C, bool J, typename K, bool F>
+void Bench<L, C, J, K, F>::underrun_callback (Context c)
+{
+    auto *po = ThePlanner::Object::self(c);
+    
+    // Running dry at the end of the path is the normal way to finish.
+    if (!(po->m_waiting && po->m_segments_length == 0)) {
+        state()->result.underruns++;
+    }
+}
+
+/*
+ * Path input: G-code parsing and synthetic paths.
+ */
+
+struct PathBuilder {
+    std::vector<BenchMove> moves;
+    double pos[NumAxes];
+    int64_t step_pos[NumAxes];
+    double feedrate;
+    bool delta_split;
+    
+    void init (bool the_delta_split)
+    {
+        moves.clear();
+        for (int i = 0; i < NumAxes; i++) {
+            pos[i] = 0.0;
+            step_pos[i] = 0;
+        }
+        feedrate = 3000.0;
+        delta_split = the_delta_split;
+    }
+    
+    void add_segment (double const target[NumAxes], double rel_max_v_rec)
+    {
+        BenchMove move;
+        bool nonzero = false;
+        for (int i = 0; i < NumAxes; i++) {
+            int64_t new_step_pos = llround(target[i] * bench_axes[i].steps_per_unit);
+            move.steps[i] = new_step_pos - step_pos[i];
+            step_pos[i] = new_step_pos;
+            nonzero |= (move.steps[i] != 0);
+        }
+        move.rel_max_v_rec = rel_max_v_rec;
+        if (nonzero) {
+            moves.push_back(move);
+        }
+    }
+    
+    void move_to (double const target[NumAxes])
+    {
+        double cart_dist_sq = 0.0;
+        double other_dist = 0.0;
+        for (int i = 0; i < NumAxes; i++) {
+            double delta = target[i] - pos[i];
+            if (bench_axes[i].is_cartesian) {
+                cart_dist_sq += delta * delta;
+            } else {
+                other_dist = fmax(other_dist, fabs(delta));
+            }
+        }
+        double distance = (cart_dist_sq > 0.0) ? sqrt(cart_dist_sq) : other_dist;
+        double time_freq_by_max_speed = SimTimeFreq / (feedrate / 60.0);
+        
+        uint32_t count = 1;
+        if (delta_split && cart_dist_sq > 0.0) {
+            double const MinSplitLength = 0.1;
+            double const MaxSplitLength = 4.0;
+            double const SegmentsPerSecond = 100.0;
+            double base_segments_by_distance = SegmentsPerSecond / SimTimeFreq * time_freq_by_max_speed;
+            count = 1 + (uint32_t)(distance * fmin(1.0 / MinSplitLength, fmax(1.0 / MaxSplitLength, base_segments_by_distance)));
+        }
+        
+        double start[NumAxes];
+        for (int i = 0; i < NumAxes; i++) {
+            start[i] = pos[i];
+        }
+        for (uint32_t j = 1; j <= count; j++) {
+            double frac = (double)j / count;
+            double seg_target[NumAxes];
+            for (int i = 0; i < NumAxes; i++) {
+                seg_target[i] = (j == count) ? target[i] : (start[i] + frac * (target[i] - start[i]));
+            }
+            add_segment(seg_target, distance * time_freq_by_max_speed / count);
+        }
+        
+        for (int i = 0; i < NumAxes; i++) {
+            pos[i] = target[i];
+        }
+    }
+    
+    bool load_gcode (char const *filename)
+    {
+        FILE *f = fopen(filename, "r");
+        if (!f) {
+            fprintf(stderr, "Failed to open %s\n", filename);
+            return false;
+        }
+        
+        bool relative = false;
+        bool e_relative = false;
+        double offset[NumAxes] = {};
+        char line[512];
+        
+        while (fgets(line, sizeof(line), f)) {
+            char *comment = strchr(line, ';');
+            if (comment) {
+                *comment = '\0';
+            }
+            
+            char letter = 0;
+            long code = -1;
+            double values[NumAxes];
+            bool have[NumAxes] = {};
+            double new_feedrate = -1.0;
+            
+            for (char *p = line; *p;) {
+                if (*p == '(') {
+                    while (*p && *p != ')') p++;
+                    continue;
+                }
+                char ch = (*p >= 'a' && *p <= 'z') ? (*p - 32) : *p;
+                if (ch < 'A' || ch > 'Z') {
+                    p++;
+                    continue;
+                }
+                char *end;
+                double value = strtod(p + 1, &end);
+                if (end == p + 1) {
+                    p++;
+                    continue;
+                }
+                p = end;
+                if (!letter && (ch == 'G' || ch == 'M')) {
+                    letter = ch;
+                    code = (long)value;
+                } else if (ch == 'F') {
+                    new_feedrate = value;
+                } else {
+                    for (int i = 0; i < NumAxes; i++) {
+                        if (ch == bench_axes[i].name) {
+                            values[i] = value;
+                            have[i] = true;
+                        }
+                    }
+                }
+            }
+            
+            if (letter == 'G' && (code == 0 || code == 1)) {
+                if (new_feedrate > 0.0) {
+                    feedrate = new_feedrate;
+                }
+                double target[NumAxes];
+                for (int i = 0; i < NumAxes; i++) {
+                    bool axis_relative = bench_axes[i].name == 'E' ? (relative || e_relative) : relative;
+                    target[i] = !have[i] ? pos[i] : axis_relative ? (pos[i] + values[i]) : (values[i] + offset[i]);
+                }
+                move_to(target);
+            }
+            else if (letter == 'G' && code == 90) {
+                relative = false;
+            }
+            else if (letter == 'G' && code == 91) {
+                relative = true;
+            }
+            else if (letter == 'M' && code == 82) {
+                e_relative = false;
+            }
+            else if (letter == 'M' && code == 83) {
+                e_relative = true;
+            }
+            else if (letter == 'G' && code == 92) {
+                bool any = false;
+                for (int i = 0; i < NumAxes; i++) {
+                    any |= have[i];
+                }
+                for (int i = 0; i < NumAxes; i++) {
+                    if (!any || have[i]) {
+                        offset[i] = pos[i] - (have[i] ? values[i] : 0.0);
+                    }
+                }
+            }
+        }
+        
+        fclose(f);
+        return true;
+    }
+    
+    void gen_lines (int count)
+    {
+        feedrate = 9000.0;
+        for (int k = 0; k < count; k++) {
+            double z = 0.2 * (k + 1);
+            double corners[4][2] = {{10, 10}, {190, 10}, {190, 190}, {10, 190}};
+            for (int j = 0; j <= 4; j++) {
+                double target[NumAxes] = {corners[j % 4][0], corners[j % 4][1], z, pos[3] + (j > 0 ? 6.0 : 0.0)};
+                move_to(target);
+            }
+        }
+    }
+    
+    void gen_arcs (int count)
+    {
+        feedrate = 6000.0;
+        double const ChordLength = 0.2;
+        for (int k = 0; k < count; k++) {
+            double radius = 5.0 + 15.0 * ((k % 8) + 1) / 8.0;
+            int n = (int)ceil(2 * M_PI * radius / ChordLength);
+            double z = 0.2 * (k + 1);
+            for (int j = 0; j <= n; j++) {
+                double angle = 2 * M_PI * j / n;
+                double target[NumAxes] = {100.0 + radius * cos(angle), 100.0 + radius * sin(angle), z, pos[3] + (j > 0 ? 0.01 : 0.0)};
+                move_to(target);
+            }
+        }
+    }
+};
+
+template <typename BenchType>
+static void run_bench (std::vector<BenchMove> const *moves, double cpu_scale)
+{
+    BenchResult r = BenchType::run(moves, cpu_scale);
+    
+    double other_mean = (r.other_count > 0) ? (r.other_host_time / r.other_count) : 0.0;
+    double plan_only = r.plan_host_time - r.plans * other_mean;
+    double plan_per_call = (r.plans > 0) ? (plan_only / r.plans) : 0.0;
+    double plan_per_seg = (r.plans > 0) ? (plan_only / (r.plans * (double)r.commit)) : 0.0;
+    double occupancy_mean = (r.occupancy_samples > 0) ? ((double)r.occupancy_sum / r.occupancy_samples) : 0.0;
+    
+    printf("%5d %6d %9llu %8llu %10.3f %10.3f %9llu %7zu/%-4zu %8.1f %10.2f %6.3f %08lx %s\n",
+           r.lookahead, r.commit, (unsigned long long)r.segments, (unsigned long long)r.plans,
+           plan_per_call * 1e6, plan_per_seg * 1e6, (unsigned long long)r.underruns,
+           (r.occupancy_samples > 0) ? r.occupancy_min : (size_t)0, r.commit_buffer_size,
+           occupancy_mean, r.motion_time, r.max_jerk_ratio, (unsigned long)r.commands_hash, r.position_ok ? "ok" : "POSITION MISMATCH");
+}
+
+template <bool JerkLimited, typename LinearPlannerService, bool Filters>
+static void run_sweep (std::vector<BenchMove> const *moves, double cpu_scale)
+{
+    run_bench<Bench<8, 2, JerkLimited, LinearPlannerService, Filters>>(moves, cpu_scale);
+    run_bench<Bench<16, 4, JerkLimited, LinearPlannerService, Filters>>(moves, cpu_scale);
+    run_bench<Bench<32, 8, JerkLimited, LinearPlannerService, Filters>>(moves, cpu_scale);
+    run_bench<Bench<64, 16, JerkLimited, LinearPlannerService, Filters>>(moves, cpu_scale);
+    run_bench<Bench<128, 32, JerkLimited, LinearPlannerService, Filters>>(moves, cpu_scale);
+    run_bench<Bench<256, 64, JerkLimited, LinearPlannerService, Filters>>(moves, cpu_scale);
+}
+
+template <bool JerkLimited, typename LinearPlannerService>
+static void run_sweep_filters (BenchOptions const *opts, std::vector<BenchMove> const *moves)
+{
+    if (opts->filters) {
+        run_sweep<JerkLimited, LinearPlannerService, true>(moves, opts->cpu_scale);
+    } else {
+        run_sweep<JerkLimited, LinearPlannerService, false>(moves, opts->cpu_scale);
+    }
+}
+
+template <bool JerkLimited>
+static void run_sweep_kernel (BenchOptions const *opts, std::vector<BenchMove> const *moves)
+{
+    if (opts->batch) {
+        run_sweep_filters<JerkLimited, BatchLinearPlannerService>(opts, moves);
+    } else {
+        run_sweep_filters<JerkLimited, LinearPlannerService>(opts, moves);
+    }
+}
+
+static void usage (char const *prog)
+{
+    fprintf(stderr, "Usage: %s [-d] [-j] [-b] [-f] [-k cpu_scale] [-g lines|arcs] [-n count] [file.gcode ...]\n", prog);
+}
+
+int main (int argc, char *argv[])
+{
+    BenchOptions opts;
+    opts.synthetic = nullptr;
+    opts.synthetic_count = 10;
+    opts.delta_split = false;
+    opts.cpu_scale = 1.0;
+    opts.jerk = false;
+    opts.batch = false;
+    opts.filters = false;
+    
+    int opt;
+    while ((opt = getopt(argc, argv, "g:n:djbfk:")) != -1) {
+        switch (opt) {
+            case 'g': opts.synthetic = optarg; break;
+            case 'n': opts.synthetic_count = atoi(optarg); break;
+            case 'd': opts.delta_split = true; break;
+            case 'j': opts.jerk = true; break;
+            case 'b': opts.batch = true; break;
+            case 'f': opts.filters = true; break;
+            case 'k': opts.cpu_scale = atof(optarg); break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    
+    if (opts.cpu_scale <= 0.0 || opts.synthetic_count <= 0 || (!opts.synthetic && optind == argc)) {
+        usage(argv[0]);
+        return 1;
+    }
+    
+    PathBuilder builder;
+    builder.init(opts.delta_split);
+    
+    if (opts.synthetic) {
+        if (!strcmp(opts.synthetic, "lines")) {
+            builder.gen_lines(opts.synthetic_count);
+        } else if (!strcmp(opts.synthetic, "arcs")) {
+            builder.gen_arcs(opts.synthetic_count);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    for (int i = optind; i < argc; i++) {
+        if (!builder.load_gcode(argv[i])) {
+            return 1;
+        }
+    }
+    
+    printf("segments: %zu, cpu scale: %g, delta split: %s, jerk limit: %s, kernel: %s, filters: %s\n", builder.moves.size(), opts.cpu_scale,
+           opts.delta_split ? "yes" : "no", opts.jerk ? "yes" : "no", opts.batch ? "batch" : "sequential", opts.filters ? "yes" : "no");
+    printf("%5s %6s %9s %8s %10s %10s %9s %12s %8s %10s %6s %8s %s\n",
+           "look", "commit", "segments", "plans", "us/plan", "us/seg", "underruns", "occ-min/size", "occ-avg", "motion-s", "jerk", "cmds", "check");
+    
+    if (opts.jerk) {
+        run_sweep_kernel<true>(&opts, &builder.moves);
+    } else {
+        run_sweep_kernel<false>(&opts, &builder.moves);
+    }
+    
+    return 0;
+}
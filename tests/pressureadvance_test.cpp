@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <math.h>
+#include <stdio.h>
+
+#include <vector>
+
+#include <aprinter/system/InterruptLockCommon.h>
+
+#define APRINTER_INTERRUPT_LOCK_MODE APRINTER_INTERRUPT_LOCK_MODE_SIMPLE
+
+inline static void cli (void) {}
+inline static void sei (void) {}
+
+#include <aprinter/base/Assert.h>
+#include <aprinter/printer/planning/PressureAdvance.h>
+
+using namespace APrinter;
+
+using FpType = double;
+
+static int const StepBits = 13;
+
+struct Command {
+    bool dir;
+    uint32_t x;
+    uint32_t t;
+    int32_t a;
+};
+
+static long double command_position (Command const &cmd, long double u)
+{
+    long double sign = cmd.dir ? 1.0L : -1.0L;
+    long double s = u / cmd.t;
+    return sign * ((cmd.x - cmd.a) * s + cmd.a * s * s);
+}
+
+static void test_sequence (int num_pieces)
+{
+    using Advance = PressureAdvance<FpType, StepBits>;
+    
+    FpType k = (rand() % 4 == 0) ? 0.0 : (rand() % 100000);
+    
+    typename Advance::State st;
+    Advance::reset(&st);
+    
+    std::vector<Command> output;
+    auto out = [&](bool dir, uint32_t x, uint32_t t, int32_t a) {
+        AMBRO_ASSERT_FORCE(t > 0)
+        AMBRO_ASSERT_FORCE(x < ((uint32_t)1 << StepBits))
+        AMBRO_ASSERT_FORCE(a >= -(int32_t)x && a <= (int32_t)x)
+        output.push_back(Command{dir, x, t, a});
+    };
+    
+    long double input_pos = 0.0L;
+    long double output_pos = 0.0L;
+    long double advance = 0.0L;
+    for (int j = 0; j < num_pieces; j++) {
+        Command cmd;
+        cmd.dir = rand() % 2;
+        cmd.x = (rand() % 8 == 0) ? 0 : rand() % ((rand() % 4 == 0) ? 8000 : 500);
+        // At most one step per two ticks.
+        cmd.t = 2 * cmd.x + 100 + rand() % ((rand() % 4 == 0) ? 50000 : 2000);
+        cmd.a = (cmd.x == 0) ? 0 : (rand() % (2 * cmd.x + 1)) - (int32_t)cmd.x;
+        if (j == num_pieces - 1) {
+            // End at rest.
+            cmd.a = -(int32_t)cmd.x;
+        }
+        
+        size_t prev_output = output.size();
+        Advance::addPiece(&st, k, cmd.dir, cmd.x, cmd.t, cmd.a, out);
+        
+        // The advance at the end of the piece is the rounded velocity times K,
+        // and is interpolated linearly within the piece.
+        long double sign = cmd.dir ? 1.0L : -1.0L;
+        long double v_end = sign * ((long double)cmd.x + cmd.a) / cmd.t;
+        long double max_advance = ((1 << StepBits) - 1) / 8;
+        long double new_advance = st.advance;
+        if (cmd.x + cmd.a <= 1) {
+            AMBRO_ASSERT_FORCE(new_advance == 0.0L)
+        } else {
+            AMBRO_ASSERT_FORCE(fabsl(new_advance - fmaxl(-max_advance, fminl(max_advance, k * v_end))) <= 0.5L + 1e-6L)
+        }
+        
+        uint64_t time = 0;
+        for (size_t i = prev_output; i < output.size(); i++) {
+            Command const &o = output[i];
+            long double mid_u = time + 0.5L * o.t;
+            long double mid_pos = output_pos + command_position(o, 0.5L * o.t);
+            time += o.t;
+            output_pos += (o.dir ? 1.0L : -1.0L) * o.x;
+            
+            long double exact = input_pos + command_position(cmd, time) + advance + (new_advance - advance) * time / cmd.t;
+            long double mid_exact = input_pos + command_position(cmd, mid_u) + advance + (new_advance - advance) * mid_u / cmd.t;
+            if (!(fabsl(output_pos - exact) <= 0.5L + 1e-6L) || !(fabsl(mid_pos - mid_exact) <= 1.0L)) {
+                printf("piece=%d pos=%Lf exact=%Lf mid_pos=%Lf mid_exact=%Lf\n", j, output_pos, exact, mid_pos, mid_exact);
+                AMBRO_ASSERT_FORCE(0)
+            }
+        }
+        AMBRO_ASSERT_FORCE(time == cmd.t)
+        AMBRO_ASSERT_FORCE(output.size() - prev_output <= Advance::MaxCommandsPerPiece)
+        
+        input_pos += sign * cmd.x;
+        advance = new_advance;
+        AMBRO_ASSERT_FORCE(output_pos == input_pos + advance)
+    }
+    
+    // Having come to rest, the output is back at the input position.
+    AMBRO_ASSERT_FORCE(advance == 0.0L)
+    AMBRO_ASSERT_FORCE(output_pos == input_pos)
+}
+
+int main ()
+{
+    srand(1);
+    
+    for (int i = 0; i < 3000; i++) {
+        test_sequence(1 + rand() % 50);
+    }
+    
+    printf("All tests passed.\n");
+    return 0;
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <aprinter/math/PrintFloat.h>
+
+using namespace APrinter;
+
+static int num_errors = 0;
+
+template <typename T>
+static void check (T x)
+{
+    char mine[PrintFloatGeneralMaxLength + 1];
+    int len = PrintFloatGeneral<T>(x, mine);
+    mine[len] = '\0';
+    
+    char libc[32];
+    snprintf(libc, sizeof(libc), "%g", (double)x);
+    
+    if (strcmp(mine, libc) != 0) {
+        printf("MISMATCH %.17g: %s vs %s\n", (double)x, mine, libc);
+        num_errors++;
+    }
+}
+
+int main ()
+{
+    double const fixed[] = {
+        0.0, -0.0, 1.0, -1.0, 10.0, 0.5, 2.5, 0.1, 123.456, 100000.0, 999999.0,
+        999999.4, 999999.5, 1e6, 1234567.0, 0.0001, 0.00012345, 9.99999e-5,
+        9.999995e-5, 1e-300, 1e300, 5e-324, 1.7976931348623157e308, INFINITY, -INFINITY,
+    };
+    for (double x : fixed) {
+        check<double>(x);
+        check<float>(x);
+    }
+    
+    // Random bit patterns cover the whole range, random decimals
+    // cover the usual magnitudes more densely.
+    srand(1);
+    for (int i = 0; i < 1000000; i++) {
+        uint64_t bits64 = ((uint64_t)rand() << 40) ^ ((uint64_t)rand() << 20) ^ (uint64_t)rand();
+        uint32_t bits32 = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+        double d;
+        float f;
+        memcpy(&d, &bits64, sizeof(d));
+        memcpy(&f, &bits32, sizeof(f));
+        if (!isnan(d)) {
+            check<double>(d);
+        }
+        if (!isnan(f)) {
+            check<float>(f);
+        }
+        
+        double v = (rand() % 2000001 - 1000000) * pow(10.0, rand() % 12 - 9);
+        check<double>(v);
+        check<float>(v);
+    }
+    
+    if (num_errors > 0) {
+        printf("%d errors\n", num_errors);
+        return 1;
+    }
+    
+    printf("OK\n");
+    return 0;
+}
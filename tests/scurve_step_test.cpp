@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <math.h>
+#include <stdio.h>
+
+#include <aprinter/system/InterruptLockCommon.h>
+
+#define APRINTER_INTERRUPT_LOCK_MODE APRINTER_INTERRUPT_LOCK_MODE_SIMPLE
+
+inline static void cli (void) {}
+inline static void sei (void) {}
+
+#include <aprinter/base/Assert.h>
+#include <aprinter/printer/actuators/SCurveAxisDriver.h>
+
+using namespace APrinter;
+
+static uint8_t const Profiles[] = {SCURVE_PROFILE_NONE, SCURVE_PROFILE_START, SCURVE_PROFILE_END, SCURVE_PROFILE_BOTH};
+
+// The f(u) of the profiles, see SCurveAxisDriver, and its second and third derivatives.
+static long double profile_f (uint8_t profile, long double u)
+{
+    switch (profile) {
+        case SCURVE_PROFILE_START: return u * u * u * (3.0L - 3.0L * u + u * u);
+        case SCURVE_PROFILE_END:   return u * u * (1.0L - u + 2.0L * u * u - u * u * u);
+        case SCURVE_PROFILE_BOTH:  return u * u * u * (2.0L - u);
+        default:                   return u * u;
+    }
+}
+
+static long double profile_f2 (uint8_t profile, long double u)
+{
+    switch (profile) {
+        case SCURVE_PROFILE_START: return u * (18.0L - 36.0L * u + 20.0L * u * u);
+        case SCURVE_PROFILE_END:   return 2.0L - 6.0L * u + 24.0L * u * u - 20.0L * u * u * u;
+        case SCURVE_PROFILE_BOTH:  return 12.0L * u * (1.0L - u);
+        default:                   return 2.0L;
+    }
+}
+
+static long double profile_f3 (uint8_t profile, long double u)
+{
+    switch (profile) {
+        case SCURVE_PROFILE_START: return 18.0L - 72.0L * u + 60.0L * u * u;
+        case SCURVE_PROFILE_END:   return -6.0L + 48.0L * u - 60.0L * u * u;
+        case SCURVE_PROFILE_BOTH:  return 12.0L - 24.0L * u;
+        default:                   return 0.0L;
+    }
+}
+
+static long double position (uint8_t profile, long double v0, long double a, long double u)
+{
+    return v0 * u + a * profile_f(profile, u);
+}
+
+// Reference root by plain bisection in long double.
+static long double exact_step_time (uint8_t profile, long double v0, long double a, long double k)
+{
+    long double lo = 0.0L;
+    long double hi = 1.0L;
+    for (int i = 0; i < 100; i++) {
+        long double mid = 0.5L * (lo + hi);
+        if (position(profile, v0, a, mid) < k) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Checks the end conditions of the profiles, that the polynomials used by
+// the driver match them, that the acceleration peaks at most 1.5 times the
+// planned acceleration A, and that the jerk stays within JerkFactor*A/T.
+static void test_profiles ()
+{
+    for (uint8_t profile : Profiles) {
+        bool smooth_start = (profile & SCURVE_PROFILE_START);
+        bool smooth_end = (profile & SCURVE_PROFILE_END);
+        
+        AMBRO_ASSERT_FORCE(fabsl(profile_f(profile, 1.0L) - 1.0L) < 1e-15L)
+        AMBRO_ASSERT_FORCE(fabsl(profile_f2(profile, 0.0L) - (smooth_start ? 0.0L : 2.0L)) < 1e-15L)
+        AMBRO_ASSERT_FORCE(fabsl(profile_f2(profile, 1.0L) - (smooth_end ? 0.0L : 2.0L)) < 1e-15L)
+        
+        SCurvePoly<long double> poly = SCurveMakePoly<long double>(0.0L, 1.0L, profile);
+        long double max_f2 = 0.0L;
+        long double max_f3 = 0.0L;
+        long double prev_f = 0.0L;
+        for (int i = 0; i <= 10000; i++) {
+            long double u = i / 10000.0L;
+            long double f = u * (poly.v0 + u * (poly.k2 + u * (poly.k3 + u * (poly.k4 + u * poly.k5))));
+            AMBRO_ASSERT_FORCE(fabsl(f - profile_f(profile, u)) < 1e-15L)
+            AMBRO_ASSERT_FORCE(f >= prev_f)
+            max_f2 = fmaxl(max_f2, profile_f2(profile, u));
+            max_f3 = fmaxl(max_f3, fabsl(profile_f3(profile, u)));
+            if (i > 0) {
+                long double f2_prev = profile_f2(profile, u - 1e-4L);
+                AMBRO_ASSERT_FORCE(fabsl((profile_f2(profile, u) - f2_prev) / 1e-4L - profile_f3(profile, u - 0.5e-4L)) < 1e-6L)
+            }
+            AMBRO_ASSERT_FORCE(profile_f2(profile, u) >= 0.0L)
+            prev_f = f;
+        }
+        
+        // The planned acceleration corresponds to f'' = 2.
+        long double peak = max_f2 / 2.0L;
+        AMBRO_ASSERT_FORCE(peak <= 1.5L + 1e-12L)
+        if (profile == SCURVE_PROFILE_BOTH) {
+            AMBRO_ASSERT_FORCE(fabsl(peak - 1.5L) < 1e-6L)
+        }
+        
+        // The jerk is a*f'''/T^3 = A*f'''/(2*T).
+        long double jerk_factor = max_f3 / 2.0L;
+        AMBRO_ASSERT_FORCE(jerk_factor <= 9.0L + 1e-12L)
+        if (profile != SCURVE_PROFILE_NONE) {
+            AMBRO_ASSERT_FORCE(fabsl(jerk_factor - ((profile == SCURVE_PROFILE_BOTH) ? 6.0L : 9.0L)) < 1e-12L)
+        }
+    }
+}
+
+// Checks that a command planned at the largest acceleration the planner
+// allows, MaxAccel/AccelPeakFactor, stays within MaxAccel at every point.
+static void test_peak_accel ()
+{
+    static long double const MaxAccels[] = {100.0L, 3000.0L, 250000.0L}; // steps/s^2
+    static long double const Durations[] = {1e-3L, 0.02L, 0.5L}; // s
+    
+    for (uint8_t profile : Profiles) {
+        for (long double max_accel : MaxAccels) {
+            for (long double t : Durations) {
+                // The planned acceleration A = 2*a/T^2.
+                long double planned_accel = max_accel / (long double)SCurveAccelPeakFactor;
+                long double a = planned_accel * t * t / 2.0L;
+                long double peak_accel = 0.0L;
+                for (int i = 0; i <= 10000; i++) {
+                    long double u = i / 10000.0L;
+                    peak_accel = fmaxl(peak_accel, a * profile_f2(profile, u) / (t * t));
+                }
+                AMBRO_ASSERT_FORCE(peak_accel <= max_accel * (1.0L + 1e-12L))
+            }
+        }
+    }
+}
+
+template <typename FpType>
+static void test_command (uint8_t profile, int x, int a, double t, double max_rel_error)
+{
+    SCurvePoly<FpType> poly = SCurveMakePoly<FpType>((FpType)x - (FpType)a, (FpType)a, profile);
+    FpType tolerance = (FpType)0.25f / (FpType)t;
+    
+    FpType u = 0.0f;
+    for (int k = 1; k < x; k++) {
+        // Like the driver, solve step 1 fully and the others with the
+        // iteration limit of the step interrupt.
+        int max_iterations = (k == 1) ? SCurveCommandSolveIterations : SCurveStepSolveIterations;
+        FpType u_next = SCurveSolveStepTime<FpType>(poly, tolerance, (FpType)k, u, max_iterations);
+        AMBRO_ASSERT_FORCE(u_next >= u)
+        AMBRO_ASSERT_FORCE(u_next <= 1.0f)
+        
+        long double exact = exact_step_time(profile, x - a, a, k);
+        double error_ticks = fabsl(u_next - exact) * t;
+        if (!(error_ticks <= 0.5 + max_rel_error * t)) {
+            printf("profile=%d x=%d a=%d t=%f k=%d error=%f ticks\n", (int)profile, x, a, t, k, error_ticks);
+            AMBRO_ASSERT_FORCE(0)
+        }
+        
+        u = u_next;
+    }
+}
+
+template <typename FpType>
+static void test_random (int count, double max_t, double max_rel_error)
+{
+    for (int i = 0; i < count; i++) {
+        uint8_t profile = Profiles[rand() % 4];
+        int x = 1 + rand() % 2000;
+        int a;
+        switch (rand() % 4) {
+            case 0: a = x; break;
+            case 1: a = -x; break;
+            case 2: a = 0; break;
+            default: a = rand() % (2 * x + 1) - x; break;
+        }
+        double t = 1000.0 + (max_t - 1000.0) * (rand() / (double)RAND_MAX);
+        test_command<FpType>(profile, x, a, t, max_rel_error);
+    }
+}
+
+int main ()
+{
+    test_profiles();
+    test_peak_accel();
+    
+    srand(1);
+    test_random<double>(2000, 1e8, 0.0);
+    
+    // Near the end of a deceleration to rest, p(u) is flat and the
+    // root is only as good as float resolution of the position allows.
+    test_random<float>(2000, 1e6, 4e-6);
+    
+    printf("All tests passed.\n");
+    return 0;
+}
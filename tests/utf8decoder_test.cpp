@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <aprinter/base/Assert.h>
+#include <aprinter/misc/Utf8Encoder.h>
+#include <aprinter/misc/Utf8Decoder.h>
+
+using namespace APrinter;
+
+static bool decode_fails (char const *data, size_t len)
+{
+    uint32_t ch;
+    return Utf8DecodeChar(data, len, &ch) == 0;
+}
+
+int main ()
+{
+    // Everything the encoder produces must decode back.
+    for (uint32_t ch = 0; ch < UINT32_C(0x10FFFF); ch++) {
+        char buf[4];
+        int len = Utf8EncodeChar(ch, buf);
+        if (len == 0) {
+            AMBRO_ASSERT_FORCE(ch >= UINT32_C(0xD800) && ch <= UINT32_C(0xDFFF))
+            continue;
+        }
+        uint32_t dec_ch;
+        AMBRO_ASSERT_FORCE(Utf8DecodeChar(buf, len, &dec_ch) == len)
+        AMBRO_ASSERT_FORCE(dec_ch == ch)
+        AMBRO_ASSERT_FORCE(decode_fails(buf, len - 1))
+    }
+    
+    AMBRO_ASSERT_FORCE(decode_fails("", 0))
+    AMBRO_ASSERT_FORCE(decode_fails("\x80", 1))
+    AMBRO_ASSERT_FORCE(decode_fails("\xC3\x28", 2))
+    AMBRO_ASSERT_FORCE(decode_fails("\xC0\xAF", 2))
+    AMBRO_ASSERT_FORCE(decode_fails("\xE0\x80\xAF", 3))
+    AMBRO_ASSERT_FORCE(decode_fails("\xED\xA0\x80", 3))
+    AMBRO_ASSERT_FORCE(decode_fails("\xF4\x90\x80\x80", 4))
+    AMBRO_ASSERT_FORCE(decode_fails("\xF8\x88\x80\x80\x80", 5))
+    
+    uint32_t ch;
+    AMBRO_ASSERT_FORCE(Utf8DecodeChar("a\xC3\xA4", 3, &ch) == 1 && ch == 'a')
+    AMBRO_ASSERT_FORCE(Utf8DecodeChar("\xC3\xA4z", 3, &ch) == 2 && ch == 0xE4)
+    
+    printf("All good\n");
+    return 0;
+}
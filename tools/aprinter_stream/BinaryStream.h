@@ -0,0 +1,382 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef APRINTER_TOOLS_BINARY_STREAM_H
+#define APRINTER_TOOLS_BINARY_STREAM_H
+
+/*
+ * Host side of binary g-code streaming: encoding of g-code lines into
+ * packets (doc/encoding.txt) and the framing and flow control protocol
+ * implemented by BinaryFrameParser in the firmware (see README.md).
+ * This is plain C++11 for the host and is not used by the firmware.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <string>
+#include <deque>
+#include <utility>
+
+#include <aprinter/misc/CrcItuT.h>
+
+namespace APrinter {
+namespace BinaryStream {
+
+static uint8_t const FrameSyncByte = 0xA5;
+static size_t const FrameOverhead = 5;
+static size_t const SyncFrameSize = FrameOverhead;
+static int const MaxOutstandingFrames = 128;
+static int const MaxOutstandingSyncs = 4;
+static uint32_t const MaxTimeoutBackoff = 64;
+
+enum class EncodeResult {OK, EMPTY, ERROR};
+
+inline void append_le32 (std::string *out, uint32_t x)
+{
+    for (int i = 0; i < 4; i++) {
+        out->push_back((char)(x >> (8 * i)));
+    }
+}
+
+/**
+ * Encodes one g-code line into a packet, following the encoder rules in
+ * doc/encoding.txt, for a decoder which accepts float, uint32 and void
+ * (values which need an uint64 are sent as floats).
+ * Comments, line numbers and checksums are removed.
+ * Returns EMPTY if there is no command in the line.
+ */
+inline EncodeResult encodeLine (char const *line, int max_parts, std::string *packet, char const **err)
+{
+    static int const MaxPartsLimit = 14;
+    
+    packet->clear();
+    
+    std::string index;
+    std::string payload;
+    char cmd_code = 0;
+    uint32_t cmd_num = 0;
+    int num_parts = 0;
+    
+    char const *p = line;
+    while (1) {
+        while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+            p++;
+        }
+        if (*p == '\0' || *p == ';' || *p == '*') {
+            break;
+        }
+        if (*p == '(') {
+            char const *end = strchr(p, ')');
+            if (!end) {
+                break;
+            }
+            p = end + 1;
+            continue;
+        }
+        
+        char code = toupper((unsigned char)*p++);
+        char const *value = p;
+        while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n' && *p != ';' && *p != '*') {
+            p++;
+        }
+        size_t value_len = p - value;
+        
+        if (code < 'A' || code > 'Z') {
+            *err = "invalid letter";
+            return EncodeResult::ERROR;
+        }
+        
+        if (code == 'N' && !cmd_code) {
+            continue;
+        }
+        
+        std::string value_str(value, value_len);
+        
+        if (!cmd_code) {
+            char *end;
+            unsigned long num = strtoul(value_str.c_str(), &end, 10);
+            if (value_len == 0 || *end != '\0' || num >= 2048) {
+                *err = "invalid command number";
+                return EncodeResult::ERROR;
+            }
+            cmd_code = code;
+            cmd_num = num;
+            continue;
+        }
+        
+        if (num_parts >= max_parts || num_parts >= MaxPartsLimit) {
+            *err = "too many parameters";
+            return EncodeResult::ERROR;
+        }
+        num_parts++;
+        
+        int type;
+        if (value_len == 0) {
+            type = 5;
+        } else {
+            bool is_integer = (strspn(value_str.c_str(), "0123456789") == value_len);
+            unsigned long long int_val = is_integer ? strtoull(value_str.c_str(), nullptr, 10) : 0;
+            if (is_integer && int_val <= UINT32_MAX) {
+                type = 3;
+                append_le32(&payload, int_val);
+            } else {
+                char *end;
+                float val = strtof(value_str.c_str(), &end);
+                if (*end != '\0') {
+                    *err = "invalid parameter value";
+                    return EncodeResult::ERROR;
+                }
+                uint32_t bits;
+                static_assert(sizeof(val) == sizeof(bits), "");
+                memcpy(&bits, &val, sizeof(bits));
+                type = 1;
+                append_le32(&payload, bits);
+            }
+        }
+        index.push_back((char)((type << 5) | (code - 'A')));
+    }
+    
+    if (!cmd_code) {
+        return EncodeResult::EMPTY;
+    }
+    
+    int short_type = 0;
+    if (cmd_code == 'G') {
+        switch (cmd_num) {
+            case 0: short_type = 1; break;
+            case 1: short_type = 2; break;
+            case 92: short_type = 3; break;
+        }
+    }
+    
+    if (short_type) {
+        packet->push_back((char)((short_type << 4) | num_parts));
+    } else {
+        packet->push_back((char)((15 << 4) | num_parts));
+        packet->push_back((char)(((cmd_code - 'A') << 3) | (cmd_num >> 8)));
+        packet->push_back((char)(cmd_num & 0xFF));
+    }
+    *packet += index;
+    *packet += payload;
+    
+    return EncodeResult::OK;
+}
+
+inline void appendFrame (std::string *out, uint8_t seq, char const *packet, size_t length)
+{
+    char header[2] = {(char)seq, (char)length};
+    uint16_t crc = CrcItuTUpdate(CrcItuTInitial, header, sizeof(header));
+    crc = CrcItuTUpdate(crc, packet, length);
+    
+    out->push_back((char)FrameSyncByte);
+    out->append(header, sizeof(header));
+    out->append(packet, length);
+    out->push_back((char)(crc & 0xFF));
+    out->push_back((char)(crc >> 8));
+}
+
+/**
+ * Flow control for streaming frames to the firmware, independent of
+ * the transport. The user queues packets while canQueue() allows,
+ * writes out whatever takeOutput() gives, feeds each received line to
+ * handleLine(), and calls handleTimeout() when nothing was received
+ * for a while but frames are outstanding.
+ * 
+ * The window is the byte count reported by M948; the queued frames
+ * plus possible sync frames never exceed it, so the firmware receive
+ * buffer cannot overrun. Each accepted frame is acknowledged by an "ok"
+ * in order. After a "Resend:" or a timeout, sending stops and a sync
+ * frame is sent. Its reply comes after the firmware has gone through
+ * everything sent before it, so the unacknowledged frames can then be
+ * sent again without exceeding the window.
+ */
+class FrameStreamer {
+public:
+    enum class LineType {OK, PROTOCOL, OTHER, ERROR};
+    
+    explicit FrameStreamer (size_t window)
+    : m_window(window),
+      m_queued_bytes(0),
+      m_next_seq(0),
+      m_num_sent(0),
+      m_recovering(false),
+      m_sync_token(0),
+      m_syncs_outstanding(0),
+      m_timeout_count(0),
+      m_timeout_backoff(1),
+      m_num_resends(0)
+    {}
+    
+    bool canQueue (size_t packet_size) const
+    {
+        return m_frames.size() < (size_t)MaxOutstandingFrames &&
+               m_queued_bytes + FrameOverhead + packet_size + MaxOutstandingSyncs * SyncFrameSize <= m_window;
+    }
+    
+    void queuePacket (std::string const &packet)
+    {
+        Frame frame;
+        frame.seq = m_next_seq++;
+        appendFrame(&frame.data, frame.seq, packet.data(), packet.size());
+        m_queued_bytes += frame.data.size();
+        m_frames.push_back(std::move(frame));
+    }
+    
+    bool isIdle () const
+    {
+        return m_frames.empty() && !m_recovering;
+    }
+    
+    size_t numOutstanding () const
+    {
+        return m_frames.size();
+    }
+    
+    uint32_t numResends () const
+    {
+        return m_num_resends;
+    }
+    
+    void takeOutput (std::string *out)
+    {
+        if (!m_output.empty()) {
+            *out += m_output;
+            m_output.clear();
+        }
+        if (!m_recovering) {
+            for (; m_num_sent < m_frames.size(); m_num_sent++) {
+                *out += m_frames[m_num_sent].data;
+            }
+        }
+    }
+    
+    LineType handleLine (char const *line)
+    {
+        if (!strncmp(line, "ok", 2)) {
+            if (m_frames.empty()) {
+                return LineType::ERROR;
+            }
+            m_queued_bytes -= m_frames.front().data.size();
+            m_frames.pop_front();
+            if (m_num_sent > 0) {
+                m_num_sent--;
+            }
+            return LineType::OK;
+        }
+        
+        if (!strncmp(line, "Resend:", 7)) {
+            if (!m_recovering) {
+                m_num_resends++;
+                start_recovery();
+            }
+            return LineType::PROTOCOL;
+        }
+        
+        if (!strncmp(line, "Sync:", 5)) {
+            char *end;
+            uint8_t token = strtoul(line + 5, &end, 10);
+            char const *next_str = strstr(end, "Next:");
+            if (!next_str) {
+                return LineType::ERROR;
+            }
+            uint8_t next_seq = strtoul(next_str + 5, nullptr, 10);
+            
+            m_syncs_outstanding = (uint8_t)(m_sync_token - token);
+            m_timeout_count = 0;
+            m_timeout_backoff = 1;
+            if (m_recovering && token == m_sync_token) {
+                uint8_t expected = m_frames.empty() ? m_next_seq : m_frames.front().seq;
+                if (next_seq != expected) {
+                    return LineType::ERROR;
+                }
+                m_recovering = false;
+                m_num_sent = 0;
+            }
+            return LineType::PROTOCOL;
+        }
+        
+        return LineType::OTHER;
+    }
+    
+    void handleTimeout ()
+    {
+        if (m_frames.empty() && !m_recovering) {
+            return;
+        }
+        
+        // A lost sync frame is never answered, but neither is one behind
+        // a long running command such as M109. Once all allowed syncs are
+        // outstanding, assume one was lost, at exponentially increasing
+        // intervals so that a busy firmware does not get its buffer filled.
+        if (m_syncs_outstanding >= MaxOutstandingSyncs) {
+            if (++m_timeout_count < m_timeout_backoff) {
+                return;
+            }
+            m_timeout_count = 0;
+            if (m_timeout_backoff < MaxTimeoutBackoff) {
+                m_timeout_backoff *= 2;
+            }
+            m_syncs_outstanding--;
+        }
+        start_recovery();
+    }
+
+private:
+    struct Frame {
+        uint8_t seq;
+        std::string data;
+    };
+    
+    void start_recovery ()
+    {
+        m_recovering = true;
+        if (m_syncs_outstanding < MaxOutstandingSyncs) {
+            m_syncs_outstanding++;
+            m_sync_token++;
+            appendFrame(&m_output, m_sync_token, "", 0);
+        }
+    }
+    
+    size_t m_window;
+    std::deque<Frame> m_frames;
+    size_t m_queued_bytes;
+    uint8_t m_next_seq;
+    size_t m_num_sent;
+    bool m_recovering;
+    uint8_t m_sync_token;
+    int m_syncs_outstanding;
+    uint32_t m_timeout_count;
+    uint32_t m_timeout_backoff;
+    uint32_t m_num_resends;
+    std::string m_output;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,399 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Streams a g-code file to the firmware using binary framing (M948),
+ * over a serial port or a TCP console, or encodes it into a binary file
+ * for the SD card like aprinter_encode.py.
+ * 
+ * Build (from this directory):
+ *   g++ -std=c++11 -O2 -I../.. -o aprinter_stream aprinter_stream.cpp
+ * 
+ * Usage:
+ *   aprinter_stream encode <input.gcode> <output.bin>
+ *   aprinter_stream serial <device> <baud> <input.gcode>
+ *   aprinter_stream tcp <host> <port> <input.gcode>
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <string>
+
+#include "BinaryStream.h"
+
+using namespace APrinter::BinaryStream;
+
+static int const ReplyTimeoutMs = 3000;
+static int const HandshakeTimeoutMs = 10000;
+
+static double now_seconds ()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void fail (char const *msg)
+{
+    fprintf(stderr, "Error: %s\n", msg);
+    exit(1);
+}
+
+static speed_t baud_to_speed (long baud)
+{
+    switch (baud) {
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+        case 230400: return B230400;
+#ifdef B250000
+        case 250000: return B250000;
+#endif
+#ifdef B460800
+        case 460800: return B460800;
+#endif
+#ifdef B500000
+        case 500000: return B500000;
+#endif
+#ifdef B1000000
+        case 1000000: return B1000000;
+#endif
+        default: fail("unsupported baud rate");
+    }
+    return B0;
+}
+
+static int open_serial (char const *device, long baud)
+{
+    int fd = open(device, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        fail("cannot open serial device");
+    }
+    struct termios tio;
+    if (tcgetattr(fd, &tio) < 0) {
+        fail("tcgetattr failed");
+    }
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    cfsetispeed(&tio, baud_to_speed(baud));
+    cfsetospeed(&tio, baud_to_speed(baud));
+    if (tcsetattr(fd, TCSANOW, &tio) < 0) {
+        fail("tcsetattr failed");
+    }
+    tcflush(fd, TCIOFLUSH);
+    return fd;
+}
+
+static int open_tcp (char const *host, char const *port)
+{
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *res;
+    if (getaddrinfo(host, port, &hints, &res) != 0) {
+        fail("cannot resolve host");
+    }
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+        fail("cannot connect");
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+class Connection {
+public:
+    explicit Connection (int fd)
+    : m_fd(fd)
+    {
+        fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) | O_NONBLOCK);
+    }
+    
+    // Writes what it can of m_out, waits for input for up to timeout_ms,
+    // and returns false if no complete line was received.
+    bool poll_line (int timeout_ms, std::string *line)
+    {
+        double deadline = now_seconds() + timeout_ms * 1e-3;
+        while (1) {
+            if (extract_line(line)) {
+                return true;
+            }
+            int remaining_ms = (int)((deadline - now_seconds()) * 1e3);
+            if (remaining_ms < 0) {
+                return false;
+            }
+            struct pollfd pfd = {m_fd, (short)(POLLIN | (m_out.empty() ? 0 : POLLOUT)), 0};
+            if (poll(&pfd, 1, remaining_ms) < 0 && errno != EINTR) {
+                fail("poll failed");
+            }
+            if ((pfd.revents & POLLOUT)) {
+                ssize_t res = write(m_fd, m_out.data(), m_out.size());
+                if (res < 0 && errno != EAGAIN && errno != EINTR) {
+                    fail("write failed");
+                }
+                if (res > 0) {
+                    m_out.erase(0, res);
+                }
+            }
+            if ((pfd.revents & (POLLIN | POLLHUP | POLLERR))) {
+                char buf[512];
+                ssize_t res = read(m_fd, buf, sizeof(buf));
+                if (res == 0 || (res < 0 && errno != EAGAIN && errno != EINTR)) {
+                    fail("connection closed");
+                }
+                if (res > 0) {
+                    m_in.append(buf, res);
+                }
+            }
+        }
+    }
+    
+    std::string m_out;
+
+private:
+    bool extract_line (std::string *line)
+    {
+        size_t pos = m_in.find('\n');
+        if (pos == std::string::npos) {
+            return false;
+        }
+        line->assign(m_in, 0, pos);
+        m_in.erase(0, pos + 1);
+        if (!line->empty() && line->back() == '\r') {
+            line->pop_back();
+        }
+        return true;
+    }
+    
+    int m_fd;
+    std::string m_in;
+};
+
+static int do_encode (char const *input_path, char const *output_path)
+{
+    FILE *in = fopen(input_path, "r");
+    if (!in) {
+        fail("cannot open input file");
+    }
+    FILE *out = fopen(output_path, "wb");
+    if (!out) {
+        fail("cannot open output file");
+    }
+    char *line = nullptr;
+    size_t line_cap = 0;
+    unsigned long line_num = 0;
+    std::string packet;
+    while (getline(&line, &line_cap, in) >= 0) {
+        line_num++;
+        char const *err;
+        EncodeResult res = encodeLine(line, 14, &packet, &err);
+        if (res == EncodeResult::ERROR) {
+            fprintf(stderr, "Error: line %lu: %s\n", line_num, err);
+            return 1;
+        }
+        fwrite(packet.data(), 1, packet.size(), out);
+    }
+    fputc(0xE0, out);
+    free(line);
+    fclose(in);
+    if (fclose(out) != 0) {
+        fail("write failed");
+    }
+    return 0;
+}
+
+static int do_stream (int fd, char const *input_path)
+{
+    FILE *in = fopen(input_path, "r");
+    if (!in) {
+        fail("cannot open input file");
+    }
+    
+    Connection conn(fd);
+    std::string line;
+    
+    // An empty line first, in case the firmware has a partial line buffered.
+    conn.m_out = "\nM948\n";
+    long window = -1;
+    int max_parts = 0;
+    while (1) {
+        if (!conn.poll_line(HandshakeTimeoutMs, &line)) {
+            fail("no response to M948");
+        }
+        if (!strncmp(line.c_str(), "BinaryFraming ", 14)) {
+            char const *w = strstr(line.c_str(), "Window:");
+            char const *p = strstr(line.c_str(), "MaxParts:");
+            if (w && p) {
+                window = strtol(w + 7, nullptr, 10);
+                max_parts = strtol(p + 9, nullptr, 10);
+            }
+        }
+        else if (!strncmp(line.c_str(), "ok", 2)) {
+            break;
+        }
+        else {
+            printf("%s\n", line.c_str());
+        }
+    }
+    if (window <= 0 || max_parts <= 0) {
+        fail("binary framing is not supported by the firmware");
+    }
+    
+    FrameStreamer streamer(window);
+    char *in_line = nullptr;
+    size_t in_line_cap = 0;
+    unsigned long line_num = 0;
+    unsigned long num_commands = 0;
+    unsigned long num_errors = 0;
+    std::string packet;
+    bool have_packet = false;
+    bool input_done = false;
+    bool exit_queued = false;
+    double start_time = now_seconds();
+    double last_rx_time = start_time;
+    
+    while (1) {
+        while (1) {
+            if (!have_packet) {
+                if (!input_done) {
+                    if (getline(&in_line, &in_line_cap, in) < 0) {
+                        input_done = true;
+                        continue;
+                    }
+                    line_num++;
+                    char const *err;
+                    EncodeResult res = encodeLine(in_line, max_parts, &packet, &err);
+                    if (res == EncodeResult::ERROR) {
+                        fprintf(stderr, "Error: line %lu: %s\n", line_num, err);
+                        return 1;
+                    }
+                    have_packet = (res == EncodeResult::OK);
+                    num_commands += have_packet;
+                }
+                else if (!exit_queued) {
+                    // Return the console to text mode at the end.
+                    char const *err;
+                    encodeLine("M948 S0", max_parts, &packet, &err);
+                    have_packet = true;
+                    exit_queued = true;
+                }
+                else {
+                    break;
+                }
+            }
+            if (!streamer.canQueue(packet.size())) {
+                break;
+            }
+            streamer.queuePacket(packet);
+            have_packet = false;
+        }
+        
+        if (exit_queued && !have_packet && streamer.isIdle()) {
+            break;
+        }
+        
+        streamer.takeOutput(&conn.m_out);
+        
+        bool got_line = conn.poll_line(ReplyTimeoutMs, &line);
+        double now = now_seconds();
+        if (got_line) {
+            last_rx_time = now;
+            switch (streamer.handleLine(line.c_str())) {
+                case FrameStreamer::LineType::ERROR:
+                    fprintf(stderr, "Error: unexpected reply: %s\n", line.c_str());
+                    return 1;
+                case FrameStreamer::LineType::OTHER:
+                    if (!strncmp(line.c_str(), "Error:", 6)) {
+                        num_errors++;
+                    }
+                    printf("%s\n", line.c_str());
+                    break;
+                default:
+                    break;
+            }
+        }
+        else if (now - last_rx_time >= ReplyTimeoutMs * 1e-3) {
+            last_rx_time = now;
+            streamer.handleTimeout();
+        }
+    }
+    
+    double elapsed = now_seconds() - start_time;
+    fprintf(stderr, "%lu commands in %.2f s (%.0f/s), %lu errors, %lu resend requests\n",
+            num_commands, elapsed, num_commands / elapsed, num_errors, (unsigned long)streamer.numResends());
+    
+    free(in_line);
+    fclose(in);
+    return (num_errors > 0);
+}
+
+int main (int argc, char *argv[])
+{
+    if (argc == 4 && !strcmp(argv[1], "encode")) {
+        return do_encode(argv[2], argv[3]);
+    }
+    if (argc == 5 && !strcmp(argv[1], "serial")) {
+        return do_stream(open_serial(argv[2], strtol(argv[3], nullptr, 10)), argv[4]);
+    }
+    if (argc == 5 && !strcmp(argv[1], "tcp")) {
+        return do_stream(open_tcp(argv[2], argv[3]), argv[4]);
+    }
+    fprintf(stderr,
+        "Usage:\n"
+        "  %s encode <input.gcode> <output.bin>\n"
+        "  %s serial <device> <baud> <input.gcode>\n"
+        "  %s tcp <host> <port> <input.gcode>\n",
+        argv[0], argv[0], argv[0]);
+    return 1;
+}
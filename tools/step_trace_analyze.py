@@ -0,0 +1,331 @@
+#! /usr/bin/env nix-shell
+#! nix-shell -i "python2.7 -B" -p python27
+
+# Copyright (c) 2016 Ambroz Bizjak
+# All rights reserved.
+# 
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+# 
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+# DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+# (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+# LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+# ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+# SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+# Analyzes a step trace recorded by the Linux port with LinuxTracePins
+# (aprinter.elf --step-trace=FILE). For each channel it reconstructs the
+# position, velocity and acceleration from the step and direction events,
+# and reports histograms of the step latency (actual time minus the time
+# the stepper timer was set for) and of the step interval jitter (actual
+# minus planned interval), as well as the position deviation from the
+# planned trajectory. With the --max-* options it exits with status 1 if
+# a limit is exceeded, so it can be used as a regression test.
+
+from __future__ import print_function
+from __future__ import division
+import argparse
+import struct
+import sys
+
+HEADER_FORMAT = '<4sHHII'
+RECORD_FORMAT = '<IIBBBB'
+MAGIC = b'APST'
+VERSION = 1
+
+EVENT_STEP = 0
+EVENT_DIR = 1
+EVENT_OVERFLOW = 2
+
+HISTOGRAM_BOUNDS_US = [1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000]
+
+class TraceFormatError(Exception):
+    pass
+
+class Step(object):
+    __slots__ = ('planned', 'actual', 'dir', 'planned_valid')
+    
+    def __init__(self, planned, actual, dir, planned_valid):
+        self.planned = planned
+        self.actual = actual
+        self.dir = dir
+        self.planned_valid = planned_valid
+
+class Channel(object):
+    def __init__(self, index):
+        self.index = index
+        self.steps = []
+        self.dir = 1
+        self.dropped = 0
+        self.step_events = 0
+        self.dir_events = 0
+
+def read_trace(f, args):
+    header_size = struct.calcsize(HEADER_FORMAT)
+    record_size = struct.calcsize(RECORD_FORMAT)
+    
+    header = f.read(header_size)
+    if len(header) != header_size:
+        raise TraceFormatError('Truncated header')
+    magic, version, num_channels, ticks_per_sec, _ = struct.unpack(HEADER_FORMAT, header)
+    if magic != MAGIC:
+        raise TraceFormatError('Bad magic')
+    if version != VERSION:
+        raise TraceFormatError('Unsupported version {}'.format(version))
+    if ticks_per_sec == 0:
+        raise TraceFormatError('Bad clock frequency')
+    
+    channels = [Channel(i) for i in range(num_channels)]
+    
+    # Times in the trace are 32-bit clock values which wrap around. Records
+    # are close enough in time that each one can be unwrapped relative to
+    # the actual time of the previous record.
+    reference = None
+    offset = 0
+    
+    while True:
+        data = f.read(record_size)
+        if len(data) < record_size:
+            break
+        set_time, actual_time, channel, type, level, flags = struct.unpack(RECORD_FORMAT, data)
+        if channel >= num_channels:
+            raise TraceFormatError('Bad channel {}'.format(channel))
+        ch = channels[channel]
+        
+        if type == EVENT_OVERFLOW:
+            ch.dropped += actual_time
+            continue
+        
+        if reference is None:
+            reference = actual_time
+        offset += signed_diff(actual_time, reference)
+        reference = actual_time
+        actual = offset
+        planned = offset + signed_diff(set_time, actual_time)
+        
+        if type == EVENT_DIR:
+            ch.dir_events += 1
+            positive = bool(level) != (channel in args.invert_dir)
+            ch.dir = 1 if positive else -1
+        elif type == EVENT_STEP:
+            ch.step_events += 1
+            if bool(level) == args.step_level:
+                ch.steps.append(Step(planned, actual, ch.dir, bool(flags & 1)))
+        else:
+            raise TraceFormatError('Bad event type {}'.format(type))
+    
+    return ticks_per_sec, channels
+
+def signed_diff(a, b):
+    diff = (a - b) & 0xFFFFFFFF
+    if diff >= 0x80000000:
+        diff -= 0x100000000
+    return diff
+
+def percentile(sorted_values, p):
+    if len(sorted_values) == 0:
+        return 0.0
+    index = min(len(sorted_values) - 1, int(p * len(sorted_values)))
+    return sorted_values[index]
+
+def print_histogram(title, values_us):
+    print('  {} histogram [us]:'.format(title))
+    counts = [0] * (len(HISTOGRAM_BOUNDS_US) + 1)
+    for value in values_us:
+        magnitude = abs(value)
+        bucket = 0
+        while bucket < len(HISTOGRAM_BOUNDS_US) and magnitude >= HISTOGRAM_BOUNDS_US[bucket]:
+            bucket += 1
+        counts[bucket] += 1
+    total = max(1, len(values_us))
+    lower = 0
+    for bucket, count in enumerate(counts):
+        if bucket < len(HISTOGRAM_BOUNDS_US):
+            label = '{:>5} - {:<5}'.format(lower, HISTOGRAM_BOUNDS_US[bucket])
+            lower = HISTOGRAM_BOUNDS_US[bucket]
+        else:
+            label = '{:>5} -      '.format(lower)
+        if count > 0:
+            bar = '#' * max(1, int(round(50.0 * count / total)))
+            print('    {} {:>9} {:7.3f}% {}'.format(label, count, 100.0 * count / total, bar))
+
+def print_stats(title, values_us):
+    sorted_values = sorted(values_us)
+    mean = sum(sorted_values) / max(1, len(sorted_values))
+    print('  {}: mean={:.2f} p50={:.2f} p99={:.2f} p99.9={:.2f} min={:.2f} max={:.2f} [us]'.format(
+        title, mean, percentile(sorted_values, 0.5), percentile(sorted_values, 0.99),
+        percentile(sorted_values, 0.999), sorted_values[0] if sorted_values else 0.0,
+        sorted_values[-1] if sorted_values else 0.0))
+
+def kinematics(times, positions):
+    # Velocity over each step interval (in steps per second), and
+    # acceleration between the midpoints of consecutive intervals.
+    velocities = []
+    for i in range(1, len(times)):
+        dt = times[i] - times[i - 1]
+        if dt > 0.0:
+            velocities.append(((times[i] + times[i - 1]) / 2.0, (positions[i] - positions[i - 1]) / dt))
+    accelerations = []
+    for i in range(1, len(velocities)):
+        dt = velocities[i][0] - velocities[i - 1][0]
+        if dt > 0.0:
+            accelerations.append(((velocities[i][0] + velocities[i - 1][0]) / 2.0, (velocities[i][1] - velocities[i - 1][1]) / dt))
+    return velocities, accelerations
+
+def analyze_channel(ch, name, ticks_per_sec, args, csv_file):
+    tick_us = 1e6 / ticks_per_sec
+    steps = ch.steps
+    
+    print('Channel {} ({}): {} steps, {} dir events, {} dropped events'.format(
+        ch.index, name, len(steps), ch.dir_events, ch.dropped))
+    
+    result = {'latency_max': 0.0, 'jitter_max': 0.0, 'deviation_max': 0.0, 'dropped': ch.dropped}
+    if len(steps) == 0:
+        return result
+    
+    position = 0
+    positions = []
+    actual_times = []
+    planned_times = []
+    for step in steps:
+        position += step.dir
+        positions.append(position)
+        actual_times.append(step.actual / ticks_per_sec)
+        planned_times.append(step.planned / ticks_per_sec)
+    print('  final position: {} steps'.format(position) + (' ({:.4f} units)'.format(position / args.steps_per_unit) if args.steps_per_unit else ''))
+    
+    # Latency of each step relative to the time the timer was set for.
+    latencies = [(s.actual - s.planned) * tick_us for s in steps if s.planned_valid]
+    if len(latencies) > 0:
+        print_stats('latency', latencies)
+        if not args.no_histograms:
+            print_histogram('latency', latencies)
+        result['latency_max'] = max(latencies)
+    
+    # Jitter of each step interval, i.e. how much the actual interval
+    # between consecutive steps differs from the planned one.
+    jitters = []
+    for i in range(1, len(steps)):
+        if steps[i].planned_valid and steps[i - 1].planned_valid:
+            actual_interval = steps[i].actual - steps[i - 1].actual
+            planned_interval = steps[i].planned - steps[i - 1].planned
+            jitters.append((actual_interval - planned_interval) * tick_us)
+    if len(jitters) > 0:
+        print_stats('interval jitter', jitters)
+        if not args.no_histograms:
+            print_histogram('interval jitter', jitters)
+        result['jitter_max'] = max(abs(j) for j in jitters)
+    
+    planned_vel, planned_acc = kinematics(planned_times, positions)
+    actual_vel, actual_acc = kinematics(actual_times, positions)
+    
+    # Deviation from the planned trajectory: at the time each step actually
+    # happened, how far off the planned position was from the actual one.
+    # The planned position is interpolated between planned step times.
+    deviations = []
+    j = 0
+    for i, step in enumerate(steps):
+        t = actual_times[i]
+        while j + 1 < len(planned_times) and planned_times[j + 1] <= t:
+            j += 1
+        if planned_times[j] > t:
+            planned_pos = positions[j] - steps[j].dir
+        elif j + 1 < len(planned_times) and planned_times[j + 1] > planned_times[j]:
+            frac = (t - planned_times[j]) / (planned_times[j + 1] - planned_times[j])
+            planned_pos = positions[j] + frac * (positions[j + 1] - positions[j])
+        else:
+            planned_pos = positions[j]
+        deviations.append(abs(positions[i] - planned_pos))
+    result['deviation_max'] = max(deviations)
+    
+    speed_scale = 1.0 / args.steps_per_unit if args.steps_per_unit else 1.0
+    unit = 'units' if args.steps_per_unit else 'steps'
+    print('  max speed: planned={:.2f} actual={:.2f} [{}/s]'.format(
+        max(abs(v) for _, v in planned_vel) * speed_scale if planned_vel else 0.0,
+        max(abs(v) for _, v in actual_vel) * speed_scale if actual_vel else 0.0, unit))
+    print('  max accel: planned={:.1f} actual={:.1f} [{}/s^2]'.format(
+        max(abs(a) for _, a in planned_acc) * speed_scale if planned_acc else 0.0,
+        max(abs(a) for _, a in actual_acc) * speed_scale if actual_acc else 0.0, unit))
+    print('  max deviation from planned trajectory: {:.3f} steps'.format(result['deviation_max']))
+    
+    if csv_file is not None:
+        for i in range(len(steps)):
+            v = actual_vel[i - 1][1] if 0 < i <= len(actual_vel) else 0.0
+            a = actual_acc[i - 2][1] if 1 < i <= len(actual_acc) + 1 else 0.0
+            csv_file.write('{},{:.9f},{:.9f},{},{:.3f},{:.3f},{:.3f}\n'.format(
+                name, planned_times[i], actual_times[i], positions[i], v * speed_scale, a * speed_scale, deviations[i]))
+    
+    return result
+
+def main():
+    parser = argparse.ArgumentParser(description='Analyze an APrinter step trace.')
+    parser.add_argument('trace', help='Trace file written with --step-trace')
+    parser.add_argument('--names', default='', help='Comma-separated channel names, e.g. X,Y,Z,E')
+    parser.add_argument('--steps-per-unit', type=float, default=0.0, help='Steps per unit for reporting speed/position in units')
+    parser.add_argument('--step-level-low', action='store_true', help='Steps are active-low (StepLevel=false)')
+    parser.add_argument('--invert-dir', default='', help='Comma-separated channels with inverted direction')
+    parser.add_argument('--csv', help='Write per-step planned/actual time, position, velocity, acceleration and deviation to this file')
+    parser.add_argument('--no-histograms', action='store_true', help='Only print summary statistics')
+    parser.add_argument('--max-latency-us', type=float, help='Fail if any step latency exceeds this')
+    parser.add_argument('--max-jitter-us', type=float, help='Fail if any step interval jitter exceeds this')
+    parser.add_argument('--max-deviation-steps', type=float, help='Fail if the deviation from the planned trajectory exceeds this')
+    parser.add_argument('--allow-dropped', action='store_true', help='Do not fail if events were dropped')
+    args = parser.parse_args()
+    
+    args.step_level = not args.step_level_low
+    args.invert_dir = set(int(x) for x in args.invert_dir.split(',') if x != '')
+    names = [x for x in args.names.split(',') if x != '']
+    
+    try:
+        with open(args.trace, 'rb') as f:
+            ticks_per_sec, channels = read_trace(f, args)
+    except (IOError, TraceFormatError) as e:
+        print('Error: {}'.format(e), file=sys.stderr)
+        return 2
+    
+    print('Clock: {} ticks/s ({:.3f} us/tick)'.format(ticks_per_sec, 1e6 / ticks_per_sec))
+    
+    csv_file = None
+    if args.csv:
+        csv_file = open(args.csv, 'w')
+        csv_file.write('channel,planned_time,actual_time,position,velocity,acceleration,deviation\n')
+    
+    failures = []
+    for ch in channels:
+        if len(ch.steps) == 0 and ch.dir_events == 0 and ch.dropped == 0:
+            continue
+        name = names[ch.index] if ch.index < len(names) else str(ch.index)
+        res = analyze_channel(ch, name, ticks_per_sec, args, csv_file)
+        if args.max_latency_us is not None and res['latency_max'] > args.max_latency_us:
+            failures.append('{}: latency {:.2f} us > {:.2f} us'.format(name, res['latency_max'], args.max_latency_us))
+        if args.max_jitter_us is not None and res['jitter_max'] > args.max_jitter_us:
+            failures.append('{}: jitter {:.2f} us > {:.2f} us'.format(name, res['jitter_max'], args.max_jitter_us))
+        if args.max_deviation_steps is not None and res['deviation_max'] > args.max_deviation_steps:
+            failures.append('{}: deviation {:.3f} steps > {:.3f} steps'.format(name, res['deviation_max'], args.max_deviation_steps))
+        if res['dropped'] > 0 and not args.allow_dropped:
+            failures.append('{}: {} events dropped'.format(name, res['dropped']))
+    
+    if csv_file is not None:
+        csv_file.close()
+    
+    if len(failures) > 0:
+        print('FAILED:')
+        for failure in failures:
+            print('  {}'.format(failure))
+        return 1
+    
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())